@@ -0,0 +1,89 @@
+#include "qlegobridgeserver.h"
+#include "qlegodevice.h"
+#include "qlegodevicescanner.h"
+#include "qlegosimulatedhub.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QLoggingCategory>
+#include <QtDebug>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("qlegobridge");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Serves LEGO hubs to other programs over local sockets.");
+    parser.addHelpOption();
+    const QCommandLineOption tcpOption({ "p", "port" }, "Listen on TCP <port>.", "port");
+    const QCommandLineOption addressOption({ "a", "address" },
+                                           "Listen on <address> (default: 127.0.0.1).", "address",
+                                           "127.0.0.1");
+    const QCommandLineOption localOption({ "l", "local" }, "Listen on the local socket <name>.",
+                                         "name");
+    const QCommandLineOption flushOption({ "f", "flush-interval" },
+                                         "Write samples every <msecs> at most (default: 10).",
+                                         "msecs", "10");
+    const QCommandLineOption simulateOption({ "s", "simulate" },
+                                            "Serve <count> simulated hubs instead of scanning.",
+                                            "count");
+    const QCommandLineOption verboseOption({ "v", "verbose" }, "Log hub and client activity.");
+    parser.addOption(tcpOption);
+    parser.addOption(addressOption);
+    parser.addOption(localOption);
+    parser.addOption(flushOption);
+    parser.addOption(simulateOption);
+    parser.addOption(verboseOption);
+    parser.process(app);
+
+    if (parser.isSet(verboseOption)) {
+        QLoggingCategory::setFilterRules(QStringLiteral("lego.*=true"));
+    }
+    if (!parser.isSet(tcpOption) && !parser.isSet(localOption)) {
+        qWarning() << "Nothing to listen on; use --port or --local.";
+        return 1;
+    }
+
+    QLegoBridgeServer server;
+    server.setFlushInterval(parser.value(flushOption).toInt());
+    if (parser.isSet(tcpOption)) {
+        const QHostAddress address(parser.value(addressOption));
+        if (!server.listen(address, parser.value(tcpOption).toUShort())) {
+            qWarning() << "Cannot listen on TCP:" << server.errorString();
+            return 1;
+        }
+        qDebug() << "Listening on" << address.toString() << server.serverPort();
+    }
+    if (parser.isSet(localOption)) {
+        if (!server.listen(parser.value(localOption))) {
+            qWarning() << "Cannot listen on local socket:" << server.errorString();
+            return 1;
+        }
+        qDebug() << "Listening on" << server.serverName();
+    }
+
+    if (parser.isSet(simulateOption)) {
+        const int count = parser.value(simulateOption).toInt();
+        for (int i = 0; i < count; i++) {
+            auto hub = new QLegoSimulatedHub(&app);
+            hub->setAddress(QStringLiteral("00:16:53:00:00:%1").arg(i + 1, 2, 16, QChar('0')));
+            hub->attachDevice(0, QLegoAttachedDevice::TechnicLargeLinearMotor);
+            hub->attachDevice(1, QLegoAttachedDevice::TechnicLargeLinearMotor);
+            auto device = QLegoDevice::createDevice(hub);
+            server.addDevice(device);
+            device->connectToDevice();
+        }
+        return app.exec();
+    }
+
+    auto scanner = new QLegoDeviceScanner(&app);
+    QObject::connect(scanner, &QLegoDeviceScanner::errorMessage, [](const QString &message) {
+        qWarning() << message;
+    });
+    QObject::connect(scanner, &QLegoDeviceScanner::deviceFound, [&server](QLegoDevice *device) {
+        qDebug() << "Serving" << device->address() << "as hub" << server.addDevice(device);
+    });
+    scanner->scan();
+
+    return app.exec();
+}
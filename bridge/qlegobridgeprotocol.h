@@ -0,0 +1,169 @@
+#ifndef QLEGOBRIDGEPROTOCOL_H
+#define QLEGOBRIDGEPROTOCOL_H
+
+#include "qlegosample.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QVector>
+#include <QtCore/QtEndian>
+
+QT_BEGIN_NAMESPACE
+
+// Messages between the bridge and its clients. Every message is a little-endian u16 size of
+// the rest, a u8 type and its payload. All numbers are little-endian.
+namespace QLegoBridgeProtocol {
+
+static const int HeaderSize = 3;
+static const int MaxPayloadSize = 0xFFFF - 1;
+
+// Matches every hub, port or mode in a subscription.
+static const quint8 Any = 0xFF;
+
+enum MessageType : quint8
+{
+    // u32 tick, u8 count, count x (u8 hub, u8 port, u8 sub-command, u8 size, data)
+    CommandBatch = 0x10,
+    // u8 hub, u8 port, u8 mode. A specific port and mode also sets up the port.
+    Subscribe = 0x11,
+    // u8 hub, u8 port, u8 mode
+    Unsubscribe = 0x12,
+
+    // u8 hub, u8 connected, u8 battery, i8 rssi, u64 address, u8 size, name
+    HubState = 0x80,
+    // u8 hub, u8 port, u16 type, u8 attached
+    PortState = 0x81,
+    // u8 count, count x sample
+    Telemetry = 0x82,
+    // u32 tick, u8 commands accepted
+    CommandAck = 0x83
+};
+
+struct Command
+{
+    quint8 hub;
+    quint8 port;
+    quint8 subCommand;
+    QByteArray data;
+};
+
+// u8 hub, u8 port, u8 mode, u8 count, u8 type, u16 coalesced, u32 sequence, i64 timestamp,
+// count x i32 values. Coalesced counts the newer samples that replaced older ones unsent.
+struct TelemetrySample
+{
+    quint8 hub;
+    quint16 coalesced;
+    QLegoSample sample;
+};
+
+static const int SampleHeaderSize = 19;
+
+static inline QByteArray message(MessageType type, const QByteArray &payload)
+{
+    QByteArray bytes(HeaderSize, Qt::Uninitialized);
+    qToLittleEndian<quint16>(static_cast<quint16>(payload.size() + 1), bytes.data());
+    bytes[2] = static_cast<char>(type);
+    return bytes + payload;
+}
+
+// Takes the first complete message out of buffer.
+static inline bool takeMessage(QByteArray &buffer, MessageType *type, QByteArray *payload)
+{
+    if (buffer.size() < HeaderSize) {
+        return false;
+    }
+    const int size = qFromLittleEndian<quint16>(buffer.constData());
+    if (size < 1) {
+        // Without a type, nothing after it can be trusted.
+        buffer.clear();
+        return false;
+    }
+    if (buffer.size() < size + 2) {
+        return false;
+    }
+    *type = static_cast<MessageType>(buffer[2]);
+    *payload = buffer.mid(HeaderSize, size - 1);
+    buffer.remove(0, size + 2);
+    return true;
+}
+
+static inline QByteArray commandBatch(quint32 tick, const QVector<Command> &commands)
+{
+    QByteArray payload(5, Qt::Uninitialized);
+    qToLittleEndian<quint32>(tick, payload.data());
+    quint8 count = 0;
+    for (const auto &command : commands) {
+        if (count == 255) {
+            break;
+        }
+        // The size takes a single byte; longer commands are left out rather than cut.
+        if (command.data.size() > 255) {
+            continue;
+        }
+        payload += static_cast<char>(command.hub);
+        payload += static_cast<char>(command.port);
+        payload += static_cast<char>(command.subCommand);
+        payload += static_cast<char>(command.data.size());
+        payload += command.data;
+        count++;
+    }
+    payload[4] = static_cast<char>(count);
+    return message(CommandBatch, payload);
+}
+
+static inline QByteArray subscription(MessageType type, quint8 hub, quint8 port, quint8 mode)
+{
+    QByteArray payload(3, Qt::Uninitialized);
+    payload[0] = static_cast<char>(hub);
+    payload[1] = static_cast<char>(port);
+    payload[2] = static_cast<char>(mode);
+    return message(type, payload);
+}
+
+static inline void appendSample(QByteArray &payload, quint8 hub, quint16 coalesced,
+                                const QLegoSample &sample)
+{
+    const int offset = payload.size();
+    payload.resize(offset + SampleHeaderSize + sample.count * 4);
+    char *data = payload.data() + offset;
+    data[0] = static_cast<char>(hub);
+    data[1] = static_cast<char>(sample.portId);
+    data[2] = static_cast<char>(sample.mode);
+    data[3] = static_cast<char>(sample.count);
+    data[4] = static_cast<char>(sample.type);
+    qToLittleEndian<quint16>(coalesced, data + 5);
+    qToLittleEndian<quint32>(sample.sequence, data + 7);
+    qToLittleEndian<qint64>(sample.timestamp, data + 11);
+    for (int i = 0; i < sample.count; i++) {
+        qToLittleEndian<qint32>(sample.values[i], data + SampleHeaderSize + i * 4);
+    }
+}
+
+static inline bool readSample(const char *&data, const char *end, TelemetrySample *sample)
+{
+    if (end - data < SampleHeaderSize) {
+        return false;
+    }
+    const quint8 count = data[3];
+    if (count > QLegoSample::MaxValues || end - data < SampleHeaderSize + count * 4) {
+        return false;
+    }
+    sample->hub = data[0];
+    sample->sample.portId = data[1];
+    sample->sample.mode = data[2];
+    sample->sample.count = count;
+    sample->sample.type = data[4];
+    sample->coalesced = qFromLittleEndian<quint16>(data + 5);
+    sample->sample.sequence = qFromLittleEndian<quint32>(data + 7);
+    sample->sample.timestamp = qFromLittleEndian<qint64>(data + 11);
+    for (int i = 0; i < count; i++) {
+        sample->sample.values[i] = qFromLittleEndian<qint32>(data + SampleHeaderSize + i * 4);
+    }
+    data += SampleHeaderSize + count * 4;
+    return true;
+}
+
+} // namespace QLegoBridgeProtocol
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,524 @@
+#include "qlegobridgeserver.h"
+#include "qlegobridgeprotocol.h"
+#include "qlegoattacheddevice.h"
+#include "qlegodevice.h"
+#include <QtBluetooth/QBluetoothAddress>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QTimer>
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include <algorithm>
+
+Q_LOGGING_CATEGORY(bridgeLogger, "lego.bridge");
+
+using namespace QLegoBridgeProtocol;
+
+static inline bool matches(quint8 filter, quint8 value)
+{
+    return filter == Any || filter == value;
+}
+
+/*!
+  \class QLegoBridgeServer
+  \brief The QLegoBridgeServer class serves hubs to other programs over local sockets.
+  \inmodule QtLego
+
+  The bridge owns the connections to its hubs and speaks the compact binary protocol of
+  QLegoBridgeProtocol with any number of clients, over TCP or a local socket. Clients send
+  the port output commands of a control tick in one batch, and subscribe to the samples of
+  the hubs, ports and modes they need.
+
+  Samples are not forwarded one by one. Each client keeps the latest unsent sample of every
+  port and mode, and all of them are written together at most every flushInterval()
+  milliseconds. A client that does not read its socket stops receiving samples once
+  maxPendingBytes() are waiting for it, and then only receives the latest values, with the
+  number of samples they replaced. The hubs never wait for a client.
+*/
+
+/*!
+    Constructs a bridge with no hubs, with the given \a parent.
+*/
+QLegoBridgeServer::QLegoBridgeServer(QObject *parent)
+    : QObject(parent)
+    , m_tcpServer(nullptr)
+    , m_localServer(nullptr)
+    , m_errorString()
+    , m_flushTimer(new QTimer(this))
+    , m_maxPendingBytes(DefaultMaxPendingBytes)
+    , m_hubs()
+    , m_clients()
+    , m_samplesSent(0)
+    , m_samplesCoalesced(0)
+    , m_commandsForwarded(0)
+{
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(DefaultFlushInterval);
+    connect(m_flushTimer, &QTimer::timeout, this, &QLegoBridgeServer::flush);
+}
+
+QLegoBridgeServer::~QLegoBridgeServer()
+{
+    close();
+}
+
+/*!
+    Serves \a device to clients, and returns the number clients use for it. The device may
+    already be connected, like those reported by QLegoDeviceScanner::deviceFound().
+*/
+int QLegoBridgeServer::addDevice(QLegoDevice *device)
+{
+    for (int hub = 0; hub < m_hubs.size(); hub++) {
+        if (m_hubs[hub].device == device) {
+            return hub;
+        }
+    }
+    if (m_hubs.size() >= Any) {
+        qCWarning(bridgeLogger) << "too many hubs, ignoring:" << device->address();
+        return -1;
+    }
+
+    const int hub = m_hubs.size();
+    m_hubs.append({ device, device->isReady(), QMap<quint8, QLegoAttachedDevice *>() });
+
+    // clang-format off
+    connect(device, &QLegoDevice::ready, this, [this, hub]() {
+        m_hubs[hub].connected = true;
+        broadcast(hubState(hub));
+    });
+    connect(device, &QLegoDevice::batteryLevel, this, [this, hub]() {
+        broadcast(hubState(hub));
+    });
+    connect(device, &QLegoDevice::disconnected, this, [this, hub]() {
+        m_hubs[hub].connected = false;
+        broadcast(hubState(hub));
+    });
+    connect(device, &QLegoDevice::deviceAttached, this, [this, hub](QLegoAttachedDevice *attachment) {
+        attachPort(hub, attachment);
+    });
+    connect(device, &QLegoDevice::deviceDetached, this, [this, hub](QLegoAttachedDevice *attachment) {
+        detachPort(hub, attachment);
+    });
+    // The number stays taken by a hub that is gone for good.
+    connect(device, &QObject::destroyed, this, [this, hub]() {
+        m_hubs[hub].connected = false;
+        m_hubs[hub].ports.clear();
+        broadcast(hubState(hub));
+    });
+    // clang-format on
+
+    broadcast(hubState(hub));
+    for (const auto attachment : device->attachedDevices()) {
+        attachPort(hub, attachment);
+    }
+    return hub;
+}
+
+/*!
+    Listens for TCP clients on \a address and \a port. A port of 0 picks a free one, which
+    serverPort() returns. Returns \c false and sets errorString() on failure.
+*/
+bool QLegoBridgeServer::listen(const QHostAddress &address, quint16 port)
+{
+    if (!m_tcpServer) {
+        m_tcpServer = new QTcpServer(this);
+        connect(m_tcpServer, &QTcpServer::newConnection, this,
+                &QLegoBridgeServer::acceptTcpConnections);
+    }
+    if (!m_tcpServer->listen(address, port)) {
+        m_errorString = m_tcpServer->errorString();
+        return false;
+    }
+    return true;
+}
+
+/*!
+    Listens for clients on the local socket \a name. A socket left behind by a bridge that
+    exited without closing it is replaced, but not one another bridge still listens on.
+    Returns \c false and sets errorString() on failure.
+*/
+bool QLegoBridgeServer::listen(const QString &name)
+{
+    if (!m_localServer) {
+        m_localServer = new QLocalServer(this);
+        connect(m_localServer, &QLocalServer::newConnection, this,
+                &QLegoBridgeServer::acceptLocalConnections);
+    }
+    // Only a socket nobody answers on is left over.
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if (probe.waitForConnected(100)) {
+        m_errorString = QStringLiteral("another bridge is listening on %1").arg(name);
+        return false;
+    }
+    QLocalServer::removeServer(name);
+    if (!m_localServer->listen(name)) {
+        m_errorString = m_localServer->errorString();
+        return false;
+    }
+    return true;
+}
+
+/*!
+    Stops listening and disconnects all clients.
+*/
+void QLegoBridgeServer::close()
+{
+    if (m_tcpServer) {
+        m_tcpServer->close();
+    }
+    if (m_localServer) {
+        m_localServer->close();
+    }
+    const auto sockets = m_clients.keys();
+    m_clients.clear();
+    for (const auto socket : sockets) {
+        socket->disconnect(this);
+        socket->close();
+        socket->deleteLater();
+    }
+}
+
+/*!
+    Returns the TCP port the bridge listens on, or 0.
+*/
+quint16 QLegoBridgeServer::serverPort() const
+{
+    return m_tcpServer ? m_tcpServer->serverPort() : 0;
+}
+
+/*!
+    Returns the full name of the local socket the bridge listens on, if any.
+*/
+QString QLegoBridgeServer::serverName() const
+{
+    return m_localServer ? m_localServer->fullServerName() : QString();
+}
+
+/*!
+    Returns a description of the last error.
+*/
+QString QLegoBridgeServer::errorString() const
+{
+    return m_errorString;
+}
+
+/*!
+    Returns the longest time in milliseconds a sample waits before it is written to clients.
+*/
+int QLegoBridgeServer::flushInterval() const
+{
+    return m_flushTimer->interval();
+}
+
+/*!
+    Writes samples to clients at most every \a msecs milliseconds. Longer intervals coalesce
+    more samples of fast sensors into one; 0 writes them as soon as the event loop is idle.
+*/
+void QLegoBridgeServer::setFlushInterval(int msecs)
+{
+    m_flushTimer->setInterval(qMax(msecs, 0));
+}
+
+/*!
+    Returns the number of bytes that may wait to be sent to a client before it only receives
+    the latest samples.
+*/
+qint64 QLegoBridgeServer::maxPendingBytes() const
+{
+    return m_maxPendingBytes;
+}
+
+/*!
+    Sets the number of bytes that may wait to be sent to a client to \a bytes.
+*/
+void QLegoBridgeServer::setMaxPendingBytes(qint64 bytes)
+{
+    m_maxPendingBytes = qMax<qint64>(bytes, 0);
+}
+
+/*!
+    Returns the number of connected clients.
+*/
+int QLegoBridgeServer::clientCount() const
+{
+    return m_clients.size();
+}
+
+/*!
+    Returns the number of samples written to clients.
+*/
+quint64 QLegoBridgeServer::samplesSent() const
+{
+    return m_samplesSent;
+}
+
+/*!
+    Returns the number of samples replaced by a newer one before they were written.
+*/
+quint64 QLegoBridgeServer::samplesCoalesced() const
+{
+    return m_samplesCoalesced;
+}
+
+/*!
+    Returns the number of commands forwarded to hubs.
+*/
+quint64 QLegoBridgeServer::commandsForwarded() const
+{
+    return m_commandsForwarded;
+}
+
+void QLegoBridgeServer::acceptTcpConnections()
+{
+    while (m_tcpServer->hasPendingConnections()) {
+        QTcpSocket *socket = m_tcpServer->nextPendingConnection();
+        // Commands are small and latency matters more than packet count.
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        connect(socket, &QAbstractSocket::disconnected, this, [this, socket]() {
+            removeClient(socket);
+        });
+        addClient(socket);
+    }
+}
+
+void QLegoBridgeServer::acceptLocalConnections()
+{
+    while (m_localServer->hasPendingConnections()) {
+        QLocalSocket *socket = m_localServer->nextPendingConnection();
+        connect(socket, &QLocalSocket::disconnected, this, [this, socket]() {
+            removeClient(socket);
+        });
+        addClient(socket);
+    }
+}
+
+void QLegoBridgeServer::addClient(QIODevice *socket)
+{
+    m_clients.insert(socket, Client());
+    connect(socket, &QIODevice::readyRead, this, [this, socket]() { readClient(socket); });
+
+    for (int hub = 0; hub < m_hubs.size(); hub++) {
+        socket->write(hubState(hub));
+        const auto &ports = m_hubs[hub].ports;
+        for (auto it = ports.cbegin(); it != ports.cend(); ++it) {
+            socket->write(portState(hub, it.key(), it.value()->type(), true));
+        }
+    }
+    qCDebug(bridgeLogger) << "client connected:" << m_clients.size();
+}
+
+void QLegoBridgeServer::removeClient(QIODevice *socket)
+{
+    if (m_clients.remove(socket)) {
+        socket->deleteLater();
+        qCDebug(bridgeLogger) << "client disconnected:" << m_clients.size();
+    }
+}
+
+void QLegoBridgeServer::readClient(QIODevice *socket)
+{
+    const auto it = m_clients.find(socket);
+    if (it == m_clients.end()) {
+        return;
+    }
+    it->buffer += socket->readAll();
+
+    MessageType type;
+    QByteArray payload;
+    while (takeMessage(it->buffer, &type, &payload)) {
+        switch (type) {
+            case CommandBatch:
+                processCommands(socket, payload);
+                break;
+            case Subscribe:
+            case Unsubscribe:
+                processSubscription(*it, type == Subscribe, payload);
+                break;
+            default:
+                qCDebug(bridgeLogger) << "unknown message:" << type;
+                break;
+        }
+    }
+}
+
+void QLegoBridgeServer::processCommands(QIODevice *socket, const QByteArray &payload)
+{
+    if (payload.size() < 5) {
+        return;
+    }
+    const char *data = payload.constData();
+    const char *end = data + payload.size();
+    const quint32 tick = qFromLittleEndian<quint32>(data);
+    const quint8 count = data[4];
+    data += 5;
+
+    quint8 accepted = 0;
+    for (int i = 0; i < count && end - data >= 4; i++) {
+        const quint8 hub = data[0];
+        const quint8 port = data[1];
+        const quint8 subCommand = data[2];
+        const quint8 size = data[3];
+        if (end - data < 4 + size) {
+            break;
+        }
+        if (hub < m_hubs.size() && m_hubs[hub].ports.contains(port)) {
+            m_hubs[hub].ports[port]->writePortOutput(subCommand, QByteArray(data + 4, size));
+            accepted++;
+        }
+        data += 4 + size;
+    }
+    m_commandsForwarded += accepted;
+
+    QByteArray ack(5, Qt::Uninitialized);
+    qToLittleEndian<quint32>(tick, ack.data());
+    ack[4] = static_cast<char>(accepted);
+    socket->write(message(CommandAck, ack));
+}
+
+void QLegoBridgeServer::processSubscription(Client &client, bool subscribe,
+                                            const QByteArray &payload)
+{
+    if (payload.size() < 3) {
+        return;
+    }
+    const Filter filter = { static_cast<quint8>(payload[0]), static_cast<quint8>(payload[1]),
+                            static_cast<quint8>(payload[2]) };
+    const auto same = [&filter](const Filter &other) {
+        return other.hub == filter.hub && other.port == filter.port && other.mode == filter.mode;
+    };
+
+    if (!subscribe) {
+        client.filters.erase(std::remove_if(client.filters.begin(), client.filters.end(), same),
+                             client.filters.end());
+        return;
+    }
+    if (std::none_of(client.filters.cbegin(), client.filters.cend(), same)) {
+        client.filters.append(filter);
+    }
+
+    // Set up the port unless it already reports the mode.
+    if (filter.hub < m_hubs.size() && filter.mode != Any
+        && m_hubs[filter.hub].ports.contains(filter.port)) {
+        const auto attachment = m_hubs[filter.hub].ports[filter.port];
+        if (!attachment->subscribed() || attachment->mode() != filter.mode) {
+            attachment->subscribe(filter.mode);
+        }
+    }
+}
+
+void QLegoBridgeServer::publishSample(int hub, const QLegoSample &sample)
+{
+    const quint32 key = (hub << 16) | (sample.portId << 8) | sample.mode;
+    bool queued = false;
+    for (auto it = m_clients.begin(); it != m_clients.end(); ++it) {
+        const auto matching = [hub, &sample](const Filter &filter) {
+            return matches(filter.hub, hub) && matches(filter.port, sample.portId)
+                    && matches(filter.mode, sample.mode);
+        };
+        if (std::none_of(it->filters.cbegin(), it->filters.cend(), matching)) {
+            continue;
+        }
+
+        const auto pending = it->pending.find(key);
+        if (pending == it->pending.end()) {
+            it->pending.insert(key, { static_cast<quint8>(hub), 0, sample });
+        } else {
+            pending->sample = sample;
+            pending->coalesced = qMin(pending->coalesced + 1, 0xFFFF);
+            m_samplesCoalesced++;
+        }
+        queued = true;
+    }
+    if (queued && !m_flushTimer->isActive()) {
+        m_flushTimer->start();
+    }
+}
+
+void QLegoBridgeServer::flush()
+{
+    bool waiting = false;
+    for (auto it = m_clients.begin(); it != m_clients.end(); ++it) {
+        QIODevice *socket = it.key();
+        auto &pending = it->pending;
+        if (pending.isEmpty()) {
+            continue;
+        }
+        if (socket->bytesToWrite() > m_maxPendingBytes) {
+            // Keep coalescing until the client catches up.
+            waiting = true;
+            continue;
+        }
+
+        QByteArray payload(1, '\0');
+        int count = 0;
+        for (const auto &entry : pending) {
+            if (count == 255 || payload.size() > MaxPayloadSize - SampleHeaderSize - 32) {
+                payload[0] = static_cast<char>(count);
+                socket->write(message(Telemetry, payload));
+                payload.truncate(1);
+                count = 0;
+            }
+            appendSample(payload, entry.hub, entry.coalesced, entry.sample);
+            count++;
+        }
+        payload[0] = static_cast<char>(count);
+        socket->write(message(Telemetry, payload));
+        m_samplesSent += pending.size();
+        pending.clear();
+    }
+    if (waiting) {
+        m_flushTimer->start();
+    }
+}
+
+void QLegoBridgeServer::attachPort(int hub, QLegoAttachedDevice *attachment)
+{
+    m_hubs[hub].ports.insert(attachment->portId(), attachment);
+    connect(attachment, &QLegoAttachedDevice::valueReceived, this,
+            [this, hub](const QLegoSample &sample) { publishSample(hub, sample); });
+    broadcast(portState(hub, attachment->portId(), attachment->type(), true));
+}
+
+void QLegoBridgeServer::detachPort(int hub, QLegoAttachedDevice *attachment)
+{
+    m_hubs[hub].ports.remove(attachment->portId());
+    attachment->disconnect(this);
+    broadcast(portState(hub, attachment->portId(), attachment->type(), false));
+}
+
+QByteArray QLegoBridgeServer::hubState(int hub) const
+{
+    const auto device = m_hubs[hub].device;
+    QByteArray payload(13, 0);
+    payload[0] = static_cast<char>(hub);
+    payload[1] = static_cast<char>(m_hubs[hub].connected);
+    if (!device) {
+        // A deleted hub is reported as disconnected, without a name.
+        return message(HubState, payload);
+    }
+    const QByteArray name = device->name().toUtf8().left(255);
+    payload[2] = static_cast<char>(device->battery());
+    payload[3] = static_cast<char>(device->rssi());
+    qToLittleEndian<quint64>(QBluetoothAddress(device->address()).toUInt64(), payload.data() + 4);
+    payload[12] = static_cast<char>(name.size());
+    return message(HubState, payload + name);
+}
+
+QByteArray QLegoBridgeServer::portState(int hub, quint8 portId, quint16 type, bool attached) const
+{
+    QByteArray payload(5, Qt::Uninitialized);
+    payload[0] = static_cast<char>(hub);
+    payload[1] = static_cast<char>(portId);
+    qToLittleEndian<quint16>(type, payload.data() + 2);
+    payload[4] = static_cast<char>(attached);
+    return message(PortState, payload);
+}
+
+void QLegoBridgeServer::broadcast(const QByteArray &message)
+{
+    for (auto it = m_clients.cbegin(); it != m_clients.cend(); ++it) {
+        it.key()->write(message);
+    }
+}
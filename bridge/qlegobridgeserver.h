@@ -0,0 +1,113 @@
+#ifndef QLEGOBRIDGESERVER_H
+#define QLEGOBRIDGESERVER_H
+
+#include "qlegosample.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QObject>
+#include <QtCore/QPointer>
+#include <QtCore/QVector>
+#include <QtNetwork/QHostAddress>
+
+QT_FORWARD_DECLARE_CLASS(QIODevice)
+QT_FORWARD_DECLARE_CLASS(QLocalServer)
+QT_FORWARD_DECLARE_CLASS(QTcpServer)
+QT_FORWARD_DECLARE_CLASS(QTimer)
+QT_FORWARD_DECLARE_CLASS(QLegoDevice)
+QT_FORWARD_DECLARE_CLASS(QLegoAttachedDevice)
+
+QT_BEGIN_NAMESPACE
+
+class QLegoBridgeServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int DefaultFlushInterval = 10;
+    static const qint64 DefaultMaxPendingBytes = 64 * 1024;
+
+    explicit QLegoBridgeServer(QObject *parent = nullptr);
+    ~QLegoBridgeServer();
+
+    int addDevice(QLegoDevice *device);
+
+    bool listen(const QHostAddress &address, quint16 port = 0);
+    bool listen(const QString &name);
+    void close();
+    quint16 serverPort() const;
+    QString serverName() const;
+    QString errorString() const;
+
+    int flushInterval() const;
+    void setFlushInterval(int msecs);
+    qint64 maxPendingBytes() const;
+    void setMaxPendingBytes(qint64 bytes);
+
+    int clientCount() const;
+    quint64 samplesSent() const;
+    quint64 samplesCoalesced() const;
+    quint64 commandsForwarded() const;
+
+private Q_SLOTS:
+    void acceptTcpConnections();
+    void acceptLocalConnections();
+    void flush();
+
+private:
+    struct Hub
+    {
+        QPointer<QLegoDevice> device;
+        bool connected;
+        QMap<quint8, QLegoAttachedDevice *> ports;
+    };
+
+    struct Filter
+    {
+        quint8 hub;
+        quint8 port;
+        quint8 mode;
+    };
+
+    struct Pending
+    {
+        quint8 hub;
+        quint16 coalesced;
+        QLegoSample sample;
+    };
+
+    struct Client
+    {
+        QByteArray buffer;
+        QVector<Filter> filters;
+        // Latest unsent sample of each hub, port and mode.
+        QHash<quint32, Pending> pending;
+    };
+
+    void addClient(QIODevice *socket);
+    void removeClient(QIODevice *socket);
+    void readClient(QIODevice *socket);
+    void processCommands(QIODevice *socket, const QByteArray &payload);
+    void processSubscription(Client &client, bool subscribe, const QByteArray &payload);
+    void publishSample(int hub, const QLegoSample &sample);
+    void attachPort(int hub, QLegoAttachedDevice *attachment);
+    void detachPort(int hub, QLegoAttachedDevice *attachment);
+    QByteArray hubState(int hub) const;
+    QByteArray portState(int hub, quint8 portId, quint16 type, bool attached) const;
+    void broadcast(const QByteArray &message);
+
+    QTcpServer *m_tcpServer;
+    QLocalServer *m_localServer;
+    QString m_errorString;
+    QTimer *m_flushTimer;
+    qint64 m_maxPendingBytes;
+    QVector<Hub> m_hubs;
+    QHash<QIODevice *, Client> m_clients;
+    quint64 m_samplesSent;
+    quint64 m_samplesCoalesced;
+    quint64 m_commandsForwarded;
+};
+
+QT_END_NAMESPACE
+
+#endif
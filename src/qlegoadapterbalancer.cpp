@@ -0,0 +1,297 @@
+#include "qlegoadapterbalancer.h"
+#include <QtCore/QLoggingCategory>
+#include <QtBluetooth/QBluetoothLocalDevice>
+
+Q_LOGGING_CATEGORY(balancerLogger, "lego.balancer");
+
+/*!
+  \class QLegoAdapterBalancer
+  \brief The QLegoAdapterBalancer class spreads hub connections across Bluetooth adapters.
+  \inmodule QtLego
+  \ingroup devices
+
+  A Bluetooth controller can only hold a handful of LE connections at once, typically seven to
+  ten. QLegoDeviceScanner therefore scans on every local adapter and asks the balancer which
+  adapter each hub should be connected through.
+
+  Every adapter reports the signal strength at which it heard a hub with reportRssi(). place()
+  then picks the adapter that still has room for another connection and scores best, where the
+  score is the RSSI less connectionPenalty() dB for every connection the adapter already holds.
+  Adapters that have not heard the hub score as if at UnknownRssi. A hub is therefore placed on
+  the adapter that hears it best, unless that adapter is noticeably busier than another.
+
+  The balancer does not talk to the adapters itself, so it can be given any list of adapters:
+
+  \code
+  QBluetoothHostInfo first, second;
+  first.setAddress(QBluetoothAddress("00:1A:7D:DA:71:01"));
+  second.setAddress(QBluetoothAddress("00:1A:7D:DA:71:02"));
+
+  QLegoAdapterBalancer balancer({ first, second });
+  balancer.reportRssi(first.address(), "90:84:2B:4E:5A:1F", -80);
+  balancer.reportRssi(second.address(), "90:84:2B:4E:5A:1F", -55);
+
+  QBluetoothAddress adapter;
+  balancer.place("90:84:2B:4E:5A:1F", &adapter); // the second adapter
+  \endcode
+
+  Each adapter has a QLegoAdapterStatistics object. The balancer is not thread-safe, but the
+  statistics may be read from any thread.
+
+  \sa QLegoDeviceScanner::adapterBalancer()
+*/
+
+/*!
+    \variable QLegoAdapterBalancer::UnknownRssi
+
+    The RSSI, in dBm, assumed for an adapter that has not heard a hub.
+*/
+
+/*!
+    Constructs a balancer for all local Bluetooth adapters.
+*/
+QLegoAdapterBalancer::QLegoAdapterBalancer()
+    : m_adapters()
+    , m_maxConnections(DefaultMaxConnections)
+    , m_connectionPenalty(DefaultConnectionPenalty)
+    , m_rssi()
+    , m_placements()
+{
+    setAdapters(QBluetoothLocalDevice::allDevices());
+}
+
+/*!
+    Constructs a balancer for \a adapters.
+*/
+QLegoAdapterBalancer::QLegoAdapterBalancer(const QList<QBluetoothHostInfo> &adapters)
+    : m_adapters()
+    , m_maxConnections(DefaultMaxConnections)
+    , m_connectionPenalty(DefaultConnectionPenalty)
+    , m_rssi()
+    , m_placements()
+{
+    setAdapters(adapters);
+}
+
+QLegoAdapterBalancer::~QLegoAdapterBalancer()
+{
+    for (const auto &adapter : m_adapters) {
+        delete adapter.statistics;
+    }
+}
+
+void QLegoAdapterBalancer::setAdapters(const QList<QBluetoothHostInfo> &adapters)
+{
+    for (const auto &info : adapters) {
+        auto statistics = new QLegoAdapterStatistics;
+        statistics->m_address = info.address().toString();
+        m_adapters.append({ info, 0, statistics });
+    }
+}
+
+/*!
+    Returns the adapters connections are spread across.
+
+    The list is empty on platforms that do not expose their adapters, in which case every hub
+    is placed on the default adapter.
+*/
+QList<QBluetoothHostInfo> QLegoAdapterBalancer::adapters() const
+{
+    QList<QBluetoothHostInfo> adapters;
+    for (const auto &adapter : m_adapters) {
+        adapters.append(adapter.info);
+    }
+    return adapters;
+}
+
+/*!
+    Returns the number of connections each adapter may hold. The default is 7.
+*/
+int QLegoAdapterBalancer::maxConnections() const
+{
+    return m_maxConnections;
+}
+
+/*!
+    Sets the number of connections each adapter may hold to \a connections.
+*/
+void QLegoAdapterBalancer::setMaxConnections(int connections)
+{
+    m_maxConnections = qMax(connections, 1);
+}
+
+/*!
+    Returns how many dB of signal strength an adapter loses in the placement score for each
+    connection it holds. The default is 6 dB.
+*/
+int QLegoAdapterBalancer::connectionPenalty() const
+{
+    return m_connectionPenalty;
+}
+
+/*!
+    Sets the placement penalty of each held connection to \a dB. With a penalty of 0, hubs are
+    placed by signal strength alone until an adapter is full.
+*/
+void QLegoAdapterBalancer::setConnectionPenalty(int dB)
+{
+    m_connectionPenalty = qMax(dB, 0);
+}
+
+/*!
+    Records that \a adapter heard \a device at \a rssi dBm. Reports from unknown adapters are
+    ignored.
+*/
+void QLegoAdapterBalancer::reportRssi(const QBluetoothAddress &adapter, const QString &device,
+                                      qint16 rssi)
+{
+    const int index = indexOf(adapter);
+    if (index < 0) {
+        return;
+    }
+    auto &levels = m_rssi[device];
+    if (levels.isEmpty()) {
+        levels.fill(UnknownRssi, m_adapters.size());
+    }
+    levels[index] = rssi;
+}
+
+/*!
+    Chooses the adapter \a device is connected through and stores its address in \a adapter.
+    The connection is counted against the adapter until release() is called.
+
+    Returns \c false if every adapter is full, and forgets the signal strengths reported for
+    \a device. If there are no known adapters, \a adapter is set to a null address, meaning the
+    default adapter, and \c true is returned. Placing a device that is already placed returns its
+    current adapter.
+*/
+bool QLegoAdapterBalancer::place(const QString &device, QBluetoothAddress *adapter)
+{
+    if (m_placements.contains(device)) {
+        *adapter = m_adapters[m_placements.value(device)].info.address();
+        return true;
+    }
+    if (m_adapters.isEmpty()) {
+        *adapter = QBluetoothAddress();
+        return true;
+    }
+
+    const QVector<int> levels = m_rssi.value(device);
+    int best = -1;
+    int bestScore = 0;
+    for (int i = 0; i < m_adapters.size(); i++) {
+        const int connections = m_adapters[i].connections;
+        if (connections >= m_maxConnections) {
+            continue;
+        }
+        const int rssi = levels.isEmpty() ? UnknownRssi : levels[i];
+        const int score = rssi - connections * m_connectionPenalty;
+        // Ties go to the adapter with fewer connections, then to the first one.
+        if (best < 0 || score > bestScore
+            || (score == bestScore && connections < m_adapters[best].connections)) {
+            best = i;
+            bestScore = score;
+        }
+    }
+
+    if (best < 0) {
+        qCWarning(balancerLogger) << "No adapter has room for" << device;
+        // Nothing releases a device that was never placed.
+        m_rssi.remove(device);
+        return false;
+    }
+
+    auto &chosen = m_adapters[best];
+    chosen.connections++;
+    chosen.statistics->m_connections.store(chosen.connections, std::memory_order_relaxed);
+    chosen.statistics->m_placements.fetch_add(1, std::memory_order_relaxed);
+    if (!levels.isEmpty() && levels[best] != UnknownRssi) {
+        chosen.statistics->m_rssiTotal.fetch_add(levels[best], std::memory_order_relaxed);
+        chosen.statistics->m_rssiSamples.fetch_add(1, std::memory_order_relaxed);
+    }
+    m_placements.insert(device, best);
+    *adapter = chosen.info.address();
+
+    qCDebug(balancerLogger) << "placed" << device << "on" << chosen.info.address().toString()
+                            << "score" << bestScore;
+    return true;
+}
+
+/*!
+    Frees the connection held by \a device, for example after it disconnected. If \a failed is
+    \c true, the connection never became usable and is counted as a connection failure of the
+    adapter.
+*/
+void QLegoAdapterBalancer::release(const QString &device, bool failed)
+{
+    m_rssi.remove(device);
+    if (!m_placements.contains(device)) {
+        return;
+    }
+
+    auto &adapter = m_adapters[m_placements.take(device)];
+    adapter.connections--;
+    adapter.statistics->m_connections.store(adapter.connections, std::memory_order_relaxed);
+    if (failed) {
+        adapter.statistics->m_connectFailures.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/*!
+    Returns the adapter \a device is placed on, or a null address if it is not placed.
+*/
+QBluetoothAddress QLegoAdapterBalancer::adapterFor(const QString &device) const
+{
+    const int index = m_placements.value(device, -1);
+    return index < 0 ? QBluetoothAddress() : m_adapters[index].info.address();
+}
+
+/*!
+    Returns the number of connections \a adapter holds.
+*/
+int QLegoAdapterBalancer::connections(const QBluetoothAddress &adapter) const
+{
+    const int index = indexOf(adapter);
+    return index < 0 ? 0 : m_adapters[index].connections;
+}
+
+/*!
+    Returns the last RSSI at which \a adapter heard \a device, or UnknownRssi.
+*/
+int QLegoAdapterBalancer::rssi(const QBluetoothAddress &adapter, const QString &device) const
+{
+    const int index = indexOf(adapter);
+    const QVector<int> levels = m_rssi.value(device);
+    return index < 0 || levels.isEmpty() ? UnknownRssi : levels[index];
+}
+
+/*!
+    Returns the statistics of \a adapter, or \c nullptr if it is not known.
+*/
+const QLegoAdapterStatistics *QLegoAdapterBalancer::statistics(const QBluetoothAddress &adapter) const
+{
+    const int index = indexOf(adapter);
+    return index < 0 ? nullptr : m_adapters[index].statistics;
+}
+
+/*!
+    Returns the statistics of every adapter, in the order of adapters().
+*/
+QList<const QLegoAdapterStatistics *> QLegoAdapterBalancer::statistics() const
+{
+    QList<const QLegoAdapterStatistics *> statistics;
+    for (const auto &adapter : m_adapters) {
+        statistics.append(adapter.statistics);
+    }
+    return statistics;
+}
+
+int QLegoAdapterBalancer::indexOf(const QBluetoothAddress &adapter) const
+{
+    for (int i = 0; i < m_adapters.size(); i++) {
+        if (m_adapters[i].info.address() == adapter) {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,66 @@
+#ifndef QLEGOADAPTERBALANCER_H
+#define QLEGOADAPTERBALANCER_H
+
+#include "qlegoglobal.h"
+#include "qlegostatistics.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtBluetooth/QBluetoothAddress>
+#include <QtBluetooth/QBluetoothHostInfo>
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoAdapterBalancer
+{
+public:
+    static const int DefaultMaxConnections = 7;
+    static const int DefaultConnectionPenalty = 6;
+    static const int UnknownRssi = -100;
+
+    QLegoAdapterBalancer();
+    explicit QLegoAdapterBalancer(const QList<QBluetoothHostInfo> &adapters);
+    ~QLegoAdapterBalancer();
+
+    QList<QBluetoothHostInfo> adapters() const;
+
+    int maxConnections() const;
+    void setMaxConnections(int connections);
+    int connectionPenalty() const;
+    void setConnectionPenalty(int dB);
+
+    void reportRssi(const QBluetoothAddress &adapter, const QString &device, qint16 rssi);
+    bool place(const QString &device, QBluetoothAddress *adapter);
+    void release(const QString &device, bool failed = false);
+
+    QBluetoothAddress adapterFor(const QString &device) const;
+    int connections(const QBluetoothAddress &adapter) const;
+    int rssi(const QBluetoothAddress &adapter, const QString &device) const;
+    const QLegoAdapterStatistics *statistics(const QBluetoothAddress &adapter) const;
+    QList<const QLegoAdapterStatistics *> statistics() const;
+
+private:
+    Q_DISABLE_COPY(QLegoAdapterBalancer)
+
+    struct Adapter
+    {
+        QBluetoothHostInfo info;
+        int connections;
+        QLegoAdapterStatistics *statistics;
+    };
+
+    void setAdapters(const QList<QBluetoothHostInfo> &adapters);
+    int indexOf(const QBluetoothAddress &adapter) const;
+
+    QVector<Adapter> m_adapters;
+    int m_maxConnections;
+    int m_connectionPenalty;
+    QHash<QString, QVector<int>> m_rssi;
+    QHash<QString, int> m_placements;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -1,11 +1,55 @@
 #include "qlegoattacheddevice.h"
+#include "qlegocommandreply.h"
+#include "qlegocommon.h"
+#include "qlegorule.h"
+#include "qlegosamplebuffer.h"
 #include <QtCore/QLoggingCategory>
+#include <QtCore/QtEndian>
 #include <QtCore/QString>
 #include <QtBluetooth/QBluetoothDeviceInfo>
 #include <QtBluetooth/QLowEnergyService>
 
 Q_LOGGING_CATEGORY(attachedDeviceLogger, "lego.attachedDevice");
 
+enum StartupCompletion
+{
+    ExecuteImmediatelyWithFeedback = 0x11,
+    BufferIfNecessaryWithFeedback = 0x01,
+};
+
+enum CommandFeedback
+{
+    BufferEmptyInProgress = 0x01,
+    BufferEmptyCompleted = 0x02,
+    CommandDiscarded = 0x04,
+    Idle = 0x08,
+    BusyFull = 0x10,
+};
+
+enum CombinedModeCommands
+{
+    SetModeAndDatasetCombination = 0x01,
+    LockForSetup = 0x02,
+    UnlockWithUpdatesEnabled = 0x03,
+    UnlockWithUpdatesDisabled = 0x04,
+};
+
+static inline qint32 decodeValue(const char *value, QLegoValueFormat::DataType type)
+{
+    switch (type) {
+        case QLegoValueFormat::Int8:
+            return static_cast<qint8>(*value);
+        case QLegoValueFormat::Int16:
+            return qFromLittleEndian<qint16>(value);
+        default:
+            // Floats keep their bit pattern.
+            return qFromLittleEndian<qint32>(value);
+    }
+}
+
+// One command executing on the hub plus one in its buffer.
+static const int MaxCommandsOnHub = 2;
+
 /*!
   \class QLegoAttachedDevice
   \brief The QLegoAttachedDevice class is a device attached to a QLegoDevice (aka Hub).
@@ -18,6 +62,57 @@ Q_LOGGING_CATEGORY(attachedDeviceLogger, "lego.attachedDevice");
   An attached device represents a connection of a specific type of device to a specific port on
   the parent device.
 
+  \section1 Command Completion
+
+  Every port output command returns a \l{QLegoCommandReply} that follows the feedback the hub
+  reports for that port. By default commands are executed immediately, replacing whatever the
+  port was doing. When \l{QLegoAttachedDevice::startupMode} is \c BufferIfNecessary, commands
+  run one after another instead: the hub holds one command in its buffer while another executes,
+  and any further commands are queued by the host until the hub has room for them.
+
+  \section1 Sensor Values
+
+  Sensors, and motors with encoders, report values for one input mode at a time. Calling
+  \l{QLegoAttachedDevice::subscribe()} selects a mode and asks the hub to push a new value
+  whenever it has changed by at least the delta interval. Small changes are filtered out by the
+  hub, so they never use the Bluetooth link. Decoded values are delivered through
+  \l{QLegoAttachedDevice::valueReceived()} and the typed signals of subclasses such as
+  \l{QLegoColorDistanceSensor}.
+
+  Several modes can be reported together with
+  \l{QLegoAttachedDevice::subscribeCombined()}. The hub then samples all of the selected datasets
+  at the same time and sends them in a single notification, which is delivered as one
+  QLegoSample with \c QLegoSample::CombinedMode as its mode. The typed signals of subclasses
+  are emitted for each mode as well.
+
+  \code
+  motor->subscribeCombined({ { QLegoMotor::SpeedMode, 0 },
+                             { QLegoMotor::PositionMode, 0 },
+                             { QLegoMotor::AbsolutePositionMode, 0 } });
+  \endcode
+
+  Values of modes without a known format are decoded with the format reported by the hub. It
+  is discovered the first time such a mode is used, a few requests at a time so the link stays
+  available for commands, and shared with all hubs reporting the same device and firmware. See
+  \l{QLegoAttachedDevice::portInformation()}.
+
+  \l{QLegoAttachedDevice::requestValue()} reads a single value instead. Comparing
+  \l{QLegoDeviceStatistics::framesReceived()} for message type \c 0x45 between polling and
+  subscribing shows the traffic saved by the delta interval.
+
+  \code
+  auto sensor = qobject_cast<QLegoColorDistanceSensor *>(device->waitForDeviceByName("C"));
+  sensor->subscribe(QLegoColorDistanceSensor::DistanceMode, 1);
+  QObject::connect(sensor, &QLegoColorDistanceSensor::distanceChanged, [](int distance) {
+      qDebug() << "distance:" << distance;
+  });
+  \endcode
+
+  Emitting a signal for every value is comfortable, but adds up for sensors reporting at high
+  rates, especially when values are consumed on another thread. A QLegoSampleBuffer installed
+  with \l{QLegoAttachedDevice::setSampleBuffer()} receives every sample as well, and can be
+  drained in batches by a single consumer thread without locking.
+
   \note Users should NEVER create a QLegoAttachedDevice directly. This API will
   likely change significantly.
 */
@@ -32,6 +127,57 @@ Q_LOGGING_CATEGORY(attachedDeviceLogger, "lego.attachedDevice");
     \value MoveHubMediumLinearMotor  The built-in motor for Boost Move hubs.
 */
 
+/*!
+    \class QLegoSample
+    \brief The QLegoSample struct holds one decoded value reported by an attached device.
+    \inmodule QtLego
+    \ingroup attached-devices
+
+    A sample holds up to \c MaxValues datasets of a single mode, stored as raw integers.
+    Datasets of type \c QLegoValueFormat::Float keep their bit pattern, so use
+    \l{QLegoSample::value()} to read them. The timestamp is taken from a monotonic clock in
+    nanoseconds when the notification arrived, and the sequence number counts every sample
+    received from the port.
+*/
+
+/*!
+    \class QLegoModeDataset
+    \brief The QLegoModeDataset struct selects one dataset of a mode for a combined mode.
+    \inmodule QtLego
+    \ingroup attached-devices
+
+    \sa QLegoAttachedDevice::subscribeCombined()
+*/
+
+/*!
+    \class QLegoValueFormat
+    \brief The QLegoValueFormat struct describes how the values of a mode are encoded.
+    \inmodule QtLego
+    \ingroup attached-devices
+*/
+
+/*!
+    \fn void QLegoAttachedDevice::valueReceived(const QLegoSample &sample)
+
+    This signal is emitted for every value reported by the device.
+*/
+
+/*!
+    \fn void QLegoAttachedDevice::modeChanged()
+
+    This signal is emitted when the hub confirms a new input mode or subscription state.
+*/
+
+/*!
+    \enum QLegoAttachedDevice::StartupMode
+
+    How the hub schedules a new command for a port.
+
+    \value ExecuteImmediately  The new command replaces the command currently executing.
+
+    \value BufferIfNecessary   The new command runs after the current command has finished.
+*/
+
 /*!
     Constructs a QLegoAttachedDevice object.
 
@@ -44,6 +190,20 @@ QLegoAttachedDevice::QLegoAttachedDevice(DeviceType type, quint8 portId, QObject
     , m_sensor(false)
     , m_motor(false)
     , m_portId(portId)
+    , m_startupMode(StartupMode::ExecuteImmediately)
+    , m_pendingCommands()
+    , m_sentCommands()
+    , m_mode(-1)
+    , m_deltaInterval(1)
+    , m_subscribed(false)
+    , m_sequence(0)
+    , m_combinedSample()
+    , m_sampleBuffer(nullptr)
+    , m_rules()
+    , m_portInformationKey()
+    , m_portInformation()
+    , m_portInformationRequested(false)
+    , m_superseding(false)
 {
 }
 
@@ -88,6 +248,440 @@ int QLegoAttachedDevice::portId() const
     return m_portId;
 }
 
+/*!
+    \property QLegoAttachedDevice::startupMode
+    \brief whether new commands replace or follow the command currently executing.
+
+    Switching to \c ExecuteImmediately discards any commands still queued by the host.
+*/
+QLegoAttachedDevice::StartupMode QLegoAttachedDevice::startupMode() const
+{
+    return m_startupMode;
+}
+
+void QLegoAttachedDevice::setStartupMode(StartupMode mode)
+{
+    m_startupMode = mode;
+    if (mode == StartupMode::ExecuteImmediately) {
+        clearPendingCommands();
+    }
+}
+
+/*!
+    \property QLegoAttachedDevice::pendingCommands
+    \brief the number of commands queued by the host that have not been sent to the hub.
+*/
+int QLegoAttachedDevice::pendingCommands() const
+{
+    return m_pendingCommands.size();
+}
+
+/*!
+    \property QLegoAttachedDevice::mode
+    \brief the current input mode, or -1 if no mode has been selected.
+*/
+int QLegoAttachedDevice::mode() const
+{
+    return m_mode;
+}
+
+/*!
+    \property QLegoAttachedDevice::subscribed
+    \brief returns whether the hub pushes values for the current mode.
+*/
+bool QLegoAttachedDevice::subscribed() const
+{
+    return m_subscribed;
+}
+
+/*!
+    Returns how values of \a mode are encoded.
+
+    Subclasses return the formats of the modes they know about. The default implementation
+    returns the format reported by the hub, see portInformation(). Until it is known, the
+    format has no datasets and is inferred from the size of each value.
+*/
+QLegoValueFormat QLegoAttachedDevice::valueFormat(quint8 mode) const
+{
+    if (mode < m_portInformation.modes.size()) {
+        return m_portInformation.modes[mode].format;
+    }
+    return { 0, QLegoValueFormat::Int8 };
+}
+
+/*!
+    Selects the input \a mode and asks the hub to report a new value whenever it has changed by
+    at least \a deltaInterval. When \a notify is \c false, the mode is selected but values are
+    only reported when requested with requestValue().
+*/
+void QLegoAttachedDevice::subscribe(quint8 mode, quint32 deltaInterval, bool notify)
+{
+    // Values may arrive before the hub confirms the new format.
+    m_mode = mode;
+    m_deltaInterval = deltaInterval;
+    m_combination.clear();
+    requestUnknownFormat(mode);
+    writeInputFormat(mode, deltaInterval, notify);
+}
+
+/*!
+    Reports the given \a datasets together, in a single notification per change.
+
+    Every mode used by \a datasets is set up with \a deltaInterval, and the hub sends a new
+    sample whenever any of them has changed by at least that amount. At most
+    \c QLegoSample::MaxValues datasets can be combined, and the value format of every mode must be
+    known by valueFormat().
+
+    The values of a combined sample share one type. When a mode with float values is combined
+    with integer modes, the integers are converted to floats.
+*/
+void QLegoAttachedDevice::subscribeCombined(const QVector<QLegoModeDataset> &datasets,
+                                           quint32 deltaInterval)
+{
+    if (datasets.isEmpty() || datasets.size() > QLegoSample::MaxValues) {
+        qCWarning(attachedDeviceLogger) << "invalid combination size:" << datasets.size();
+        return;
+    }
+
+    m_mode = QLegoSample::CombinedMode;
+    m_deltaInterval = deltaInterval;
+    m_combination = datasets;
+
+    m_combinedSample.portId = m_portId;
+    m_combinedSample.mode = QLegoSample::CombinedMode;
+    m_combinedSample.count = static_cast<quint8>(datasets.size());
+    m_combinedSample.type = QLegoValueFormat::Int32;
+    for (int i = 0; i < QLegoSample::MaxValues; i++) {
+        m_combinedSample.values[i] = 0;
+    }
+
+    writeCombinedFormat(QByteArray(1, LockForSetup));
+
+    QVector<quint8> modes;
+    QByteArray combination(1, SetModeAndDatasetCombination);
+    combination += static_cast<char>(0x00);
+    for (const auto &entry : datasets) {
+        if (!modes.contains(entry.mode)) {
+            modes.append(entry.mode);
+            requestUnknownFormat(entry.mode);
+            writeInputFormat(entry.mode, deltaInterval, true);
+        }
+        combination += static_cast<char>((entry.mode << 4) | (entry.dataset & 0x0F));
+    }
+    writeCombinedFormat(combination);
+
+    writeCombinedFormat(QByteArray(1, UnlockWithUpdatesEnabled));
+}
+
+/*!
+    Returns the datasets reported together after subscribeCombined(), or an empty list when
+    a single mode is selected.
+*/
+QVector<QLegoModeDataset> QLegoAttachedDevice::combination() const
+{
+    return m_combination;
+}
+
+void QLegoAttachedDevice::writeInputFormat(quint8 mode, quint32 deltaInterval, bool notify)
+{
+    QByteArray bytes;
+    bytes.resize(3);
+    bytes[0] = 0x41;
+    bytes[1] = m_portId;
+    bytes[2] = mode;
+    appendLittleEndian<quint32>(bytes, deltaInterval);
+    bytes += static_cast<char>(notify ? 0x01 : 0x00);
+
+    qCDebug(attachedDeviceLogger) << "writeInputFormat:" << bytes.toHex();
+    emit command(bytes);
+}
+
+void QLegoAttachedDevice::writeCombinedFormat(const QByteArray &data)
+{
+    QByteArray bytes;
+    bytes.resize(2);
+    bytes[0] = 0x42;
+    bytes[1] = m_portId;
+    bytes += data;
+
+    qCDebug(attachedDeviceLogger) << "writeCombinedFormat:" << bytes.toHex();
+    emit command(bytes);
+}
+
+/*!
+    Stops the hub from pushing values for the current mode.
+*/
+void QLegoAttachedDevice::unsubscribe()
+{
+    if (m_mode < 0) {
+        return;
+    }
+    if (!m_combination.isEmpty()) {
+        writeCombinedFormat(QByteArray(1, UnlockWithUpdatesDisabled));
+        return;
+    }
+    subscribe(m_mode, m_deltaInterval, false);
+}
+
+/*!
+    Asks the hub for the current value of the selected mode.
+*/
+void QLegoAttachedDevice::requestValue()
+{
+    if (m_mode >= 0 && m_combination.isEmpty()) {
+        requestUnknownFormat(static_cast<quint8>(m_mode));
+    }
+
+    QByteArray bytes;
+    bytes.resize(3);
+    bytes[0] = 0x21;
+    bytes[1] = m_portId;
+    bytes[2] = 0x00;
+    emit command(bytes);
+}
+
+/*!
+    Returns what is known about the modes of this device.
+
+    The information is discovered from the hub the first time a mode without a known value
+    format is used, or when requestPortInformation() is called. Devices of the same type and
+    revisions share the result through QLegoPortInformationTable, so usually only the first
+    hub in a process has to ask. portInformationChanged() is emitted once discovery is
+    complete.
+*/
+QLegoPortInformation QLegoAttachedDevice::portInformation() const
+{
+    return m_portInformation;
+}
+
+/*!
+    Asks the parent device to discover the modes of this device, unless it already has.
+*/
+void QLegoAttachedDevice::requestPortInformation()
+{
+    if (m_portInformationRequested || m_portInformation.complete) {
+        return;
+    }
+    m_portInformationRequested = true;
+    emit portInformationRequested();
+}
+
+/*!
+    Returns a converter from raw values of \a mode to \a unit, using the ranges in
+    portInformation(). Values are returned unchanged while the ranges are unknown.
+*/
+QLegoValueConverter QLegoAttachedDevice::valueConverter(quint8 mode,
+                                                        QLegoValueConverter::Unit unit) const
+{
+    if (mode >= m_portInformation.modes.size()) {
+        return QLegoValueConverter();
+    }
+    return QLegoValueConverter(m_portInformation.modes[mode], unit);
+}
+
+void QLegoAttachedDevice::requestUnknownFormat(quint8 mode)
+{
+    if (valueFormat(mode).datasets == 0) {
+        requestPortInformation();
+    }
+}
+
+void QLegoAttachedDevice::processPortInformation(const QLegoPortInformation &information)
+{
+    m_portInformation = information;
+    if (information.complete) {
+        emit portInformationChanged();
+    }
+}
+
+/*!
+    Returns the buffer receiving the values of this device, or \c nullptr if there is none.
+*/
+QLegoSampleBuffer *QLegoAttachedDevice::sampleBuffer() const
+{
+    return m_sampleBuffer;
+}
+
+/*!
+    Writes every value reported by this device into \a buffer, in addition to emitting
+    valueReceived(). Pass \c nullptr to stop writing into the buffer.
+
+    The device is the only producer of \a buffer, which must outlive it or be removed first.
+    Samples are pushed from the thread the device lives in.
+*/
+void QLegoAttachedDevice::setSampleBuffer(QLegoSampleBuffer *buffer)
+{
+    m_sampleBuffer = buffer;
+}
+
+/*!
+    Called for every value reported by the device, after valueReceived() has been emitted.
+    Subclasses reimplement this function to emit typed signals for \a sample.
+*/
+void QLegoAttachedDevice::processSample(const QLegoSample &sample)
+{
+    Q_UNUSED(sample)
+}
+
+/*!
+    Called when a port output command prepared by QLegoDispatchGroup, QLegoRule or
+    QLegoMotionScheduler has been handed to the link. \a bytes holds the command without the
+    common header. Subclasses reimplement this function to track the state commands change.
+*/
+void QLegoAttachedDevice::processTransmittedCommand(const QByteArray &bytes)
+{
+    Q_UNUSED(bytes)
+}
+
+void QLegoAttachedDevice::processInputFormat(quint8 mode, quint32 deltaInterval, bool notify)
+{
+    const bool changed = m_mode != mode || m_subscribed != notify;
+    m_mode = mode;
+    m_deltaInterval = deltaInterval;
+    m_subscribed = notify;
+    if (changed) {
+        emit modeChanged();
+    }
+}
+
+void QLegoAttachedDevice::processValue(const char *data, int size, qint64 timestamp)
+{
+    if (m_mode < 0 || !m_combination.isEmpty() || size <= 0) {
+        return;
+    }
+
+    QLegoValueFormat format = valueFormat(m_mode);
+    if (format.datasets == 0) {
+        // Unknown mode: assume a single dataset filling the value, or a list of bytes.
+        switch (size) {
+            case 2:
+                format = { 1, QLegoValueFormat::Int16 };
+                break;
+            case 4:
+                format = { 1, QLegoValueFormat::Int32 };
+                break;
+            default:
+                format = { static_cast<quint8>(qMin(size, 0xFF)), QLegoValueFormat::Int8 };
+                break;
+        }
+    }
+
+    const int width = QLegoValueFormat::size(format.type);
+    const int count = qMin<int>(qMin<int>(format.datasets, size / width), QLegoSample::MaxValues);
+
+    QLegoSample sample;
+    sample.timestamp = timestamp;
+    sample.sequence = m_sequence++;
+    sample.portId = m_portId;
+    sample.mode = static_cast<quint8>(m_mode);
+    sample.count = static_cast<quint8>(count);
+    sample.type = format.type;
+    for (int i = 0; i < count; i++) {
+        sample.values[i] = decodeValue(data + i * width, format.type);
+    }
+    for (int i = count; i < QLegoSample::MaxValues; i++) {
+        sample.values[i] = 0;
+    }
+
+    // Rules may remove themselves when they trigger.
+    const auto rules = m_rules;
+    for (const auto rule : rules) {
+        rule->evaluate(sample);
+    }
+    if (m_sampleBuffer) {
+        m_sampleBuffer->push(sample);
+    }
+    emit valueReceived(sample);
+    processSample(sample);
+}
+
+void QLegoAttachedDevice::processCombinedValue(const char *data, int size, qint64 timestamp)
+{
+    if (m_combination.isEmpty() || size < 2) {
+        return;
+    }
+
+    // Each set bit selects an entry of the combination, whose values follow in order.
+    const quint16 pointer = qFromLittleEndian<quint16>(data);
+    int offset = 2;
+    for (int i = 0; i < m_combination.size(); i++) {
+        if (!(pointer & (1 << i))) {
+            continue;
+        }
+        const auto format = valueFormat(m_combination[i].mode);
+        const int width = QLegoValueFormat::size(format.type);
+        if (format.datasets == 0 || offset + width > size) {
+            qCWarning(attachedDeviceLogger) << "cannot decode combined value for port" << m_portId;
+            return;
+        }
+        m_combinedSample.values[i] = decodeValue(data + offset, format.type);
+        offset += width;
+    }
+
+    m_combinedSample.timestamp = timestamp;
+    m_combinedSample.sequence = m_sequence++;
+
+    // The combined sample keeps each value in the format of its mode, so a single type only
+    // describes it if no floats are mixed with integers.
+    QLegoSample sample = m_combinedSample;
+    bool floats = false;
+    for (const auto &entry : m_combination) {
+        floats |= valueFormat(entry.mode).type == QLegoValueFormat::Float;
+    }
+    if (floats) {
+        sample.type = QLegoValueFormat::Float;
+        for (int i = 0; i < m_combination.size(); i++) {
+            if (valueFormat(m_combination[i].mode).type != QLegoValueFormat::Float) {
+                const float value = m_combinedSample.values[i];
+                memcpy(&sample.values[i], &value, sizeof(value));
+            }
+        }
+    }
+
+    const auto rules = m_rules;
+    for (const auto rule : rules) {
+        rule->evaluate(sample);
+    }
+    if (m_sampleBuffer) {
+        m_sampleBuffer->push(sample);
+    }
+    emit valueReceived(sample);
+
+    // Pass each mode on separately, so typed signals follow the combined stream.
+    for (int i = 0; i < m_combination.size();) {
+        const quint8 mode = m_combination[i].mode;
+        sample = m_combinedSample;
+        sample.mode = mode;
+        sample.type = valueFormat(mode).type;
+        sample.count = 0;
+        while (i < m_combination.size() && m_combination[i].mode == mode) {
+            sample.values[sample.count++] = m_combinedSample.values[i++];
+        }
+        processSample(sample);
+    }
+}
+
+void QLegoAttachedDevice::processCombinedFormat(quint16 pointer, bool enabled)
+{
+    qCDebug(attachedDeviceLogger) << "combined format:" << m_portId << toBin(pointer, 16);
+    const bool changed = m_subscribed != enabled;
+    m_subscribed = enabled;
+    if (changed) {
+        emit modeChanged();
+    }
+}
+
+/*!
+    Discards every command queued by the host. Commands already sent to the hub are unaffected.
+*/
+void QLegoAttachedDevice::clearPendingCommands()
+{
+    while (!m_pendingCommands.isEmpty()) {
+        const auto pending = m_pendingCommands.dequeue();
+        pending.second->setState(QLegoCommandReply::Discarded);
+    }
+}
+
 /*!
     Detaches an attached device. The connection to the port is dropped, but
     physically the device remains attached until the user removes it.
@@ -95,6 +689,7 @@ int QLegoAttachedDevice::portId() const
 void QLegoAttachedDevice::detach()
 {
     setAttached(false);
+    abortCommands();
 }
 
 void QLegoAttachedDevice::setDeviceType(QLegoAttachedDevice::DeviceType type)
@@ -117,20 +712,157 @@ void QLegoAttachedDevice::setMotor(bool motor)
     m_motor = motor;
 }
 
-void QLegoAttachedDevice::writeDirect(quint8 mode, const QByteArray &data)
+/*!
+    Sends a Port Output Command with the sub-command \a subCommand and its
+    payload \a data to this port, and returns a reply that tracks its completion.
+
+    The command is scheduled according to \l{QLegoAttachedDevice::startupMode}, except for
+    commands that stop or brake a motor: those discard the commands queued for the port, both
+    on the host and on the hub, and are executed immediately. Subclasses offer the
+    sub-commands their devices support; this function sends any other.
+*/
+QLegoCommandReply *QLegoAttachedDevice::writePortOutput(quint8 subCommand, const QByteArray &data)
+{
+    QByteArray bytes = portOutput(subCommand, data);
+    if (m_startupMode == StartupMode::BufferIfNecessary) {
+        bytes[2] = BufferIfNecessaryWithFeedback;
+    }
+
+    auto reply = new QLegoCommandReply(m_portId, this);
+
+    if (m_motor && isStopCommand(bytes)) {
+        // Never wait behind the commands it is meant to stop.
+        bytes[2] = ExecuteImmediatelyWithFeedback;
+        clearPendingCommands();
+        sendCommand(bytes, reply);
+    } else if (m_startupMode == StartupMode::ExecuteImmediately) {
+        clearPendingCommands();
+        sendCommand(bytes, reply);
+    } else if (m_sentCommands.size() < MaxCommandsOnHub) {
+        sendCommand(bytes, reply);
+    } else {
+        qCDebug(attachedDeviceLogger) << "queued:" << bytes.toHex();
+        m_pendingCommands.enqueue(qMakePair(bytes, reply));
+    }
+
+    return reply;
+}
+
+/*!
+    Sends the WriteDirectModeData sub-command for \a mode with the payload \a data.
+*/
+QLegoCommandReply *QLegoAttachedDevice::writeDirect(quint8 mode, const QByteArray &data)
+{
+    QByteArray bytes;
+    bytes.reserve(data.size() + 1);
+    bytes += static_cast<char>(mode);
+    bytes += data;
+    return writePortOutput(0x51, bytes);
+}
+
+// Encodes a port output command that executes immediately and reports feedback.
+QByteArray QLegoAttachedDevice::portOutput(quint8 subCommand, const QByteArray &data) const
 {
     QByteArray bytes;
-    const quint8 size = data.size() + 5;
+    const quint8 size = data.size() + 4;
     bytes.resize(size);
     bytes[0] = 0x81;
     bytes[1] = m_portId;
-    bytes[2] = 0x11;
-    bytes[3] = 0x51;
-    bytes[4] = mode;
+    bytes[2] = ExecuteImmediatelyWithFeedback;
+    bytes[3] = subCommand;
     for (int i = 0; i < data.size(); i++) {
-        bytes[i + 5] = data[i];
+        bytes[i + 4] = data[i];
     }
+    return bytes;
+}
 
-    qCDebug(attachedDeviceLogger) << "writeDirect:" << bytes.toHex();
+// Tracks the feedback of a command that QLegoDispatchGroup writes to the hub itself. It
+// supersedes every command that has not been sent yet, like an immediate command.
+QLegoCommandReply *QLegoAttachedDevice::trackCommand()
+{
+    clearPendingCommands();
+    auto reply = new QLegoCommandReply(m_portId, this);
+    m_sentCommands.enqueue(reply);
+    reply->setState(QLegoCommandReply::Sent);
+    return reply;
+}
+
+void QLegoAttachedDevice::sendCommand(const QByteArray &bytes, QLegoCommandReply *reply)
+{
+    qCDebug(attachedDeviceLogger) << "writePortOutput:" << bytes.toHex();
+    m_sentCommands.enqueue(reply);
+    reply->setState(QLegoCommandReply::Sent);
     emit command(bytes);
 }
+
+void QLegoAttachedDevice::sendPendingCommands()
+{
+    while (!m_pendingCommands.isEmpty() && m_sentCommands.size() < MaxCommandsOnHub) {
+        const auto pending = m_pendingCommands.dequeue();
+        sendCommand(pending.first, pending.second);
+    }
+}
+
+void QLegoAttachedDevice::processFeedback(quint8 feedback)
+{
+    qCDebug(attachedDeviceLogger) << "feedback:" << m_portId << toBin(feedback);
+
+    if ((feedback & CommandDiscarded) && !m_sentCommands.isEmpty()) {
+        m_sentCommands.dequeue()->setState(QLegoCommandReply::Discarded);
+    }
+    if ((feedback & BufferEmptyCompleted) && !m_sentCommands.isEmpty()) {
+        m_sentCommands.dequeue()->setState(QLegoCommandReply::Completed);
+    }
+    if ((feedback & BufferEmptyInProgress) && !m_sentCommands.isEmpty()) {
+        m_sentCommands.head()->setState(QLegoCommandReply::InProgress);
+    }
+
+    if (!(feedback & BusyFull)) {
+        sendPendingCommands();
+    }
+}
+
+// Discards the count commands sent before the last one, which QLegoDevice dropped from its
+// queue before they were written. Unless keepLast is set, the last one was dropped as well, by
+// a command written to another port.
+void QLegoAttachedDevice::discardQueuedCommands(int count, bool keepLast)
+{
+    if (m_sentCommands.isEmpty()) {
+        return;
+    }
+    const auto last = keepLast ? m_sentCommands.takeLast() : nullptr;
+    for (int i = 0; i < count && !m_sentCommands.isEmpty(); i++) {
+        m_sentCommands.takeLast()->setState(QLegoCommandReply::Discarded);
+    }
+    if (last) {
+        m_sentCommands.enqueue(last);
+    }
+}
+
+// Discards the command sent last, which QLegoDevice dropped as the link was not open. No
+// feedback will ever arrive for it, so it must not hold one of the places on the hub.
+void QLegoAttachedDevice::discardLastCommand()
+{
+    if (m_sentCommands.isEmpty()) {
+        return;
+    }
+    m_sentCommands.takeLast()->setState(QLegoCommandReply::Discarded);
+    sendPendingCommands();
+}
+
+// Discards reply, a command tracked for QLegoDispatchGroup and others that was never written.
+void QLegoAttachedDevice::discardCommand(QLegoCommandReply *reply)
+{
+    if (m_sentCommands.removeOne(reply)) {
+        reply->setState(QLegoCommandReply::Discarded);
+        sendPendingCommands();
+    }
+}
+
+void QLegoAttachedDevice::abortCommands()
+{
+    clearPendingCommands();
+    while (!m_sentCommands.isEmpty()) {
+        m_sentCommands.dequeue()->setState(QLegoCommandReply::Discarded);
+    }
+}
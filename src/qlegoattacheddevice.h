@@ -2,10 +2,19 @@
 #define QLEGOATTACHEDDEVICE_H
 
 #include "qlegoglobal.h"
+#include "qlegosample.h"
+#include "qlegoportinformation.h"
+#include "qlegovalueconverter.h"
 
 #include <QtCore/QObject>
+#include <QtCore/QQueue>
+#include <QtCore/QPair>
+#include <QtCore/QVector>
 
 QT_FORWARD_DECLARE_CLASS(QString)
+QT_FORWARD_DECLARE_CLASS(QLegoCommandReply)
+QT_FORWARD_DECLARE_CLASS(QLegoSampleBuffer)
+QT_FORWARD_DECLARE_CLASS(QLegoRule)
 
 QT_BEGIN_NAMESPACE
 
@@ -17,6 +26,10 @@ class Q_LEGO_EXPORT QLegoAttachedDevice : public QObject
     Q_PROPERTY(bool sensor READ sensor)
     Q_PROPERTY(bool motor READ motor)
     Q_PROPERTY(int portId READ portId)
+    Q_PROPERTY(StartupMode startupMode READ startupMode WRITE setStartupMode)
+    Q_PROPERTY(int pendingCommands READ pendingCommands)
+    Q_PROPERTY(int mode READ mode NOTIFY modeChanged)
+    Q_PROPERTY(bool subscribed READ subscribed NOTIFY modeChanged)
 
 public:
     enum DeviceType
@@ -58,6 +71,13 @@ public:
     };
     Q_ENUM(DeviceType)
 
+    enum StartupMode
+    {
+        ExecuteImmediately,
+        BufferIfNecessary
+    };
+    Q_ENUM(StartupMode)
+
     QLegoAttachedDevice(DeviceType deviceType, quint8 portId, QObject *parent = nullptr);
 
     DeviceType type() const;
@@ -65,28 +85,102 @@ public:
     bool sensor() const;
     bool motor() const;
     int portId() const;
+    StartupMode startupMode() const;
+    int pendingCommands() const;
+    int mode() const;
+    bool subscribed() const;
+
+    virtual QLegoValueFormat valueFormat(quint8 mode) const;
+
+    Q_INVOKABLE void subscribe(quint8 mode, quint32 deltaInterval = 1, bool notify = true);
+    Q_INVOKABLE void subscribeCombined(const QVector<QLegoModeDataset> &datasets,
+                                       quint32 deltaInterval = 1);
+    QVector<QLegoModeDataset> combination() const;
+    Q_INVOKABLE void unsubscribe();
+    Q_INVOKABLE void requestValue();
+
+    QLegoPortInformation portInformation() const;
+    Q_INVOKABLE void requestPortInformation();
+    QLegoValueConverter valueConverter(quint8 mode, QLegoValueConverter::Unit unit) const;
+
+    QLegoCommandReply *writePortOutput(quint8 subCommand, const QByteArray &data);
+
+    QLegoSampleBuffer *sampleBuffer() const;
+    void setSampleBuffer(QLegoSampleBuffer *buffer);
 
 public Q_SLOTS:
     void detach();
+    void setStartupMode(StartupMode mode);
+    void clearPendingCommands();
 
 Q_SIGNALS:
     // Signals the parent object to send a command to the device.
     void command(const QByteArray &command);
+    void modeChanged();
+    void valueReceived(const QLegoSample &sample);
+    // Signals the parent object to discover the modes of the port.
+    void portInformationRequested();
+    void portInformationChanged();
 
 protected:
+    virtual void processSample(const QLegoSample &sample);
+    virtual void processTransmittedCommand(const QByteArray &bytes);
+
     void setDeviceType(DeviceType type);
     void setAttached(bool attached);
     void setSensor(bool sensor);
     void setMotor(bool motor);
 
-    void writeDirect(quint8 mode, const QByteArray &data);
+    QLegoCommandReply *writeDirect(quint8 mode, const QByteArray &data);
 
 private:
+    friend class QLegoControlLoop;
+    friend class QLegoDevice;
+    friend class QLegoDispatchGroup;
+    friend class QLegoMotionProgram;
+    friend class QLegoMotionScheduler;
+    friend class QLegoRule;
+
+    typedef QPair<QByteArray, QLegoCommandReply *> PendingCommand;
+
+    QByteArray portOutput(quint8 subCommand, const QByteArray &data) const;
+    QLegoCommandReply *trackCommand();
+    void sendCommand(const QByteArray &bytes, QLegoCommandReply *reply);
+    void sendPendingCommands();
+    void processFeedback(quint8 feedback);
+    void processInputFormat(quint8 mode, quint32 deltaInterval, bool notify);
+    void processValue(const char *data, int size, qint64 timestamp);
+    void processCombinedValue(const char *data, int size, qint64 timestamp);
+    void processCombinedFormat(quint16 pointer, bool enabled);
+    void writeInputFormat(quint8 mode, quint32 deltaInterval, bool notify);
+    void writeCombinedFormat(const QByteArray &data);
+    void abortCommands();
+    void discardQueuedCommands(int count, bool keepLast = true);
+    void discardLastCommand();
+    void discardCommand(QLegoCommandReply *reply);
+    void processPortInformation(const QLegoPortInformation &information);
+    void requestUnknownFormat(quint8 mode);
+
     DeviceType m_type;
     bool m_attached;
     bool m_sensor;
     bool m_motor;
     quint8 m_portId;
+    StartupMode m_startupMode;
+    QQueue<PendingCommand> m_pendingCommands;
+    QQueue<QLegoCommandReply *> m_sentCommands;
+    int m_mode;
+    quint32 m_deltaInterval;
+    bool m_subscribed;
+    quint32 m_sequence;
+    QVector<QLegoModeDataset> m_combination;
+    QLegoSample m_combinedSample;
+    QLegoSampleBuffer *m_sampleBuffer;
+    QVector<QLegoRule *> m_rules;
+    QByteArray m_portInformationKey;
+    QLegoPortInformation m_portInformation;
+    bool m_portInformationRequested;
+    bool m_superseding;
 };
 
 QT_END_NAMESPACE
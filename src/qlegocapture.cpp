@@ -0,0 +1,525 @@
+#include "qlegocapture.h"
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+#include <QtCore/QtEndian>
+#include <cstring>
+
+Q_LOGGING_CATEGORY(captureLogger, "lego.capture");
+
+static const char SegmentMagic[8] = { 'Q', 'L', 'E', 'G', 'O', 'C', 'A', 'P' };
+static const quint32 SegmentVersion = 1;
+
+// Marks a written record, so the zero-filled tail of a segment is never read as one.
+static const uchar RecordMarker = 0xC5;
+static const int MaxRecordPayload = 0xFFFF;
+static const qint64 MinimumSegmentSize = 4096;
+
+// Retry interval when a segment cannot be created, for example on a full disk.
+static const int SegmentRetryInterval = 1000;
+
+/*!
+  \class QLegoCapture
+  \brief The QLegoCapture class records raw frames to a binary log.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  A capture appends every frame received from or sent to a QLegoDevice to a memory-mapped
+  file, together with its direction, a monotonic timestamp in nanoseconds and the address of
+  the device. Install it with \l{QLegoDevice::setCapture()}; several devices, on any threads,
+  can share one capture.
+
+  Writing a record only copies it into the mapped file under a short lock: it neither
+  allocates nor waits for the disk. The file is split into segments of segmentSize() bytes.
+  A worker thread creates and pre-faults the next segment in advance, and truncates full
+  segments to their used size. If the writer outruns the worker, records are dropped and
+  counted by recordsDropped(). With maxSegments() set, the oldest segments are deleted.
+
+  Segments are named after fileName() with a six digit index before the suffix, so
+  \c{hub.qlc} is written to \c{hub.000000.qlc}, \c{hub.000001.qlc} and so on. They are read
+  back with QLegoCaptureReader.
+
+  Each segment starts with a 16 byte header: the magic \c{QLEGOCAP}, the format version and
+  the segment index, as 32-bit little endian integers. Each record then consists of:
+
+  \table
+  \header \li Offset \li Size \li Field
+  \row \li 0  \li 2 \li Payload size, little endian
+  \row \li 2  \li 1 \li Direction: 0 for incoming, 1 for outgoing
+  \row \li 3  \li 1 \li Record marker, \c 0xC5
+  \row \li 4  \li 6 \li Bluetooth address, most significant byte first
+  \row \li 10 \li 8 \li Monotonic timestamp in nanoseconds, little endian
+  \row \li 18 \li n \li The frame, starting with its length byte
+  \endtable
+*/
+
+/*!
+    \enum QLegoCapture::Direction
+
+    \value Incoming  A frame received from the hub.
+    \value Outgoing  A frame sent to the hub.
+*/
+
+/*!
+    Constructs a capture writing segments named after \a fileName.
+*/
+QLegoCapture::QLegoCapture(const QString &fileName)
+    : m_fileName(fileName)
+    , m_segmentSize(DefaultSegmentSize)
+    , m_maxSegments(0)
+    , m_worker(nullptr)
+    , m_mutex()
+    , m_condition()
+    , m_stopping(false)
+    , m_current()
+    , m_next()
+    , m_finished()
+    , m_nextIndex(0)
+    , m_segments()
+    , m_recordsWritten(0)
+    , m_recordsDropped(0)
+{
+}
+
+QLegoCapture::~QLegoCapture()
+{
+    close();
+}
+
+/*!
+    Returns the file name segment names are derived from.
+*/
+QString QLegoCapture::fileName() const
+{
+    return m_fileName;
+}
+
+/*!
+    Returns the size of each segment in bytes.
+*/
+qint64 QLegoCapture::segmentSize() const
+{
+    return m_segmentSize;
+}
+
+/*!
+    Sets the size of each segment to \a size bytes. The size cannot be changed while the
+    capture is open.
+*/
+void QLegoCapture::setSegmentSize(qint64 size)
+{
+    if (isOpen()) {
+        qCWarning(captureLogger) << "cannot change the segment size of an open capture";
+        return;
+    }
+    m_segmentSize = qMax(size, MinimumSegmentSize);
+}
+
+/*!
+    Returns the number of segments kept on disk, or 0 if there is no limit.
+*/
+int QLegoCapture::maxSegments() const
+{
+    return m_maxSegments;
+}
+
+/*!
+    Keeps at most \a count segments on disk, deleting the oldest ones, including segments of
+    earlier captures with the same file name. 0 keeps all segments.
+*/
+void QLegoCapture::setMaxSegments(int count)
+{
+    QMutexLocker locker(&m_mutex);
+    m_maxSegments = qMax(count, 0);
+}
+
+/*!
+    Creates the first segment and starts the worker thread. New segments continue the
+    numbering of segments already on disk. Returns \c false if the segment cannot be created.
+*/
+bool QLegoCapture::open()
+{
+    if (isOpen()) {
+        return true;
+    }
+
+    const QStringList existing = findSegments(m_fileName);
+    int index = 0;
+    if (!existing.isEmpty()) {
+        // The index is the second to last part of the name, or the last without a suffix.
+        const QStringList parts = QFileInfo(existing.last()).fileName().split('.');
+        const bool suffix = !QFileInfo(m_fileName).suffix().isEmpty();
+        index = parts.value(parts.size() - (suffix ? 2 : 1)).toInt() + 1;
+    }
+
+    Segment segment = createSegment(index);
+    if (!segment.memory) {
+        return false;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_segments = existing;
+    m_segments.append(segment.file->fileName());
+    m_current = segment;
+    m_nextIndex = index + 1;
+    m_stopping = false;
+    locker.unlock();
+
+    m_worker = QThread::create([this]() { run(); });
+    m_worker->start(QThread::LowPriority);
+    return true;
+}
+
+/*!
+    Stops the worker thread and truncates the last segment to its used size.
+*/
+void QLegoCapture::close()
+{
+    if (!m_worker) {
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_stopping = true;
+    m_condition.wakeOne();
+    locker.unlock();
+
+    m_worker->wait();
+    delete m_worker;
+    m_worker = nullptr;
+
+    locker.relock();
+    discardSegment(m_next);
+    finishSegment(m_finished);
+    finishSegment(m_current);
+}
+
+/*!
+    Returns \c true if records are being written.
+*/
+bool QLegoCapture::isOpen() const
+{
+    return m_worker != nullptr;
+}
+
+/*!
+    Returns the segments of this capture on disk, oldest first, including those found when it
+    was opened.
+*/
+QStringList QLegoCapture::segments() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_segments;
+}
+
+/*!
+    Returns the number of records written.
+*/
+quint64 QLegoCapture::recordsWritten() const
+{
+    return m_recordsWritten.load(std::memory_order_relaxed);
+}
+
+/*!
+    Returns the number of records dropped, because the capture was not open, the record was
+    larger than a segment, or the next segment was not ready yet.
+*/
+quint64 QLegoCapture::recordsDropped() const
+{
+    return m_recordsDropped.load(std::memory_order_relaxed);
+}
+
+/*!
+    Appends a record of the \a size bytes at \a data, sent or received as given by
+    \a direction by the device with Bluetooth \a address at \a timestamp. Returns \c false if
+    the record was dropped.
+
+    This function is thread-safe.
+*/
+bool QLegoCapture::write(Direction direction, quint64 address, qint64 timestamp,
+                         const char *data, int size)
+{
+    const qint64 recordSize = RecordHeaderSize + size;
+
+    QMutexLocker locker(&m_mutex);
+    if (!m_current.memory || size > MaxRecordPayload) {
+        m_recordsDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Records must fit the mapping of the segment they are copied to.
+    if (m_current.used + recordSize > m_current.size) {
+        if (!m_next.memory || m_finished.file || SegmentHeaderSize + recordSize > m_next.size) {
+            m_recordsDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        // Hand the full segment to the worker and continue in the spare one.
+        m_finished = m_current;
+        m_current = m_next;
+        m_next = Segment();
+        m_condition.wakeOne();
+    }
+
+    uchar *record = m_current.memory + m_current.used;
+    qToLittleEndian<quint16>(static_cast<quint16>(size), record);
+    record[2] = static_cast<uchar>(direction);
+    record[3] = RecordMarker;
+    for (int i = 0; i < 6; i++) {
+        record[4 + i] = static_cast<uchar>(address >> (40 - 8 * i));
+    }
+    qToLittleEndian<qint64>(timestamp, record + 10);
+    memcpy(record + RecordHeaderSize, data, size);
+    m_current.used += recordSize;
+
+    m_recordsWritten.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+/*!
+    Returns the name of segment \a index of a capture named \a fileName.
+*/
+QString QLegoCapture::segmentFileName(const QString &fileName, int index)
+{
+    const QFileInfo info(fileName);
+    const QString number = QString::number(index).rightJustified(6, '0');
+    QString name = info.completeBaseName() + '.' + number;
+    if (!info.suffix().isEmpty()) {
+        name += '.' + info.suffix();
+    }
+    return info.dir().filePath(name);
+}
+
+/*!
+    Returns the segments of a capture named \a fileName found on disk, oldest first.
+*/
+QStringList QLegoCapture::findSegments(const QString &fileName)
+{
+    const QFileInfo info(fileName);
+    QString pattern = info.completeBaseName() + ".??????";
+    if (!info.suffix().isEmpty()) {
+        pattern += '.' + info.suffix();
+    }
+
+    const QDir dir = info.dir();
+    QStringList segments;
+    for (const auto &name : dir.entryList({ pattern }, QDir::Files, QDir::Name)) {
+        segments.append(dir.filePath(name));
+    }
+    return segments;
+}
+
+QLegoCapture::Segment QLegoCapture::createSegment(int index) const
+{
+    Segment segment;
+    auto file = new QFile(segmentFileName(m_fileName, index));
+    if (!file->open(QIODevice::ReadWrite | QIODevice::Truncate) || !file->resize(m_segmentSize)) {
+        qCWarning(captureLogger) << "cannot create segment:" << file->fileName()
+                                 << file->errorString();
+        delete file;
+        return segment;
+    }
+
+    uchar *memory = file->map(0, m_segmentSize);
+    if (!memory) {
+        qCWarning(captureLogger) << "cannot map segment:" << file->fileName();
+        file->remove();
+        delete file;
+        return segment;
+    }
+
+    // Touch every page now, so writers never wait for the kernel to provide one.
+    memset(memory, 0, m_segmentSize);
+    memcpy(memory, SegmentMagic, sizeof(SegmentMagic));
+    qToLittleEndian<quint32>(SegmentVersion, memory + 8);
+    qToLittleEndian<quint32>(static_cast<quint32>(index), memory + 12);
+
+    segment.file = file;
+    segment.memory = memory;
+    segment.size = m_segmentSize;
+    segment.used = SegmentHeaderSize;
+    return segment;
+}
+
+void QLegoCapture::finishSegment(Segment &segment)
+{
+    if (!segment.file) {
+        return;
+    }
+    segment.file->unmap(segment.memory);
+    segment.file->resize(segment.used);
+    segment.file->close();
+    delete segment.file;
+    segment = Segment();
+}
+
+void QLegoCapture::discardSegment(Segment &segment)
+{
+    if (!segment.file) {
+        return;
+    }
+    m_segments.removeAll(segment.file->fileName());
+    segment.file->unmap(segment.memory);
+    segment.file->remove();
+    delete segment.file;
+    segment = Segment();
+}
+
+void QLegoCapture::run()
+{
+    QMutexLocker locker(&m_mutex);
+    while (true) {
+        if (m_finished.file) {
+            Segment finished = m_finished;
+            m_finished = Segment();
+            locker.unlock();
+            finishSegment(finished);
+            locker.relock();
+
+            // The current and the spare segment are never deleted.
+            while (m_maxSegments > 0 && m_segments.size() > m_maxSegments + (m_next.file ? 1 : 0)) {
+                QFile::remove(m_segments.takeFirst());
+            }
+            continue;
+        }
+
+        if (!m_next.file && !m_stopping) {
+            const int index = m_nextIndex;
+            locker.unlock();
+            Segment next = createSegment(index);
+            locker.relock();
+            if (next.file) {
+                m_next = next;
+                m_nextIndex++;
+                m_segments.append(next.file->fileName());
+                continue;
+            }
+            m_condition.wait(&m_mutex, SegmentRetryInterval);
+            continue;
+        }
+
+        if (m_stopping) {
+            break;
+        }
+        m_condition.wait(&m_mutex);
+    }
+}
+
+/*!
+  \class QLegoCaptureReader
+  \brief The QLegoCaptureReader class reads the records of a QLegoCapture.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  The reader maps all segments of a capture and returns their records in order. Records
+  point into the mapped files, so their data stays valid until the reader is closed.
+
+  \code
+  QLegoCaptureReader reader(QLegoCapture::findSegments("hub.qlc"));
+  QLegoCaptureReader::Record record;
+  if (reader.open()) {
+      while (reader.readNext(&record)) {
+          qDebug() << record.timestamp << QByteArray(record.data, record.size).toHex();
+      }
+  }
+  \endcode
+*/
+
+/*!
+    Constructs a reader for the capture \a segments, oldest first.
+*/
+QLegoCaptureReader::QLegoCaptureReader(const QStringList &segments)
+    : m_segmentNames(segments)
+    , m_segments()
+    , m_segment(0)
+    , m_offset(QLegoCapture::SegmentHeaderSize)
+    , m_recordsRead(0)
+{
+}
+
+QLegoCaptureReader::~QLegoCaptureReader()
+{
+    close();
+}
+
+/*!
+    Maps all segments. Returns \c false if one of them cannot be read or is not a capture.
+*/
+bool QLegoCaptureReader::open()
+{
+    close();
+    for (const auto &name : m_segmentNames) {
+        auto file = new QFile(name);
+        const uchar *memory = nullptr;
+        if (file->open(QIODevice::ReadOnly) && file->size() >= QLegoCapture::SegmentHeaderSize) {
+            memory = file->map(0, file->size());
+        }
+        if (!memory || memcmp(memory, SegmentMagic, sizeof(SegmentMagic)) != 0) {
+            qCWarning(captureLogger) << "not a capture segment:" << name;
+            delete file;
+            close();
+            return false;
+        }
+        m_segments.append({ file, memory, file->size() });
+    }
+    return true;
+}
+
+/*!
+    Unmaps all segments and starts over at the first record.
+*/
+void QLegoCaptureReader::close()
+{
+    for (const auto &segment : m_segments) {
+        delete segment.file;
+    }
+    m_segments.clear();
+    m_segment = 0;
+    m_offset = QLegoCapture::SegmentHeaderSize;
+    m_recordsRead = 0;
+}
+
+/*!
+    Reads the next record into \a record. Returns \c false at the end of the capture.
+*/
+bool QLegoCaptureReader::readNext(Record *record)
+{
+    while (m_segment < m_segments.size()) {
+        const auto &segment = m_segments[m_segment];
+        if (m_offset + QLegoCapture::RecordHeaderSize <= segment.size) {
+            const uchar *header = segment.memory + m_offset;
+            const int size = qFromLittleEndian<quint16>(header);
+            const qint64 end = m_offset + QLegoCapture::RecordHeaderSize + size;
+            if (header[3] == RecordMarker && header[2] <= QLegoCapture::Outgoing
+                && end <= segment.size) {
+                record->direction = static_cast<QLegoCapture::Direction>(header[2]);
+                record->address = 0;
+                for (int i = 0; i < 6; i++) {
+                    record->address = (record->address << 8) | header[4 + i];
+                }
+                record->timestamp = qFromLittleEndian<qint64>(header + 10);
+                record->data = reinterpret_cast<const char *>(header)
+                        + QLegoCapture::RecordHeaderSize;
+                record->size = size;
+                m_offset = end;
+                m_recordsRead++;
+                return true;
+            }
+        }
+
+        // The end of the segment, or the unused tail of one that was never closed.
+        m_segment++;
+        m_offset = QLegoCapture::SegmentHeaderSize;
+    }
+    return false;
+}
+
+/*!
+    Returns the number of records read since the reader was opened.
+*/
+quint64 QLegoCaptureReader::recordsRead() const
+{
+    return m_recordsRead;
+}
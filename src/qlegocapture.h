@@ -0,0 +1,129 @@
+#ifndef QLEGOCAPTURE_H
+#define QLEGOCAPTURE_H
+
+#include "qlegoglobal.h"
+
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QWaitCondition>
+
+#include <atomic>
+
+QT_FORWARD_DECLARE_CLASS(QFile)
+QT_FORWARD_DECLARE_CLASS(QThread)
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoCapture
+{
+public:
+    enum Direction
+    {
+        Incoming = 0,
+        Outgoing = 1
+    };
+
+    static const int SegmentHeaderSize = 16;
+    static const int RecordHeaderSize = 18;
+    static const qint64 DefaultSegmentSize = 16 * 1024 * 1024;
+
+    explicit QLegoCapture(const QString &fileName);
+    ~QLegoCapture();
+
+    QString fileName() const;
+    qint64 segmentSize() const;
+    void setSegmentSize(qint64 size);
+    int maxSegments() const;
+    void setMaxSegments(int count);
+
+    bool open();
+    void close();
+    bool isOpen() const;
+    QStringList segments() const;
+
+    quint64 recordsWritten() const;
+    quint64 recordsDropped() const;
+
+    bool write(Direction direction, quint64 address, qint64 timestamp, const char *data,
+               int size);
+
+    static QString segmentFileName(const QString &fileName, int index);
+    static QStringList findSegments(const QString &fileName);
+
+private:
+    Q_DISABLE_COPY(QLegoCapture)
+
+    struct Segment
+    {
+        QFile *file = nullptr;
+        uchar *memory = nullptr;
+        qint64 size = 0;
+        qint64 used = 0;
+    };
+
+    Segment createSegment(int index) const;
+    void finishSegment(Segment &segment);
+    void discardSegment(Segment &segment);
+    void run();
+
+    const QString m_fileName;
+    qint64 m_segmentSize;
+    int m_maxSegments;
+    QThread *m_worker;
+
+    // Guards everything below. Writers only hold it to copy a record.
+    mutable QMutex m_mutex;
+    QWaitCondition m_condition;
+    bool m_stopping;
+    Segment m_current;
+    Segment m_next;
+    Segment m_finished;
+    int m_nextIndex;
+    QStringList m_segments;
+
+    std::atomic<quint64> m_recordsWritten;
+    std::atomic<quint64> m_recordsDropped;
+};
+
+class Q_LEGO_EXPORT QLegoCaptureReader
+{
+public:
+    struct Record
+    {
+        QLegoCapture::Direction direction;
+        quint64 address;
+        qint64 timestamp;
+        const char *data;
+        int size;
+    };
+
+    explicit QLegoCaptureReader(const QStringList &segments);
+    ~QLegoCaptureReader();
+
+    bool open();
+    void close();
+    bool readNext(Record *record);
+    quint64 recordsRead() const;
+
+private:
+    Q_DISABLE_COPY(QLegoCaptureReader)
+
+    struct MappedSegment
+    {
+        QFile *file;
+        const uchar *memory;
+        qint64 size;
+    };
+
+    QStringList m_segmentNames;
+    QList<MappedSegment> m_segments;
+    int m_segment;
+    qint64 m_offset;
+    quint64 m_recordsRead;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,175 @@
+#include "qlegocolordistancesensor.h"
+#include <QtCore/QLoggingCategory>
+
+Q_LOGGING_CATEGORY(colorDistanceSensorLogger, "lego.attachedDevice.colorDistanceSensor");
+
+/*!
+  \class QLegoColorDistanceSensor
+  \brief The QLegoColorDistanceSensor class reads a color and distance sensor.
+  \inmodule QtLego
+  \ingroup attached-devices
+
+  QLegoColorDistanceSensor decodes the values of the Boost color and distance sensor. Select a
+  mode with \l{QLegoAttachedDevice::subscribe()}; the typed signals are emitted only when the
+  decoded value has changed.
+
+  \code
+  sensor->subscribe(QLegoColorDistanceSensor::ColorAndDistanceMode);
+  QObject::connect(sensor, &QLegoColorDistanceSensor::colorChanged, [](auto color) {
+      qDebug() << "color:" << color;
+  });
+  \endcode
+*/
+
+/*!
+    \enum QLegoColorDistanceSensor::Mode
+
+    The input modes of the sensor.
+
+    \value ColorMode             The detected color.
+
+    \value DistanceMode          The distance to an object, from 0 to 10.
+
+    \value CountMode             The number of objects that have passed the sensor.
+
+    \value ReflectionMode        The reflected light, in percent.
+
+    \value AmbientLightMode      The ambient light, in percent.
+
+    \value RgbMode               The raw red, green and blue values.
+
+    \value ColorAndDistanceMode  The color, distance and reflected light combined.
+*/
+
+/*!
+    Constructs a QLegoColorDistanceSensor object for a given \a deviceType and \a portId.
+
+    Most users will not need to construct this class themselves.
+*/
+QLegoColorDistanceSensor::QLegoColorDistanceSensor(DeviceType deviceType, quint8 portId,
+                                                   QObject *parent)
+    : QLegoAttachedDevice(deviceType, portId, parent)
+    , m_color(Color::NoColor)
+    , m_distance(-1)
+    , m_reflection(-1)
+    , m_ambientLight(-1)
+{
+    setAttached(true);
+    setMotor(false);
+    setSensor(true);
+}
+
+/*!
+    \property QLegoColorDistanceSensor::color
+    \brief the last color detected.
+*/
+QLegoColorDistanceSensor::Color QLegoColorDistanceSensor::color() const
+{
+    return m_color;
+}
+
+/*!
+    \property QLegoColorDistanceSensor::distance
+    \brief the last distance measured, from 0 (closest) to 10, or -1 if unknown.
+*/
+int QLegoColorDistanceSensor::distance() const
+{
+    return m_distance;
+}
+
+/*!
+    \property QLegoColorDistanceSensor::reflection
+    \brief the last reflected light measured in percent, or -1 if unknown.
+*/
+int QLegoColorDistanceSensor::reflection() const
+{
+    return m_reflection;
+}
+
+/*!
+    \property QLegoColorDistanceSensor::ambientLight
+    \brief the last ambient light measured in percent, or -1 if unknown.
+*/
+int QLegoColorDistanceSensor::ambientLight() const
+{
+    return m_ambientLight;
+}
+
+QLegoValueFormat QLegoColorDistanceSensor::valueFormat(quint8 mode) const
+{
+    switch (mode) {
+        case Mode::ColorMode:
+        case Mode::DistanceMode:
+        case Mode::ReflectionMode:
+        case Mode::AmbientLightMode:
+            return { 1, QLegoValueFormat::Int8 };
+        case Mode::CountMode:
+            return { 1, QLegoValueFormat::Int32 };
+        case Mode::RgbMode:
+            return { 3, QLegoValueFormat::Int16 };
+        case Mode::ColorAndDistanceMode:
+            return { 4, QLegoValueFormat::Int8 };
+        default:
+            return QLegoAttachedDevice::valueFormat(mode);
+    }
+}
+
+void QLegoColorDistanceSensor::processSample(const QLegoSample &sample)
+{
+    switch (sample.mode) {
+        case Mode::ColorMode:
+            updateColor(sample.values[0]);
+            break;
+        case Mode::DistanceMode:
+            updateDistance(sample.values[0]);
+            break;
+        case Mode::ReflectionMode:
+            if (sample.values[0] != m_reflection) {
+                m_reflection = sample.values[0];
+                emit reflectionChanged(m_reflection);
+            }
+            break;
+        case Mode::AmbientLightMode:
+            if (sample.values[0] != m_ambientLight) {
+                m_ambientLight = sample.values[0];
+                emit ambientLightChanged(m_ambientLight);
+            }
+            break;
+        case Mode::RgbMode:
+            if (sample.count == 3) {
+                emit rgbChanged(sample.values[0], sample.values[1], sample.values[2]);
+            }
+            break;
+        case Mode::ColorAndDistanceMode:
+            if (sample.count == 4) {
+                updateColor(sample.values[0]);
+                updateDistance(sample.values[1]);
+                if (sample.values[3] != m_reflection) {
+                    m_reflection = sample.values[3];
+                    emit reflectionChanged(m_reflection);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void QLegoColorDistanceSensor::updateColor(int value)
+{
+    // Colors are reported as an unsigned byte.
+    const auto color = static_cast<Color>(value & 0xFF);
+    if (color != m_color) {
+        m_color = color;
+        qCDebug(colorDistanceSensorLogger) << "color:" << color;
+        emit colorChanged(color);
+    }
+}
+
+void QLegoColorDistanceSensor::updateDistance(int distance)
+{
+    if (distance != m_distance) {
+        m_distance = distance;
+        emit distanceChanged(distance);
+    }
+}
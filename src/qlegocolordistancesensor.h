@@ -0,0 +1,80 @@
+#ifndef QLEGOCOLORDISTANCESENSOR_H
+#define QLEGOCOLORDISTANCESENSOR_H
+
+#include "qlegoglobal.h"
+#include "qlegoattacheddevice.h"
+#include <QtCore/QObject>
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoColorDistanceSensor : public QLegoAttachedDevice
+{
+    Q_OBJECT
+    Q_PROPERTY(Color color READ color NOTIFY colorChanged)
+    Q_PROPERTY(int distance READ distance NOTIFY distanceChanged)
+    Q_PROPERTY(int reflection READ reflection NOTIFY reflectionChanged)
+    Q_PROPERTY(int ambientLight READ ambientLight NOTIFY ambientLightChanged)
+
+public:
+    enum Mode
+    {
+        ColorMode = 0,
+        DistanceMode = 1,
+        CountMode = 2,
+        ReflectionMode = 3,
+        AmbientLightMode = 4,
+        RgbMode = 6,
+        ColorAndDistanceMode = 8
+    };
+    Q_ENUM(Mode)
+
+    enum Color
+    {
+        Black = 0,
+        Pink = 1,
+        Purple = 2,
+        Blue = 3,
+        LightBlue = 4,
+        Cyan = 5,
+        Green = 6,
+        Yellow = 7,
+        Orange = 8,
+        Red = 9,
+        White = 10,
+        NoColor = 255
+    };
+    Q_ENUM(Color)
+
+    explicit QLegoColorDistanceSensor(DeviceType deviceType, quint8 portId,
+                                      QObject *parent = nullptr);
+
+    Color color() const;
+    int distance() const;
+    int reflection() const;
+    int ambientLight() const;
+
+    QLegoValueFormat valueFormat(quint8 mode) const override;
+
+Q_SIGNALS:
+    void colorChanged(QLegoColorDistanceSensor::Color color);
+    void distanceChanged(int distance);
+    void reflectionChanged(int reflection);
+    void ambientLightChanged(int ambientLight);
+    void rgbChanged(int red, int green, int blue);
+
+protected:
+    void processSample(const QLegoSample &sample) override;
+
+private:
+    void updateColor(int color);
+    void updateDistance(int distance);
+
+    Color m_color;
+    int m_distance;
+    int m_reflection;
+    int m_ambientLight;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,130 @@
+#include "qlegocommandreply.h"
+
+/*!
+  \class QLegoCommandReply
+  \brief The QLegoCommandReply class tracks the completion of a command sent to a port.
+  \inmodule QtLego
+  \ingroup attached-devices
+
+  Every port output command, such as \l{QLegoMotor::startSpeedForDegrees()}, returns a
+  QLegoCommandReply. The reply follows the command feedback reported by the hub, so users can
+  tell when a command has started, has completed, or was discarded in favour of a newer command.
+
+  Replies are owned by the attached device that created them and are deleted automatically
+  after \l{QLegoCommandReply::finished()} has been emitted. Use QPointer when keeping a reply
+  beyond the slot connected to \c finished().
+
+  \code
+  auto reply = motor->startSpeedForDegrees(360, 50);
+  QObject::connect(reply, &QLegoCommandReply::completed, [=]() {
+      motor->gotoAbsolutePosition(0, 50);
+  });
+  \endcode
+*/
+
+/*!
+    \enum QLegoCommandReply::State
+
+    The progress of a command.
+
+    \value Queued      The command is held by the host until the hub can buffer it.
+
+    \value Sent        The command has been sent, but the hub has not started it.
+
+    \value InProgress  The hub is executing the command.
+
+    \value Completed   The hub has finished the command.
+
+    \value Discarded   The command was discarded before it finished.
+*/
+
+/*!
+    \fn void QLegoCommandReply::stateChanged(QLegoCommandReply::State state)
+
+    This signal is emitted when the command moves to \a state.
+*/
+
+/*!
+    \fn void QLegoCommandReply::started()
+
+    This signal is emitted when the hub starts executing the command.
+*/
+
+/*!
+    \fn void QLegoCommandReply::completed()
+
+    This signal is emitted when the hub reports that the command has completed.
+*/
+
+/*!
+    \fn void QLegoCommandReply::discarded()
+
+    This signal is emitted when the command was discarded, either by the hub or by the host.
+*/
+
+/*!
+    \fn void QLegoCommandReply::finished()
+
+    This signal is emitted after the command has completed or was discarded.
+*/
+
+QLegoCommandReply::QLegoCommandReply(quint8 portId, QObject *parent)
+    : QObject(parent)
+    , m_state(State::Queued)
+    , m_portId(portId)
+{
+}
+
+/*!
+    \property QLegoCommandReply::state
+    \brief the progress of the command.
+*/
+QLegoCommandReply::State QLegoCommandReply::state() const
+{
+    return m_state;
+}
+
+/*!
+    \property QLegoCommandReply::finished
+    \brief returns whether the command has completed or was discarded.
+*/
+bool QLegoCommandReply::isFinished() const
+{
+    return m_state == State::Completed || m_state == State::Discarded;
+}
+
+/*!
+    \property QLegoCommandReply::portId
+    \brief the port the command was sent to.
+*/
+int QLegoCommandReply::portId() const
+{
+    return m_portId;
+}
+
+void QLegoCommandReply::setState(State state)
+{
+    if (state == m_state || isFinished()) {
+        return;
+    }
+    m_state = state;
+    emit stateChanged(state);
+
+    switch (state) {
+        case State::InProgress:
+            emit started();
+            break;
+        case State::Completed:
+            emit completed();
+            emit finished();
+            deleteLater();
+            break;
+        case State::Discarded:
+            emit discarded();
+            emit finished();
+            deleteLater();
+            break;
+        default:
+            break;
+    }
+}
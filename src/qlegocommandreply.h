@@ -0,0 +1,54 @@
+#ifndef QLEGOCOMMANDREPLY_H
+#define QLEGOCOMMANDREPLY_H
+
+#include "qlegoglobal.h"
+
+#include <QtCore/QObject>
+
+QT_BEGIN_NAMESPACE
+
+class QLegoAttachedDevice;
+
+class Q_LEGO_EXPORT QLegoCommandReply : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(State state READ state NOTIFY stateChanged)
+    Q_PROPERTY(bool finished READ isFinished)
+    Q_PROPERTY(int portId READ portId)
+
+public:
+    enum State
+    {
+        Queued,
+        Sent,
+        InProgress,
+        Completed,
+        Discarded
+    };
+    Q_ENUM(State)
+
+    State state() const;
+    bool isFinished() const;
+    int portId() const;
+
+Q_SIGNALS:
+    void stateChanged(QLegoCommandReply::State state);
+    void started();
+    void completed();
+    void discarded();
+    void finished();
+
+private:
+    friend class QLegoAttachedDevice;
+
+    explicit QLegoCommandReply(quint8 portId, QObject *parent = nullptr);
+
+    void setState(State state);
+
+    State m_state;
+    quint8 m_portId;
+};
+
+QT_END_NAMESPACE
+
+#endif
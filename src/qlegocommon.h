@@ -10,6 +10,8 @@
 #include <QtBluetooth/QBluetoothUuid>
 #include <QtBluetooth/QLowEnergyService>
 
+#include <chrono>
+
 QT_BEGIN_NAMESPACE
 
 static const auto LPF2_SERVICE = QStringLiteral("00001623-1212-efde-1623-785feabcd123");
@@ -44,6 +46,13 @@ static inline QString decodeVersion(const QByteArray &bytes)
     return version;
 }
 
+// Monotonic timestamp used for all instrumentation and sample timing.
+static inline qint64 monotonicNanoseconds()
+{
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
 static inline QString toHex(int value, int length = 2)
 {
     return QString::number(value, 16).rightJustified(length, '0');
@@ -67,6 +76,35 @@ static inline qint8 mapSpeed(qint8 speed)
     return speed;
 }
 
+// Whether a Port Output Command, without its frame header, stops or brakes a motor:
+// StartPower (0x01), StartSpeed (0x07), or WriteDirectModeData (0x51) in mode 0, with a power
+// or speed of 0 (float) or 127 (brake). The synchronized StartPower (0x02) and StartSpeed
+// (0x08) of a virtual port stop when both of their values do.
+static inline bool isStopCommand(const QByteArray &bytes)
+{
+    if (bytes.size() < 5 || bytes[0] != static_cast<char>(0x81)) {
+        return false;
+    }
+    const auto isStop = [](char value) { return value == 0 || value == 127; };
+    const quint8 subCommand = bytes[3];
+    if (subCommand == 0x01 || subCommand == 0x07) {
+        return isStop(bytes[4]);
+    } else if ((subCommand == 0x02 || subCommand == 0x08) && bytes.size() >= 6) {
+        return isStop(bytes[4]) && isStop(bytes[5]);
+    } else if (subCommand == 0x51 && bytes.size() >= 6 && bytes[4] == 0x00) {
+        return isStop(bytes[5]);
+    }
+    return false;
+}
+
+template<typename T>
+static inline void appendLittleEndian(QByteArray &bytes, T value)
+{
+    const int offset = bytes.size();
+    bytes.resize(offset + int(sizeof(T)));
+    qToLittleEndian<T>(value, bytes.data() + offset);
+}
+
 static inline int normalizeAngle(int angle)
 {
     if (angle >= 180) {
@@ -0,0 +1,425 @@
+#include "qlegocontrolloop.h"
+#include "qlegocommon.h"
+#include "qlegoattacheddevice.h"
+#include "qlegocommandreply.h"
+#include "qlegomotor.h"
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QThread>
+
+#include <chrono>
+#include <thread>
+
+Q_LOGGING_CATEGORY(controlLoopLogger, "lego.controlloop");
+
+static const qint64 NanosecondsPerSecond = 1000000000;
+
+/*!
+  \class QLegoControlContext
+  \brief The QLegoControlContext class is what a control step sees and acts through.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  Each tick of a QLegoControlLoop fills a context with the latest sample of every input, read
+  at the same instant, and passes it to the steps in the order they were added. Steps issue
+  commands through the context. After the last step, the loop hands the commands to the threads
+  of their devices, which send them like any other command. If several steps command the same
+  device in one tick, only the last command is sent.
+
+  A context is only valid during the tick it is passed to.
+*/
+
+QLegoControlContext::QLegoControlContext(int inputs)
+    : m_tick(0)
+    , m_timestamp(0)
+    , m_interval(0)
+    , m_samples(inputs)
+    , m_valid(inputs, false)
+    , m_commands()
+{
+}
+
+/*!
+    Returns the number of the tick, starting at 0.
+*/
+quint64 QLegoControlContext::tick() const
+{
+    return m_tick;
+}
+
+/*!
+    Returns the monotonic time the tick started, in nanoseconds.
+*/
+qint64 QLegoControlContext::timestamp() const
+{
+    return m_timestamp;
+}
+
+/*!
+    Returns the time since the previous tick started in seconds, or 0 for the first tick.
+*/
+double QLegoControlContext::interval() const
+{
+    return m_interval;
+}
+
+/*!
+    Returns the number of inputs of the loop.
+*/
+int QLegoControlContext::inputCount() const
+{
+    return m_samples.size();
+}
+
+/*!
+    Returns \c true if \a input has received a sample since the loop started.
+*/
+bool QLegoControlContext::hasSample(int input) const
+{
+    return input >= 0 && input < m_valid.size() && m_valid[input];
+}
+
+/*!
+    Returns the latest sample of \a input. Its timestamp tells how old it is.
+*/
+QLegoSample QLegoControlContext::sample(int input) const
+{
+    return hasSample(input) ? m_samples[input] : QLegoSample();
+}
+
+/*!
+    Returns value \a index of the latest sample of \a input, or 0 if there is none.
+*/
+double QLegoControlContext::value(int input, int index) const
+{
+    if (!hasSample(input) || index < 0 || index >= m_samples[input].count) {
+        return 0;
+    }
+    return m_samples[input].value(index);
+}
+
+/*!
+    Sets \a motor to \a power percent.
+
+    \sa QLegoMotor::startPower()
+*/
+void QLegoControlContext::setPower(QLegoMotor *motor, int power)
+{
+    addCommand(motor, [motor, power]() { return motor->startPower(power); });
+}
+
+/*!
+    Runs \a motor at \a speed percent, using at most \a maxPower percent of power.
+
+    \sa QLegoMotor::startSpeed()
+*/
+void QLegoControlContext::startSpeed(QLegoMotor *motor, int speed, int maxPower)
+{
+    addCommand(motor, [motor, speed, maxPower]() { return motor->startSpeed(speed, maxPower); });
+}
+
+/*!
+    Sends the port output command \a subCommand with the payload \a data to \a attachment.
+
+    \sa QLegoAttachedDevice::writePortOutput()
+*/
+void QLegoControlContext::writePortOutput(QLegoAttachedDevice *attachment, quint8 subCommand,
+                                          const QByteArray &data)
+{
+    addCommand(attachment, [attachment, subCommand, data]() {
+        return attachment->writePortOutput(subCommand, data);
+    });
+}
+
+void QLegoControlContext::addCommand(QLegoAttachedDevice *attachment, const Command &command)
+{
+    for (auto &pending : m_commands) {
+        if (pending.first == attachment) {
+            pending.second = command;
+            return;
+        }
+    }
+    m_commands.append(qMakePair(attachment, command));
+}
+
+/*!
+  \class QLegoControlLoop
+  \brief The QLegoControlLoop class runs host-side feedback control at a fixed rate.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  Balancing, line following or force control close the loop on the host, often over sensors
+  on several ports and hubs. Driving them from signal handlers or wait() ties their timing to
+  the event loop, and every slow slot shows up as jitter in the controller.
+
+  A control loop runs its steps on a thread of its own, at time-critical priority, at rate()
+  ticks per second. Ticks are scheduled on absolute deadlines, so timing errors do not add up.
+  A tick that runs past the next deadline is an overrun; the ticks it missed are skipped rather
+  than run back to back.
+
+  Inputs are attached devices whose samples the loop keeps. Each tick reads the latest sample
+  of every input at the same instant, without locks, and passes them to the steps in a
+  QLegoControlContext. Commands the steps issue through the context are sent from the threads
+  the devices live in, through their normal command queues. Each one replaces the command of
+  an earlier tick still queued for the same port, so a loop faster than the link does not
+  build up a backlog.
+
+  \code
+  auto loop = new QLegoControlLoop(this);
+  loop->setRate(200);
+  const int tilt = loop->addInput(tiltSensor);
+  loop->addStep([=](QLegoControlContext &context) {
+      if (context.hasSample(tilt)) {
+          context.setPower(motor, -2 * context.value(tilt, 1));
+      }
+  });
+  loop->start();
+  \endcode
+
+  The loop records the jitter of each tick, the time its steps take, how many ticks were missed
+  and the time from a command leaving the loop to the hub reporting it completed. All of them
+  may be read from any thread while the loop runs.
+
+  Inputs and steps can only be added while the loop is stopped. Steps must not block, and the
+  devices of the inputs and commands must outlive the loop.
+
+  \sa QLegoPidController
+*/
+
+QLegoControlLoop::QLegoControlLoop(QObject *parent)
+    : QObject(parent)
+    , m_rate(DefaultRate)
+    , m_worker(nullptr)
+    , m_stopping(false)
+    , m_inputs()
+    , m_steps()
+    , m_ticks(0)
+    , m_overruns(0)
+    , m_jitter()
+    , m_stepTime()
+    , m_feedbackLatency(new QLegoLatencyHistogram)
+{
+}
+
+QLegoControlLoop::~QLegoControlLoop()
+{
+    stop();
+    for (const auto input : m_inputs) {
+        QObject::disconnect(input->connection);
+    }
+    qDeleteAll(m_inputs);
+}
+
+/*!
+    \property QLegoControlLoop::rate
+    \brief the number of ticks per second.
+
+    The rate is taken into account the next time the loop starts. The default is 100.
+*/
+int QLegoControlLoop::rate() const
+{
+    return m_rate;
+}
+
+void QLegoControlLoop::setRate(int hz)
+{
+    m_rate = qBound(1, hz, MaxRate);
+}
+
+/*!
+    \property QLegoControlLoop::running
+    \brief whether the loop thread is running.
+*/
+bool QLegoControlLoop::isRunning() const
+{
+    return m_worker != nullptr;
+}
+
+/*!
+    Keeps the latest sample of \a attachment for the steps, or only samples of \a mode if it is
+    not -1. Returns the index of the input, or -1 if the loop is running.
+*/
+int QLegoControlLoop::addInput(QLegoAttachedDevice *attachment, int mode)
+{
+    if (m_worker) {
+        qCWarning(controlLoopLogger) << "cannot add an input while the loop is running";
+        return -1;
+    }
+
+    auto input = new Input;
+    input->attachment = attachment;
+    input->mode = mode;
+    input->sequence.store(0, std::memory_order_relaxed);
+    input->sample = QLegoSample();
+    // Runs in the thread of the device, as soon as the sample is decoded.
+    input->connection = connect(attachment, &QLegoAttachedDevice::valueReceived,
+                                [input](const QLegoSample &sample) {
+                                    if (input->mode >= 0 && sample.mode != input->mode) {
+                                        return;
+                                    }
+                                    const quint32 sequence =
+                                            input->sequence.load(std::memory_order_relaxed);
+                                    input->sequence.store(sequence + 1, std::memory_order_relaxed);
+                                    std::atomic_thread_fence(std::memory_order_release);
+                                    input->sample = sample;
+                                    input->sequence.store(sequence + 2, std::memory_order_release);
+                                });
+    m_inputs.append(input);
+    return m_inputs.size() - 1;
+}
+
+/*!
+    Adds \a step, which runs on the loop thread once per tick, after the steps added before it.
+    Steps cannot be added while the loop is running.
+*/
+void QLegoControlLoop::addStep(const Step &step)
+{
+    if (m_worker) {
+        qCWarning(controlLoopLogger) << "cannot add a step while the loop is running";
+        return;
+    }
+    m_steps.append(step);
+}
+
+/*!
+    Returns the number of ticks run so far.
+*/
+quint64 QLegoControlLoop::ticks() const
+{
+    return m_ticks.load(std::memory_order_relaxed);
+}
+
+/*!
+    Returns the number of ticks skipped because a tick ran past their deadline.
+*/
+quint64 QLegoControlLoop::overruns() const
+{
+    return m_overruns.load(std::memory_order_relaxed);
+}
+
+/*!
+    Returns the histogram of how late each tick started after its deadline.
+*/
+const QLegoLatencyHistogram *QLegoControlLoop::jitter() const
+{
+    return &m_jitter;
+}
+
+/*!
+    Returns the histogram of the time each tick took, from reading the inputs to handing off
+    the commands.
+*/
+const QLegoLatencyHistogram *QLegoControlLoop::stepTime() const
+{
+    return &m_stepTime;
+}
+
+/*!
+    Returns the histogram of the time from a command leaving the loop to the hub reporting it
+    completed.
+*/
+const QLegoLatencyHistogram *QLegoControlLoop::feedbackLatency() const
+{
+    return m_feedbackLatency.data();
+}
+
+/*!
+    Starts the loop thread. The first tick runs immediately.
+*/
+void QLegoControlLoop::start()
+{
+    if (m_worker) {
+        return;
+    }
+    m_stopping.store(false, std::memory_order_relaxed);
+    m_worker = QThread::create([this]() { run(); });
+    m_worker->start(QThread::TimeCriticalPriority);
+}
+
+/*!
+    Stops the loop thread after the current tick. Commands already handed off are still sent.
+*/
+void QLegoControlLoop::stop()
+{
+    if (!m_worker) {
+        return;
+    }
+    m_stopping.store(true, std::memory_order_release);
+    m_worker->wait();
+    delete m_worker;
+    m_worker = nullptr;
+}
+
+void QLegoControlLoop::run()
+{
+    using Clock = std::chrono::steady_clock;
+
+    const qint64 period = NanosecondsPerSecond / m_rate;
+    QLegoControlContext context(m_inputs.size());
+    qint64 deadline = monotonicNanoseconds();
+    qint64 previous = -1;
+
+    while (!m_stopping.load(std::memory_order_acquire)) {
+        std::this_thread::sleep_until(Clock::time_point(std::chrono::nanoseconds(deadline)));
+        const qint64 started = monotonicNanoseconds();
+        m_jitter.record(qMax<qint64>(started - deadline, 0));
+
+        context.m_tick = m_ticks.load(std::memory_order_relaxed);
+        context.m_timestamp = started;
+        context.m_interval = previous < 0 ? 0 : (started - previous) / double(NanosecondsPerSecond);
+        previous = started;
+        readInputs(context);
+        for (const auto &step : m_steps) {
+            step(context);
+        }
+        postCommands(context);
+
+        const qint64 finished = monotonicNanoseconds();
+        m_stepTime.record(finished - started);
+        m_ticks.fetch_add(1, std::memory_order_relaxed);
+
+        deadline += period;
+        if (finished > deadline) {
+            const qint64 missed = (finished - deadline) / period + 1;
+            m_overruns.fetch_add(missed, std::memory_order_relaxed);
+            deadline += missed * period;
+        }
+    }
+}
+
+void QLegoControlLoop::readInputs(QLegoControlContext &context)
+{
+    for (int i = 0; i < m_inputs.size(); i++) {
+        const auto input = m_inputs[i];
+        quint32 before;
+        do {
+            before = input->sequence.load(std::memory_order_acquire);
+            context.m_samples[i] = input->sample;
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((before & 1) || input->sequence.load(std::memory_order_relaxed) != before);
+        context.m_valid[i] = before != 0;
+    }
+}
+
+void QLegoControlLoop::postCommands(QLegoControlContext &context)
+{
+    const qint64 issued = monotonicNanoseconds();
+    const auto latency = m_feedbackLatency;
+    for (const auto &command : context.m_commands) {
+        const auto attachment = command.first;
+        const auto write = command.second;
+        QMetaObject::invokeMethod(
+                attachment,
+                [attachment, write, latency, issued]() {
+                    // Commands of earlier ticks that are still queued are out of date.
+                    attachment->clearPendingCommands();
+                    attachment->m_superseding = true;
+                    const auto reply = write();
+                    attachment->m_superseding = false;
+                    QObject::connect(reply, &QLegoCommandReply::completed, [latency, issued]() {
+                        latency->record(monotonicNanoseconds() - issued);
+                    });
+                },
+                Qt::QueuedConnection);
+    }
+    context.m_commands.clear();
+}
@@ -0,0 +1,123 @@
+#ifndef QLEGOCONTROLLOOP_H
+#define QLEGOCONTROLLOOP_H
+
+#include "qlegoglobal.h"
+#include "qlegolatencyhistogram.h"
+#include "qlegosample.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QPair>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QVector>
+
+#include <atomic>
+#include <functional>
+
+QT_FORWARD_DECLARE_CLASS(QThread)
+QT_FORWARD_DECLARE_CLASS(QLegoAttachedDevice)
+QT_FORWARD_DECLARE_CLASS(QLegoCommandReply)
+QT_FORWARD_DECLARE_CLASS(QLegoMotor)
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoControlContext
+{
+public:
+    quint64 tick() const;
+    qint64 timestamp() const;
+    double interval() const;
+
+    int inputCount() const;
+    bool hasSample(int input) const;
+    QLegoSample sample(int input) const;
+    double value(int input, int index = 0) const;
+
+    void setPower(QLegoMotor *motor, int power);
+    void startSpeed(QLegoMotor *motor, int speed, int maxPower = 100);
+    void writePortOutput(QLegoAttachedDevice *attachment, quint8 subCommand,
+                         const QByteArray &data);
+
+private:
+    Q_DISABLE_COPY(QLegoControlContext)
+    friend class QLegoControlLoop;
+
+    typedef std::function<QLegoCommandReply *()> Command;
+
+    explicit QLegoControlContext(int inputs);
+
+    void addCommand(QLegoAttachedDevice *attachment, const Command &command);
+
+    quint64 m_tick;
+    qint64 m_timestamp;
+    double m_interval;
+    QVector<QLegoSample> m_samples;
+    QVector<bool> m_valid;
+    QVector<QPair<QLegoAttachedDevice *, Command>> m_commands;
+};
+
+class Q_LEGO_EXPORT QLegoControlLoop : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int rate READ rate WRITE setRate)
+    Q_PROPERTY(bool running READ isRunning)
+
+public:
+    typedef std::function<void(QLegoControlContext &context)> Step;
+
+    static const int DefaultRate = 100;
+    static const int MaxRate = 10000;
+
+    explicit QLegoControlLoop(QObject *parent = nullptr);
+    ~QLegoControlLoop();
+
+    int rate() const;
+    void setRate(int hz);
+    bool isRunning() const;
+
+    int addInput(QLegoAttachedDevice *attachment, int mode = -1);
+    void addStep(const Step &step);
+
+    quint64 ticks() const;
+    quint64 overruns() const;
+    const QLegoLatencyHistogram *jitter() const;
+    const QLegoLatencyHistogram *stepTime() const;
+    const QLegoLatencyHistogram *feedbackLatency() const;
+
+public Q_SLOTS:
+    void start();
+    void stop();
+
+private:
+    Q_DISABLE_COPY(QLegoControlLoop)
+
+    struct Input
+    {
+        QLegoAttachedDevice *attachment;
+        int mode;
+        QMetaObject::Connection connection;
+        // Odd while the device thread is writing the sample.
+        std::atomic<quint32> sequence;
+        QLegoSample sample;
+    };
+
+    void run();
+    void readInputs(QLegoControlContext &context);
+    void postCommands(QLegoControlContext &context);
+
+    int m_rate;
+    QThread *m_worker;
+    std::atomic<bool> m_stopping;
+    QVector<Input *> m_inputs;
+    QVector<Step> m_steps;
+
+    std::atomic<quint64> m_ticks;
+    std::atomic<quint64> m_overruns;
+    QLegoLatencyHistogram m_jitter;
+    QLegoLatencyHistogram m_stepTime;
+    // Replies may finish after the loop is gone.
+    QSharedPointer<QLegoLatencyHistogram> m_feedbackLatency;
+};
+
+QT_END_NAMESPACE
+
+#endif
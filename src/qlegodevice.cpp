@@ -1,18 +1,33 @@
 #include "qlegodevice.h"
+#include "qlegocommandreply.h"
 #include "qlegomotor.h"
+#include "qlegosynchronizedmotor.h"
+#include "qlegocolordistancesensor.h"
+#include "qlegotiltsensor.h"
 #include "qlegocommon.h"
+#include "qlegocapture.h"
+#include "qlegotransport.h"
+#include "qlegolatencyhistogram.h"
+#include "qlegoportinformation.h"
+#include "qlegowatchdog.h"
+#include "qlegorule.h"
 #include <QtCore/QCoreApplication>
 #include <QtCore/QEventLoop>
 #include <QtCore/QString>
 #include <QtCore/QMap>
 #include <QtCore/QList>
+#include <QtCore/QHash>
+#include <QtCore/QPointer>
+#include <QtCore/QQueue>
 #include <QtCore/QTimer>
 #include <QtCore/QtEndian>
 #include <QtCore/QLoggingCategory>
 #include <QtCore/QThread>
+#include <QtBluetooth/QBluetoothAddress>
 #include <QtBluetooth/QBluetoothDeviceInfo>
 #include <QtBluetooth/QLowEnergyService>
 #include <QtBluetooth/QLowEnergyController>
+#include <cstring>
 
 Q_LOGGING_CATEGORY(deviceLogger, "lego.device");
 
@@ -22,8 +37,23 @@ using DeviceType = QLegoDevice::DeviceType;
 static inline QLegoAttachedDevice *createAttachment(AttachedDeviceType deviceType, quint8 portId)
 {
     switch (deviceType) {
+        case AttachedDeviceType::SimpleMediumLinearMotor:
+        case AttachedDeviceType::TrainMotor:
+        case AttachedDeviceType::MediumLinearMotor:
         case AttachedDeviceType::MoveHubMediumLinearMotor:
+        case AttachedDeviceType::TechnicLargeLinearMotor:
+        case AttachedDeviceType::TechnicXLargeLinearMotor:
+        case AttachedDeviceType::SpikePrimeMediumAngularMotor:
+        case AttachedDeviceType::SpikePrimeLargeAngularMotor:
+        case AttachedDeviceType::TechnicMediumAngularMotor:
+        case AttachedDeviceType::TechnicLargeAngularMotor:
             return new QLegoMotor(deviceType, portId);
+        case AttachedDeviceType::ColorDistanceSensor:
+            return new QLegoColorDistanceSensor(deviceType, portId);
+        case AttachedDeviceType::TiltSensor:
+        case AttachedDeviceType::MoveHubTiltSensor:
+        case AttachedDeviceType::TechnicMediumHubTiltSensor:
+            return new QLegoTiltSensor(deviceType, portId);
         case AttachedDeviceType::Unknown:
         default:
             return new QLegoAttachedDevice(deviceType, portId);
@@ -40,6 +70,90 @@ static inline PortMap getPortMap(DeviceType deviceType)
     }
 }
 
+// Writes handed to the Bluetooth stack that have not been acknowledged yet. ATT allows a
+// single outstanding write request, so a deeper window would only move the queue into Qt.
+static const int MaxWritesInFlight = 1;
+static const int WriteTimeout = 1000;
+
+// Port and mode information requests in flight. A small window keeps discovery from
+// starving commands, which share the same write queue.
+static const int MaxDiscoveryRequests = 2;
+static const int DiscoveryTimeout = 1000;
+
+// Mode information types requested for every mode, after the value formats of all modes.
+static const quint8 ModeInformationTypes[] = { 0x00, 0x01, 0x02, 0x03, 0x04 };
+static const quint8 ValueFormatInformation = 0x80;
+
+static inline float decodeFloat(const char *data)
+{
+    const quint32 bits = qFromLittleEndian<quint32>(data);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline QString decodeName(const char *data, int size)
+{
+    return QString::fromLatin1(data, static_cast<int>(qstrnlen(data, size)));
+}
+
+// Requests still waiting for a response, per request type and port or property.
+static const int MaxTrackedRequests = 16;
+
+struct QLegoLatencyTracker
+{
+    QLegoLatencyTracker()
+    {
+        for (int i = 0; i < 256; i++) {
+            roundTrip[i].store(nullptr, std::memory_order_relaxed);
+            dispatch[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~QLegoLatencyTracker()
+    {
+        for (int i = 0; i < 256; i++) {
+            delete roundTrip[i].load(std::memory_order_relaxed);
+            delete dispatch[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    // Histograms are created on first use by the device thread and never freed
+    // before the device, so readers on other threads can keep the pointers.
+    static QLegoLatencyHistogram *histogram(std::atomic<QLegoLatencyHistogram *> &slot)
+    {
+        auto histogram = slot.load(std::memory_order_acquire);
+        if (!histogram) {
+            histogram = new QLegoLatencyHistogram;
+            slot.store(histogram, std::memory_order_release);
+        }
+        return histogram;
+    }
+
+    void sent(quint8 type, quint8 key, qint64 timestamp)
+    {
+        auto &queue = pending[(type << 8) | key];
+        if (queue.size() >= MaxTrackedRequests) {
+            queue.dequeue();
+        }
+        queue.enqueue(timestamp);
+    }
+
+    void received(quint8 type, quint8 key, qint64 timestamp)
+    {
+        auto it = pending.find((type << 8) | key);
+        if (it == pending.end() || it.value().isEmpty()) {
+            return;
+        }
+        const qint64 sentAt = it.value().dequeue();
+        histogram(roundTrip[type])->record(timestamp - sentAt);
+    }
+
+    std::atomic<QLegoLatencyHistogram *> roundTrip[256];
+    std::atomic<QLegoLatencyHistogram *> dispatch[256];
+    QHash<quint16, QQueue<qint64>> pending;
+};
+
 static inline QString getPortNameForPortId(PortMap portMap, int portId)
 {
     for (const auto key : portMap.keys()) {
@@ -64,6 +178,31 @@ static inline QString getPortNameForPortId(PortMap portMap, int portId)
   a central LEGO device that can receive commands.
   Currently only Powered UP Bluetooth Low Energy smart hubs are supported,
   but the interface should be expandable to EV3 and Spike Prime hubs.
+
+  \section1 Hub Property Reports
+
+  The hub only reports its button, signal strength and battery level while something is
+  connected to the button(), rssiChanged() or batteryLevel() signal. Reports are enabled when
+  the first slot is connected to a signal and disabled again when the last one is
+  disconnected, so hubs nobody listens to do not spend radio time on them. The rssi() and
+  battery() properties are only kept up to date while their reports are enabled.
+
+  Each report can be throttled with setReportInterval(), which emits at most one signal per
+  interval and delivers the latest value at the end of it, and with setReportHysteresis(),
+  which drops values that differ from the last emitted one by less than the hysteresis.
+
+  Connections to these signals should be made from the thread the device lives in.
+
+  \section1 Command Priorities
+
+  Commands wait in one of four lanes until the link can take them, and the lanes are emptied
+  strictly in the order of QLegoDevice::Priority. Commands that stop or brake a motor are
+  safety commands and go out before anything else; they also drop the motion commands still
+  queued for their port, whose replies are discarded. Other port output commands are motion
+  commands, except those for lights, which are cosmetic. Everything else configures the hub.
+  stopAll() brakes every motor of the hub through the safety lane. Commands sent by a
+  QLegoDispatchGroup enter the motion lane at its head, in place of the motion commands queued
+  for their ports.
 */
 
 /*!
@@ -90,6 +229,12 @@ static inline QString getPortNameForPortId(PortMap portMap, int portId)
     This signal is emitted when the battery level for this device has changed.
 */
 
+/*!
+    \fn void QLegoDevice::rssiChanged(int rssi)
+
+    This signal is emitted when the hub reports a new signal strength of \a rssi dBm.
+*/
+
 /*!
     \fn void QLegoDevice::deviceAttached(QLegoAttachedDevice *attachment);
 
@@ -102,6 +247,32 @@ static inline QString getPortNameForPortId(PortMap portMap, int portId)
     This signal is emitted when an attached device has been detached.
 */
 
+/*!
+    \enum QLegoDevice::HubProperty
+
+    The hub properties that are reported by signals.
+
+    \value ButtonProperty   The state of the hub button, reported by button().
+
+    \value RssiProperty     The signal strength, reported by rssiChanged().
+
+    \value BatteryProperty  The battery level, reported by batteryLevel().
+*/
+
+/*!
+    \enum QLegoDevice::Priority
+
+    The lanes outgoing commands are queued in, from the most to the least urgent.
+
+    \value SafetyPriority         Commands that stop or brake a motor.
+
+    \value MotionPriority         Other port output commands.
+
+    \value ConfigurationPriority  Property, port information and port format requests.
+
+    \value CosmeticPriority       Port output commands for lights.
+*/
+
 /*!
     \enum QLegoDevice::DeviceType
 
@@ -128,6 +299,9 @@ QLegoDevice::QLegoDevice(QObject *parent)
     , m_battery(100)
     , m_rssi(-60)
     , m_deviceType(DeviceType::UnknownDevice)
+    , m_ready(false)
+    , m_sessionActive(false)
+    , m_localAdapter()
     , m_controller(nullptr)
     , m_service(nullptr)
     , m_char()
@@ -135,11 +309,47 @@ QLegoDevice::QLegoDevice(QObject *parent)
     , m_portMap()
     , m_virtualPorts()
     , m_attachedDevices()
+    , m_latencyTracking(false)
+    , m_receiveTimestamp(0)
+    , m_latency()
+    , m_outgoing()
+    , m_writesInFlight(0)
+    , m_writeTimer(new QTimer(this))
+    , m_phaseTimestamp(0)
+    , m_statistics()
+    , m_discoveries()
+    , m_discoveryRequests()
+    , m_discoveryInFlight()
+    , m_discoveryTimer(new QTimer(this))
+    , m_propertyReports()
+    , m_capture(nullptr)
+    , m_transport(nullptr)
+    , m_watchdog(nullptr)
+    , m_rules()
+    , m_transmissions()
+    , m_captureAddress(0)
 {
+    // Recover if the stack never acknowledges a write.
+    m_writeTimer->setSingleShot(true);
+    m_writeTimer->setInterval(WriteTimeout);
+    connect(m_writeTimer, &QTimer::timeout, this, &QLegoDevice::messageWritten);
+
+    // Hubs do not answer information requests for some modes.
+    m_discoveryTimer->setSingleShot(true);
+    m_discoveryTimer->setInterval(DiscoveryTimeout);
+    connect(m_discoveryTimer, &QTimer::timeout, this, &QLegoDevice::discoveryTimeout);
+
+    for (const auto property : { ButtonProperty, RssiProperty, BatteryProperty }) {
+        m_propertyReports.insert(property, PropertyReports());
+    }
 }
 
 QLegoDevice::~QLegoDevice()
 {
+    // Whoever prepared a frame waits to hear what became of it.
+    while (!m_transmissions.isEmpty()) {
+        m_transmissions.takeFirst().transmitted(-1);
+    }
     if (m_controller != nullptr) {
         delete m_controller;
     }
@@ -184,6 +394,17 @@ QString QLegoDevice::address() const
     return m_address;
 }
 
+/*!
+    Returns the local Bluetooth adapter the device connects through, or a null address for the
+    default adapter.
+
+    \sa QLegoAdapterBalancer
+*/
+QBluetoothAddress QLegoDevice::localAdapter() const
+{
+    return m_localAdapter;
+}
+
 /*!
     \property QLegoDevice::battery
     \brief battery charge level.
@@ -195,13 +416,61 @@ int QLegoDevice::battery() const
 
 /*!
     \property QLegoDevice::rssi
-    \brief connection signal strength.
+    \brief connection signal strength, in dBm.
 */
 int QLegoDevice::rssi() const
 {
     return m_rssi;
 }
 
+/*!
+    Returns \c true if the hub has been asked to report \a property.
+*/
+bool QLegoDevice::reportsEnabled(HubProperty property) const
+{
+    return m_propertyReports.value(property).enabled;
+}
+
+/*!
+    Returns the minimum interval between two signals reporting \a property, in milliseconds.
+*/
+int QLegoDevice::reportInterval(HubProperty property) const
+{
+    return m_propertyReports.value(property).interval;
+}
+
+/*!
+    Sets the minimum interval between two signals reporting \a property to \a msecs. A value
+    reported within the interval is held back, and only the latest one is emitted when the
+    interval has passed. The default is 0, which emits every report.
+*/
+void QLegoDevice::setReportInterval(HubProperty property, int msecs)
+{
+    if (m_propertyReports.contains(property)) {
+        m_propertyReports[property].interval = qMax(msecs, 0);
+    }
+}
+
+/*!
+    Returns how much a reported \a property must change before it is emitted again.
+*/
+int QLegoDevice::reportHysteresis(HubProperty property) const
+{
+    return m_propertyReports.value(property).hysteresis;
+}
+
+/*!
+    Sets how much a reported \a property must differ from the last emitted value before it is
+    emitted again to \a delta, in dBm for the signal strength and in percent for the battery
+    level. The default is 0, which emits every change.
+*/
+void QLegoDevice::setReportHysteresis(HubProperty property, int delta)
+{
+    if (m_propertyReports.contains(property)) {
+        m_propertyReports[property].hysteresis = qMax(delta, 0);
+    }
+}
+
 /*!
     \property QLegoDevice::deviceType
     \brief type of device connected.
@@ -211,25 +480,261 @@ QLegoDevice::DeviceType QLegoDevice::deviceType() const
     return m_deviceType;
 }
 
+/*!
+    Returns \c true if the device has emitted ready() and has not been disconnected since.
+*/
+bool QLegoDevice::isReady() const
+{
+    return m_ready;
+}
+
+/*!
+    \property QLegoDevice::latencyTracking
+    \brief whether command and notification latencies are recorded.
+
+    When enabled, every request sent to the hub is timestamped with a monotonic clock and matched
+    with the response or command feedback it causes. The time each notification takes to be
+    dispatched, including the slots connected to the signals it causes, is recorded as well.
+    Tracking is disabled by default, in which case the clock is only read for messages whose
+    samples, rules or capture need a timestamp.
+
+    Disabling tracking keeps the histograms recorded so far.
+
+    \sa roundTripLatency(), dispatchLatency()
+*/
+bool QLegoDevice::latencyTracking() const
+{
+    return m_latencyTracking;
+}
+
+void QLegoDevice::setLatencyTracking(bool enabled)
+{
+    if (enabled && m_latency.isNull()) {
+        m_latency.reset(new QLegoLatencyTracker);
+    }
+    m_receiveTimestamp = monotonicNanoseconds();
+    m_latencyTracking = enabled;
+}
+
+/*!
+    Returns the number of commands waiting in the lane of \a priority.
+*/
+int QLegoDevice::queuedCommands(Priority priority) const
+{
+    return m_outgoing[priority].size();
+}
+
+/*!
+    Returns the traffic counters of this device. The counters may be read from any thread.
+*/
+const QLegoDeviceStatistics *QLegoDevice::statistics() const
+{
+    return &m_statistics;
+}
+
+/*!
+    Returns the capture recording the frames of this device, or \c nullptr if there is none.
+*/
+QLegoCapture *QLegoDevice::capture() const
+{
+    return m_capture;
+}
+
+/*!
+    Records every frame received from and sent to this device in \a capture. Pass \c nullptr
+    to stop recording. The capture is not owned by the device and must outlive it, or be
+    removed first.
+*/
+void QLegoDevice::setCapture(QLegoCapture *capture)
+{
+    m_capture = capture;
+}
+
+/*!
+    Returns the watchdog that stops the motors of this hub when the host stops sending motion
+    commands or heartbeats. The watchdog is created on first use and does nothing until it is
+    armed.
+
+    \sa QLegoWatchdog::arm()
+*/
+QLegoWatchdog *QLegoDevice::watchdog()
+{
+    if (!m_watchdog) {
+        m_watchdog = new QLegoWatchdog(this);
+    }
+    return m_watchdog;
+}
+
+/*!
+    Adds \a rule, whose source must be the button of this hub or a device attached to it.
+    The rule is evaluated in the thread of this hub, as soon as a value of its source is
+    decoded. The hub does not take ownership of the rule.
+
+    \sa QLegoRule
+*/
+void QLegoDevice::addRule(QLegoRule *rule)
+{
+    if (!rule || m_rules.contains(rule)) {
+        return;
+    }
+    const auto sensor = rule->m_sensor.data();
+    if (!rule->m_button && (!sensor || m_attachedDevices.value(sensor->portId()) != sensor)) {
+        qCWarning(deviceLogger) << "cannot add a rule whose source is not on this hub";
+        return;
+    }
+    if (rule->m_device) {
+        rule->m_device->removeRule(rule);
+    }
+
+    rule->m_device = this;
+    rule->m_armed = true;
+    m_rules.append(rule);
+    if (rule->m_button) {
+        if (m_propertyReports[ButtonProperty].listeners++ == 0) {
+            updatePropertyReports(ButtonProperty);
+        }
+    } else {
+        sensor->m_rules.append(rule);
+    }
+}
+
+/*!
+    Removes \a rule from this hub.
+*/
+void QLegoDevice::removeRule(QLegoRule *rule)
+{
+    if (!m_rules.removeOne(rule)) {
+        return;
+    }
+    rule->m_device = nullptr;
+    if (rule->m_button) {
+        if (m_propertyReports[ButtonProperty].listeners > 0
+            && --m_propertyReports[ButtonProperty].listeners == 0) {
+            updatePropertyReports(ButtonProperty);
+        }
+    } else if (rule->m_sensor) {
+        rule->m_sensor->m_rules.removeAll(rule);
+    }
+}
+
+/*!
+    Returns the rules added to this hub.
+*/
+QList<QLegoRule *> QLegoDevice::rules() const
+{
+    return m_rules;
+}
+
+/*!
+    Returns the histogram of round-trip latencies for requests of type \a messageType, measured
+    from \c send() to the matching response or command feedback.
+
+    Returns \nullptr if no latency has been recorded for that message type. The histogram is
+    owned by the device and may be read from any thread.
+
+    \sa latencyTracking
+*/
+const QLegoLatencyHistogram *QLegoDevice::roundTripLatency(quint8 messageType) const
+{
+    if (m_latency.isNull()) {
+        return nullptr;
+    }
+    return m_latency->roundTrip[messageType].load(std::memory_order_acquire);
+}
+
+/*!
+    Returns the histogram of the time notifications of type \a messageType spend between being
+    delivered by the Bluetooth stack and being fully dispatched, when the slots connected to the
+    signals they cause have returned.
+
+    Returns \nullptr if no latency has been recorded for that message type. The histogram is
+    owned by the device and may be read from any thread.
+
+    \sa latencyTracking
+*/
+const QLegoLatencyHistogram *QLegoDevice::dispatchLatency(quint8 messageType) const
+{
+    if (m_latency.isNull()) {
+        return nullptr;
+    }
+    return m_latency->dispatch[messageType].load(std::memory_order_acquire);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
-QLegoDevice *QLegoDevice::createDevice(const QBluetoothDeviceInfo &deviceInfo)
+/*!
+    Creates a device for the hub described by \a deviceInfo. The connection is made through the
+    local Bluetooth adapter with the address \a localAdapter, or through the default adapter if
+    it is null. Call connectToDevice() to connect.
+*/
+QLegoDevice *QLegoDevice::createDevice(const QBluetoothDeviceInfo &deviceInfo,
+                                       const QBluetoothAddress &localAdapter)
 {
     QLegoDevice *device = new QLegoDevice();
     device->m_deviceInfo = deviceInfo;
-    device->m_address = getAddress(deviceInfo);
+    device->m_localAdapter = localAdapter;
+    device->setAddress(getAddress(deviceInfo));
+    return device;
+}
+
+/*!
+    Creates a device that talks to its hub through \a transport instead of Bluetooth Low
+    Energy. The device takes ownership of \a transport. Call connectToDevice() to open it.
+*/
+QLegoDevice *QLegoDevice::createDevice(QLegoTransport *transport)
+{
+    QLegoDevice *device = new QLegoDevice();
+    device->m_transport = transport;
+    device->setAddress(transport->address());
+    transport->setParent(device);
+
+    // clang-format off
+    connect(transport, &QLegoTransport::opened, device, &QLegoDevice::transportOpened);
+    connect(transport, &QLegoTransport::received, device, &QLegoDevice::transportReceived);
+    connect(transport, &QLegoTransport::written, device, &QLegoDevice::messageWritten);
+    connect(transport, &QLegoTransport::closed, device, &QLegoDevice::deviceDisconnected);
+    // clang-format on
     return device;
 }
 
+void QLegoDevice::setAddress(const QString &address)
+{
+    m_address = address;
+    m_statistics.setAddress(address);
+    // Not a MAC address on platforms that only provide UUIDs; those are captured as zero.
+    m_captureAddress = QBluetoothAddress(address).toUInt64();
+}
+
 void QLegoDevice::connectToDevice()
 {
+    if (m_transport) {
+        if (m_transport->isOpen()) {
+            m_statistics.m_reconnects.fetch_add(1, std::memory_order_relaxed);
+            m_transport->close();
+        }
+        m_phaseTimestamp = monotonicNanoseconds();
+        m_transport->open();
+        return;
+    }
+
     if (!m_deviceInfo.isValid()) {
         qCWarning(deviceLogger) << "Not a valid device";
         emit disconnected();
         return;
     }
 
-    m_controller = QLowEnergyController::createCentral(m_deviceInfo);
+    if (m_controller != nullptr) {
+        m_statistics.m_reconnects.fetch_add(1, std::memory_order_relaxed);
+        m_controller->deleteLater();
+        m_controller = nullptr;
+    }
+    m_phaseTimestamp = monotonicNanoseconds();
+
+    if (m_localAdapter.isNull()) {
+        m_controller = QLowEnergyController::createCentral(m_deviceInfo);
+    } else {
+        m_controller = QLowEnergyController::createCentral(m_deviceInfo, m_localAdapter);
+    }
 
     // clang-format off
     connect(m_controller, &QLowEnergyController::connected, this, &QLegoDevice::deviceConnected);
@@ -251,12 +756,27 @@ void QLegoDevice::errorReceived(QLowEnergyController::Error error)
 
 void QLegoDevice::deviceConnected()
 {
+    finishConnectionPhase(QLegoDeviceStatistics::ConnectPhase);
     auto controller = qobject_cast<QLowEnergyController *>(sender());
     controller->discoverServices();
 }
 
 void QLegoDevice::deviceDisconnected()
 {
+    for (const auto attachment : m_attachedDevices) {
+        attachment->abortCommands();
+    }
+    dropPendingMessages();
+    abortDiscovery();
+    if (!m_messageBuffer.isEmpty()) {
+        m_statistics.m_truncatedFrames.fetch_add(1, std::memory_order_relaxed);
+        m_messageBuffer.clear();
+    }
+    m_ready = false;
+    m_sessionActive = false;
+    for (auto &reports : m_propertyReports) {
+        reports.enabled = false;
+    }
     emit disconnected();
 }
 
@@ -342,6 +862,21 @@ void QLegoDevice::disconnect()
     send(bytes);
 }
 
+/*!
+    Brakes every motor attached to the hub. The commands jump ahead of all queued commands, and
+    the motion commands still queued for the motors are dropped.
+
+    \sa QLegoDeviceScanner::stopAll()
+*/
+void QLegoDevice::stopAll()
+{
+    for (const auto attachment : m_attachedDevices) {
+        if (auto motor = qobject_cast<QLegoMotor *>(attachment)) {
+            motor->brake();
+        }
+    }
+}
+
 void QLegoDevice::requestHubPropertyValue(quint8 value)
 {
     QByteArray bytes;
@@ -362,60 +897,507 @@ void QLegoDevice::requestHubPropertyReports(quint8 value)
     send(bytes);
 }
 
-void QLegoDevice::send(const QByteArray &bytes)
+void QLegoDevice::disableHubPropertyReports(quint8 value)
 {
-    QByteArray message;
-    const quint8 size = bytes.size() + 2;
-    message.resize(size);
-    message[0] = size;
-    message[1] = 0x00;
-    for (int i = 0; i < bytes.size(); i++) {
-        message[i + 2] = bytes[i];
+    QByteArray bytes;
+    bytes.resize(3);
+    bytes[0] = 0x01;
+    bytes[1] = value;
+    bytes[2] = 0x03;
+    send(bytes);
+}
+
+static int reportedProperty(const QMetaMethod &signal)
+{
+    if (signal == QMetaMethod::fromSignal(&QLegoDevice::button)) {
+        return QLegoDevice::ButtonProperty;
+    } else if (signal == QMetaMethod::fromSignal(&QLegoDevice::rssiChanged)) {
+        return QLegoDevice::RssiProperty;
+    } else if (signal == QMetaMethod::fromSignal(&QLegoDevice::batteryLevel)) {
+        return QLegoDevice::BatteryProperty;
     }
-    // qCDebug(deviceLogger) << "send:" << message.toHex();
-    m_service->writeCharacteristic(m_char, message);
+    return 0;
 }
 
-void QLegoDevice::readDeviceCharacteristics(QLowEnergyService *service)
+void QLegoDevice::connectNotify(const QMetaMethod &signal)
 {
-    const QList<QLowEnergyCharacteristic> chars = service->characteristics();
+    const auto property = static_cast<HubProperty>(reportedProperty(signal));
+    if (property && m_propertyReports[property].listeners++ == 0) {
+        updatePropertyReports(property);
+    }
+}
 
-    for (const QLowEnergyCharacteristic &ch : chars) {
-        if (getUuid(ch.uuid()) == LPF2_CHARACTERISTIC) {
-            m_char = ch;
+void QLegoDevice::disconnectNotify(const QMetaMethod &signal)
+{
+    if (!signal.isValid()) {
+        // Everything was disconnected at once; find out what is left.
+        const QMetaMethod methods[] = {
+            QMetaMethod::fromSignal(&QLegoDevice::button),
+            QMetaMethod::fromSignal(&QLegoDevice::rssiChanged),
+            QMetaMethod::fromSignal(&QLegoDevice::batteryLevel),
+        };
+        for (const auto &method : methods) {
+            const auto property = static_cast<HubProperty>(reportedProperty(method));
+            if (!isSignalConnected(method)) {
+                m_propertyReports[property].listeners = 0;
+                updatePropertyReports(property);
+            }
         }
+        return;
     }
 
-    if (!m_char.isValid()) {
-        emit disconnected();
+    const auto property = static_cast<HubProperty>(reportedProperty(signal));
+    if (property && m_propertyReports[property].listeners > 0
+        && --m_propertyReports[property].listeners == 0) {
+        updatePropertyReports(property);
+    }
+}
+
+void QLegoDevice::updatePropertyReports(HubProperty property)
+{
+    auto &reports = m_propertyReports[property];
+    const bool enable = reports.listeners > 0;
+    if (!m_sessionActive || reports.enabled == enable) {
         return;
     }
+    reports.enabled = enable;
+    if (enable) {
+        requestHubPropertyReports(property);
+    } else {
+        disableHubPropertyReports(property);
+    }
+}
 
-    auto notificationDesc = m_char.descriptor(QBluetoothUuid::ClientCharacteristicConfiguration);
-    if (notificationDesc.isValid()) {
-        service->writeDescriptor(notificationDesc, QByteArray::fromHex("0100"));
+void QLegoDevice::reportProperty(HubProperty property, int value)
+{
+    auto &reports = m_propertyReports[property];
+    reports.latest = value;
+    if (reports.emitted && qAbs(value - reports.value) < qMax(reports.hysteresis, 1)) {
+        return;
     }
 
-    connect(service, &QLowEnergyService::characteristicChanged, this, &QLegoDevice::parseMessage);
+    const qint64 now = monotonicNanoseconds() / 1000000;
+    const qint64 wait = reports.emitted ? reports.emittedAt + reports.interval - now : 0;
+    if (wait > 0) {
+        if (!reports.pending) {
+            reports.pending = true;
+            QTimer::singleShot(static_cast<int>(wait), this, [this, property]() {
+                auto &reports = m_propertyReports[property];
+                reports.pending = false;
+                reportProperty(property, reports.latest);
+            });
+        }
+        return;
+    }
+
+    reports.emitted = true;
+    reports.value = value;
+    reports.emittedAt = now;
+    switch (property) {
+        case ButtonProperty:
+            emit button(static_cast<ButtonState>(value));
+            break;
+        case RssiProperty:
+            emit rssiChanged(value);
+            break;
+        case BatteryProperty:
+            emit batteryLevel(static_cast<quint8>(value));
+            break;
+    }
+}
+
+void QLegoDevice::send(const QByteArray &bytes)
+{
+    const bool open = m_transport ? m_transport->isOpen() : m_service && m_char.isValid();
+    if (!open) {
+        m_statistics.m_commandsDropped.fetch_add(1, std::memory_order_relaxed);
+        // The reply of a port output command would otherwise wait for feedback forever.
+        const auto attachment = m_attachedDevices.value(static_cast<quint8>(bytes[1]));
+        if (bytes[0] == static_cast<char>(0x81) && attachment) {
+            attachment->discardLastCommand();
+        }
+        return;
+    }
+
+    const QByteArray message = encodeMessage(bytes);
+    const Priority priority = priorityOf(bytes);
+    auto &lane = m_outgoing[priority];
+
+    // A request identical to the last one queued adds nothing. An older copy cannot stand in
+    // for it, as requests queued in between, such as disabling reports, may undo it. Port
+    // output commands are never merged, as each one is tracked by its own command feedback.
+    if (bytes[0] != static_cast<char>(0x81) && !lane.isEmpty() && lane.last() == message) {
+        m_statistics.m_commandsCoalesced.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Stop commands, and the commands of a control loop, replace the motion queued for the port.
+    const auto attachment = m_attachedDevices.value(static_cast<quint8>(bytes[1]));
+    if (priority == SafetyPriority
+        || (priority == MotionPriority && attachment && attachment->m_superseding)) {
+        purgeMotionCommands(bytes[1]);
+    }
+    // A stop on a virtual port stops both of its motors, which their own motion would restart.
+    const auto synchronized = qobject_cast<QLegoSynchronizedMotor *>(attachment);
+    if (priority == SafetyPriority && synchronized) {
+        for (const int portId : { synchronized->firstPortId(), synchronized->secondPortId() }) {
+            if (const auto member = m_attachedDevices.value(portId)) {
+                member->clearPendingCommands();
+            }
+            purgeMotionCommands(static_cast<quint8>(portId), false);
+        }
+    }
+
+    if (m_latencyTracking) {
+        trackRequest(bytes);
+    }
+    if (m_watchdog && priority <= MotionPriority) {
+        m_watchdog->commandSent();
+    }
+
+    lane.enqueue(message);
+    writePendingMessages();
+}
+
+// Prepends the common header to a message.
+QByteArray QLegoDevice::encodeMessage(const QByteArray &bytes)
+{
+    QByteArray message;
+    const quint8 size = bytes.size() + 2;
+    message.resize(size);
+    message[0] = size;
+    message[1] = 0x00;
+    for (int i = 0; i < bytes.size(); i++) {
+        message[i + 2] = bytes[i];
+    }
+    return message;
+}
+
+// Writes a port output message prepared by QLegoDispatchGroup ahead of all queued motion
+// commands, but behind the prepared ones, and reports the time it was handed to the link, or
+// -1 if it never was.
+void QLegoDevice::transmit(const QByteArray &message, const TransmitCallback &transmitted)
+{
+    const bool open = m_transport ? m_transport->isOpen() : m_service && m_char.isValid();
+    if (!open) {
+        m_statistics.m_commandsDropped.fetch_add(1, std::memory_order_relaxed);
+        transmitted(-1);
+        return;
+    }
+
+    const auto bytes = QByteArray::fromRawData(message.constData() + 2, message.size() - 2);
+    // Motion commands still queued for the port would undo this one.
+    purgeMotionCommands(bytes[1]);
+
+    if (m_latencyTracking) {
+        trackRequest(bytes);
+    }
+    if (m_watchdog) {
+        m_watchdog->commandSent();
+    }
+
+    // Every pending transmission is still queued, at the head of the lane.
+    m_outgoing[MotionPriority].insert(m_transmissions.size(), message);
+    m_transmissions.append({ message, transmitted });
+    writePendingMessages();
+}
+
+// Transmits a port output message for attachment and tracks its command feedback, like a
+// command the attachment wrote itself. The attachment learns about the command once it is handed
+// to the link, and the reply is discarded if it never is.
+QLegoCommandReply *QLegoDevice::transmitCommand(QLegoAttachedDevice *attachment,
+                                                const QByteArray &message,
+                                                const TransmitCallback &transmitted)
+{
+    const auto reply = attachment->trackCommand();
+    const QPointer<QLegoAttachedDevice> target = attachment;
+    const QPointer<QLegoCommandReply> tracked = reply;
+    transmit(message, [target, tracked, message, transmitted](qint64 timestamp) {
+        if (target && timestamp >= 0) {
+            target->processTransmittedCommand(message.mid(2));
+        } else if (target && tracked) {
+            target->discardCommand(tracked);
+        }
+        transmitted(timestamp);
+    });
+    return reply;
+}
+
+// Messages are matched by their data, which the queued copy shares with the transmission.
+// Returns false if message is not a transmission.
+bool QLegoDevice::finishTransmission(const QByteArray &message, qint64 timestamp)
+{
+    for (int i = 0; i < m_transmissions.size(); i++) {
+        if (m_transmissions[i].message.constData() == message.constData()) {
+            const auto transmitted = m_transmissions.takeAt(i).transmitted;
+            transmitted(timestamp);
+            return true;
+        }
+    }
+    return false;
+}
+
+QLegoDevice::Priority QLegoDevice::priorityOf(const QByteArray &bytes) const
+{
+    if (bytes[0] != static_cast<char>(0x81)) {
+        return ConfigurationPriority;
+    }
+    const auto attachment = m_attachedDevices.value(static_cast<quint8>(bytes[1]));
+    if (attachment
+        && (attachment->type() == QLegoAttachedDevice::HubLed
+            || attachment->type() == QLegoAttachedDevice::Light)) {
+        return CosmeticPriority;
+    }
+    return isStopCommand(bytes) ? SafetyPriority : MotionPriority;
+}
+
+// Unless keepLast is set, the command that purges the port was not written by its attachment.
+void QLegoDevice::purgeMotionCommands(quint8 portId, bool keepLast)
+{
+    auto &lane = m_outgoing[MotionPriority];
+    QList<QByteArray> purged;
+    for (auto it = lane.begin(); it != lane.end();) {
+        // Frames carry a three byte header before the port output command.
+        if (static_cast<quint8>(it->at(3)) == portId) {
+            purged.append(*it);
+            it = lane.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (purged.isEmpty()) {
+        return;
+    }
+    m_statistics.m_commandsPurged.fetch_add(purged.size(), std::memory_order_relaxed);
+
+    // Transmissions discard their own replies, the attachment the replies of the others.
+    int commands = 0;
+    for (const auto &message : purged) {
+        if (m_transmissions.isEmpty() || !finishTransmission(message, -1)) {
+            commands++;
+        }
+    }
+    if (commands > 0 && m_attachedDevices.contains(portId)) {
+        m_attachedDevices[portId]->discardQueuedCommands(commands, keepLast);
+    }
+}
+
+void QLegoDevice::writePendingMessages()
+{
+    const int maxWrites = m_transport ? m_transport->maxWritesInFlight() : MaxWritesInFlight;
+    while (m_writesInFlight < maxWrites) {
+        int priority = SafetyPriority;
+        while (priority < PriorityCount && m_outgoing[priority].isEmpty()) {
+            priority++;
+        }
+        if (priority == PriorityCount) {
+            break;
+        }
+        const QByteArray message = m_outgoing[priority].dequeue();
+        // qCDebug(deviceLogger) << "send:" << message.toHex();
+        m_writesInFlight++;
+        m_statistics.m_commandsSent.fetch_add(1, std::memory_order_relaxed);
+        m_statistics.m_bytesSent.fetch_add(message.size(), std::memory_order_relaxed);
+        m_writeTimer->start();
+        const bool timed = m_capture || !m_transmissions.isEmpty();
+        const qint64 timestamp = timed ? monotonicNanoseconds() : 0;
+        if (m_capture) {
+            m_capture->write(QLegoCapture::Outgoing, m_captureAddress, timestamp,
+                             message.constData(), message.size());
+        }
+        if (m_transport) {
+            m_transport->write(message);
+        } else {
+            m_service->writeCharacteristic(m_char, message);
+        }
+        if (!m_transmissions.isEmpty()) {
+            finishTransmission(message, timestamp);
+        }
+    }
+    updateQueueDepth();
+}
+
+void QLegoDevice::messageWritten()
+{
+    m_writesInFlight = qMax(0, m_writesInFlight - 1);
+    if (m_writesInFlight == 0) {
+        m_writeTimer->stop();
+    }
+    writePendingMessages();
+}
+
+void QLegoDevice::dropPendingMessages()
+{
+    for (auto &lane : m_outgoing) {
+        m_statistics.m_commandsDropped.fetch_add(lane.size(), std::memory_order_relaxed);
+        lane.clear();
+    }
+    while (!m_transmissions.isEmpty()) {
+        m_transmissions.takeFirst().transmitted(-1);
+    }
+    m_writesInFlight = 0;
+    m_writeTimer->stop();
+    updateQueueDepth();
+}
+
+void QLegoDevice::updateQueueDepth()
+{
+    quint64 depth = m_writesInFlight;
+    for (const auto &lane : m_outgoing) {
+        depth += lane.size();
+    }
+    m_statistics.m_queueDepth.store(depth, std::memory_order_relaxed);
+}
+
+void QLegoDevice::finishConnectionPhase(QLegoDeviceStatistics::ConnectionPhase phase)
+{
+    const qint64 now = monotonicNanoseconds();
+    m_statistics.m_phaseDurations[phase].store(now - m_phaseTimestamp, std::memory_order_relaxed);
+    m_phaseTimestamp = now;
+}
+
+void QLegoDevice::trackRequest(const QByteArray &bytes)
+{
+    const auto msg = bytes.constData();
+    const qint64 now = monotonicNanoseconds();
+    const quint8 type = msg[0];
+    switch (type) {
+        case 0x01:
+            // Only property updates requested with 0x05 receive a response.
+            if (bytes.size() > 2 && msg[2] == 0x05) {
+                m_latency->sent(type, msg[1], now);
+            }
+            break;
+        case 0x21:
+            // Port value requests are answered with 0x45, which cannot be told apart from
+            // subscribed values.
+            if (bytes.size() > 2 && msg[2] != 0x00) {
+                m_latency->sent(type, msg[1], now);
+            }
+            break;
+        case 0x22:
+        case 0x41:
+            m_latency->sent(type, msg[1], now);
+            break;
+        case 0x81:
+            // Only commands that request command feedback.
+            if (bytes.size() > 2 && (msg[2] & 0x01)) {
+                m_latency->sent(type, msg[1], now);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void QLegoDevice::trackResponse(const QByteArray &message)
+{
+    const auto msg = message.constData();
+    const qint64 received = m_receiveTimestamp;
+    const quint8 type = msg[2];
+    switch (type) {
+        case 0x01:
+            if (message.size() > 4 && msg[4] == 0x06) {
+                m_latency->received(0x01, msg[3], received);
+            }
+            break;
+        case 0x43:
+            m_latency->received(0x21, msg[3], received);
+            break;
+        case 0x44:
+            m_latency->received(0x22, msg[3], received);
+            break;
+        case 0x47:
+            m_latency->received(0x41, msg[3], received);
+            break;
+        case 0x82:
+            for (int i = 3; i + 1 < message.size(); i += 2) {
+                m_latency->received(0x81, msg[i], received);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// The time the chunk being parsed arrived. Unless latency tracking needs it for every chunk, the
+// clock is read when the first sample, rule or capture of the chunk asks for it.
+qint64 QLegoDevice::receiveTimestamp()
+{
+    if (m_receiveTimestamp == 0) {
+        m_receiveTimestamp = monotonicNanoseconds();
+    }
+    return m_receiveTimestamp;
+}
+
+void QLegoDevice::readDeviceCharacteristics(QLowEnergyService *service)
+{
+    const QList<QLowEnergyCharacteristic> chars = service->characteristics();
+
+    for (const QLowEnergyCharacteristic &ch : chars) {
+        if (getUuid(ch.uuid()) == LPF2_CHARACTERISTIC) {
+            m_char = ch;
+        }
+    }
+
+    if (!m_char.isValid()) {
+        emit disconnected();
+        return;
+    }
+
+    finishConnectionPhase(QLegoDeviceStatistics::DiscoveryPhase);
+
+    auto notificationDesc = m_char.descriptor(QBluetoothUuid::ClientCharacteristicConfiguration);
+    if (notificationDesc.isValid()) {
+        service->writeDescriptor(notificationDesc, QByteArray::fromHex("0100"));
+    }
+
+    connect(service, &QLowEnergyService::characteristicChanged, this, &QLegoDevice::parseMessage);
+    connect(service, &QLowEnergyService::characteristicWritten, this, &QLegoDevice::messageWritten);
 
     // this._bleDevice.discoverCharacteristicsForService(BLEService.LPF2_HUB);
     // this._bleDevice.subscribeToCharacteristic(BLECharacteristic.LPF2_ALL, _parseMessage);
 
-    // Button reports
-    requestHubPropertyReports(0x02);
+    startSession();
+}
+
+void QLegoDevice::transportOpened()
+{
+    // Transports have no services to discover.
+    finishConnectionPhase(QLegoDeviceStatistics::ConnectPhase);
+    finishConnectionPhase(QLegoDeviceStatistics::DiscoveryPhase);
+    startSession();
+}
+
+void QLegoDevice::transportReceived(const QByteArray &data)
+{
+    parseMessage(QLowEnergyCharacteristic(), data);
+}
+
+void QLegoDevice::startSession()
+{
+    m_sessionActive = true;
+    for (auto &reports : m_propertyReports) {
+        reports.enabled = false;
+    }
+
+    // Button reports, if anyone listens
+    updatePropertyReports(ButtonProperty);
     // Firmware
     requestHubPropertyValue(0x03);
     // Hardware
     requestHubPropertyValue(0x04);
-    // RSSI
-    requestHubPropertyReports(0x05);
-    // Battery level
-    requestHubPropertyReports(0x06);
+    // RSSI reports
+    updatePropertyReports(RssiProperty);
+    // Battery level reports
+    updatePropertyReports(BatteryProperty);
     // MAC Address
     requestHubPropertyValue(0x0D);
 
     QTimer::singleShot(400, this, [this]() {
         // Wait 400 milliseconds to allow time to receive responses.
+        finishConnectionPhase(QLegoDeviceStatistics::SetupPhase);
+        m_ready = true;
         emit ready();
     });
 }
@@ -425,6 +1407,8 @@ void QLegoDevice::parseMessage(const QLowEnergyCharacteristic &ch, const QByteAr
     Q_UNUSED(ch)
     if (!data.isEmpty()) {
         m_messageBuffer += data;
+        m_statistics.m_bytesReceived.fetch_add(data.size(), std::memory_order_relaxed);
+        m_receiveTimestamp = m_latencyTracking ? monotonicNanoseconds() : 0;
     }
 
     if (m_messageBuffer.length() <= 0) {
@@ -432,15 +1416,35 @@ void QLegoDevice::parseMessage(const QLowEnergyCharacteristic &ch, const QByteAr
     }
 
     const quint8 len = m_messageBuffer[0];
+    if (len < 3) {
+        // A frame must hold at least its length, hub ID and message type.
+        qCWarning(deviceLogger) << "invalid message:" << m_messageBuffer.toHex();
+        m_statistics.m_parseFailures.fetch_add(1, std::memory_order_relaxed);
+        m_messageBuffer.clear();
+        return;
+    }
+
     if (len <= m_messageBuffer.length()) {
         const QByteArray message = m_messageBuffer.mid(0, len);
         m_messageBuffer = m_messageBuffer.mid(len);
 
         // qCDebug(deviceLogger) << "received message:" << message.toHex();
+        if (m_capture) {
+            m_capture->write(QLegoCapture::Incoming, m_captureAddress, receiveTimestamp(),
+                             message.constData(), message.size());
+        }
 
         const auto msg = message.constData();
 
         const quint8 cmd = msg[2];
+        // Slots connected to the signals emitted below may parse further messages.
+        const bool tracking = m_latencyTracking;
+        const qint64 received = m_receiveTimestamp;
+        if (tracking) {
+            trackResponse(message);
+        }
+        m_statistics.m_framesReceived.fetch_add(1, std::memory_order_relaxed);
+        m_statistics.m_framesByType[cmd].fetch_add(1, std::memory_order_relaxed);
         switch (cmd) {
             case 0x01:
                 parseHubPropertyResponse(message);
@@ -448,6 +1452,9 @@ void QLegoDevice::parseMessage(const QLowEnergyCharacteristic &ch, const QByteAr
             case 0x04:
                 parsePortMessage(message);
                 break;
+            case 0x05:
+                parseErrorMessage(message);
+                break;
             case 0x43:
                 parsePortInformationResponse(message);
                 break;
@@ -457,6 +1464,15 @@ void QLegoDevice::parseMessage(const QLowEnergyCharacteristic &ch, const QByteAr
             case 0x45:
                 parseSensorMessage(message);
                 break;
+            case 0x46:
+                parseCombinedSensorMessage(message);
+                break;
+            case 0x47:
+                parseInputFormatResponse(message);
+                break;
+            case 0x48:
+                parseCombinedInputFormatResponse(message);
+                break;
             case 0x82:
                 parsePortAction(message);
                 break;
@@ -464,6 +1480,11 @@ void QLegoDevice::parseMessage(const QLowEnergyCharacteristic &ch, const QByteAr
                 break;
         }
 
+        if (tracking) {
+            const auto histogram = QLegoLatencyTracker::histogram(m_latency->dispatch[cmd]);
+            histogram->record(monotonicNanoseconds() - received);
+        }
+
         if (m_messageBuffer.size() > 0) {
             parseMessage(ch, QByteArray());
         }
@@ -477,11 +1498,20 @@ void QLegoDevice::parseHubPropertyResponse(const QByteArray &message)
     // qCDebug(deviceLogger) << "parseHubPropertyResponse" << report << message.toHex();
     if (report == 0x02) {
         // Button press reports
+        if (msg[5] == 0 || msg[5] == 1) {
+            const auto state = msg[5] == 1 ? ButtonState::Pressed : ButtonState::Released;
+            const auto rules = m_rules;
+            for (const auto rule : rules) {
+                if (rule->m_button) {
+                    rule->evaluate(state, receiveTimestamp());
+                }
+            }
+        }
         if (msg[5] == 1) {
-            emit button(ButtonState::Pressed);
+            reportProperty(ButtonProperty, ButtonState::Pressed);
             return;
         } else if (msg[5] == 0) {
-            emit button(ButtonState::Released);
+            reportProperty(ButtonProperty, ButtonState::Released);
             return;
         }
     } else if (report == 0x03) {
@@ -492,28 +1522,22 @@ void QLegoDevice::parseHubPropertyResponse(const QByteArray &message)
         // Hardware version
         m_hardware = decodeVersion(message.mid(5, 4).toHex());
     } else if (report == 0x05) {
-        // RSSI update
-        int rssi = 0;
-        bool ok;
-        const auto signal = message.mid(5, 2).toHex().toShort(&ok, 16);
-        if (ok) {
-            rssi = qToBigEndian<qint8>(signal);
-        }
-        if (rssi) {
-            m_rssi = rssi;
-            // emit rssiStrength();
+        // RSSI update, a signed byte in dBm
+        if (message.size() < 6) {
+            m_statistics.m_parseFailures.fetch_add(1, std::memory_order_relaxed);
+            return;
         }
+        m_rssi = static_cast<qint8>(msg[5]);
+        reportProperty(RssiProperty, m_rssi);
     } else if (report == 0x0D) {
         // Primary MAC Address
-        m_address = message.mid(5).toHex(':');
+        setAddress(message.mid(5).toHex(':'));
     } else if (report == 0x06) {
         // Battery level reports
         const quint8 battery = msg[5];
-        if (battery != m_battery) {
-            // qCDebug(deviceLogger) << "battery:" << battery;
-            m_battery = battery;
-            emit batteryLevel(battery);
-        }
+        // qCDebug(deviceLogger) << "battery:" << battery;
+        m_battery = battery;
+        reportProperty(BatteryProperty, battery);
     }
 }
 
@@ -558,20 +1582,36 @@ void QLegoDevice::parsePortMessage(const QByteArray &message)
             // Device attachment
             const auto attachment = createAttachment(deviceType, portId);
             if (attachment != nullptr) {
+                // Device type, hardware and software revision.
+                attachment->m_portInformationKey = message.mid(5, 10);
                 attachDevice(portId, attachment);
             }
             break;
         }
         case 0x02: {
             // Virtual port creation
-            const auto firstPortName = getPortNameForPortId(m_portMap, message[7]);
-            const auto secondPortName = getPortNameForPortId(m_portMap, message[8]);
-            const auto virtualPortName = firstPortName + secondPortName;
+            if (message.size() < 9) {
+                m_statistics.m_parseFailures.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            const quint8 firstPortId = message[7];
+            const quint8 secondPortId = message[8];
+            const auto firstPortName = getPortNameForPortId(m_portMap, firstPortId);
+            const auto secondPortName = getPortNameForPortId(m_portMap, secondPortId);
             const quint8 virtualPortId = message[3];
-            m_portMap[virtualPortName] = virtualPortId;
+            if (!firstPortName.isEmpty() && !secondPortName.isEmpty()) {
+                m_portMap[firstPortName + secondPortName] = virtualPortId;
+            }
             m_virtualPorts.append(virtualPortId);
-            const auto attachment = createAttachment(deviceType, virtualPortId);
+            QLegoAttachedDevice *attachment = nullptr;
+            if (qobject_cast<QLegoMotor *>(m_attachedDevices.value(firstPortId))) {
+                attachment = new QLegoSynchronizedMotor(deviceType, virtualPortId, firstPortId,
+                                                        secondPortId);
+            } else {
+                attachment = createAttachment(deviceType, virtualPortId);
+            }
             if (attachment != nullptr) {
+                attachment->m_portInformationKey = message.mid(5, 2);
                 attachDevice(virtualPortId, attachment);
             }
             break;
@@ -581,41 +1621,83 @@ void QLegoDevice::parsePortMessage(const QByteArray &message)
     }
 }
 
-void QLegoDevice::sendPortInformationRequest(quint8 port)
+void QLegoDevice::discoverPort(quint8 port)
 {
-    QByteArray batch1;
-    QByteArray batch2;
-    batch1.resize(3);
-    batch2.resize(3);
-    batch1[0] = 0x21;
-    batch1[1] = port;
-    batch1[2] = 0x01;
-    batch2[0] = 0x21;
-    batch2[1] = port;
-    batch2[2] = 0x02;
-    send(batch1);
-    send(batch2); // Mode combinations
+    const auto attachment = m_attachedDevices.value(port);
+    if (!attachment || m_discoveries.contains(port)) {
+        return;
+    }
+
+    QLegoPortInformation information;
+    if (QLegoPortInformationTable::find(attachment->m_portInformationKey, &information)) {
+        attachment->processPortInformation(information);
+        return;
+    }
+
+    qCDebug(deviceLogger) << "discovering port:" << port;
+    m_discoveries[port].key = attachment->m_portInformationKey;
+    sendPortInformationRequest(port, 0x01);
+}
+
+void QLegoDevice::sendPortInformationRequest(quint8 port, quint8 type)
+{
+    QByteArray bytes;
+    bytes.resize(3);
+    bytes[0] = 0x21;
+    bytes[1] = port;
+    bytes[2] = type;
+    queueDiscoveryRequest(port, bytes);
 }
 
 void QLegoDevice::parsePortInformationResponse(const QByteArray &message)
 {
     const auto msg = message.constData();
-    const quint8 port = msg[3];
-    if (msg[4] == 2) {
+    if (message.size() < 5) {
+        m_statistics.m_parseFailures.fetch_add(1, std::memory_order_relaxed);
         return;
     }
-    const quint8 count = msg[6];
+    const quint8 port = msg[3];
+    const quint8 type = msg[4];
     qCDebug(deviceLogger) << "parsePortInformationResponse:" << message.toHex();
-    /*
-    for (let i = 0; i < count; i++) {
-        await this._sendModeInformationRequest(port, i, 0x00); // Mode Name
-        await this._sendModeInformationRequest(port, i, 0x01); // RAW Range
-        await this._sendModeInformationRequest(port, i, 0x02); // PCT Range
-        await this._sendModeInformationRequest(port, i, 0x03); // SI Range
-        await this._sendModeInformationRequest(port, i, 0x04); // SI Symbol
-        await this._sendModeInformationRequest(port, i, 0x80); // Value Format
+
+    const char request[] = { 0x21, static_cast<char>(port), static_cast<char>(type) };
+    const int index = m_discoveryInFlight.indexOf(QByteArray(request, sizeof(request)));
+    if (index < 0) {
+        return;
     }
-    */
+
+    auto &information = m_discoveries[port].information;
+    if (type == 0x01 && message.size() >= 11) {
+        const quint8 count = msg[6];
+        information.capabilities = msg[5];
+        information.inputModes = qFromLittleEndian<quint16>(msg + 7);
+        information.outputModes = qFromLittleEndian<quint16>(msg + 9);
+        information.modes.resize(count);
+
+        // Value formats first, as they are needed to decode values.
+        for (quint8 mode = 0; mode < count; mode++) {
+            sendModeInformationRequest(port, mode, ValueFormatInformation);
+        }
+        if (information.capabilities & QLegoPortInformation::LogicalCombinable) {
+            sendPortInformationRequest(port, 0x02);
+        }
+        for (quint8 mode = 0; mode < count; mode++) {
+            for (const quint8 item : ModeInformationTypes) {
+                sendModeInformationRequest(port, mode, item);
+            }
+        }
+    } else if (type == 0x02) {
+        // A list of mode masks, terminated by an empty one.
+        for (int i = 5; i + 1 < message.size(); i += 2) {
+            const quint16 combination = qFromLittleEndian<quint16>(msg + i);
+            if (!combination) {
+                break;
+            }
+            information.combinations.append(combination);
+        }
+    }
+
+    finishDiscoveryRequest(index);
 }
 
 void QLegoDevice::sendModeInformationRequest(quint8 port, quint8 mode, quint8 type)
@@ -626,44 +1708,252 @@ void QLegoDevice::sendModeInformationRequest(quint8 port, quint8 mode, quint8 ty
     bytes[1] = port;
     bytes[2] = mode;
     bytes[3] = type;
-    send(bytes);
+    queueDiscoveryRequest(port, bytes);
 }
 
 void QLegoDevice::parseModeInformationResponse(const QByteArray &message)
 {
-    Q_UNUSED(message)
-    // Doesn't set any values.
+    const auto msg = message.constData();
+    if (message.size() < 6) {
+        m_statistics.m_parseFailures.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    const quint8 port = msg[3];
+    const quint8 mode = msg[4];
+    const quint8 type = msg[5];
+
+    const char request[] = { 0x22, static_cast<char>(port), static_cast<char>(mode),
+                             static_cast<char>(type) };
+    const int index = m_discoveryInFlight.indexOf(QByteArray(request, sizeof(request)));
+    if (index < 0) {
+        return;
+    }
+
+    auto &modes = m_discoveries[port].information.modes;
+    if (mode < modes.size()) {
+        auto &information = modes[mode];
+        const auto data = msg + 6;
+        const int size = message.size() - 6;
+        switch (type) {
+            case 0x00:
+                information.name = decodeName(data, size);
+                information.received |= QLegoModeInformation::NameItem;
+                break;
+            case 0x01:
+                if (size >= 8) {
+                    information.rawMinimum = decodeFloat(data);
+                    information.rawMaximum = decodeFloat(data + 4);
+                    information.received |= QLegoModeInformation::RawRangeItem;
+                }
+                break;
+            case 0x02:
+                if (size >= 8) {
+                    information.percentMinimum = decodeFloat(data);
+                    information.percentMaximum = decodeFloat(data + 4);
+                    information.received |= QLegoModeInformation::PercentRangeItem;
+                }
+                break;
+            case 0x03:
+                if (size >= 8) {
+                    information.siMinimum = decodeFloat(data);
+                    information.siMaximum = decodeFloat(data + 4);
+                    information.received |= QLegoModeInformation::SiRangeItem;
+                }
+                break;
+            case 0x04:
+                information.symbol = decodeName(data, size);
+                information.received |= QLegoModeInformation::SymbolItem;
+                break;
+            case 0x80:
+                if (size >= 4 && static_cast<quint8>(data[1]) <= QLegoValueFormat::Float) {
+                    information.format.datasets = data[0];
+                    information.format.type = static_cast<QLegoValueFormat::DataType>(data[1]);
+                    information.figures = data[2];
+                    information.decimals = data[3];
+                    information.received |= QLegoModeInformation::ValueFormatItem;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    finishDiscoveryRequest(index);
 }
 
-void QLegoDevice::parsePortAction(const QByteArray &message)
+void QLegoDevice::parseErrorMessage(const QByteArray &message)
 {
     const auto msg = message.constData();
-    const quint8 portId = msg[3];
-    qCDebug(deviceLogger) << "parsePortAction:" << portId;
-    /*
-    const device = this._getDeviceByPortId(portId);
+    if (message.size() < 5) {
+        m_statistics.m_parseFailures.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    const quint8 command = msg[3];
+    const quint8 error = msg[4];
+    qCDebug(deviceLogger) << "error:" << toHex(command) << error;
+
+    // Errors do not name the port, but requests of one type are answered in order.
+    if (command == 0x21 || command == 0x22) {
+        for (int i = 0; i < m_discoveryInFlight.size(); i++) {
+            if (static_cast<quint8>(m_discoveryInFlight[i][0]) == command) {
+                finishDiscoveryRequest(i, false);
+                return;
+            }
+        }
+    }
+}
+
+void QLegoDevice::queueDiscoveryRequest(quint8 port, const QByteArray &request)
+{
+    m_discoveries[port].outstanding++;
+    m_discoveryRequests.enqueue(request);
+    sendDiscoveryRequests();
+}
+
+void QLegoDevice::sendDiscoveryRequests()
+{
+    while (m_discoveryInFlight.size() < MaxDiscoveryRequests && !m_discoveryRequests.isEmpty()) {
+        const QByteArray request = m_discoveryRequests.dequeue();
+        m_discoveryInFlight.append(request);
+        send(request);
+    }
+    if (m_discoveryInFlight.isEmpty()) {
+        m_discoveryTimer->stop();
+    } else {
+        m_discoveryTimer->start();
+    }
+}
+
+void QLegoDevice::finishDiscoveryRequest(int index, bool answered)
+{
+    const quint8 port = m_discoveryInFlight.takeAt(index)[1];
+    auto it = m_discoveries.find(port);
+    if (it == m_discoveries.end()) {
+        sendDiscoveryRequests();
+        return;
+    }
 
-    if (device) {
-        const finished = (message[4] == 0x0a);
-        if (finished) {
-            device.finish();
+    const auto attachment = m_attachedDevices.value(port);
+    it->failed |= !answered;
+    const bool finished = --it->outstanding == 0;
+    // Only what every request answered is shared with other hubs, which never ask again.
+    if (finished && !it->failed) {
+        it->information.complete = true;
+        if (it->information.isValid()) {
+            QLegoPortInformationTable::insert(it->key, it->information);
+        }
+        qCDebug(deviceLogger) << "discovered port:" << port << it->information.modes.size();
+    } else if (finished) {
+        qCWarning(deviceLogger) << "incomplete information for port:" << port;
+    }
+
+    if (attachment) {
+        // Pass on partial results, so values can be decoded as soon as their format is known.
+        attachment->processPortInformation(it->information);
+        if (finished && it->failed) {
+            attachment->m_portInformationRequested = false;
+        }
+    }
+    if (finished) {
+        m_discoveries.erase(it);
+    }
+
+    sendDiscoveryRequests();
+}
+
+void QLegoDevice::discoveryTimeout()
+{
+    qCWarning(deviceLogger) << "information requests timed out:" << m_discoveryInFlight.size();
+    // Requests sent while finishing these get a full timeout of their own.
+    for (int timedOut = m_discoveryInFlight.size(); timedOut > 0; timedOut--) {
+        finishDiscoveryRequest(0, false);
+    }
+}
+
+void QLegoDevice::abortDiscovery()
+{
+    for (auto it = m_discoveries.cbegin(); it != m_discoveries.cend(); ++it) {
+        if (m_attachedDevices.contains(it.key())) {
+            m_attachedDevices[it.key()]->m_portInformationRequested = false;
+        }
+    }
+    m_discoveries.clear();
+    m_discoveryRequests.clear();
+    m_discoveryInFlight.clear();
+    m_discoveryTimer->stop();
+}
+
+void QLegoDevice::parsePortAction(const QByteArray &message)
+{
+    const auto msg = message.constData();
+    // A single feedback message may report on several ports.
+    for (int i = 3; i + 1 < message.size(); i += 2) {
+        const quint8 portId = msg[i];
+        const quint8 feedback = msg[i + 1];
+        qCDebug(deviceLogger) << "parsePortAction:" << portId << feedback;
+        if (m_attachedDevices.contains(portId)) {
+            m_attachedDevices[portId]->processFeedback(feedback);
         }
     }
-    */
 }
 
 void QLegoDevice::parseSensorMessage(const QByteArray &message)
 {
     const auto msg = message.constData();
-    const quint8 portId = message[3];
-    qCDebug(deviceLogger) << "parseSensorMessage:" << portId;
-    /*
-    const device = this._getDeviceByPortId(portId);
+    const quint8 portId = msg[3];
+    if (message.size() < 5) {
+        m_statistics.m_parseFailures.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (m_attachedDevices.contains(portId)) {
+        m_attachedDevices[portId]->processValue(msg + 4, message.size() - 4, receiveTimestamp());
+    }
+}
 
-    if (device) {
-        device.receive(message);
+void QLegoDevice::parseCombinedSensorMessage(const QByteArray &message)
+{
+    const auto msg = message.constData();
+    if (message.size() < 6) {
+        m_statistics.m_parseFailures.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    const quint8 portId = msg[3];
+    if (m_attachedDevices.contains(portId)) {
+        const auto attachment = m_attachedDevices[portId];
+        attachment->processCombinedValue(msg + 4, message.size() - 4, receiveTimestamp());
+    }
+}
+
+void QLegoDevice::parseCombinedInputFormatResponse(const QByteArray &message)
+{
+    const auto msg = message.constData();
+    if (message.size() < 7) {
+        m_statistics.m_parseFailures.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    const quint8 portId = msg[3];
+    const quint8 control = msg[4];
+    const quint16 pointer = qFromLittleEndian<quint16>(msg + 5);
+    if (m_attachedDevices.contains(portId)) {
+        m_attachedDevices[portId]->processCombinedFormat(pointer, control & 0x80);
+    }
+}
+
+void QLegoDevice::parseInputFormatResponse(const QByteArray &message)
+{
+    const auto msg = message.constData();
+    if (message.size() < 10) {
+        m_statistics.m_parseFailures.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    const quint8 portId = msg[3];
+    const quint8 mode = msg[4];
+    const quint32 deltaInterval = qFromLittleEndian<quint32>(msg + 5);
+    const bool notify = msg[9] != 0;
+    qCDebug(deviceLogger) << "parseInputFormatResponse:" << portId << mode << notify;
+    if (m_attachedDevices.contains(portId)) {
+        m_attachedDevices[portId]->processInputFormat(mode, deltaInterval, notify);
     }
-    */
 }
 
 void QLegoDevice::attachDevice(int portId, QLegoAttachedDevice *device)
@@ -679,9 +1969,26 @@ void QLegoDevice::attachDevice(int portId, QLegoAttachedDevice *device)
     });
     */
     connect(device, &QLegoAttachedDevice::command, this, &QLegoDevice::send);
+    connect(device, &QLegoAttachedDevice::portInformationRequested, this, [this, portId]() {
+        discoverPort(portId);
+    });
+
+    // Devices seen on another hub are known without asking.
+    QLegoPortInformation information;
+    if (QLegoPortInformationTable::find(device->m_portInformationKey, &information)) {
+        device->processPortInformation(information);
+    }
     emit deviceAttached(device);
 }
 
+/*!
+    Returns the devices currently attached to the hub, ordered by port.
+*/
+QList<QLegoAttachedDevice *> QLegoDevice::attachedDevices() const
+{
+    return m_attachedDevices.values();
+}
+
 QLegoAttachedDevice *QLegoDevice::waitForDeviceByName(const QString &name)
 {
     QLegoAttachedDevice *attachment = nullptr;
@@ -753,6 +2060,84 @@ QLegoMotor *QLegoDevice::waitForAttachedMotor(const QString &port)
     return qobject_cast<QLegoMotor *>(device);
 }
 
+/*!
+    Asks the hub to join the ports of \a first and \a second into a virtual port. The hub
+    reports the virtual port as a QLegoSynchronizedMotor through deviceAttached().
+
+    Both motors must be of the same type and attached to this device.
+
+    \sa synchronizeMotors(), destroyVirtualPort()
+*/
+void QLegoDevice::createVirtualPort(QLegoMotor *first, QLegoMotor *second)
+{
+    QByteArray bytes;
+    bytes.resize(4);
+    bytes[0] = 0x61;
+    bytes[1] = 0x01;
+    bytes[2] = first->portId();
+    bytes[3] = second->portId();
+    send(bytes);
+}
+
+/*!
+    Asks the hub to remove the virtual port of \a motor. The hub reports it through
+    deviceDetached().
+*/
+void QLegoDevice::destroyVirtualPort(QLegoSynchronizedMotor *motor)
+{
+    QByteArray bytes;
+    bytes.resize(3);
+    bytes[0] = 0x61;
+    bytes[1] = 0x00;
+    bytes[2] = motor->portId();
+    send(bytes);
+}
+
+/*!
+    Joins \a first and \a second into a virtual port and returns the motor that drives both,
+    or \nullptr if the hub did not create the port within five seconds. An existing virtual
+    port for the two motors is returned without asking the hub again.
+
+    This function is synchronous but non-blocking, like waitForAttachedMotor().
+
+    \sa createVirtualPort()
+*/
+QLegoSynchronizedMotor *QLegoDevice::synchronizeMotors(QLegoMotor *first, QLegoMotor *second)
+{
+    const auto find = [this, first, second]() -> QLegoSynchronizedMotor * {
+        for (const auto portId : m_virtualPorts) {
+            auto motor = qobject_cast<QLegoSynchronizedMotor *>(m_attachedDevices.value(portId));
+            if (motor && motor->firstPortId() == first->portId()
+                && motor->secondPortId() == second->portId()) {
+                return motor;
+            }
+        }
+        return nullptr;
+    };
+
+    auto motor = find();
+    if (motor) {
+        return motor;
+    }
+
+    bool waiting = true;
+    QTimer timer;
+    timer.setSingleShot(true);
+    connect(&timer, &QTimer::timeout, this, [&waiting]() { waiting = false; });
+    const auto connection = connect(this, &QLegoDevice::deviceAttached, this,
+                                    [&waiting, &motor, &find](QLegoAttachedDevice *) {
+                                        motor = find();
+                                        waiting = !motor;
+                                    });
+    createVirtualPort(first, second);
+    timer.start(5000);
+    while (waiting) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents | QEventLoop::WaitForMoreEvents);
+    }
+    QObject::disconnect(connection);
+    return motor;
+}
+
 /*!
     Waits for \a usecs micro-seconds before returning.
 
@@ -3,20 +3,37 @@
 
 #include "qlegoglobal.h"
 #include "qlegoattacheddevice.h"
+#include "qlegostatistics.h"
 #include <QtCore/QObject>
+#include <QtCore/QHash>
 #include <QtCore/QList>
 #include <QtCore/QMap>
+#include <QtCore/QQueue>
+#include <QtCore/QScopedPointer>
+#include <QtBluetooth/QBluetoothAddress>
 #include <QtBluetooth/QLowEnergyController>
 #include <QtBluetooth/QLowEnergyService>
 #include <QtBluetooth/QLowEnergyDescriptor>
 
+#include <functional>
+
 QT_FORWARD_DECLARE_CLASS(QString)
 QT_FORWARD_DECLARE_CLASS(QBluetoothDeviceInfo)
 QT_FORWARD_DECLARE_CLASS(QLowEnergyCharacteristic)
+QT_FORWARD_DECLARE_CLASS(QLegoCommandReply)
 QT_FORWARD_DECLARE_CLASS(QLegoMotor)
+QT_FORWARD_DECLARE_CLASS(QLegoSynchronizedMotor)
+QT_FORWARD_DECLARE_CLASS(QLegoLatencyHistogram)
+QT_FORWARD_DECLARE_CLASS(QLegoCapture)
+QT_FORWARD_DECLARE_CLASS(QLegoTransport)
+QT_FORWARD_DECLARE_CLASS(QLegoWatchdog)
+QT_FORWARD_DECLARE_CLASS(QLegoRule)
+QT_FORWARD_DECLARE_CLASS(QTimer)
 
 QT_BEGIN_NAMESPACE
 
+struct QLegoLatencyTracker;
+
 class Q_LEGO_EXPORT QLegoDevice : public QObject
 {
     Q_OBJECT
@@ -26,13 +43,16 @@ class Q_LEGO_EXPORT QLegoDevice : public QObject
     Q_PROPERTY(QString hardware READ hardware)
     Q_PROPERTY(QString address READ address)
     Q_PROPERTY(int battery READ battery)
-    Q_PROPERTY(int rssi READ rssi)
+    Q_PROPERTY(int rssi READ rssi NOTIFY rssiChanged)
+    Q_PROPERTY(bool latencyTracking READ latencyTracking WRITE setLatencyTracking)
 
 public:
     explicit QLegoDevice(QObject *parent = nullptr);
     ~QLegoDevice();
 
-    static QLegoDevice *createDevice(const QBluetoothDeviceInfo &deviceInfo);
+    static QLegoDevice *createDevice(const QBluetoothDeviceInfo &deviceInfo,
+                                     const QBluetoothAddress &localAdapter = QBluetoothAddress());
+    static QLegoDevice *createDevice(QLegoTransport *transport);
 
     enum DeviceType
     {
@@ -52,28 +72,75 @@ public:
     };
     Q_ENUM(ButtonState)
 
+    enum HubProperty
+    {
+        ButtonProperty = 0x02,
+        RssiProperty = 0x05,
+        BatteryProperty = 0x06
+    };
+    Q_ENUM(HubProperty)
+
+    enum Priority
+    {
+        SafetyPriority,
+        MotionPriority,
+        ConfigurationPriority,
+        CosmeticPriority
+    };
+    Q_ENUM(Priority)
+
     QString name() const;
     QString firmware() const;
     QString hardware() const;
     QString address() const;
+    QBluetoothAddress localAdapter() const;
     int battery() const;
     int rssi() const;
     DeviceType deviceType() const;
+    bool isReady() const;
+    bool latencyTracking() const;
+
+    const QLegoLatencyHistogram *roundTripLatency(quint8 messageType) const;
+    const QLegoLatencyHistogram *dispatchLatency(quint8 messageType) const;
+    const QLegoDeviceStatistics *statistics() const;
+    int queuedCommands(Priority priority) const;
+
+    bool reportsEnabled(HubProperty property) const;
+    int reportInterval(HubProperty property) const;
+    void setReportInterval(HubProperty property, int msecs);
+    int reportHysteresis(HubProperty property) const;
+    void setReportHysteresis(HubProperty property, int delta);
+
+    QLegoCapture *capture() const;
+    void setCapture(QLegoCapture *capture);
+
+    QLegoWatchdog *watchdog();
+
+    void addRule(QLegoRule *rule);
+    void removeRule(QLegoRule *rule);
+    QList<QLegoRule *> rules() const;
 
     Q_INVOKABLE QLegoMotor *waitForAttachedMotor(const QString &port);
+    Q_INVOKABLE QLegoSynchronizedMotor *synchronizeMotors(QLegoMotor *first, QLegoMotor *second);
+    Q_INVOKABLE void createVirtualPort(QLegoMotor *first, QLegoMotor *second);
+    Q_INVOKABLE void destroyVirtualPort(QLegoSynchronizedMotor *motor);
     // Q_INVOKABLE QLegoMotor *waitForAttachedMotor(const DeviceType deviceType);
     // Q_INVOKABLE QLegoSensor *waitForAttachedSensor(const QString &name);
     // Q_INVOKABLE QLegoSensor *waitForAttachedSensor(const DeviceType deviceType);
 
     QLegoAttachedDevice *waitForDeviceByName(const QString &name);
+    QList<QLegoAttachedDevice *> attachedDevices() const;
     // Q_INVOKABLE QLegoAttachedDevice* waitForDeviceByType(const DeviceType deviceType);
 
 public Q_SLOTS:
     void connectToDevice();
     void disconnect();
+    void stopAll();
 
     void wait(const int usecs);
 
+    void setLatencyTracking(bool enabled);
+
 private Q_SLOTS:
     void addLowEnergyService(const QBluetoothUuid &uuid);
     void deviceConnected();
@@ -83,12 +150,17 @@ private Q_SLOTS:
     void serviceDetailsDiscovered(QLowEnergyService::ServiceState newState);
     void parseMessage(const QLowEnergyCharacteristic &c, const QByteArray &value);
     void send(const QByteArray &bytes);
+    void messageWritten();
+    void discoveryTimeout();
+    void transportOpened();
+    void transportReceived(const QByteArray &data);
 
 Q_SIGNALS:
     void disconnected();
     void ready();
     void button(const ButtonState state);
     void batteryLevel(quint8 level);
+    void rssiChanged(int rssi);
     void deviceAttached(QLegoAttachedDevice *attachment);
     void deviceDetached(QLegoAttachedDevice *attachment);
 
@@ -97,20 +169,86 @@ private Q_SLOTS:
     void waitTimeout();
 #endif
 
+protected:
+    void connectNotify(const QMetaMethod &signal) override;
+    void disconnectNotify(const QMetaMethod &signal) override;
+
 private:
     void connectToService(QLowEnergyService *service);
     void readDeviceCharacteristics(QLowEnergyService *service);
+    void startSession();
     void requestHubPropertyValue(quint8 value);
     void requestHubPropertyReports(quint8 value);
+    void disableHubPropertyReports(quint8 value);
+    void updatePropertyReports(HubProperty property);
+    void reportProperty(HubProperty property, int value);
     void parseHubPropertyResponse(const QByteArray &message);
     void parsePortMessage(const QByteArray &message);
     void parsePortInformationResponse(const QByteArray &message);
     void parseModeInformationResponse(const QByteArray &message);
     void parseSensorMessage(const QByteArray &message);
+    void parseInputFormatResponse(const QByteArray &message);
+    void parseCombinedSensorMessage(const QByteArray &message);
+    void parseCombinedInputFormatResponse(const QByteArray &message);
     void parsePortAction(const QByteArray &message);
-    void sendPortInformationRequest(quint8 port);
+    void parseErrorMessage(const QByteArray &message);
+    void discoverPort(quint8 port);
+    void sendPortInformationRequest(quint8 port, quint8 type);
     void sendModeInformationRequest(quint8 port, quint8 mode, quint8 type);
+    void queueDiscoveryRequest(quint8 port, const QByteArray &request);
+    void sendDiscoveryRequests();
+    void finishDiscoveryRequest(int index, bool answered = true);
+    void abortDiscovery();
     void attachDevice(int portId, QLegoAttachedDevice *device);
+    Priority priorityOf(const QByteArray &bytes) const;
+    void purgeMotionCommands(quint8 portId, bool keepLast = true);
+    void writePendingMessages();
+    void dropPendingMessages();
+    void updateQueueDepth();
+    void finishConnectionPhase(QLegoDeviceStatistics::ConnectionPhase phase);
+    void trackRequest(const QByteArray &bytes);
+    void trackResponse(const QByteArray &message);
+    qint64 receiveTimestamp();
+    void setAddress(const QString &address);
+
+    friend class QLegoDispatchGroup;
+    friend class QLegoMotionProgram;
+    friend class QLegoMotionScheduler;
+    friend class QLegoRule;
+    typedef std::function<void(qint64)> TransmitCallback;
+
+    static QByteArray encodeMessage(const QByteArray &bytes);
+    void transmit(const QByteArray &message, const TransmitCallback &transmitted);
+    QLegoCommandReply *transmitCommand(QLegoAttachedDevice *attachment, const QByteArray &message,
+                                       const TransmitCallback &transmitted);
+    bool finishTransmission(const QByteArray &message, qint64 timestamp);
+
+    struct PortDiscovery
+    {
+        QByteArray key;
+        QLegoPortInformation information;
+        int outstanding = 0;
+        bool failed = false;
+    };
+
+    struct PropertyReports
+    {
+        int listeners = 0;
+        int interval = 0;
+        int hysteresis = 0;
+        bool enabled = false;
+        bool emitted = false;
+        bool pending = false;
+        int value = 0;
+        int latest = 0;
+        qint64 emittedAt = 0;
+    };
+
+    struct Transmission
+    {
+        QByteArray message;
+        TransmitCallback transmitted;
+    };
 
     QString m_name;
     QString m_firmware;
@@ -119,7 +257,10 @@ private:
     quint8 m_battery;
     int m_rssi;
     DeviceType m_deviceType;
+    bool m_ready;
+    bool m_sessionActive;
     QBluetoothDeviceInfo m_deviceInfo;
+    QBluetoothAddress m_localAdapter;
     QLowEnergyController *m_controller;
     QLowEnergyService *m_service;
     QLowEnergyCharacteristic m_char;
@@ -127,6 +268,26 @@ private:
     QMap<QString, int> m_portMap;
     QList<int> m_virtualPorts;
     QMap<int, QLegoAttachedDevice *> m_attachedDevices;
+    bool m_latencyTracking;
+    qint64 m_receiveTimestamp;
+    QScopedPointer<QLegoLatencyTracker> m_latency;
+    static const int PriorityCount = CosmeticPriority + 1;
+    QQueue<QByteArray> m_outgoing[PriorityCount];
+    int m_writesInFlight;
+    QTimer *m_writeTimer;
+    qint64 m_phaseTimestamp;
+    QLegoDeviceStatistics m_statistics;
+    QHash<quint8, PortDiscovery> m_discoveries;
+    QQueue<QByteArray> m_discoveryRequests;
+    QList<QByteArray> m_discoveryInFlight;
+    QTimer *m_discoveryTimer;
+    QMap<HubProperty, PropertyReports> m_propertyReports;
+    QLegoCapture *m_capture;
+    QLegoTransport *m_transport;
+    QLegoWatchdog *m_watchdog;
+    QList<QLegoRule *> m_rules;
+    QList<Transmission> m_transmissions;
+    quint64 m_captureAddress;
 };
 
 QT_END_NAMESPACE
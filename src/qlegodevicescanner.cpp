@@ -3,6 +3,7 @@
 #include <QtCore/QLoggingCategory>
 #include <QtCore/QMetaEnum>
 #include <QtCore/QString>
+#include <QtCore/QTimer>
 #include <QtBluetooth/QBluetoothDeviceInfo>
 #include <QtBluetooth/QBluetoothDeviceDiscoveryAgent>
 
@@ -11,6 +12,9 @@ Q_LOGGING_CATEGORY(scannerLogger, "lego.scanner");
 // TODO: Need to verify full names before can use.
 static QStringList deviceNames({ "LEGO Move Hub", "Technic" });
 
+// How long other adapters may report a hub before it is placed.
+static const int PlacementDelay = 500;
+
 /*!
   \class QLegoDeviceScanner
   \brief The QLegoDeviceScanner class scans for QLegoDevices.
@@ -23,6 +27,14 @@ static QStringList deviceNames({ "LEGO Move Hub", "Technic" });
   QLegoDeviceScanner currently only scans using Bluetooth LE, but future versions
   may support scanning by Bluetooth Classic or serial ports.
 
+  \section1 Multiple Adapters
+
+  A Bluetooth adapter can only hold a limited number of connections. The scanner scans on
+  every local adapter at once, and connects each hub through the adapter chosen by its
+  \l{QLegoDeviceScanner::adapterBalancer()}{adapter balancer}, based on how well each adapter
+  hears the hub and how many connections it already holds. A hub heard while every adapter is
+  full is not connected, and is counted by QLegoScannerStatistics::placementsRejected().
+
   \section1 Scanning and Connecting
 
   When a new device has been detected, the \l{QLegoDeviceScanner::deviceFound()} signal will
@@ -68,22 +80,45 @@ static QStringList deviceNames({ "LEGO Move Hub", "Technic" });
 */
 QLegoDeviceScanner::QLegoDeviceScanner(QObject *parent)
     : QObject(parent)
-    , m_agent(new QBluetoothDeviceDiscoveryAgent)
     , m_scanning(false)
     , m_deviceCount(0)
+    , m_agents()
+    , m_balancer()
+    , m_pending()
+    , m_addresses()
+    , m_devices()
+    , m_statistics()
 {
-    m_agent->setLowEnergyDiscoveryTimeout(5000);
+    QList<QBluetoothAddress> adapters;
+    for (const auto &info : m_balancer.adapters()) {
+        adapters.append(info.address());
+    }
+    if (adapters.isEmpty()) {
+        // The platform does not list its adapters; use the default one.
+        adapters.append(QBluetoothAddress());
+    }
+
+    for (const auto &adapter : adapters) {
+        auto agent = adapter.isNull() ? new QBluetoothDeviceDiscoveryAgent
+                                      : new QBluetoothDeviceDiscoveryAgent(adapter);
+        agent->setLowEnergyDiscoveryTimeout(5000);
+
+        // clang-format off
+        connect(agent, &QBluetoothDeviceDiscoveryAgent::deviceDiscovered, this, [this, adapter](const QBluetoothDeviceInfo &info) {
+            addDevice(adapter, info);
+        });
+        connect(agent, QOverload<QBluetoothDeviceDiscoveryAgent::Error>::of(&QBluetoothDeviceDiscoveryAgent::error), this, &QLegoDeviceScanner::deviceScanError);
+        connect(agent, &QBluetoothDeviceDiscoveryAgent::finished, this, &QLegoDeviceScanner::deviceScanFinished);
+        // clang-format on
+        m_agents.append(agent);
+    }
 
-    // clang-format off
-    connect(m_agent, &QBluetoothDeviceDiscoveryAgent::deviceDiscovered, this, &QLegoDeviceScanner::addDevice);
-    connect(m_agent, QOverload<QBluetoothDeviceDiscoveryAgent::Error>::of(&QBluetoothDeviceDiscoveryAgent::error), this, &QLegoDeviceScanner::deviceScanError);
-    connect(m_agent, &QBluetoothDeviceDiscoveryAgent::finished, this, &QLegoDeviceScanner::deviceScanFinished);
-    // clang-format on
+    m_statistics.m_adapters = m_balancer.statistics();
 }
 
 QLegoDeviceScanner::~QLegoDeviceScanner()
 {
-    delete m_agent;
+    qDeleteAll(m_agents);
 }
 
 /*!
@@ -101,54 +136,52 @@ bool QLegoDeviceScanner::scanning() const
 void QLegoDeviceScanner::scan()
 {
     m_scanning = true;
-    m_agent->start(QBluetoothDeviceDiscoveryAgent::LowEnergyMethod);
+    m_statistics.m_scansStarted.fetch_add(1, std::memory_order_relaxed);
+    for (const auto agent : m_agents) {
+        agent->start(QBluetoothDeviceDiscoveryAgent::LowEnergyMethod);
+    }
 }
 
-void QLegoDeviceScanner::addDevice(const QBluetoothDeviceInfo &info)
+/*!
+    Brakes every motor of every device the scanner has connected to. On each hub the brake
+    commands are sent before any other queued command, so they reach every hub within about
+    one write round trip of its link, however congested it is.
+
+    \sa QLegoDevice::stopAll()
+*/
+void QLegoDeviceScanner::stopAll()
 {
+    for (const auto device : m_devices) {
+        device->stopAll();
+    }
+}
+
+void QLegoDeviceScanner::addDevice(const QBluetoothAddress &adapter,
+                                   const QBluetoothDeviceInfo &info)
+{
+    m_statistics.m_advertisementsSeen.fetch_add(1, std::memory_order_relaxed);
+
     /*
      * **TODO**: NEED TO FIX THE NAMES!!!
      */
     if (info.name().contains("Move Hub", Qt::CaseInsensitive) || info.name().contains("Technic")) {
-        qCDebug(scannerLogger) << "found" << info.name();
-
-#if 0
         const auto address = getAddress(info);
-        if (m_addresses.contains(address)) {
-            qDebug() << "Device" << address << "already added";
-            // return;
+        if (info.rssi() != 0) {
+            m_balancer.reportRssi(adapter, address, info.rssi());
         }
-#endif
-
-        QLegoDevice *device = QLegoDevice::createDevice(info);
-
-        QObject::connect(device, &QLegoDevice::disconnected, [this, device]() {
-            m_deviceCount = m_deviceCount > 0 ? m_deviceCount - 1 : 0;
-#if 0
-            const auto addr = device->address();
-            m_addresses.removeAll(addr);
-            if (m_addresses.isEmpty()) {
-                qDebug() << "No more devices";
-                emit done();
-            }
-#endif
-            device->deleteLater();
-        });
-
-#if 0
-        m_addresses.append(address);
-
-        device->connectToDevice();
-#endif
-
-        QObject::connect(device, &QLegoDevice::ready, [this, device]() {
-            // TODO: Maybe disconnect() ?
-            emit deviceFound(device);
-        });
-
-        m_deviceCount++;
+        if (m_addresses.contains(address) || m_pending.contains(address)) {
+            // Already connected, or heard by another adapter.
+            return;
+        }
+        qCDebug(scannerLogger) << "found" << info.name();
 
-        device->connectToDevice();
+        m_pending.insert(address, info);
+        if (m_agents.size() > 1) {
+            // Give the other adapters a chance to report how well they hear the hub.
+            QTimer::singleShot(PlacementDelay, this, [this, address]() { placeDevice(address); });
+        } else {
+            placeDevice(address);
+        }
 
 #if 0
         // Deactivate. KEEP! Will use when finished with service scan.
@@ -170,21 +203,72 @@ void QLegoDeviceScanner::addDevice(const QBluetoothDeviceInfo &info)
     }
 }
 
+void QLegoDeviceScanner::placeDevice(const QString &address)
+{
+    if (!m_pending.contains(address)) {
+        return;
+    }
+    const QBluetoothDeviceInfo info = m_pending.take(address);
+
+    QBluetoothAddress adapter;
+    if (!m_balancer.place(address, &adapter)) {
+        m_statistics.m_placementsRejected.fetch_add(1, std::memory_order_relaxed);
+        emit errorMessage("No Bluetooth adapter can take another connection for " + address);
+        return;
+    }
+
+    QLegoDevice *device = QLegoDevice::createDevice(info, adapter);
+    m_statistics.m_devicesFound.fetch_add(1, std::memory_order_relaxed);
+    m_statistics.addDevice(device->statistics());
+    m_addresses.insert(address, false);
+    m_devices.append(device);
+
+    QObject::connect(device, &QLegoDevice::disconnected, [this, device, address]() {
+        // The device may report its disconnection more than once before it is deleted.
+        if (!m_statistics.removeDevice(device->statistics())) {
+            return;
+        }
+        m_deviceCount = m_deviceCount > 0 ? m_deviceCount - 1 : 0;
+        m_statistics.m_devicesLost.fetch_add(1, std::memory_order_relaxed);
+        // A device that never became ready failed to connect through its adapter.
+        m_balancer.release(address, !m_addresses.take(address));
+        m_devices.removeAll(device);
+        device->deleteLater();
+    });
+
+    QObject::connect(device, &QLegoDevice::ready, [this, device, address]() {
+        // TODO: Maybe disconnect() ?
+        m_addresses[address] = true;
+        emit deviceFound(device);
+    });
+
+    m_deviceCount++;
+
+    device->connectToDevice();
+}
+
 void QLegoDeviceScanner::deviceScanError(QBluetoothDeviceDiscoveryAgent::Error error)
 {
+    m_statistics.m_scanErrors.fetch_add(1, std::memory_order_relaxed);
     if (error == QBluetoothDeviceDiscoveryAgent::PoweredOffError) {
         emit errorMessage("The Bluetooth adaptor is powered off.");
     } else if (error == QBluetoothDeviceDiscoveryAgent::InputOutputError) {
         emit errorMessage("Writing or reading from the device resulted in an error.");
     } else {
-        const auto index = m_agent->metaObject()->indexOfEnumerator("Error");
-        static QMetaEnum qme = m_agent->metaObject()->enumerator(index);
+        const auto agent = m_agents.first();
+        const auto index = agent->metaObject()->indexOfEnumerator("Error");
+        static QMetaEnum qme = agent->metaObject()->enumerator(index);
         emit errorMessage("Error: " + QLatin1String(qme.valueToKey(error)));
     }
 }
 
 void QLegoDeviceScanner::deviceScanFinished()
 {
+    for (const auto agent : m_agents) {
+        if (agent->isActive()) {
+            return;
+        }
+    }
     m_scanning = false;
     emit finished();
 #if 0
@@ -204,6 +288,28 @@ int QLegoDeviceScanner::devicesFound() const
     return m_deviceCount;
 }
 
+/*!
+    Returns the scan counters of this scanner, together with the counters of every connected
+    device. The counters may be read from any thread.
+
+    \sa QLegoDevice::statistics()
+*/
+const QLegoScannerStatistics *QLegoDeviceScanner::statistics() const
+{
+    return &m_statistics;
+}
+
+/*!
+    Returns the balancer that decides which local adapter each device is connected through.
+    It can be used to tune the placement before scan() is called.
+
+    \sa QLegoDevice::localAdapter()
+*/
+QLegoAdapterBalancer *QLegoDeviceScanner::adapterBalancer()
+{
+    return &m_balancer;
+}
+
 /*
 https://github.com/nathankellenicki/node-poweredup/blob/master/src/consts.ts
 https://github.com/nathankellenicki/node-poweredup/blob/master/src/nobleabstraction.ts
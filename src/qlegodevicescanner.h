@@ -2,8 +2,11 @@
 #define QLEGODEVICESCANNER_H
 
 #include "qlegoglobal.h"
+#include "qlegoadapterbalancer.h"
 #include "qlegodevice.h"
+#include "qlegostatistics.h"
 
+#include <QtCore/QHash>
 #include <QtCore/QObject>
 #include <QtBluetooth/QBluetoothDeviceDiscoveryAgent>
 
@@ -23,11 +26,13 @@ public:
 
     bool scanning() const;
     int devicesFound() const;
+    const QLegoScannerStatistics *statistics() const;
+    QLegoAdapterBalancer *adapterBalancer();
 
     Q_INVOKABLE void scan();
+    Q_INVOKABLE void stopAll();
 
 private Q_SLOTS:
-    void addDevice(const QBluetoothDeviceInfo &info);
     void deviceScanError(QBluetoothDeviceDiscoveryAgent::Error error);
     void deviceScanFinished();
 
@@ -37,9 +42,17 @@ Q_SIGNALS:
     void finished();
 
 private:
+    void addDevice(const QBluetoothAddress &adapter, const QBluetoothDeviceInfo &info);
+    void placeDevice(const QString &address);
+
     bool m_scanning;
     int m_deviceCount;
-    QBluetoothDeviceDiscoveryAgent *m_agent;
+    QList<QBluetoothDeviceDiscoveryAgent *> m_agents;
+    QLegoAdapterBalancer m_balancer;
+    QHash<QString, QBluetoothDeviceInfo> m_pending;
+    QHash<QString, bool> m_addresses;
+    QList<QLegoDevice *> m_devices;
+    QLegoScannerStatistics m_statistics;
 };
 
 QT_END_NAMESPACE
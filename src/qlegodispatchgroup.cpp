@@ -0,0 +1,275 @@
+#include "qlegodispatchgroup.h"
+#include "qlegocommon.h"
+#include "qlegodevice.h"
+#include "qlegomotor.h"
+#include <QtCore/QHash>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QThread>
+
+#include <atomic>
+#include <limits>
+
+Q_LOGGING_CATEGORY(dispatchLogger, "lego.dispatch");
+
+struct QLegoDispatchGroup::Dispatch
+{
+    explicit Dispatch(int count)
+        : transmitted(count, -1)
+        , remaining(count)
+    {
+    }
+
+    // Each entry is written by the thread of its device before remaining is decremented.
+    QVector<qint64> transmitted;
+    std::atomic<int> remaining;
+};
+
+// The targets handed to a hub in another thread. Those still here when it is destroyed were
+// never transmitted, because the hub was deleted before it could take them.
+struct QLegoDispatchGroup::RemoteTargets
+{
+    ~RemoteTargets()
+    {
+        for (const auto index : indexes) {
+            group->report(index, -1, dispatch);
+        }
+    }
+
+    QLegoDispatchGroup *group;
+    QVector<int> indexes;
+    QSharedPointer<Dispatch> dispatch;
+};
+
+/*!
+  \class QLegoDispatchGroup
+  \brief The QLegoDispatchGroup class starts motors on several hubs at the same time.
+  \inmodule QtLego
+  \ingroup devices
+
+  Setting the power of motors on several hubs one after the other starts them at different
+  times: every command waits behind the commands already queued for its hub, and the code
+  that builds and sends each one runs between the writes. The skew grows with the size of the
+  fleet and quickly reaches tens of milliseconds.
+
+  A dispatch group encodes the commands for all of its targets up front. dispatch() then hands
+  them to their hubs back to back, ahead of every queued motion or configuration command, and
+  replaces the motion commands still queued for the same ports. Only safety commands and a
+  write already in flight go out before them. Hubs that live in other threads receive their
+  commands first, so they are written in parallel with the hubs of the calling thread.
+
+  Once every command has been handed to its link, dispatched() reports the skew between the
+  first and the last transmit, in nanoseconds. transmitTimes() has the transmit time of each
+  target and skewHistogram() collects the skew of all dispatches.
+
+  \code
+  auto group = new QLegoDispatchGroup(this);
+  for (auto device : devices) {
+      group->addPower(device, device->waitForAttachedMotor("A"), 60);
+  }
+  connect(group, &QLegoDispatchGroup::dispatched, [](qint64 skew) {
+      qDebug() << "started within" << skew / 1000 << "us";
+  });
+  group->dispatch();
+  \endcode
+
+  The commands execute immediately and their feedback is tracked like that of any other
+  command. A group can be dispatched again once dispatched() has been emitted. It must not be
+  deleted while a dispatch is in progress.
+*/
+
+/*!
+    \fn void QLegoDispatchGroup::dispatched(qint64 skew)
+
+    Emitted when every command of a dispatch has been handed to its link or dropped. \a skew is
+    the time between the first and the last transmit in nanoseconds, or -1 if no command was
+    transmitted.
+*/
+
+QLegoDispatchGroup::QLegoDispatchGroup(QObject *parent)
+    : QObject(parent)
+    , m_targets()
+    , m_dispatching(false)
+    , m_skew(-1)
+    , m_transmitTimes()
+    , m_skewHistogram()
+{
+}
+
+QLegoDispatchGroup::~QLegoDispatchGroup()
+{
+}
+
+/*!
+    \property QLegoDispatchGroup::size
+    \brief the number of commands sent by every dispatch.
+*/
+int QLegoDispatchGroup::size() const
+{
+    return m_targets.size();
+}
+
+/*!
+    \property QLegoDispatchGroup::dispatching
+    \brief whether some commands of the last dispatch have not been transmitted yet.
+*/
+bool QLegoDispatchGroup::isDispatching() const
+{
+    return m_dispatching;
+}
+
+/*!
+    Adds the port output command \a subCommand with the payload \a data for \a attachment, which
+    is attached to \a device.
+*/
+void QLegoDispatchGroup::addCommand(QLegoDevice *device, QLegoAttachedDevice *attachment,
+                                    quint8 subCommand, const QByteArray &data)
+{
+    const auto bytes = attachment->portOutput(subCommand, data);
+    m_targets.append({ device, attachment, QLegoDevice::encodeMessage(bytes) });
+}
+
+/*!
+    Adds a command that sets \a motor, which is attached to \a device, to \a power percent.
+    The power of the motor changes when the command is handed to the link.
+
+    \sa QLegoMotor::startPower()
+*/
+void QLegoDispatchGroup::addPower(QLegoDevice *device, QLegoMotor *motor, int power)
+{
+    const qint8 value = mapSpeed(power);
+    const auto bytes = motor->portOutput(0x51, QByteArray(1, 0x00) + static_cast<char>(value));
+    m_targets.append({ device, motor, QLegoDevice::encodeMessage(bytes) });
+}
+
+/*!
+    Removes all commands.
+*/
+void QLegoDispatchGroup::clear()
+{
+    m_targets.clear();
+}
+
+/*!
+    Returns the skew of the last dispatch in nanoseconds, or -1 if there was none.
+*/
+qint64 QLegoDispatchGroup::skew() const
+{
+    return m_skew;
+}
+
+/*!
+    Returns the monotonic time each command of the last dispatch was handed to its link, in
+    nanoseconds and in the order the commands were added. Commands that were dropped, because
+    their hub was disconnected or deleted or a safety command replaced them, have a time of -1.
+*/
+QVector<qint64> QLegoDispatchGroup::transmitTimes() const
+{
+    return m_transmitTimes;
+}
+
+/*!
+    Returns the histogram of the skew of all dispatches with more than one transmitted command.
+*/
+const QLegoLatencyHistogram *QLegoDispatchGroup::skewHistogram() const
+{
+    return &m_skewHistogram;
+}
+
+/*!
+    Sends all commands. Returns \c false if the group is empty or still dispatching.
+*/
+bool QLegoDispatchGroup::dispatch()
+{
+    if (m_targets.isEmpty() || m_dispatching) {
+        return false;
+    }
+    m_dispatching = true;
+    const QSharedPointer<Dispatch> dispatch(new Dispatch(m_targets.size()));
+
+    QHash<QLegoDevice *, QVector<int>> remote;
+    QVector<int> local;
+    for (int i = 0; i < m_targets.size(); i++) {
+        const auto device = m_targets[i].device.data();
+        if (device && device->thread() != QThread::currentThread()) {
+            remote[device].append(i);
+        } else {
+            local.append(i);
+        }
+    }
+
+    // Hubs in other threads go first, so their writes overlap with the ones made from here.
+    const auto targets = m_targets;
+    for (auto it = remote.cbegin(); it != remote.cend(); ++it) {
+        const QSharedPointer<RemoteTargets> pending(
+                new RemoteTargets{ this, it.value(), dispatch });
+        QMetaObject::invokeMethod(
+                it.key(),
+                [this, targets, pending]() {
+                    const auto indexes = pending->indexes;
+                    pending->indexes.clear();
+                    for (const auto index : indexes) {
+                        transmit(targets[index], index, pending->dispatch);
+                    }
+                },
+                Qt::QueuedConnection);
+    }
+    for (const auto index : local) {
+        transmit(targets[index], index, dispatch);
+    }
+    return true;
+}
+
+// Runs in the thread of the target device.
+void QLegoDispatchGroup::transmit(const Target &target, int index,
+                                  const QSharedPointer<Dispatch> &dispatch)
+{
+    const auto transmitted = [this, index, dispatch](qint64 timestamp) {
+        report(index, timestamp, dispatch);
+    };
+
+    if (!target.device || !target.attachment || !target.attachment->attached()) {
+        transmitted(-1);
+        return;
+    }
+
+    target.device->transmitCommand(target.attachment, target.message, transmitted);
+}
+
+// Runs in the thread of the target device, or the one deleting it.
+void QLegoDispatchGroup::report(int index, qint64 timestamp,
+                                const QSharedPointer<Dispatch> &dispatch)
+{
+    dispatch->transmitted[index] = timestamp;
+    if (dispatch->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        QMetaObject::invokeMethod(
+                this, [this, dispatch]() { finish(dispatch); }, Qt::QueuedConnection);
+    }
+}
+
+void QLegoDispatchGroup::finish(const QSharedPointer<Dispatch> &dispatch)
+{
+    m_dispatching = false;
+    m_transmitTimes = dispatch->transmitted;
+
+    qint64 first = std::numeric_limits<qint64>::max();
+    qint64 last = -1;
+    int count = 0;
+    for (const auto timestamp : m_transmitTimes) {
+        if (timestamp >= 0) {
+            first = qMin(first, timestamp);
+            last = qMax(last, timestamp);
+            count++;
+        }
+    }
+    m_skew = count > 0 ? last - first : -1;
+    if (count > 1) {
+        m_skewHistogram.record(m_skew);
+    }
+    if (count < m_transmitTimes.size()) {
+        qCWarning(dispatchLogger) << m_transmitTimes.size() - count << "of"
+                                  << m_transmitTimes.size() << "commands were dropped";
+    }
+    qCDebug(dispatchLogger) << "dispatched" << count << "commands with a skew of" << m_skew
+                            << "ns";
+    emit dispatched(m_skew);
+}
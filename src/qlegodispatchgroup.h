@@ -0,0 +1,71 @@
+#ifndef QLEGODISPATCHGROUP_H
+#define QLEGODISPATCHGROUP_H
+
+#include "qlegoglobal.h"
+#include "qlegolatencyhistogram.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QPointer>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QVector>
+
+QT_FORWARD_DECLARE_CLASS(QLegoDevice)
+QT_FORWARD_DECLARE_CLASS(QLegoAttachedDevice)
+QT_FORWARD_DECLARE_CLASS(QLegoMotor)
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoDispatchGroup : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int size READ size)
+    Q_PROPERTY(bool dispatching READ isDispatching)
+
+public:
+    explicit QLegoDispatchGroup(QObject *parent = nullptr);
+    ~QLegoDispatchGroup();
+
+    int size() const;
+    bool isDispatching() const;
+
+    void addCommand(QLegoDevice *device, QLegoAttachedDevice *attachment, quint8 subCommand,
+                    const QByteArray &data);
+    void addPower(QLegoDevice *device, QLegoMotor *motor, int power);
+    void clear();
+
+    qint64 skew() const;
+    QVector<qint64> transmitTimes() const;
+    const QLegoLatencyHistogram *skewHistogram() const;
+
+    Q_INVOKABLE bool dispatch();
+
+Q_SIGNALS:
+    void dispatched(qint64 skew);
+
+private:
+    Q_DISABLE_COPY(QLegoDispatchGroup)
+
+    struct Target
+    {
+        QPointer<QLegoDevice> device;
+        QPointer<QLegoAttachedDevice> attachment;
+        QByteArray message;
+    };
+
+    struct Dispatch;
+    struct RemoteTargets;
+
+    void transmit(const Target &target, int index, const QSharedPointer<Dispatch> &dispatch);
+    void report(int index, qint64 timestamp, const QSharedPointer<Dispatch> &dispatch);
+    void finish(const QSharedPointer<Dispatch> &dispatch);
+
+    QVector<Target> m_targets;
+    bool m_dispatching;
+    qint64 m_skew;
+    QVector<qint64> m_transmitTimes;
+    QLegoLatencyHistogram m_skewHistogram;
+};
+
+QT_END_NAMESPACE
+
+#endif
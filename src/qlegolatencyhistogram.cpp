@@ -0,0 +1,153 @@
+#include "qlegolatencyhistogram.h"
+
+#include <limits>
+
+/*!
+  \class QLegoLatencyHistogram
+  \brief The QLegoLatencyHistogram class records a distribution of latencies.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  QLegoLatencyHistogram stores nanosecond latencies in logarithmic buckets with linear
+  sub-buckets, in the style of HDR histograms. Every recorded value is reported with a relative
+  error of at most 6.25%, while using a fixed amount of memory.
+
+  Recording and reading are lock-free, so a histogram can be read from any thread while
+  another thread records into it.
+
+  \sa QLegoDevice::roundTripLatency(), QLegoDevice::dispatchLatency()
+*/
+
+/*!
+    Constructs an empty histogram.
+*/
+QLegoLatencyHistogram::QLegoLatencyHistogram()
+{
+    reset();
+}
+
+/*!
+    Adds a latency of \a nsecs nanoseconds. Negative values are recorded as zero.
+*/
+void QLegoLatencyHistogram::record(qint64 nsecs)
+{
+    if (nsecs < 0) {
+        nsecs = 0;
+    }
+
+    m_buckets[bucketIndex(static_cast<quint64>(nsecs))].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(static_cast<quint64>(nsecs), std::memory_order_relaxed);
+
+    qint64 minimum = m_minimum.load(std::memory_order_relaxed);
+    while (nsecs < minimum
+           && !m_minimum.compare_exchange_weak(minimum, nsecs, std::memory_order_relaxed)) {
+    }
+    qint64 maximum = m_maximum.load(std::memory_order_relaxed);
+    while (nsecs > maximum
+           && !m_maximum.compare_exchange_weak(maximum, nsecs, std::memory_order_relaxed)) {
+    }
+
+    // Published last, so readers never see a count without its bucket.
+    m_count.fetch_add(1, std::memory_order_release);
+}
+
+/*!
+    Removes all recorded values.
+*/
+void QLegoLatencyHistogram::reset()
+{
+    for (auto &bucket : m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    m_sum.store(0, std::memory_order_relaxed);
+    m_minimum.store(std::numeric_limits<qint64>::max(), std::memory_order_relaxed);
+    m_maximum.store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_release);
+}
+
+/*!
+    Returns the number of recorded values.
+*/
+quint64 QLegoLatencyHistogram::count() const
+{
+    return m_count.load(std::memory_order_acquire);
+}
+
+/*!
+    Returns the smallest recorded latency in nanoseconds, or 0 if nothing was recorded.
+*/
+qint64 QLegoLatencyHistogram::minimum() const
+{
+    return count() > 0 ? m_minimum.load(std::memory_order_relaxed) : 0;
+}
+
+/*!
+    Returns the largest recorded latency in nanoseconds.
+*/
+qint64 QLegoLatencyHistogram::maximum() const
+{
+    return m_maximum.load(std::memory_order_relaxed);
+}
+
+/*!
+    Returns the mean of the recorded latencies in nanoseconds.
+*/
+double QLegoLatencyHistogram::mean() const
+{
+    const quint64 total = count();
+    if (total == 0) {
+        return 0.0;
+    }
+    return static_cast<double>(m_sum.load(std::memory_order_relaxed)) / total;
+}
+
+/*!
+    Returns the latency in nanoseconds below which \a percentile percent of the recorded values
+    fall. The result is the lower bound of the matching bucket, clamped to the recorded range.
+*/
+qint64 QLegoLatencyHistogram::percentile(double percentile) const
+{
+    const quint64 total = count();
+    if (total == 0) {
+        return 0;
+    }
+
+    percentile = qBound(0.0, percentile, 100.0);
+    const quint64 target = qMax<quint64>(1, static_cast<quint64>(percentile / 100.0 * total + 0.5));
+
+    quint64 seen = 0;
+    for (int i = 0; i < BucketCount; i++) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            const qint64 value = static_cast<qint64>(bucketValue(i));
+            return qBound(minimum(), value, maximum());
+        }
+    }
+    return maximum();
+}
+
+int QLegoLatencyHistogram::bucketIndex(quint64 value)
+{
+    if (value < SubBucketCount) {
+        return static_cast<int>(value);
+    }
+
+    int exponent = 63;
+    while (!(value & (Q_UINT64_C(1) << exponent))) {
+        exponent--;
+    }
+    const int shift = exponent - SubBucketBits;
+    const int subBucket = static_cast<int>((value >> shift) & (SubBucketCount - 1));
+    return (shift + 1) * SubBucketCount + subBucket;
+}
+
+quint64 QLegoLatencyHistogram::bucketValue(int index)
+{
+    if (index < SubBucketCount) {
+        return static_cast<quint64>(index);
+    }
+
+    const int shift = index / SubBucketCount - 1;
+    const quint64 subBucket = static_cast<quint64>(index % SubBucketCount);
+    return (SubBucketCount + subBucket) << shift;
+}
@@ -0,0 +1,45 @@
+#ifndef QLEGOLATENCYHISTOGRAM_H
+#define QLEGOLATENCYHISTOGRAM_H
+
+#include "qlegoglobal.h"
+
+#include <atomic>
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoLatencyHistogram
+{
+public:
+    QLegoLatencyHistogram();
+
+    void record(qint64 nsecs);
+    void reset();
+
+    quint64 count() const;
+    qint64 minimum() const;
+    qint64 maximum() const;
+    double mean() const;
+    qint64 percentile(double percentile) const;
+
+private:
+    Q_DISABLE_COPY(QLegoLatencyHistogram)
+
+    // Each power of two is split into 16 linear sub-buckets, which keeps the
+    // relative error of any recorded value below 6.25%.
+    static const int SubBucketBits = 4;
+    static const int SubBucketCount = 1 << SubBucketBits;
+    static const int BucketCount = (64 - SubBucketBits + 1) * SubBucketCount;
+
+    static int bucketIndex(quint64 value);
+    static quint64 bucketValue(int index);
+
+    std::atomic<quint64> m_buckets[BucketCount];
+    std::atomic<quint64> m_count;
+    std::atomic<quint64> m_sum;
+    std::atomic<qint64> m_minimum;
+    std::atomic<qint64> m_maximum;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,423 @@
+#include "qlegomotionprogram.h"
+#include "qlegocommon.h"
+#include "qlegodevice.h"
+#include <QtCore/QLoggingCategory>
+
+Q_LOGGING_CATEGORY(motionProgramLogger, "lego.motionprogram");
+
+static const qint64 Millisecond = 1000000;
+
+static inline qint8 clampSpeed(int speed)
+{
+    return static_cast<qint8>(qBound(-100, speed, 100));
+}
+
+static inline quint8 clampPower(int power)
+{
+    return static_cast<quint8>(qBound(0, power, 100));
+}
+
+/*!
+  \class QLegoMotionProgram
+  \brief The QLegoMotionProgram class is a choreographed sequence of motor commands.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  Sequences of power, wait and brake steps written against the event loop pay for a timer,
+  a dispatch and whatever else the event loop is doing at every step. A motion program
+  describes such a sequence once: commands, waits, waits for command feedback or a sensor
+  threshold, loops and parallel branches, for any number of motors on any number of hubs.
+
+  Programs are built with the functions of this class, which encode every command frame up
+  front, and compiled into a flat array of instructions by compile(). A QLegoMotionScheduler
+  then runs compiled programs on a thread of its own.
+
+  \code
+  QLegoMotionProgram program;
+  const int left = program.addMotor(device, device->waitForAttachedMotor("A"));
+  const int right = program.addMotor(device, device->waitForAttachedMotor("B"));
+  program.beginLoop(3);
+  program.beginParallel();
+  program.setPower(left, 50);
+  program.wait(1000);
+  program.brake(left);
+  program.nextBranch();
+  program.startSpeedForDegrees(right, 360, 40);
+  program.waitForFeedback();
+  program.endParallel();
+  program.endLoop();
+  program.compile();
+  scheduler->start(program);
+  \endcode
+
+  Waits are measured from when the previous wait was due rather than from when it ended, so
+  timing errors do not add up over a program. Parallel branches start together and the
+  program continues after endParallel() once all of them have finished.
+
+  Programs are implicitly shared and cheap to copy. Building functions called with invalid
+  arguments, or after compile(), make compile() fail with errorString() describing the first
+  error.
+*/
+
+/*!
+    \enum QLegoMotionProgram::Comparison
+
+    How waitForSensor() compares a value with its threshold.
+
+    \value AtLeast  The wait ends once the value is at least the threshold.
+
+    \value AtMost   The wait ends once the value is at most the threshold.
+*/
+
+QLegoMotionProgram::QLegoMotionProgram()
+    : m_actuators()
+    , m_inputs()
+    , m_frames()
+    , m_instructions()
+    , m_blocks()
+    , m_counters(0)
+    , m_joins(0)
+    , m_compiled(false)
+    , m_errorString()
+{
+}
+
+/*!
+    Adds \a motor, attached to \a device, and returns the index commands refer to it by.
+*/
+int QLegoMotionProgram::addMotor(QLegoDevice *device, QLegoMotor *motor)
+{
+    if (!isBuilding("addMotor")) {
+        return -1;
+    }
+    if (!device || !motor) {
+        fail(QStringLiteral("addMotor: no motor"));
+        return -1;
+    }
+    m_actuators.append({ device, motor });
+    return m_actuators.size() - 1;
+}
+
+/*!
+    Adds \a attachment as an input for waitForSensor(), using only samples of \a mode if it is
+    not -1, and returns its index. The attachment must be subscribed to the mode.
+*/
+int QLegoMotionProgram::addInput(QLegoAttachedDevice *attachment, int mode)
+{
+    if (!isBuilding("addInput")) {
+        return -1;
+    }
+    if (!attachment) {
+        fail(QStringLiteral("addInput: no device"));
+        return -1;
+    }
+    m_inputs.append({ attachment, mode });
+    return m_inputs.size() - 1;
+}
+
+/*!
+    Sends the port output command \a subCommand with the payload \a data to \a motor.
+    The command executes immediately and reports feedback.
+*/
+void QLegoMotionProgram::command(int motor, quint8 subCommand, const QByteArray &data)
+{
+    if (!isBuilding("command") || !isMotor(motor)) {
+        return;
+    }
+    const auto bytes = m_actuators[motor].attachment->portOutput(subCommand, data);
+    m_frames.append(QLegoDevice::encodeMessage(bytes));
+    append(Send, motor, m_frames.size() - 1);
+}
+
+/*!
+    Sets \a motor to \a power percent.
+
+    \sa QLegoMotor::startPower()
+*/
+void QLegoMotionProgram::setPower(int motor, int power)
+{
+    const qint8 value = mapSpeed(power);
+    command(motor, 0x51, QByteArray(1, 0x00) + static_cast<char>(value));
+}
+
+/*!
+    Stops \a motor and lets it float.
+*/
+void QLegoMotionProgram::stop(int motor)
+{
+    setPower(motor, 0);
+}
+
+/*!
+    Brakes \a motor.
+*/
+void QLegoMotionProgram::brake(int motor)
+{
+    setPower(motor, 127);
+}
+
+/*!
+    Runs \a motor at \a speed percent, using at most \a maxPower percent of power, with the
+    profiles the motor has when this function is called.
+
+    \sa QLegoMotor::startSpeed()
+*/
+void QLegoMotionProgram::startSpeed(int motor, int speed, int maxPower)
+{
+    if (!isMotor(motor)) {
+        return;
+    }
+    const auto device = static_cast<QLegoMotor *>(m_actuators[motor].attachment.data());
+    const auto profiles = device->profiles();
+    QByteArray bytes;
+    bytes += static_cast<char>(clampSpeed(speed));
+    bytes += static_cast<char>(clampPower(maxPower));
+    bytes += static_cast<char>(profiles);
+    command(motor, 0x07, bytes);
+}
+
+/*!
+    Rotates \a motor by \a degrees at \a speed percent, then applies \a endState. At most
+    \a maxPower percent of power is used. Follow it with waitForFeedback() to wait until the
+    motor is done.
+
+    \sa QLegoMotor::startSpeedForDegrees()
+*/
+void QLegoMotionProgram::startSpeedForDegrees(int motor, int degrees, int speed, int maxPower,
+                                              QLegoMotor::EndState endState)
+{
+    if (!isMotor(motor)) {
+        return;
+    }
+    if (degrees < 0) {
+        degrees = -degrees;
+        speed = -speed;
+    }
+    const auto device = static_cast<QLegoMotor *>(m_actuators[motor].attachment.data());
+    const auto profiles = device->profiles();
+    QByteArray bytes;
+    appendLittleEndian<quint32>(bytes, static_cast<quint32>(degrees));
+    bytes += static_cast<char>(clampSpeed(speed));
+    bytes += static_cast<char>(clampPower(maxPower));
+    bytes += static_cast<char>(endState);
+    bytes += static_cast<char>(profiles);
+    command(motor, 0x0B, bytes);
+}
+
+/*!
+    Waits \a msecs milliseconds after the previous wait was due.
+*/
+void QLegoMotionProgram::wait(int msecs)
+{
+    if (!isBuilding("wait")) {
+        return;
+    }
+    append(Wait, 0, 0, qMax(msecs, 0) * Millisecond);
+}
+
+/*!
+    Waits until the hub has reported every command sent by this branch of the program as
+    completed or discarded.
+*/
+void QLegoMotionProgram::waitForFeedback()
+{
+    if (!isBuilding("waitForFeedback")) {
+        return;
+    }
+    append(WaitFeedback);
+}
+
+/*!
+    Waits until value \a index of the latest sample of \a input compares to \a threshold as
+    \a comparison says, or \a timeout milliseconds have passed if it is not 0.
+*/
+void QLegoMotionProgram::waitForSensor(int input, Comparison comparison, double threshold,
+                                       int index, int timeout)
+{
+    if (!isBuilding("waitForSensor")) {
+        return;
+    }
+    if (input < 0 || input >= m_inputs.size() || index < 0 || index >= QLegoSample::MaxValues) {
+        fail(QStringLiteral("waitForSensor: invalid input %1").arg(input));
+        return;
+    }
+    const int pc = append(WaitSensor, input, index, qMax(timeout, 0) * Millisecond);
+    m_instructions[pc].comparison = comparison;
+    m_instructions[pc].threshold = threshold;
+}
+
+/*!
+    Starts a block that repeats \a count times, or until the program is cancelled if \a count
+    is 0. A block that repeats forever must wait.
+*/
+void QLegoMotionProgram::beginLoop(int count)
+{
+    if (!isBuilding("beginLoop")) {
+        return;
+    }
+    const int slot = m_counters++;
+    const int start = append(LoopBegin, slot, qMax(count, 0));
+    m_blocks.append({ false, start, slot, 0, 0, false, {} });
+}
+
+/*!
+    Ends the block started by beginLoop().
+*/
+void QLegoMotionProgram::endLoop()
+{
+    if (!isBuilding("endLoop")) {
+        return;
+    }
+    if (m_blocks.isEmpty() || m_blocks.last().parallel) {
+        fail(QStringLiteral("endLoop: no loop to end"));
+        return;
+    }
+    const auto block = m_blocks.takeLast();
+    if (m_instructions[block.start].operand == 0 && !block.waits) {
+        fail(QStringLiteral("endLoop: a loop without end must wait"));
+        return;
+    }
+    append(LoopEnd, block.slot, block.start + 1);
+}
+
+/*!
+    Starts a block of branches that run at the same time. The first branch starts here.
+*/
+void QLegoMotionProgram::beginParallel()
+{
+    if (!isBuilding("beginParallel")) {
+        return;
+    }
+    const int slot = m_joins++;
+    const int start = append(Fork, slot);
+    const int branch = append(Branch, slot, -1);
+    m_blocks.append({ true, start, slot, 1, branch, false, {} });
+}
+
+/*!
+    Ends the current branch of a parallel block and starts the next one.
+*/
+void QLegoMotionProgram::nextBranch()
+{
+    if (!isBuilding("nextBranch")) {
+        return;
+    }
+    if (m_blocks.isEmpty() || !m_blocks.last().parallel) {
+        fail(QStringLiteral("nextBranch: not in a parallel block"));
+        return;
+    }
+    auto &block = m_blocks.last();
+    block.joins.append(append(Join, block.slot));
+    const int branch = append(Branch, block.slot, -1);
+    m_instructions[block.branch].operand = branch;
+    block.branch = branch;
+    block.branches++;
+}
+
+/*!
+    Ends the parallel block started by beginParallel(). The program continues once every branch
+    has finished.
+*/
+void QLegoMotionProgram::endParallel()
+{
+    if (!isBuilding("endParallel")) {
+        return;
+    }
+    if (m_blocks.isEmpty() || !m_blocks.last().parallel) {
+        fail(QStringLiteral("endParallel: no parallel block to end"));
+        return;
+    }
+    auto block = m_blocks.takeLast();
+    block.joins.append(append(Join, block.slot));
+    const int next = m_instructions.size();
+    for (const auto join : block.joins) {
+        m_instructions[join].operand = next;
+    }
+    m_instructions[block.start].operand = block.branches;
+    if (block.waits && !m_blocks.isEmpty()) {
+        m_blocks.last().waits = true;
+    }
+}
+
+/*!
+    Checks the program and terminates its instructions. Returns \c false if the program is
+    invalid, in which case errorString() describes why.
+*/
+bool QLegoMotionProgram::compile()
+{
+    if (m_compiled) {
+        return true;
+    }
+    if (!m_blocks.isEmpty() && m_errorString.isEmpty()) {
+        fail(QStringLiteral("compile: %1 unterminated blocks").arg(m_blocks.size()));
+    }
+    if (!m_errorString.isEmpty()) {
+        qCWarning(motionProgramLogger) << m_errorString;
+        return false;
+    }
+    append(End);
+    m_instructions.squeeze();
+    m_frames.squeeze();
+    m_compiled = true;
+    return true;
+}
+
+/*!
+    Returns \c true once the program has been compiled.
+*/
+bool QLegoMotionProgram::isCompiled() const
+{
+    return m_compiled;
+}
+
+/*!
+    Returns the first error found while building the program.
+*/
+QString QLegoMotionProgram::errorString() const
+{
+    return m_errorString;
+}
+
+/*!
+    Returns the number of instructions the program has compiled into so far.
+*/
+int QLegoMotionProgram::instructionCount() const
+{
+    return m_instructions.size();
+}
+
+bool QLegoMotionProgram::isBuilding(const char *function)
+{
+    if (m_compiled) {
+        fail(QStringLiteral("%1: the program is already compiled").arg(QLatin1String(function)));
+        return false;
+    }
+    return true;
+}
+
+bool QLegoMotionProgram::isMotor(int motor)
+{
+    if (motor < 0 || motor >= m_actuators.size()) {
+        fail(QStringLiteral("invalid motor %1").arg(motor));
+        return false;
+    }
+    return true;
+}
+
+void QLegoMotionProgram::fail(const QString &error)
+{
+    if (m_errorString.isEmpty()) {
+        m_errorString = error;
+    }
+}
+
+int QLegoMotionProgram::append(Opcode opcode, int resource, qint32 operand, qint64 duration)
+{
+    if (opcode == Wait || opcode == WaitFeedback || opcode == WaitSensor) {
+        for (auto &block : m_blocks) {
+            block.waits = true;
+        }
+    }
+    m_instructions.append({ opcode, 0, static_cast<quint16>(resource), operand, duration, 0 });
+    return m_instructions.size() - 1;
+}
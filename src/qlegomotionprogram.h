@@ -0,0 +1,135 @@
+#ifndef QLEGOMOTIONPROGRAM_H
+#define QLEGOMOTIONPROGRAM_H
+
+#include "qlegoglobal.h"
+#include "qlegomotor.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QPointer>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+QT_FORWARD_DECLARE_CLASS(QLegoDevice)
+
+QT_BEGIN_NAMESPACE
+
+struct QLegoMotionStep
+{
+    qint32 instruction;
+    qint32 branch;
+    // When the step was due, when the scheduler ran it and, for commands, when the device
+    // handed it to the link, or -1.
+    qint64 scheduled;
+    qint64 executed;
+    qint64 transmitted;
+};
+
+class Q_LEGO_EXPORT QLegoMotionProgram
+{
+public:
+    enum Comparison
+    {
+        AtLeast,
+        AtMost
+    };
+
+    QLegoMotionProgram();
+
+    int addMotor(QLegoDevice *device, QLegoMotor *motor);
+    int addInput(QLegoAttachedDevice *attachment, int mode = -1);
+
+    void command(int motor, quint8 subCommand, const QByteArray &data);
+    void setPower(int motor, int power);
+    void stop(int motor);
+    void brake(int motor);
+    void startSpeed(int motor, int speed, int maxPower = 100);
+    void startSpeedForDegrees(int motor, int degrees, int speed, int maxPower = 100,
+                              QLegoMotor::EndState endState = QLegoMotor::Brake);
+
+    void wait(int msecs);
+    void waitForFeedback();
+    void waitForSensor(int input, Comparison comparison, double threshold, int index = 0,
+                       int timeout = 0);
+
+    void beginLoop(int count = 0);
+    void endLoop();
+    void beginParallel();
+    void nextBranch();
+    void endParallel();
+
+    bool compile();
+    bool isCompiled() const;
+    QString errorString() const;
+    int instructionCount() const;
+
+private:
+    friend class QLegoMotionScheduler;
+
+    enum Opcode : quint8
+    {
+        Send,
+        Wait,
+        WaitFeedback,
+        WaitSensor,
+        LoopBegin,
+        LoopEnd,
+        Fork,
+        Branch,
+        Join,
+        End
+    };
+
+    // resource is the motor, input, loop counter or join, operand the frame, count or jump
+    // target, depending on the opcode.
+    struct Instruction
+    {
+        Opcode opcode;
+        quint8 comparison;
+        quint16 resource;
+        qint32 operand;
+        qint64 duration;
+        double threshold;
+    };
+
+    struct Actuator
+    {
+        QPointer<QLegoDevice> device;
+        QPointer<QLegoAttachedDevice> attachment;
+    };
+
+    struct Input
+    {
+        QPointer<QLegoAttachedDevice> attachment;
+        int mode;
+    };
+
+    struct Block
+    {
+        bool parallel;
+        int start;
+        int slot;
+        int branches;
+        int branch;
+        bool waits;
+        QVector<int> joins;
+    };
+
+    bool isBuilding(const char *function);
+    bool isMotor(int motor);
+    void fail(const QString &error);
+    int append(Opcode opcode, int resource = 0, qint32 operand = 0, qint64 duration = 0);
+
+    QVector<Actuator> m_actuators;
+    QVector<Input> m_inputs;
+    QVector<QByteArray> m_frames;
+    QVector<Instruction> m_instructions;
+    QVector<Block> m_blocks;
+    int m_counters;
+    int m_joins;
+    bool m_compiled;
+    QString m_errorString;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,583 @@
+#include "qlegomotionscheduler.h"
+#include "qlegocommon.h"
+#include "qlegoattacheddevice.h"
+#include "qlegocommandreply.h"
+#include "qlegodevice.h"
+#include <QtCore/QHash>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+
+#include <chrono>
+#include <limits>
+#include <thread>
+
+Q_LOGGING_CATEGORY(motionSchedulerLogger, "lego.motionscheduler");
+
+static const qint64 Millisecond = 1000000;
+static const qint64 Never = std::numeric_limits<qint64>::max();
+// Deadlines closer than this are slept towards precisely rather than on the wait condition,
+// whose timeout only has millisecond resolution.
+static const qint64 PreciseSleep = 2 * Millisecond;
+// Keeps a branch that loops without waiting from starving the others.
+static const int MaxInstructionsPerPass = 1024;
+
+struct QLegoMotionScheduler::Run
+{
+    enum State
+    {
+        Ready,
+        Sleeping,
+        WaitingFeedback,
+        WaitingSensor,
+        Finished
+    };
+
+    struct Branch
+    {
+        int pc;
+        State state;
+        // When the current instruction of the branch was due.
+        qint64 time;
+        qint64 deadline;
+        int pending;
+        qint64 settled;
+    };
+
+    int id;
+    bool cancelled;
+    QLegoMotionProgram program;
+    QVector<Branch> branches;
+    QVector<int> counters;
+    QVector<int> joins;
+    QVector<qint64> joinTimes;
+    QVector<QLegoSample> samples;
+    QVector<bool> valid;
+    QVector<QMetaObject::Connection> connections;
+    QVector<QLegoMotionStep> trace;
+};
+
+// Shared with the callbacks running in the device threads, which may outlive the scheduler.
+struct QLegoMotionScheduler::Core
+{
+    ~Core() { qDeleteAll(runs); }
+
+    void commandFinished(int id, int branch)
+    {
+        QMutexLocker locker(&mutex);
+        const auto run = runs.value(id);
+        if (!run) {
+            return;
+        }
+        auto &state = run->branches[branch];
+        if (--state.pending == 0) {
+            state.settled = monotonicNanoseconds();
+            condition.wakeAll();
+        }
+    }
+
+    void commandTransmitted(int id, int step, qint64 timestamp)
+    {
+        if (step < 0) {
+            return;
+        }
+        QMutexLocker locker(&mutex);
+        if (const auto run = runs.value(id)) {
+            run->trace[step].transmitted = timestamp;
+        } else {
+            const auto it = traces.find(id);
+            if (it != traces.end()) {
+                (*it)[step].transmitted = timestamp;
+            }
+        }
+    }
+
+    void sampleReceived(int id, int input, const QLegoSample &sample)
+    {
+        QMutexLocker locker(&mutex);
+        const auto run = runs.value(id);
+        if (!run) {
+            return;
+        }
+        run->samples[input] = sample;
+        run->valid[input] = true;
+        condition.wakeAll();
+    }
+
+    QMutex mutex;
+    QWaitCondition condition;
+    bool stopping = false;
+    int nextId = 1;
+    QHash<int, Run *> runs;
+    QHash<int, QVector<QLegoMotionStep>> traces;
+};
+
+/*!
+  \class QLegoMotionScheduler
+  \brief The QLegoMotionScheduler class runs compiled motion programs.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  The scheduler runs any number of QLegoMotionProgram instances at the same time on a thread
+  of its own, at time-critical priority, rather than on the event loop. Waits sleep on
+  absolute deadlines, so a step runs when it is due no matter what the event loop is doing,
+  and lateness() shows by how much it missed.
+
+  Commands go straight to the head of the command queue of their hub, replacing motion
+  commands still queued for the same port, as with QLegoDispatchGroup. They are sent from the
+  threads the hubs live in. Program commands bypass the motor objects, so properties such as
+  QLegoMotor::power do not follow them.
+
+  Every step is timestamped. takeTrace() returns, for each command and wait of a finished
+  program, when it was due, when the scheduler ran it and when the hub's link took the
+  command. Traces hold at most MaxTraceSteps steps and are kept until taken.
+
+  \code
+  auto scheduler = new QLegoMotionScheduler(this);
+  connect(scheduler, &QLegoMotionScheduler::finished, [=](int run) {
+      for (const auto &step : scheduler->takeTrace(run)) {
+          qDebug() << step.instruction << step.executed - step.scheduled;
+      }
+  });
+  scheduler->start(program);
+  \endcode
+
+  The devices a program uses must outlive its runs. Cancelling a run leaves the motors with
+  their last command.
+*/
+
+/*!
+    \fn void QLegoMotionScheduler::finished(int run)
+
+    This signal is emitted from the scheduler thread when \a run has ended or was cancelled.
+*/
+
+QLegoMotionScheduler::QLegoMotionScheduler(QObject *parent)
+    : QObject(parent)
+    , m_core(new Core)
+    , m_worker(nullptr)
+    , m_steps(0)
+    , m_lateness()
+{
+}
+
+QLegoMotionScheduler::~QLegoMotionScheduler()
+{
+    if (m_worker) {
+        m_core->mutex.lock();
+        m_core->stopping = true;
+        m_core->condition.wakeAll();
+        m_core->mutex.unlock();
+        m_worker->wait();
+        delete m_worker;
+    }
+
+    QList<Run *> runs;
+    m_core->mutex.lock();
+    runs = m_core->runs.values();
+    m_core->runs.clear();
+    m_core->mutex.unlock();
+    for (const auto run : runs) {
+        for (const auto &connection : run->connections) {
+            QObject::disconnect(connection);
+        }
+        delete run;
+    }
+}
+
+/*!
+    Starts running \a program, which must be compiled, and returns the identifier of the run,
+    or -1. The first instruction runs immediately. A program can run several times at once.
+*/
+int QLegoMotionScheduler::start(const QLegoMotionProgram &program)
+{
+    if (!program.isCompiled()) {
+        qCWarning(motionSchedulerLogger) << "cannot start a program that is not compiled";
+        return -1;
+    }
+
+    m_core->mutex.lock();
+    const int id = m_core->nextId++;
+    m_core->mutex.unlock();
+
+    auto run = new Run;
+    run->id = id;
+    run->cancelled = false;
+    run->program = program;
+    run->counters = QVector<int>(program.m_counters, 0);
+    run->joins = QVector<int>(program.m_joins, 0);
+    run->joinTimes = QVector<qint64>(program.m_joins, 0);
+    run->samples = QVector<QLegoSample>(program.m_inputs.size());
+    run->valid = QVector<bool>(program.m_inputs.size(), false);
+
+    const auto core = m_core;
+    for (int i = 0; i < program.m_inputs.size(); i++) {
+        const auto &input = program.m_inputs[i];
+        if (!input.attachment) {
+            continue;
+        }
+        const int mode = input.mode;
+        // Runs in the thread of the device, as soon as the sample is decoded.
+        run->connections.append(connect(input.attachment.data(),
+                                        &QLegoAttachedDevice::valueReceived,
+                                        [core, id, i, mode](const QLegoSample &sample) {
+                                            if (mode < 0 || sample.mode == mode) {
+                                                core->sampleReceived(id, i, sample);
+                                            }
+                                        }));
+    }
+
+    m_core->mutex.lock();
+    run->branches.append({ 0, Run::Ready, monotonicNanoseconds(), 0, 0, 0 });
+    m_core->runs.insert(id, run);
+    m_core->condition.wakeAll();
+    m_core->mutex.unlock();
+
+    if (!m_worker) {
+        m_worker = QThread::create([this]() { this->run(); });
+        m_worker->start(QThread::TimeCriticalPriority);
+    }
+    return id;
+}
+
+/*!
+    Stops \a run before its next instruction. Commands already handed to the hubs are still
+    sent.
+*/
+void QLegoMotionScheduler::cancel(int run)
+{
+    QMutexLocker locker(&m_core->mutex);
+    if (const auto state = m_core->runs.value(run)) {
+        state->cancelled = true;
+        m_core->condition.wakeAll();
+    }
+}
+
+/*!
+    Returns \c true until \a run has finished.
+*/
+bool QLegoMotionScheduler::isRunning(int run) const
+{
+    QMutexLocker locker(&m_core->mutex);
+    return m_core->runs.contains(run);
+}
+
+/*!
+    Returns the number of runs that have not finished.
+*/
+int QLegoMotionScheduler::runningPrograms() const
+{
+    QMutexLocker locker(&m_core->mutex);
+    return m_core->runs.size();
+}
+
+/*!
+    Returns the steps of the finished \a run and forgets them.
+*/
+QVector<QLegoMotionStep> QLegoMotionScheduler::takeTrace(int run)
+{
+    QMutexLocker locker(&m_core->mutex);
+    return m_core->traces.take(run);
+}
+
+/*!
+    Returns the number of commands and waits executed so far, by all runs.
+*/
+quint64 QLegoMotionScheduler::steps() const
+{
+    return m_steps.load(std::memory_order_relaxed);
+}
+
+/*!
+    Returns the histogram of how late each command was handed to its hub after it was due.
+*/
+const QLegoLatencyHistogram *QLegoMotionScheduler::lateness() const
+{
+    return &m_lateness;
+}
+
+void QLegoMotionScheduler::run()
+{
+    using Clock = std::chrono::steady_clock;
+
+    QMutexLocker locker(&m_core->mutex);
+    while (!m_core->stopping) {
+        const qint64 now = monotonicNanoseconds();
+        qint64 next = Never;
+        QList<Run *> finished;
+        for (auto it = m_core->runs.begin(); it != m_core->runs.end();) {
+            const auto run = it.value();
+            if (run->cancelled || advance(run, now, next)) {
+                m_core->traces.insert(run->id, run->trace);
+                finished.append(run);
+                it = m_core->runs.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        if (!finished.isEmpty() || next <= now) {
+            locker.unlock();
+            for (const auto run : finished) {
+                for (const auto &connection : run->connections) {
+                    QObject::disconnect(connection);
+                }
+                emit this->finished(run->id);
+                delete run;
+            }
+            if (finished.isEmpty()) {
+                QThread::yieldCurrentThread();
+            }
+            locker.relock();
+        } else if (next == Never) {
+            m_core->condition.wait(&m_core->mutex);
+        } else if (next - now > PreciseSleep) {
+            m_core->condition.wait(&m_core->mutex, (next - now - PreciseSleep) / Millisecond);
+        } else {
+            locker.unlock();
+            std::this_thread::sleep_until(Clock::time_point(std::chrono::nanoseconds(next)));
+            locker.relock();
+        }
+    }
+}
+
+// Resumes the branches of run whose wait is over and executes them. Returns true once every
+// branch has ended, and lowers next to the earliest deadline of the others.
+bool QLegoMotionScheduler::advance(Run *run, qint64 now, qint64 &next)
+{
+    bool finished = true;
+    for (int i = 0; i < run->branches.size(); i++) {
+        auto &branch = run->branches[i];
+        switch (branch.state) {
+        case Run::Sleeping:
+            if (branch.deadline <= now) {
+                record(run, i, branch.pc, branch.deadline, now);
+                branch.time = branch.deadline;
+                branch.pc++;
+                branch.state = Run::Ready;
+            }
+            break;
+        case Run::WaitingFeedback:
+            if (branch.pending == 0) {
+                branch.time = qMax(branch.time, branch.settled);
+                record(run, i, branch.pc, branch.time, now);
+                branch.pc++;
+                branch.state = Run::Ready;
+            }
+            break;
+        case Run::WaitingSensor:
+            if (isSatisfied(run, branch.pc)) {
+                const auto input = run->program.m_instructions.at(branch.pc).resource;
+                branch.time = qBound(branch.time, run->samples.at(input).timestamp, now);
+                record(run, i, branch.pc, branch.time, now);
+                branch.pc++;
+                branch.state = Run::Ready;
+            } else if (branch.deadline <= now) {
+                record(run, i, branch.pc, branch.deadline, now);
+                branch.time = branch.deadline;
+                branch.pc++;
+                branch.state = Run::Ready;
+            }
+            break;
+        default:
+            break;
+        }
+
+        if (branch.state == Run::Ready) {
+            execute(run, i, now);
+        }
+
+        const auto &state = run->branches.at(i);
+        if (state.state != Run::Finished) {
+            finished = false;
+        }
+        if (state.state == Run::Ready) {
+            next = now;
+        } else if (state.state == Run::Sleeping || state.state == Run::WaitingSensor) {
+            next = qMin(next, state.deadline);
+        }
+    }
+    return finished;
+}
+
+void QLegoMotionScheduler::execute(Run *run, int index, qint64 now)
+{
+    typedef QLegoMotionProgram Program;
+    const QVector<Program::Instruction> &code = run->program.m_instructions;
+
+    for (int budget = MaxInstructionsPerPass; budget > 0; budget--) {
+        auto &branch = run->branches[index];
+        if (branch.state != Run::Ready) {
+            return;
+        }
+        const auto &instruction = code.at(branch.pc);
+        switch (instruction.opcode) {
+        case Program::Send:
+            send(run, index, branch.pc, now);
+            branch.pc++;
+            break;
+        case Program::Wait: {
+            const qint64 deadline = branch.time + instruction.duration;
+            if (deadline > now) {
+                branch.state = Run::Sleeping;
+                branch.deadline = deadline;
+            } else {
+                record(run, index, branch.pc, deadline, now);
+                branch.time = deadline;
+                branch.pc++;
+            }
+            break;
+        }
+        case Program::WaitFeedback:
+            if (branch.pending > 0) {
+                branch.state = Run::WaitingFeedback;
+            } else {
+                record(run, index, branch.pc, branch.time, now);
+                branch.pc++;
+            }
+            break;
+        case Program::WaitSensor:
+            if (isSatisfied(run, branch.pc)) {
+                record(run, index, branch.pc, branch.time, now);
+                branch.pc++;
+            } else {
+                branch.state = Run::WaitingSensor;
+                branch.deadline = instruction.duration > 0 ? branch.time + instruction.duration
+                                                           : Never;
+            }
+            break;
+        case Program::LoopBegin:
+            run->counters[instruction.resource] = instruction.operand > 0 ? instruction.operand
+                                                                          : -1;
+            branch.pc++;
+            break;
+        case Program::LoopEnd: {
+            int &counter = run->counters[instruction.resource];
+            if (counter < 0 || --counter > 0) {
+                branch.pc = instruction.operand;
+            } else {
+                branch.pc++;
+            }
+            break;
+        }
+        case Program::Fork: {
+            // The branch runs the first arm itself; the Branch entries chain the others.
+            const int first = branch.pc + 1;
+            const qint64 time = branch.time;
+            run->joins[instruction.resource] = instruction.operand;
+            run->joinTimes[instruction.resource] = time;
+            for (int arm = code.at(first).operand; arm >= 0; arm = code.at(arm).operand) {
+                spawn(run, arm + 1, time);
+            }
+            run->branches[index].pc = first + 1;
+            break;
+        }
+        case Program::Join: {
+            // The last branch to arrive continues, at the time the slowest arm finished.
+            const int slot = instruction.resource;
+            run->joinTimes[slot] = qMax(run->joinTimes.at(slot), branch.time);
+            if (--run->joins[slot] > 0) {
+                branch.state = Run::Finished;
+            } else {
+                branch.time = run->joinTimes.at(slot);
+                branch.pc = instruction.operand;
+            }
+            break;
+        }
+        case Program::Branch:
+            branch.pc++;
+            break;
+        case Program::End:
+            branch.state = Run::Finished;
+            break;
+        }
+    }
+}
+
+bool QLegoMotionScheduler::isSatisfied(const Run *run, int pc) const
+{
+    const auto &instruction = run->program.m_instructions.at(pc);
+    if (!run->valid.at(instruction.resource)) {
+        return false;
+    }
+    const auto &sample = run->samples.at(instruction.resource);
+    if (instruction.operand >= sample.count) {
+        return false;
+    }
+    const double value = sample.value(instruction.operand);
+    return instruction.comparison == QLegoMotionProgram::AtLeast ? value >= instruction.threshold
+                                                                 : value <= instruction.threshold;
+}
+
+void QLegoMotionScheduler::send(Run *run, int index, int pc, qint64 now)
+{
+    const auto &instruction = run->program.m_instructions.at(pc);
+    const auto &actuator = run->program.m_actuators.at(instruction.resource);
+    auto &branch = run->branches[index];
+    m_lateness.record(qMax<qint64>(now - branch.time, 0));
+    const int step = record(run, index, pc, branch.time, now);
+
+    const QPointer<QLegoDevice> device = actuator.device;
+    const QPointer<QLegoAttachedDevice> attachment = actuator.attachment;
+    if (!device) {
+        return;
+    }
+    branch.pending++;
+
+    const auto core = m_core;
+    const int id = run->id;
+    const auto message = run->program.m_frames.at(instruction.operand);
+    QMetaObject::invokeMethod(
+            device.data(),
+            [core, id, index, step, device, attachment, message]() {
+                // Whichever comes first of the reply finishing and the command being dropped
+                // settles it.
+                const QSharedPointer<bool> settled(new bool(false));
+                const auto settle = [core, id, index, settled]() {
+                    if (!*settled) {
+                        *settled = true;
+                        core->commandFinished(id, index);
+                    }
+                };
+                const auto transmitted = [core, id, step, settle](qint64 timestamp) {
+                    core->commandTransmitted(id, step, timestamp);
+                    if (timestamp < 0) {
+                        settle();
+                    }
+                };
+
+                if (!device || !attachment || !attachment->attached()) {
+                    transmitted(-1);
+                    return;
+                }
+                // A dropped command discards its reply, so the port is not held by it.
+                const auto reply = device->transmitCommand(attachment, message, transmitted);
+                QObject::connect(reply, &QLegoCommandReply::finished, settle);
+            },
+            Qt::QueuedConnection);
+}
+
+int QLegoMotionScheduler::record(Run *run, int branch, int pc, qint64 scheduled, qint64 now)
+{
+    m_steps.fetch_add(1, std::memory_order_relaxed);
+    if (run->trace.size() >= MaxTraceSteps) {
+        return -1;
+    }
+    run->trace.append({ pc, branch, scheduled, now, -1 });
+    return run->trace.size() - 1;
+}
+
+int QLegoMotionScheduler::spawn(Run *run, int pc, qint64 time)
+{
+    const Run::Branch branch = { pc, Run::Ready, time, 0, 0, 0 };
+    for (int i = 0; i < run->branches.size(); i++) {
+        const auto &state = run->branches.at(i);
+        if (state.state == Run::Finished && state.pending == 0) {
+            run->branches[i] = branch;
+            return i;
+        }
+    }
+    run->branches.append(branch);
+    return run->branches.size() - 1;
+}
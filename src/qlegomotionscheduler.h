@@ -0,0 +1,62 @@
+#ifndef QLEGOMOTIONSCHEDULER_H
+#define QLEGOMOTIONSCHEDULER_H
+
+#include "qlegoglobal.h"
+#include "qlegolatencyhistogram.h"
+#include "qlegomotionprogram.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QVector>
+
+#include <atomic>
+
+QT_FORWARD_DECLARE_CLASS(QThread)
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoMotionScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int MaxTraceSteps = 4096;
+
+    explicit QLegoMotionScheduler(QObject *parent = nullptr);
+    ~QLegoMotionScheduler();
+
+    int start(const QLegoMotionProgram &program);
+    void cancel(int run);
+    bool isRunning(int run) const;
+    int runningPrograms() const;
+    QVector<QLegoMotionStep> takeTrace(int run);
+
+    quint64 steps() const;
+    const QLegoLatencyHistogram *lateness() const;
+
+Q_SIGNALS:
+    void finished(int run);
+
+private:
+    Q_DISABLE_COPY(QLegoMotionScheduler)
+
+    struct Run;
+    struct Core;
+
+    void run();
+    bool advance(Run *run, qint64 now, qint64 &next);
+    void execute(Run *run, int branch, qint64 now);
+    bool isSatisfied(const Run *run, int pc) const;
+    void send(Run *run, int branch, int pc, qint64 now);
+    int record(Run *run, int branch, int pc, qint64 scheduled, qint64 now);
+    int spawn(Run *run, int pc, qint64 time);
+
+    QSharedPointer<Core> m_core;
+    QThread *m_worker;
+    std::atomic<quint64> m_steps;
+    QLegoLatencyHistogram m_lateness;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -1,5 +1,6 @@
 #include "qlegomotor.h"
 #include "qlegocommon.h"
+#include "qlegocommandreply.h"
 #include <QString>
 #include <QLoggingCategory>
 
@@ -11,6 +12,34 @@ enum MotorValues
     Brake = 127,
 };
 
+enum MotorSubCommands
+{
+    SetAccTime = 0x05,
+    SetDecTime = 0x06,
+    StartSpeed = 0x07,
+    StartSpeedForTime = 0x09,
+    StartSpeedForDegrees = 0x0B,
+    GotoAbsolutePosition = 0x0D,
+};
+
+enum MotorModes
+{
+    PresetEncoder = 0x02,
+};
+
+// The hub keeps a single acceleration and deceleration profile per port.
+static const quint8 ProfileNumber = 0x00;
+
+static inline qint8 clampSpeed(int speed)
+{
+    return static_cast<qint8>(qBound(-100, speed, 100));
+}
+
+static inline quint8 clampPower(int power)
+{
+    return static_cast<quint8>(qBound(0, power, 100));
+}
+
 /*!
   \class QLegoMotor
   \brief The QLegoMotor class allows access to any motors connected to a LEGO device.
@@ -18,8 +47,9 @@ enum MotorValues
   \ingroup attached-devices
 
   QLegoMotor is the implementation of QLegoAbstractDevice specifically for motors.
-  Because motors provide no feedback, QLegoMotor is used solely for issuing commands
-  to a device attached to a LEGO Hub.
+  QLegoMotor issues commands to a motor attached to a LEGO Hub. Motors with encoders also
+  report their speed and position once subscribed to \l{QLegoMotor::SpeedMode},
+  \l{QLegoMotor::PositionMode} or \l{QLegoMotor::AbsolutePositionMode}.
 
   Motors can be detected by connecting to the \l{QLegoDevice::deviceAttached()} signal,
   or by calling the \l{QLegoDevice::waitForAttachedMotor()} functions.
@@ -29,6 +59,15 @@ enum MotorValues
 
   \sa QLegoDevice, QLegoAttachedDevice
 
+  Tacho motors can also run closed-loop commands on the hub itself, such as
+  \l{QLegoMotor::startSpeedForDegrees()} or \l{QLegoMotor::gotoAbsolutePosition()}.
+  These are timed and positioned by the hub rather than by the host, so they are not affected
+  by Bluetooth latency.
+
+  Acceleration and deceleration ramps are also applied by the hub. Configure them once with
+  \l{QLegoMotor::accelerationTime} and \l{QLegoMotor::decelerationTime}, then select which of
+  them the speed commands use with \l{QLegoMotor::profiles}.
+
   This example sets any attached motors to 50% power, waits 5 seconds, then stops the motor.
 
   \code
@@ -53,6 +92,44 @@ enum MotorValues
   \endcode
 */
 
+/*!
+    \enum QLegoMotor::Mode
+
+    The input modes of motors with encoders.
+
+    \value PowerMode             The power currently applied.
+
+    \value SpeedMode             The measured speed in percent.
+
+    \value PositionMode          The encoder position in degrees.
+
+    \value AbsolutePositionMode  The absolute position in degrees, from -180 to 179.
+*/
+
+/*!
+    \enum QLegoMotor::EndState
+
+    What the motor does after a timed or positioned command has finished.
+
+    \value Float  The motor is left to spin freely.
+
+    \value Hold   The motor actively holds its position.
+
+    \value Brake  The motor brakes and then floats.
+*/
+
+/*!
+    \enum QLegoMotor::Profile
+
+    Which hub-side ramp profiles a speed command uses.
+
+    \value NoProfile            Speed changes are applied without a ramp.
+
+    \value AccelerationProfile  Speed increases follow the acceleration time.
+
+    \value DecelerationProfile  Speed decreases follow the deceleration time.
+*/
+
 /*!
     \fn void QLegoMotor::powerChanged()
 
@@ -67,6 +144,12 @@ enum MotorValues
 QLegoMotor::QLegoMotor(DeviceType deviceType, quint8 portId, QObject *parent)
     : QLegoAttachedDevice(deviceType, portId, parent)
     , m_power(0)
+    , m_speed(0)
+    , m_position(0)
+    , m_absolutePosition(0)
+    , m_accelerationTime(-1)
+    , m_decelerationTime(-1)
+    , m_profiles(NoProfile)
 {
     setAttached(true);
     setMotor(true);
@@ -82,26 +165,309 @@ int QLegoMotor::power() const
     return m_power;
 }
 
+/*!
+    \property QLegoMotor::speed
+    \brief the measured speed in percent, while subscribed to \c SpeedMode.
+*/
+int QLegoMotor::speed() const
+{
+    return m_speed;
+}
+
+/*!
+    \property QLegoMotor::position
+    \brief the encoder position in degrees, while subscribed to \c PositionMode.
+*/
+int QLegoMotor::position() const
+{
+    return m_position;
+}
+
+/*!
+    \property QLegoMotor::absolutePosition
+    \brief the absolute position in degrees, while subscribed to \c AbsolutePositionMode.
+*/
+int QLegoMotor::absolutePosition() const
+{
+    return m_absolutePosition;
+}
+
+QLegoValueFormat QLegoMotor::valueFormat(quint8 mode) const
+{
+    switch (mode) {
+        case Mode::PowerMode:
+        case Mode::SpeedMode:
+            return { 1, QLegoValueFormat::Int8 };
+        case Mode::PositionMode:
+            return { 1, QLegoValueFormat::Int32 };
+        case Mode::AbsolutePositionMode:
+            return { 1, QLegoValueFormat::Int16 };
+        default:
+            return QLegoAttachedDevice::valueFormat(mode);
+    }
+}
+
+/*!
+    Updates the power when a power command prepared by QLegoDispatchGroup or QLegoRule, given
+    by \a bytes, has been sent.
+*/
+void QLegoMotor::processTransmittedCommand(const QByteArray &bytes)
+{
+    // WriteDirectModeData (0x51) in mode 0.
+    if (bytes.size() >= 6 && bytes[3] == 0x51 && bytes[4] == 0x00) {
+        updatePower(static_cast<qint8>(bytes[5]));
+    }
+}
+
+void QLegoMotor::processSample(const QLegoSample &sample)
+{
+    if (sample.count < 1) {
+        return;
+    }
+
+    const int value = sample.values[0];
+    switch (sample.mode) {
+        case Mode::SpeedMode:
+            if (value != m_speed) {
+                m_speed = value;
+                emit speedChanged(value);
+            }
+            break;
+        case Mode::PositionMode:
+            if (value != m_position) {
+                m_position = value;
+                emit positionChanged(value);
+            }
+            break;
+        case Mode::AbsolutePositionMode:
+            if (value != m_absolutePosition) {
+                m_absolutePosition = value;
+                emit absolutePositionChanged(value);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/*!
+    \property QLegoMotor::accelerationTime
+    \brief the time in milliseconds to ramp from 0 to 100% speed.
+
+    The value is stored on the hub. Setting the same value again does not send a new command.
+    The value is -1 until an acceleration time has been set, and again when the hub discards
+    the command or it cannot be sent.
+*/
+int QLegoMotor::accelerationTime() const
+{
+    return m_accelerationTime;
+}
+
+void QLegoMotor::setAccelerationTime(int msecs)
+{
+    msecs = qBound(0, msecs, 10000);
+    if (msecs == m_accelerationTime) {
+        return;
+    }
+    m_accelerationTime = msecs;
+
+    QByteArray bytes;
+    appendLittleEndian<quint16>(bytes, static_cast<quint16>(msecs));
+    bytes += static_cast<char>(ProfileNumber);
+    qCDebug(motorLogger) << "setAccelerationTime:" << msecs;
+    forgetIfDiscarded(writePortOutput(MotorSubCommands::SetAccTime, bytes), &m_accelerationTime);
+}
+
+/*!
+    \property QLegoMotor::decelerationTime
+    \brief the time in milliseconds to ramp from 100% to 0 speed.
+
+    The value is stored on the hub. Setting the same value again does not send a new command.
+    The value is -1 until a deceleration time has been set, and again when the hub discards
+    the command or it cannot be sent.
+*/
+int QLegoMotor::decelerationTime() const
+{
+    return m_decelerationTime;
+}
+
+void QLegoMotor::setDecelerationTime(int msecs)
+{
+    msecs = qBound(0, msecs, 10000);
+    if (msecs == m_decelerationTime) {
+        return;
+    }
+    m_decelerationTime = msecs;
+
+    QByteArray bytes;
+    appendLittleEndian<quint16>(bytes, static_cast<quint16>(msecs));
+    bytes += static_cast<char>(ProfileNumber);
+    qCDebug(motorLogger) << "setDecelerationTime:" << msecs;
+    forgetIfDiscarded(writePortOutput(MotorSubCommands::SetDecTime, bytes), &m_decelerationTime);
+}
+
+// A ramp time the hub never applied is forgotten, so that setting it again resends it.
+void QLegoMotor::forgetIfDiscarded(QLegoCommandReply *reply, int *msecs)
+{
+    const int value = *msecs;
+    const auto forget = [msecs, value]() {
+        if (*msecs == value) {
+            *msecs = -1;
+        }
+    };
+    // A command for a closed link is discarded before it is returned.
+    if (reply->state() == QLegoCommandReply::Discarded) {
+        forget();
+        return;
+    }
+    connect(reply, &QLegoCommandReply::discarded, this, forget);
+}
+
+/*!
+    \property QLegoMotor::profiles
+    \brief which ramp profiles are used by speed and position commands.
+
+    Changing the active profiles is local; no command is sent until the next speed command.
+*/
+QLegoMotor::Profiles QLegoMotor::profiles() const
+{
+    return m_profiles;
+}
+
+void QLegoMotor::setProfiles(Profiles profiles)
+{
+    m_profiles = profiles;
+}
+
+/*!
+    Sets the motor to \a power percent. Negative values run the motor in reverse.
+
+    \sa startPower()
+*/
 void QLegoMotor::setPower(int power)
 {
-    m_power = mapSpeed(power);
+    startPower(power);
+}
+
+/*!
+    Sets the motor to \a power percent and returns a reply that tracks the command.
+
+    Power is applied without any speed regulation by the hub.
+*/
+QLegoCommandReply *QLegoMotor::startPower(int power)
+{
+    updatePower(power);
     qCDebug(motorLogger) << "setPower:" << m_power;
+    return writeDirect(0x00, QByteArray(1, m_power));
+}
+
+/*!
+    Sets the power reported by \l{QLegoMotor::power} to \a power percent, without sending a
+    command.
+*/
+void QLegoMotor::updatePower(int power)
+{
+    m_power = mapSpeed(power);
     emit powerChanged();
-    writeDirect(0x00, QByteArray(1, m_power));
 }
 
 /*!
     Commands the motor to stop.
 */
-void QLegoMotor::stop()
+QLegoCommandReply *QLegoMotor::stop()
 {
-    setPower(MotorValues::Stop);
+    return startPower(MotorValues::Stop);
 }
 
 /*!
     Commands the motor to start braking.
 */
-void QLegoMotor::brake()
+QLegoCommandReply *QLegoMotor::brake()
+{
+    return startPower(MotorValues::Brake);
+}
+
+/*!
+    Starts running the motor at \a speed percent, using at most \a maxPower percent of power.
+
+    Unlike \l{QLegoMotor::setPower()}, the speed is regulated by the hub.
+*/
+QLegoCommandReply *QLegoMotor::startSpeed(int speed, int maxPower)
+{
+    QByteArray bytes;
+    bytes += static_cast<char>(clampSpeed(speed));
+    bytes += static_cast<char>(clampPower(maxPower));
+    bytes += static_cast<char>(m_profiles);
+    qCDebug(motorLogger) << "startSpeed:" << speed;
+    return writePortOutput(MotorSubCommands::StartSpeed, bytes);
+}
+
+/*!
+    Runs the motor at \a speed percent for \a msecs milliseconds, then applies \a endState.
+    At most \a maxPower percent of power is used.
+*/
+QLegoCommandReply *QLegoMotor::startSpeedForTime(int msecs, int speed, int maxPower,
+                                                 EndState endState)
+{
+    QByteArray bytes;
+    appendLittleEndian<quint16>(bytes, static_cast<quint16>(qBound(0, msecs, 0xFFFF)));
+    bytes += static_cast<char>(clampSpeed(speed));
+    bytes += static_cast<char>(clampPower(maxPower));
+    bytes += static_cast<char>(endState);
+    bytes += static_cast<char>(m_profiles);
+    qCDebug(motorLogger) << "startSpeedForTime:" << msecs << speed;
+    return writePortOutput(MotorSubCommands::StartSpeedForTime, bytes);
+}
+
+/*!
+    Rotates the motor by \a degrees at \a speed percent, then applies \a endState.
+    At most \a maxPower percent of power is used.
+
+    A negative value for \a degrees reverses the direction of \a speed.
+*/
+QLegoCommandReply *QLegoMotor::startSpeedForDegrees(int degrees, int speed, int maxPower,
+                                                    EndState endState)
+{
+    if (degrees < 0) {
+        degrees = -degrees;
+        speed = -speed;
+    }
+    QByteArray bytes;
+    appendLittleEndian<quint32>(bytes, static_cast<quint32>(degrees));
+    bytes += static_cast<char>(clampSpeed(speed));
+    bytes += static_cast<char>(clampPower(maxPower));
+    bytes += static_cast<char>(endState);
+    bytes += static_cast<char>(m_profiles);
+    qCDebug(motorLogger) << "startSpeedForDegrees:" << degrees << speed;
+    return writePortOutput(MotorSubCommands::StartSpeedForDegrees, bytes);
+}
+
+/*!
+    Moves the motor to the absolute encoder \a position (in degrees) at \a speed percent,
+    then applies \a endState. At most \a maxPower percent of power is used.
+
+    \sa presetEncoder()
+*/
+QLegoCommandReply *QLegoMotor::gotoAbsolutePosition(int position, int speed, int maxPower,
+                                                    EndState endState)
+{
+    QByteArray bytes;
+    appendLittleEndian<qint32>(bytes, position);
+    bytes += static_cast<char>(clampSpeed(qAbs(speed)));
+    bytes += static_cast<char>(clampPower(maxPower));
+    bytes += static_cast<char>(endState);
+    bytes += static_cast<char>(m_profiles);
+    qCDebug(motorLogger) << "gotoAbsolutePosition:" << position << speed;
+    return writePortOutput(MotorSubCommands::GotoAbsolutePosition, bytes);
+}
+
+/*!
+    Sets the current encoder position of the motor to \a position degrees.
+*/
+QLegoCommandReply *QLegoMotor::presetEncoder(int position)
 {
-    setPower(MotorValues::Brake);
+    QByteArray bytes;
+    appendLittleEndian<qint32>(bytes, position);
+    qCDebug(motorLogger) << "presetEncoder:" << position;
+    return writeDirect(MotorModes::PresetEncoder, bytes);
 }
@@ -6,6 +6,7 @@
 #include <QtCore/QObject>
 
 QT_FORWARD_DECLARE_CLASS(QString)
+QT_FORWARD_DECLARE_CLASS(QLegoCommandReply)
 
 QT_BEGIN_NAMESPACE
 
@@ -13,25 +14,98 @@ class Q_LEGO_EXPORT QLegoMotor : public QLegoAttachedDevice
 {
     Q_OBJECT
     Q_PROPERTY(int power READ power WRITE setPower NOTIFY powerChanged)
+    Q_PROPERTY(int accelerationTime READ accelerationTime WRITE setAccelerationTime)
+    Q_PROPERTY(int decelerationTime READ decelerationTime WRITE setDecelerationTime)
+    Q_PROPERTY(Profiles profiles READ profiles WRITE setProfiles)
+    Q_PROPERTY(int speed READ speed NOTIFY speedChanged)
+    Q_PROPERTY(int position READ position NOTIFY positionChanged)
+    Q_PROPERTY(int absolutePosition READ absolutePosition NOTIFY absolutePositionChanged)
 
 public:
+    enum Mode
+    {
+        PowerMode = 0,
+        SpeedMode = 1,
+        PositionMode = 2,
+        AbsolutePositionMode = 3
+    };
+    Q_ENUM(Mode)
+
+    enum EndState
+    {
+        Float = 0,
+        Hold = 126,
+        Brake = 127
+    };
+    Q_ENUM(EndState)
+
+    enum Profile
+    {
+        NoProfile = 0x00,
+        AccelerationProfile = 0x01,
+        DecelerationProfile = 0x02
+    };
+    Q_DECLARE_FLAGS(Profiles, Profile)
+    Q_FLAG(Profiles)
+
     explicit QLegoMotor(DeviceType deviceType, quint8 portId, QObject *parent = nullptr);
 
     int power() const;
+    int accelerationTime() const;
+    int decelerationTime() const;
+    Profiles profiles() const;
+    int speed() const;
+    int position() const;
+    int absolutePosition() const;
+
+    QLegoValueFormat valueFormat(quint8 mode) const override;
 
-    Q_INVOKABLE void stop();
-    Q_INVOKABLE void brake();
+    Q_INVOKABLE virtual QLegoCommandReply *stop();
+    Q_INVOKABLE virtual QLegoCommandReply *brake();
+
+    Q_INVOKABLE QLegoCommandReply *startPower(int power);
+    Q_INVOKABLE QLegoCommandReply *startSpeed(int speed, int maxPower = 100);
+    Q_INVOKABLE QLegoCommandReply *startSpeedForTime(int msecs, int speed, int maxPower = 100,
+                                                     EndState endState = Brake);
+    Q_INVOKABLE QLegoCommandReply *startSpeedForDegrees(int degrees, int speed,
+                                                        int maxPower = 100,
+                                                        EndState endState = Brake);
+    Q_INVOKABLE QLegoCommandReply *gotoAbsolutePosition(int position, int speed,
+                                                        int maxPower = 100,
+                                                        EndState endState = Brake);
+    Q_INVOKABLE QLegoCommandReply *presetEncoder(int position);
 
 public Q_SLOTS:
     void setPower(int power);
+    void setAccelerationTime(int msecs);
+    void setDecelerationTime(int msecs);
+    void setProfiles(Profiles profiles);
 
 Q_SIGNALS:
     void powerChanged();
+    void speedChanged(int speed);
+    void positionChanged(int position);
+    void absolutePositionChanged(int position);
+
+protected:
+    void processSample(const QLegoSample &sample) override;
+    void processTransmittedCommand(const QByteArray &bytes) override;
+    void updatePower(int power);
 
 private:
+    void forgetIfDiscarded(QLegoCommandReply *reply, int *msecs);
+
     int m_power;
+    int m_speed;
+    int m_position;
+    int m_absolutePosition;
+    int m_accelerationTime;
+    int m_decelerationTime;
+    Profiles m_profiles;
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(QLegoMotor::Profiles)
+
 QT_END_NAMESPACE
 
 #endif
@@ -0,0 +1,197 @@
+#include "qlegopidcontroller.h"
+#include "qlegomotor.h"
+
+/*!
+  \class QLegoPidController
+  \brief The QLegoPidController class is a reference PID controller for motors.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  QLegoPidController computes a motor power from the distance between a setpoint and a
+  measurement, such as a position, speed or tilt reported by a sensor:
+
+  \list
+  \li The proportional term reacts to the current error.
+  \li The integral term removes the error that remains, and is clamped to the output limits
+      so it cannot wind up while the output saturates.
+  \li The derivative term damps the response. It is taken on the measurement rather than on
+      the error, so changing the setpoint does not kick the output.
+  \endlist
+
+  motorStep() returns a QLegoControlLoop step that feeds one input of the loop to the
+  controller and sets the power of a motor with the result.
+
+  \code
+  motor->subscribe(QLegoMotor::PositionMode);
+  QLegoPidController pid(0.8, 0.2, 0.05);
+  pid.setSetpoint(360);
+  const int position = loop->addInput(motor, QLegoMotor::PositionMode);
+  loop->addStep(pid.motorStep(motor, position));
+  loop->start();
+  \endcode
+
+  The gains and limits must not change while a loop runs the controller; the setpoint can be
+  changed from any thread.
+*/
+
+QLegoPidController::QLegoPidController(double kp, double ki, double kd)
+    : m_kp(kp)
+    , m_ki(ki)
+    , m_kd(kd)
+    , m_minimumOutput(-100)
+    , m_maximumOutput(100)
+    , m_setpoint(0)
+    , m_integral(0)
+    , m_previousMeasurement(0)
+    , m_hasMeasurement(false)
+    , m_output(0)
+{
+}
+
+/*!
+    Returns the proportional gain.
+*/
+double QLegoPidController::kp() const
+{
+    return m_kp;
+}
+
+/*!
+    Sets the proportional gain to \a kp.
+*/
+void QLegoPidController::setKp(double kp)
+{
+    m_kp = kp;
+}
+
+/*!
+    Returns the integral gain, per second.
+*/
+double QLegoPidController::ki() const
+{
+    return m_ki;
+}
+
+/*!
+    Sets the integral gain to \a ki.
+*/
+void QLegoPidController::setKi(double ki)
+{
+    m_ki = ki;
+}
+
+/*!
+    Returns the derivative gain, in seconds.
+*/
+double QLegoPidController::kd() const
+{
+    return m_kd;
+}
+
+/*!
+    Sets the derivative gain to \a kd.
+*/
+void QLegoPidController::setKd(double kd)
+{
+    m_kd = kd;
+}
+
+/*!
+    Returns the lowest output. The default is -100.
+*/
+double QLegoPidController::minimumOutput() const
+{
+    return m_minimumOutput;
+}
+
+/*!
+    Returns the highest output. The default is 100.
+*/
+double QLegoPidController::maximumOutput() const
+{
+    return m_maximumOutput;
+}
+
+/*!
+    Limits the output to the range from \a minimum to \a maximum.
+*/
+void QLegoPidController::setOutputLimits(double minimum, double maximum)
+{
+    m_minimumOutput = qMin(minimum, maximum);
+    m_maximumOutput = qMax(minimum, maximum);
+    m_integral = qBound(m_minimumOutput, m_integral, m_maximumOutput);
+}
+
+/*!
+    Returns the value the controller steers the measurement towards.
+*/
+double QLegoPidController::setpoint() const
+{
+    return m_setpoint.load(std::memory_order_relaxed);
+}
+
+/*!
+    Sets the setpoint to \a setpoint. This function is thread-safe.
+*/
+void QLegoPidController::setSetpoint(double setpoint)
+{
+    m_setpoint.store(setpoint, std::memory_order_relaxed);
+}
+
+/*!
+    Returns the output of the last update().
+*/
+double QLegoPidController::output() const
+{
+    return m_output;
+}
+
+/*!
+    Returns the output for \a measurement, taken \a dt seconds after the previous one.
+    The integral and derivative terms are left out when \a dt is not positive.
+*/
+double QLegoPidController::update(double measurement, double dt)
+{
+    const double error = setpoint() - measurement;
+
+    double derivative = 0;
+    if (dt > 0) {
+        m_integral += m_ki * error * dt;
+        m_integral = qBound(m_minimumOutput, m_integral, m_maximumOutput);
+        if (m_hasMeasurement) {
+            derivative = -m_kd * (measurement - m_previousMeasurement) / dt;
+        }
+    }
+    m_previousMeasurement = measurement;
+    m_hasMeasurement = true;
+
+    m_output = qBound(m_minimumOutput, m_kp * error + m_integral + derivative, m_maximumOutput);
+    return m_output;
+}
+
+/*!
+    Forgets the integral and the previous measurement.
+*/
+void QLegoPidController::reset()
+{
+    m_integral = 0;
+    m_previousMeasurement = 0;
+    m_hasMeasurement = false;
+    m_output = 0;
+}
+
+/*!
+    Returns a control loop step that updates the controller with value \a index of \a input
+    and sets the power of \a motor to the output. Ticks before the input has a sample do
+    nothing. The controller must outlive the loop.
+*/
+QLegoControlLoop::Step QLegoPidController::motorStep(QLegoMotor *motor, int input, int index)
+{
+    return [this, motor, input, index](QLegoControlContext &context) {
+        if (!context.hasSample(input)) {
+            return;
+        }
+        const double output = update(context.value(input, index), context.interval());
+        context.setPower(motor, qRound(output));
+    };
+}
@@ -0,0 +1,57 @@
+#ifndef QLEGOPIDCONTROLLER_H
+#define QLEGOPIDCONTROLLER_H
+
+#include "qlegoglobal.h"
+#include "qlegocontrolloop.h"
+
+#include <atomic>
+
+QT_FORWARD_DECLARE_CLASS(QLegoMotor)
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoPidController
+{
+public:
+    explicit QLegoPidController(double kp = 1.0, double ki = 0.0, double kd = 0.0);
+
+    double kp() const;
+    void setKp(double kp);
+    double ki() const;
+    void setKi(double ki);
+    double kd() const;
+    void setKd(double kd);
+
+    double minimumOutput() const;
+    double maximumOutput() const;
+    void setOutputLimits(double minimum, double maximum);
+
+    double setpoint() const;
+    void setSetpoint(double setpoint);
+
+    double output() const;
+    double update(double measurement, double dt);
+    void reset();
+
+    QLegoControlLoop::Step motorStep(QLegoMotor *motor, int input, int index = 0);
+
+private:
+    Q_DISABLE_COPY(QLegoPidController)
+
+    double m_kp;
+    double m_ki;
+    double m_kd;
+    double m_minimumOutput;
+    double m_maximumOutput;
+    // Set from any thread while the loop runs.
+    std::atomic<double> m_setpoint;
+
+    double m_integral;
+    double m_previousMeasurement;
+    bool m_hasMeasurement;
+    double m_output;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,96 @@
+#include "qlegoportinformation.h"
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+
+namespace {
+struct PortInformationTable
+{
+    QMutex mutex;
+    QHash<QByteArray, QLegoPortInformation> entries;
+};
+}
+
+Q_GLOBAL_STATIC(PortInformationTable, portInformationTable)
+
+/*!
+    \class QLegoModeInformation
+    \brief The QLegoModeInformation struct describes one mode of an attached device.
+    \inmodule QtLego
+    \ingroup attached-devices
+
+    The fields are filled from the mode information responses of the hub. \c received tells
+    which of them have been reported so far.
+*/
+
+/*!
+    \class QLegoPortInformation
+    \brief The QLegoPortInformation struct describes the modes of an attached device.
+    \inmodule QtLego
+    \ingroup attached-devices
+
+    \c inputModes and \c outputModes are bit masks of the modes in \c modes that can be read and
+    written. \c combinations lists the masks of modes that can be reported together by
+    \l{QLegoAttachedDevice::subscribeCombined()}. \c complete is \c false while discovery is
+    still running.
+
+    \sa QLegoAttachedDevice::portInformation()
+*/
+
+/*!
+    \class QLegoPortInformationTable
+    \brief The QLegoPortInformationTable class caches discovered port information.
+    \inmodule QtLego
+    \ingroup attached-devices
+
+    Devices of the same type and revisions report the same modes, so the result of discovering
+    one of them is shared by all hubs in the process. Entries are keyed by the device type,
+    hardware revision and software revision bytes of the attachment message. The table is
+    thread-safe.
+*/
+
+/*!
+    Copies the entry for \a key into \a information. Returns \c false if there is none.
+*/
+bool QLegoPortInformationTable::find(const QByteArray &key, QLegoPortInformation *information)
+{
+    auto table = portInformationTable();
+    QMutexLocker locker(&table->mutex);
+    const auto it = table->entries.constFind(key);
+    if (it == table->entries.constEnd()) {
+        return false;
+    }
+    *information = it.value();
+    return true;
+}
+
+/*!
+    Stores \a information for \a key, replacing any previous entry.
+*/
+void QLegoPortInformationTable::insert(const QByteArray &key,
+                                       const QLegoPortInformation &information)
+{
+    auto table = portInformationTable();
+    QMutexLocker locker(&table->mutex);
+    table->entries.insert(key, information);
+}
+
+/*!
+    Removes all entries, so the next use of every port discovers it again.
+*/
+void QLegoPortInformationTable::clear()
+{
+    auto table = portInformationTable();
+    QMutexLocker locker(&table->mutex);
+    table->entries.clear();
+}
+
+/*!
+    Returns the number of entries.
+*/
+int QLegoPortInformationTable::size()
+{
+    auto table = portInformationTable();
+    QMutexLocker locker(&table->mutex);
+    return table->entries.size();
+}
@@ -0,0 +1,75 @@
+#ifndef QLEGOPORTINFORMATION_H
+#define QLEGOPORTINFORMATION_H
+
+#include "qlegoglobal.h"
+#include "qlegosample.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+QT_BEGIN_NAMESPACE
+
+struct Q_LEGO_EXPORT QLegoModeInformation
+{
+    // Bits of received, one per information type.
+    enum Item
+    {
+        NameItem = 0x01,
+        RawRangeItem = 0x02,
+        PercentRangeItem = 0x04,
+        SiRangeItem = 0x08,
+        SymbolItem = 0x10,
+        ValueFormatItem = 0x20,
+        AllItems = 0x3F
+    };
+
+    QString name;
+    QString symbol;
+    float rawMinimum = 0;
+    float rawMaximum = 0;
+    float percentMinimum = 0;
+    float percentMaximum = 0;
+    float siMinimum = 0;
+    float siMaximum = 0;
+    QLegoValueFormat format = { 0, QLegoValueFormat::Int8 };
+    quint8 figures = 0;
+    quint8 decimals = 0;
+    quint8 received = 0;
+};
+
+struct Q_LEGO_EXPORT QLegoPortInformation
+{
+    enum Capability
+    {
+        Output = 0x01,
+        Input = 0x02,
+        LogicalCombinable = 0x04,
+        LogicalSynchronizable = 0x08
+    };
+
+    quint8 capabilities = 0;
+    quint16 inputModes = 0;
+    quint16 outputModes = 0;
+    QVector<quint16> combinations;
+    QVector<QLegoModeInformation> modes;
+    bool complete = false;
+
+    bool isValid() const { return !modes.isEmpty(); }
+};
+
+class Q_LEGO_EXPORT QLegoPortInformationTable
+{
+public:
+    static bool find(const QByteArray &key, QLegoPortInformation *information);
+    static void insert(const QByteArray &key, const QLegoPortInformation &information);
+    static void clear();
+    static int size();
+
+private:
+    QLegoPortInformationTable() = delete;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,338 @@
+#include "qlegoreplay.h"
+#include "qlegocapture.h"
+#include <QtCore/QTimer>
+#include <QtBluetooth/QBluetoothAddress>
+
+static const int DefaultCommandTimeout = 1000;
+
+/*!
+  \class QLegoReplay
+  \brief The QLegoReplay class plays back captured hub traffic.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  QLegoReplay is a QLegoTransport that feeds the incoming frames of a QLegoCapture into a
+  QLegoDevice, so field sessions can be reproduced, tested and benchmarked without a hub.
+
+  Frames are delivered with their recorded spacing divided by speed(): 1 replays in real
+  time, 10 ten times faster, and 0 as fast as possible.
+
+  When verifyCommands() is enabled, every frame written by the device is compared with the
+  recorded commands, in order, and differences are reported by mismatch(). Playback also keeps
+  the recorded order: a frame that arrived after a command is held back until the device has
+  sent that command, or until the command timeout has passed. The replay is therefore
+  deterministic whatever its speed. finished() is emitted after the last frame.
+
+  \code
+  auto replay = new QLegoReplay;
+  replay->load(QLegoCapture::findSegments("hub.qlc"));
+  replay->setSpeed(10);
+  auto device = QLegoDevice::createDevice(replay);
+  QObject::connect(replay, &QLegoReplay::mismatch, [](int command, const QByteArray &expected,
+                                                      const QByteArray &actual) {
+      qWarning() << "command" << command << expected.toHex() << actual.toHex();
+  });
+  device->connectToDevice();
+  \endcode
+*/
+
+/*!
+    \fn void QLegoReplay::mismatch(int command, const QByteArray &expected, const QByteArray &actual)
+
+    Emitted when the device wrote \a actual as its command number \a command, where the
+    recording has \a expected. One of them is empty if the device sent a command that was not
+    recorded, or did not send a recorded one within the command timeout.
+*/
+
+/*!
+    \fn void QLegoReplay::finished()
+
+    Emitted when all frames have been replayed.
+*/
+
+/*!
+    Constructs an empty replay with the given \a parent.
+*/
+QLegoReplay::QLegoReplay(QObject *parent)
+    : QLegoTransport(parent)
+    , m_address(0)
+    , m_frames()
+    , m_commands()
+    , m_speed(1)
+    , m_verifyCommands(true)
+    , m_commandTimeout(DefaultCommandTimeout)
+    , m_open(false)
+    , m_finished(false)
+    , m_position(0)
+    , m_commandsSent(0)
+    , m_mismatches(0)
+    , m_timer(new QTimer(this))
+    , m_clock()
+    , m_origin(0)
+    , m_originTimestamp(0)
+    , m_waitingSince(-1)
+{
+    m_timer->setSingleShot(true);
+    m_timer->setTimerType(Qt::PreciseTimer);
+    connect(m_timer, &QTimer::timeout, this, &QLegoReplay::advance);
+}
+
+/*!
+    Loads the frames of the device with \a address from the capture \a segments. With an
+    \a address of 0, the device of the first record is replayed. Returns \c false if the
+    capture cannot be read.
+*/
+bool QLegoReplay::load(const QStringList &segments, quint64 address)
+{
+    QLegoCaptureReader reader(segments);
+    if (!reader.open()) {
+        return false;
+    }
+
+    QLegoCaptureReader::Record record;
+    while (reader.readNext(&record)) {
+        if (!address) {
+            address = record.address;
+        }
+        if (record.address == address) {
+            addFrame(record.direction == QLegoCapture::Outgoing, record.timestamp,
+                     QByteArray(record.data, record.size));
+        }
+    }
+    m_address = address;
+    return true;
+}
+
+/*!
+    Appends \a frame, recorded at \a timestamp in nanoseconds. An \a outgoing frame is a
+    command expected from the device; any other frame is delivered to it.
+*/
+void QLegoReplay::addFrame(bool outgoing, qint64 timestamp, const QByteArray &frame)
+{
+    if (outgoing) {
+        m_commands.append({ timestamp, frame, m_commands.size() });
+    } else {
+        m_frames.append({ timestamp, frame, m_commands.size() });
+    }
+}
+
+/*!
+    \property QLegoReplay::speed
+    \brief how many times faster than recorded frames are replayed.
+
+    0 replays as fast as possible. The default is 1.
+*/
+qreal QLegoReplay::speed() const
+{
+    return m_speed;
+}
+
+void QLegoReplay::setSpeed(qreal speed)
+{
+    m_speed = qMax<qreal>(speed, 0);
+}
+
+/*!
+    \property QLegoReplay::verifyCommands
+    \brief whether commands written by the device are compared with the recording.
+
+    When disabled, frames are replayed on their timing alone. The default is \c true.
+*/
+bool QLegoReplay::verifyCommands() const
+{
+    return m_verifyCommands;
+}
+
+void QLegoReplay::setVerifyCommands(bool verify)
+{
+    m_verifyCommands = verify;
+}
+
+/*!
+    Sets how long playback waits for a recorded command to \a msecs. The default is one
+    second.
+*/
+void QLegoReplay::setCommandTimeout(int msecs)
+{
+    m_commandTimeout = qMax(msecs, 0);
+}
+
+/*!
+    Returns the number of frames delivered to the device.
+*/
+int QLegoReplay::framesReplayed() const
+{
+    return m_position;
+}
+
+/*!
+    Returns the number of commands written by the device that had a recorded counterpart.
+*/
+int QLegoReplay::commandsVerified() const
+{
+    return qMin(m_commandsSent, m_commands.size());
+}
+
+/*!
+    Returns the number of mismatch() signals emitted.
+*/
+int QLegoReplay::mismatches() const
+{
+    return m_mismatches;
+}
+
+/*!
+    Returns \c true once all frames have been replayed.
+*/
+bool QLegoReplay::atEnd() const
+{
+    return m_finished;
+}
+
+QString QLegoReplay::address() const
+{
+    return QBluetoothAddress(m_address).toString();
+}
+
+bool QLegoReplay::isOpen() const
+{
+    return m_open;
+}
+
+/*!
+    Starts playback from the first frame.
+*/
+void QLegoReplay::open()
+{
+    if (m_open) {
+        return;
+    }
+    m_open = true;
+    m_finished = false;
+    m_position = 0;
+    m_commandsSent = 0;
+    m_mismatches = 0;
+    m_waitingSince = -1;
+
+    m_clock.start();
+    qint64 start = 0;
+    if (!m_frames.isEmpty()) {
+        start = m_frames.first().timestamp;
+    }
+    if (!m_commands.isEmpty() && (m_frames.isEmpty() || m_commands.first().timestamp < start)) {
+        start = m_commands.first().timestamp;
+    }
+    resync(start);
+
+    QTimer::singleShot(0, this, [this]() {
+        if (m_open) {
+            emit opened();
+            advance();
+        }
+    });
+}
+
+/*!
+    Stops playback.
+*/
+void QLegoReplay::close()
+{
+    if (!m_open) {
+        return;
+    }
+    m_open = false;
+    m_timer->stop();
+    emit closed();
+}
+
+/*!
+    Takes \a frame written by the device, and compares it with the next recorded command.
+*/
+void QLegoReplay::write(const QByteArray &frame)
+{
+    if (!m_open) {
+        return;
+    }
+    // Acknowledge from the event loop, as the Bluetooth stack would.
+    QTimer::singleShot(0, this, &QLegoReplay::written);
+    if (!m_verifyCommands) {
+        return;
+    }
+
+    const int command = m_commandsSent++;
+    const QByteArray expected = command < m_commands.size() ? m_commands[command].data
+                                                             : QByteArray();
+    if (expected != frame) {
+        m_mismatches++;
+        emit mismatch(command, expected, frame);
+    }
+
+    // Frames held back for this command continue with their recorded spacing from now on.
+    if (m_waitingSince >= 0 && command < m_commands.size()) {
+        resync(m_commands[command].timestamp);
+    }
+    m_timer->start(0);
+}
+
+void QLegoReplay::advance()
+{
+    while (m_open && m_position <= m_frames.size()) {
+        const bool last = m_position == m_frames.size();
+        const int commandsBefore = last ? m_commands.size() : m_frames[m_position].commandsBefore;
+
+        if (m_verifyCommands && m_commandsSent < commandsBefore) {
+            // The recorded hub answered commands the device has not sent yet.
+            const qint64 now = m_clock.elapsed();
+            if (m_waitingSince < 0) {
+                m_waitingSince = now;
+            }
+            const qint64 remaining = m_commandTimeout - (now - m_waitingSince);
+            if (remaining > 0) {
+                m_timer->start(static_cast<int>(remaining));
+                return;
+            }
+            skipMissingCommands(commandsBefore - m_commandsSent);
+            if (!last) {
+                resync(m_frames[m_position].timestamp);
+            }
+        }
+        m_waitingSince = -1;
+
+        if (last) {
+            break;
+        }
+
+        const Frame &frame = m_frames[m_position];
+        if (m_speed > 0) {
+            const qint64 offset = (frame.timestamp - m_originTimestamp) / m_speed;
+            const qint64 delay = m_origin + offset - m_clock.nsecsElapsed();
+            if (delay > 0) {
+                m_timer->start(static_cast<int>((delay + 999999) / 1000000));
+                return;
+            }
+        }
+
+        m_position++;
+        emit received(frame.data);
+    }
+
+    if (m_open && m_position == m_frames.size() && !m_finished) {
+        m_finished = true;
+        emit finished();
+    }
+}
+
+void QLegoReplay::resync(qint64 timestamp)
+{
+    m_origin = m_clock.nsecsElapsed();
+    m_originTimestamp = timestamp;
+}
+
+void QLegoReplay::skipMissingCommands(int count)
+{
+    for (int i = 0; i < count; i++) {
+        const int command = m_commandsSent++;
+        m_mismatches++;
+        emit mismatch(command, m_commands[command].data, QByteArray());
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef QLEGOREPLAY_H
+#define QLEGOREPLAY_H
+
+#include "qlegoglobal.h"
+#include "qlegotransport.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QVector>
+
+QT_FORWARD_DECLARE_CLASS(QTimer)
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoReplay : public QLegoTransport
+{
+    Q_OBJECT
+    Q_PROPERTY(qreal speed READ speed WRITE setSpeed)
+    Q_PROPERTY(bool verifyCommands READ verifyCommands WRITE setVerifyCommands)
+
+public:
+    explicit QLegoReplay(QObject *parent = nullptr);
+
+    bool load(const QStringList &segments, quint64 address = 0);
+    void addFrame(bool outgoing, qint64 timestamp, const QByteArray &frame);
+
+    qreal speed() const;
+    void setSpeed(qreal speed);
+    bool verifyCommands() const;
+    void setVerifyCommands(bool verify);
+    void setCommandTimeout(int msecs);
+
+    int framesReplayed() const;
+    int commandsVerified() const;
+    int mismatches() const;
+    bool atEnd() const;
+
+    QString address() const override;
+    bool isOpen() const override;
+
+public Q_SLOTS:
+    void open() override;
+    void close() override;
+    void write(const QByteArray &frame) override;
+
+Q_SIGNALS:
+    void mismatch(int command, const QByteArray &expected, const QByteArray &actual);
+    void finished();
+
+private Q_SLOTS:
+    void advance();
+
+private:
+    struct Frame
+    {
+        qint64 timestamp;
+        QByteArray data;
+        // Recorded commands that were sent before this frame arrived.
+        int commandsBefore;
+    };
+
+    void resync(qint64 timestamp);
+    void skipMissingCommands(int count);
+
+    quint64 m_address;
+    QVector<Frame> m_frames;
+    QVector<Frame> m_commands;
+    qreal m_speed;
+    bool m_verifyCommands;
+    int m_commandTimeout;
+    bool m_open;
+    bool m_finished;
+    int m_position;
+    int m_commandsSent;
+    int m_mismatches;
+    QTimer *m_timer;
+    QElapsedTimer m_clock;
+    qint64 m_origin;
+    qint64 m_originTimestamp;
+    qint64 m_waitingSince;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,289 @@
+#include "qlegorule.h"
+#include "qlegocommon.h"
+#include "qlegoattacheddevice.h"
+#include "qlegodevice.h"
+#include "qlegomotor.h"
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QThread>
+
+Q_LOGGING_CATEGORY(ruleLogger, "lego.rule");
+
+/*!
+  \class QLegoRule
+  \brief The QLegoRule class sends a command as soon as a sensor value or button matches.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  Reflexes such as stopping a motor when the distance sensor reads less than 5 cm, or setting
+  its power when a button is pressed, usually go through a signal and a slot before their
+  command is sent. Every event loop they cross adds its queueing delay.
+
+  A rule says the same thing declaratively. Once added to the hub its source belongs to, the
+  hub evaluates it in the frame parser, right after a value or button report is decoded and
+  before any signal is emitted. The command of a rule is encoded when it is set, and goes
+  straight to the head of the command queue of its hub, replacing motion commands still
+  queued for the same port, as with QLegoDispatchGroup.
+
+  \code
+  auto rule = new QLegoRule(this);
+  rule->setSensor(distanceSensor, 0, QLegoColorDistanceSensor::DistanceMode);
+  rule->setCondition(QLegoRule::Below, 5);
+  rule->setPower(device, motor, 127);
+  device->addRule(rule);
+  \endcode
+
+  Rules trigger when their condition becomes true, and trigger again only after a value that
+  does not match. latency() records the time from receiving the frame that triggered the
+  rule to the command being handed to the link of its hub.
+
+  The command may be for a motor on another hub. If that hub lives in a different thread, the
+  command is posted to it. Rules must be configured before they are added.
+
+  \sa QLegoDevice::addRule()
+*/
+
+/*!
+    \enum QLegoRule::Comparison
+
+    How the value of the source is compared with the threshold.
+
+    \value Equal     The value equals the threshold.
+    \value NotEqual  The value differs from the threshold.
+    \value Below     The value is less than the threshold.
+    \value AtMost    The value is at most the threshold.
+    \value Above     The value is greater than the threshold.
+    \value AtLeast   The value is at least the threshold.
+*/
+
+/*!
+    \fn void QLegoRule::triggered(qint64 timestamp)
+
+    This signal is emitted from the thread of the source hub after the rule has handed off its
+    command. \a timestamp is when the frame that triggered it was received.
+*/
+
+QLegoRule::QLegoRule(QObject *parent)
+    : QObject(parent)
+    , m_device()
+    , m_sensor()
+    , m_index(0)
+    , m_mode(-1)
+    , m_button(false)
+    , m_comparison(Equal)
+    , m_threshold(0)
+    , m_target()
+    , m_targetAttachment()
+    , m_message()
+    , m_enabled(true)
+    , m_armed(true)
+    , m_triggers(0)
+    , m_latency(new QLegoLatencyHistogram)
+{
+}
+
+QLegoRule::~QLegoRule()
+{
+    if (m_device) {
+        m_device->removeRule(this);
+    }
+    if (m_sensor) {
+        m_sensor->m_rules.removeAll(this);
+    }
+}
+
+/*!
+    Makes value \a index of the samples of \a attachment the source of the rule, or only of
+    samples of \a mode if it is not -1. The attachment must be subscribed to the mode. For a
+    combination of modes, \a index counts the values of the combination.
+*/
+void QLegoRule::setSensor(QLegoAttachedDevice *attachment, int index, int mode)
+{
+    m_sensor = attachment;
+    m_index = index;
+    m_mode = mode;
+    m_button = false;
+}
+
+/*!
+    Makes the button of the hub the source of the rule. Its value is a
+    QLegoDevice::ButtonState.
+*/
+void QLegoRule::setButton()
+{
+    m_sensor = nullptr;
+    m_button = true;
+}
+
+/*!
+    Triggers the rule when the value of the source compares to \a threshold as \a comparison
+    says.
+*/
+void QLegoRule::setCondition(Comparison comparison, double threshold)
+{
+    m_comparison = comparison;
+    m_threshold = threshold;
+}
+
+/*!
+    Sends the port output command \a subCommand with the payload \a data to \a attachment,
+    which is attached to \a device, when the rule triggers.
+*/
+void QLegoRule::setCommand(QLegoDevice *device, QLegoAttachedDevice *attachment,
+                           quint8 subCommand, const QByteArray &data)
+{
+    const auto bytes = attachment->portOutput(subCommand, data);
+    m_target = device;
+    m_targetAttachment = attachment;
+    m_message = QLegoDevice::encodeMessage(bytes);
+}
+
+/*!
+    Sets \a motor, which is attached to \a device, to \a power percent when the rule triggers.
+    The power of the motor changes when the command is sent.
+
+    \sa QLegoMotor::startPower()
+*/
+void QLegoRule::setPower(QLegoDevice *device, QLegoMotor *motor, int power)
+{
+    const qint8 value = mapSpeed(power);
+    setCommand(device, motor, 0x51, QByteArray(1, 0x00) + static_cast<char>(value));
+}
+
+/*!
+    Returns the hub the rule was added to, or \c nullptr.
+*/
+QLegoDevice *QLegoRule::device() const
+{
+    return m_device;
+}
+
+/*!
+    Returns the attached device whose values the rule watches, or \c nullptr.
+*/
+QLegoAttachedDevice *QLegoRule::sensor() const
+{
+    return m_sensor;
+}
+
+/*!
+    Returns \c true if the rule watches the button of its hub.
+*/
+bool QLegoRule::isButton() const
+{
+    return m_button;
+}
+
+/*!
+    \property QLegoRule::enabled
+    \brief whether the rule is evaluated.
+
+    A rule that is enabled again triggers as soon as its condition is true. The property may be
+    set from any thread.
+*/
+bool QLegoRule::isEnabled() const
+{
+    return m_enabled.load(std::memory_order_relaxed);
+}
+
+void QLegoRule::setEnabled(bool enabled)
+{
+    m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+/*!
+    Returns the number of times the rule has triggered.
+*/
+quint64 QLegoRule::triggers() const
+{
+    return m_triggers.load(std::memory_order_relaxed);
+}
+
+/*!
+    Returns the histogram of the time from receiving the frame that triggered the rule to its
+    command being handed to the link.
+*/
+const QLegoLatencyHistogram *QLegoRule::latency() const
+{
+    return m_latency.data();
+}
+
+// Runs in the frame parser of the source hub.
+void QLegoRule::evaluate(const QLegoSample &sample)
+{
+    if (m_mode >= 0 && sample.mode != m_mode) {
+        return;
+    }
+    if (m_index < 0 || m_index >= sample.count) {
+        return;
+    }
+    evaluate(sample.value(m_index), sample.timestamp);
+}
+
+void QLegoRule::evaluate(double value, qint64 timestamp)
+{
+    if (!m_enabled.load(std::memory_order_relaxed)) {
+        m_armed = true;
+        return;
+    }
+
+    bool matches = false;
+    switch (m_comparison) {
+    case Equal:
+        matches = value == m_threshold;
+        break;
+    case NotEqual:
+        matches = value != m_threshold;
+        break;
+    case Below:
+        matches = value < m_threshold;
+        break;
+    case AtMost:
+        matches = value <= m_threshold;
+        break;
+    case Above:
+        matches = value > m_threshold;
+        break;
+    case AtLeast:
+        matches = value >= m_threshold;
+        break;
+    }
+
+    if (!matches) {
+        m_armed = true;
+    } else if (m_armed) {
+        m_armed = false;
+        fire(timestamp);
+    }
+}
+
+void QLegoRule::fire(qint64 timestamp)
+{
+    m_triggers.fetch_add(1, std::memory_order_relaxed);
+    if (!m_target) {
+        qCWarning(ruleLogger) << "rule triggered without a command";
+        emit triggered(timestamp);
+        return;
+    }
+
+    const auto latency = m_latency;
+    const QPointer<QLegoDevice> target = m_target;
+    const QPointer<QLegoAttachedDevice> attachment = m_targetAttachment;
+    const auto message = m_message;
+    const auto send = [latency, timestamp, target, attachment, message]() {
+        if (!target || !attachment || !attachment->attached()) {
+            return;
+        }
+        target->transmitCommand(attachment, message, [latency, timestamp](qint64 transmitted) {
+            if (transmitted >= 0) {
+                latency->record(transmitted - timestamp);
+            }
+        });
+    };
+
+    if (m_target->thread() == QThread::currentThread()) {
+        send();
+    } else {
+        QMetaObject::invokeMethod(m_target.data(), send, Qt::QueuedConnection);
+    }
+    emit triggered(timestamp);
+}
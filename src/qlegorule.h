@@ -0,0 +1,88 @@
+#ifndef QLEGORULE_H
+#define QLEGORULE_H
+
+#include "qlegoglobal.h"
+#include "qlegolatencyhistogram.h"
+#include "qlegosample.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QPointer>
+#include <QtCore/QSharedPointer>
+
+#include <atomic>
+
+QT_FORWARD_DECLARE_CLASS(QLegoDevice)
+QT_FORWARD_DECLARE_CLASS(QLegoAttachedDevice)
+QT_FORWARD_DECLARE_CLASS(QLegoMotor)
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoRule : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool enabled READ isEnabled WRITE setEnabled)
+
+public:
+    enum Comparison
+    {
+        Equal,
+        NotEqual,
+        Below,
+        AtMost,
+        Above,
+        AtLeast
+    };
+    Q_ENUM(Comparison)
+
+    explicit QLegoRule(QObject *parent = nullptr);
+    ~QLegoRule();
+
+    void setSensor(QLegoAttachedDevice *attachment, int index = 0, int mode = -1);
+    void setButton();
+    void setCondition(Comparison comparison, double threshold);
+    void setCommand(QLegoDevice *device, QLegoAttachedDevice *attachment, quint8 subCommand,
+                    const QByteArray &data);
+    void setPower(QLegoDevice *device, QLegoMotor *motor, int power);
+
+    QLegoDevice *device() const;
+    QLegoAttachedDevice *sensor() const;
+    bool isButton() const;
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    quint64 triggers() const;
+    const QLegoLatencyHistogram *latency() const;
+
+Q_SIGNALS:
+    void triggered(qint64 timestamp);
+
+private:
+    Q_DISABLE_COPY(QLegoRule)
+    friend class QLegoDevice;
+    friend class QLegoAttachedDevice;
+
+    void evaluate(const QLegoSample &sample);
+    void evaluate(double value, qint64 timestamp);
+    void fire(qint64 timestamp);
+
+    QPointer<QLegoDevice> m_device;
+    QPointer<QLegoAttachedDevice> m_sensor;
+    int m_index;
+    int m_mode;
+    bool m_button;
+    Comparison m_comparison;
+    double m_threshold;
+    QPointer<QLegoDevice> m_target;
+    QPointer<QLegoAttachedDevice> m_targetAttachment;
+    QByteArray m_message;
+    std::atomic<bool> m_enabled;
+    bool m_armed;
+    std::atomic<quint64> m_triggers;
+    // Commands may be transmitted from another thread after the rule is gone.
+    QSharedPointer<QLegoLatencyHistogram> m_latency;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef QLEGOSAMPLE_H
+#define QLEGOSAMPLE_H
+
+#include "qlegoglobal.h"
+
+#include <QtCore/QMetaType>
+
+#include <cstring>
+
+QT_BEGIN_NAMESPACE
+
+struct QLegoValueFormat
+{
+    enum DataType
+    {
+        Int8 = 0x00,
+        Int16 = 0x01,
+        Int32 = 0x02,
+        Float = 0x03
+    };
+
+    quint8 datasets;
+    DataType type;
+
+    static int size(DataType type)
+    {
+        return type == Int8 ? 1 : type == Int16 ? 2 : 4;
+    }
+};
+
+struct QLegoModeDataset
+{
+    quint8 mode;
+    quint8 dataset;
+};
+
+struct QLegoSample
+{
+    static const int MaxValues = 8;
+    static const quint8 CombinedMode = 0xFF;
+
+    qint64 timestamp;
+    quint32 sequence;
+    quint8 portId;
+    quint8 mode;
+    quint8 count;
+    quint8 type;
+    qint32 values[MaxValues];
+
+    double value(int index) const
+    {
+        if (type == QLegoValueFormat::Float) {
+            float f;
+            std::memcpy(&f, &values[index], sizeof(f));
+            return f;
+        }
+        return values[index];
+    }
+};
+
+QT_END_NAMESPACE
+
+Q_DECLARE_METATYPE(QLegoSample)
+Q_DECLARE_METATYPE(QLegoModeDataset)
+
+#endif
@@ -0,0 +1,128 @@
+#include "qlegosamplebuffer.h"
+
+static inline quint64 roundUpToPowerOfTwo(int value)
+{
+    quint64 capacity = 1;
+    while (capacity < static_cast<quint64>(qMax(value, 1))) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+/*!
+  \class QLegoSampleBuffer
+  \brief The QLegoSampleBuffer class is a lock-free queue of sensor samples.
+  \inmodule QtLego
+  \ingroup attached-devices
+
+  QLegoSampleBuffer is a fixed-capacity ring buffer of QLegoSample values for exactly one
+  producer and one consumer. It is meant for sensors reporting at high rates, where emitting a
+  signal per sample, or queueing a signal to another thread, costs more than the sample itself.
+
+  The producer is the thread the QLegoDevice lives in. Install a buffer with
+  \l{QLegoAttachedDevice::setSampleBuffer()}, then drain it from any single other thread with
+  read(). Neither side blocks or allocates. When the buffer is full, new samples are dropped and
+  counted by overruns(); gaps can also be detected through \l{QLegoSample::sequence}.
+
+  \code
+  QLegoSampleBuffer buffer(4096);
+  motor->setSampleBuffer(&buffer);
+  motor->subscribe(QLegoMotor::PositionMode);
+
+  // On the consumer thread:
+  QLegoSample samples[256];
+  const int count = buffer.read(samples, 256);
+  \endcode
+*/
+
+/*!
+    Constructs a buffer holding at least \a capacity samples. The capacity is rounded up to a
+    power of two.
+*/
+QLegoSampleBuffer::QLegoSampleBuffer(int capacity)
+    : m_head(0)
+    , m_tail(0)
+    , m_overruns(0)
+    , m_mask(roundUpToPowerOfTwo(capacity) - 1)
+    , m_samples(new QLegoSample[m_mask + 1])
+{
+}
+
+QLegoSampleBuffer::~QLegoSampleBuffer()
+{
+    delete[] m_samples;
+}
+
+/*!
+    Returns the number of samples the buffer can hold.
+*/
+int QLegoSampleBuffer::capacity() const
+{
+    return static_cast<int>(m_mask + 1);
+}
+
+/*!
+    Returns the number of samples waiting to be read. The value is only a snapshot while the
+    producer is running.
+*/
+int QLegoSampleBuffer::size() const
+{
+    const quint64 head = m_head.load(std::memory_order_acquire);
+    const quint64 tail = m_tail.load(std::memory_order_acquire);
+    return static_cast<int>(head - tail);
+}
+
+/*!
+    Returns \c true if no samples are waiting to be read.
+*/
+bool QLegoSampleBuffer::isEmpty() const
+{
+    return size() == 0;
+}
+
+/*!
+    Returns the number of samples dropped because the buffer was full.
+*/
+quint64 QLegoSampleBuffer::overruns() const
+{
+    return m_overruns.load(std::memory_order_relaxed);
+}
+
+/*!
+    Appends \a sample. Returns \c false, and counts an overrun, if the buffer is full.
+
+    This function may only be called by the producer.
+*/
+bool QLegoSampleBuffer::push(const QLegoSample &sample)
+{
+    const quint64 head = m_head.load(std::memory_order_relaxed);
+    const quint64 tail = m_tail.load(std::memory_order_acquire);
+    if (head - tail > m_mask) {
+        m_overruns.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    m_samples[head & m_mask] = sample;
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+/*!
+    Moves up to \a maxCount of the oldest samples into \a samples and returns how many were
+    read.
+
+    This function may only be called by the consumer.
+*/
+int QLegoSampleBuffer::read(QLegoSample *samples, int maxCount)
+{
+    const quint64 tail = m_tail.load(std::memory_order_relaxed);
+    const quint64 head = m_head.load(std::memory_order_acquire);
+    const int count = static_cast<int>(qMin<quint64>(head - tail, qMax(maxCount, 0)));
+
+    for (int i = 0; i < count; i++) {
+        samples[i] = m_samples[(tail + i) & m_mask];
+    }
+
+    m_tail.store(tail + count, std::memory_order_release);
+    return count;
+}
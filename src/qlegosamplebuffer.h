@@ -0,0 +1,43 @@
+#ifndef QLEGOSAMPLEBUFFER_H
+#define QLEGOSAMPLEBUFFER_H
+
+#include "qlegoglobal.h"
+#include "qlegosample.h"
+
+#include <atomic>
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoSampleBuffer
+{
+public:
+    explicit QLegoSampleBuffer(int capacity = 1024);
+    ~QLegoSampleBuffer();
+
+    int capacity() const;
+    int size() const;
+    bool isEmpty() const;
+    quint64 overruns() const;
+
+    bool push(const QLegoSample &sample);
+    int read(QLegoSample *samples, int maxCount);
+
+private:
+    Q_DISABLE_COPY(QLegoSampleBuffer)
+
+    static const int CacheLineSize = 64;
+
+    // The producer and consumer indices live on separate cache lines.
+    std::atomic<quint64> m_head;
+    char m_headPadding[CacheLineSize - sizeof(std::atomic<quint64>)];
+    std::atomic<quint64> m_tail;
+    char m_tailPadding[CacheLineSize - sizeof(std::atomic<quint64>)];
+    std::atomic<quint64> m_overruns;
+
+    const quint64 m_mask;
+    QLegoSample *m_samples;
+};
+
+QT_END_NAMESPACE
+
+#endif
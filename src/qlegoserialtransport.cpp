@@ -0,0 +1,245 @@
+#include "qlegoserialtransport.h"
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QTimer>
+
+Q_LOGGING_CATEGORY(serialLogger, "lego.serial");
+
+/*!
+  \class QLegoSerialTransport
+  \brief The QLegoSerialTransport class talks to a hub over a serial link.
+  \inmodule QtLego
+  \ingroup devices
+
+  Hubs of the LWP3 family can also be reached over USB CDC or a UART, with far lower and
+  steadier latency than Bluetooth Low Energy. QLegoSerialTransport carries the same frames as
+  the Bluetooth characteristic, so a QLegoDevice created from it parses them unchanged.
+
+  Reads never block: whatever the port has received is passed on by received(), and the
+  device reassembles frames from it. Frames written during one pass of the event loop are
+  sent to the port in a single write, and each is acknowledged once the port has written its
+  last byte. The device may keep maxWritesInFlight() frames outstanding, so a burst of
+  commands no longer waits for one acknowledgement per frame.
+
+  \code
+  auto serial = new QLegoSerialTransport("/dev/ttyACM0");
+  auto device = QLegoDevice::createDevice(serial);
+  device->connectToDevice();
+  \endcode
+*/
+
+/*!
+    Constructs a transport for the serial port \a portName, such as \c{/dev/ttyACM0} or
+    \c{COM3}, with the given \a parent.
+*/
+QLegoSerialTransport::QLegoSerialTransport(const QString &portName, QObject *parent)
+    : QLegoTransport(parent)
+    , m_port(new QSerialPort(portName, this))
+    , m_address()
+    , m_baudRate(DefaultBaudRate)
+    , m_maxWritesInFlight(DefaultMaxWritesInFlight)
+    , m_errorString()
+    , m_flushTimer(new QTimer(this))
+    , m_batch()
+    , m_frameEnds()
+    , m_bytesQueued(0)
+    , m_bytesWritten(0)
+    , m_batchesWritten(0)
+{
+    // Collect the frames written until the event loop runs again.
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(0);
+
+    // clang-format off
+    connect(m_flushTimer, &QTimer::timeout, this, &QLegoSerialTransport::flush);
+    connect(m_port, &QSerialPort::readyRead, this, &QLegoSerialTransport::readData);
+    connect(m_port, &QSerialPort::bytesWritten, this, &QLegoSerialTransport::acknowledge);
+    connect(m_port, &QSerialPort::errorOccurred, this, &QLegoSerialTransport::portError);
+    // clang-format on
+}
+
+/*!
+    Returns the name of the serial port.
+*/
+QString QLegoSerialTransport::portName() const
+{
+    return m_port->portName();
+}
+
+/*!
+    \property QLegoSerialTransport::baudRate
+    \brief the baud rate of the link, 115200 by default.
+
+    Takes effect when the port is opened.
+*/
+qint32 QLegoSerialTransport::baudRate() const
+{
+    return m_baudRate;
+}
+
+void QLegoSerialTransport::setBaudRate(qint32 baudRate)
+{
+    m_baudRate = baudRate;
+}
+
+/*!
+    Sets the address reported until the hub has sent its own to \a address.
+*/
+void QLegoSerialTransport::setAddress(const QString &address)
+{
+    m_address = address;
+}
+
+/*!
+    Allows the device to keep \a frames frames outstanding.
+*/
+void QLegoSerialTransport::setMaxWritesInFlight(int frames)
+{
+    m_maxWritesInFlight = qMax(frames, 1);
+}
+
+/*!
+    Returns a description of the last error.
+*/
+QString QLegoSerialTransport::errorString() const
+{
+    return m_errorString;
+}
+
+/*!
+    Returns the number of writes to the serial port, each carrying one or more frames.
+*/
+quint64 QLegoSerialTransport::batchesWritten() const
+{
+    return m_batchesWritten;
+}
+
+QString QLegoSerialTransport::address() const
+{
+    return m_address;
+}
+
+bool QLegoSerialTransport::isOpen() const
+{
+    return m_port->isOpen();
+}
+
+int QLegoSerialTransport::maxWritesInFlight() const
+{
+    return m_maxWritesInFlight;
+}
+
+/*!
+    Opens the serial port as 8N1 without flow control. closed() is emitted if it cannot be
+    opened.
+*/
+void QLegoSerialTransport::open()
+{
+    if (m_port->isOpen()) {
+        return;
+    }
+
+    m_port->setBaudRate(m_baudRate);
+    m_port->setDataBits(QSerialPort::Data8);
+    m_port->setParity(QSerialPort::NoParity);
+    m_port->setStopBits(QSerialPort::OneStop);
+    m_port->setFlowControl(QSerialPort::NoFlowControl);
+    const bool portOpened = m_port->open(QIODevice::ReadWrite);
+    if (!portOpened) {
+        m_errorString = m_port->errorString();
+        qCWarning(serialLogger) << "cannot open:" << m_port->portName() << m_errorString;
+    }
+
+    QTimer::singleShot(0, this, [this, portOpened]() {
+        if (!portOpened) {
+            emit closed();
+        } else if (m_port->isOpen()) {
+            emit opened();
+        }
+    });
+}
+
+/*!
+    Closes the serial port. Frames not yet written are dropped.
+*/
+void QLegoSerialTransport::close()
+{
+    if (!m_port->isOpen()) {
+        return;
+    }
+    m_port->close();
+    m_flushTimer->stop();
+    m_batch.clear();
+    m_frameEnds.clear();
+    m_bytesQueued = 0;
+    m_bytesWritten = 0;
+    emit closed();
+}
+
+/*!
+    Queues \a frame to be written with the other frames of this pass of the event loop.
+*/
+void QLegoSerialTransport::write(const QByteArray &frame)
+{
+    if (!m_port->isOpen()) {
+        return;
+    }
+    m_batch += frame;
+    m_frameEnds.enqueue(m_bytesQueued + m_batch.size());
+    if (!m_flushTimer->isActive()) {
+        m_flushTimer->start();
+    }
+}
+
+void QLegoSerialTransport::readData()
+{
+    const QByteArray data = m_port->readAll();
+    if (!data.isEmpty()) {
+        emit received(data);
+    }
+}
+
+void QLegoSerialTransport::flush()
+{
+    if (m_batch.isEmpty() || !m_port->isOpen()) {
+        return;
+    }
+    const qint64 accepted = m_port->write(m_batch);
+    if (accepted < 0) {
+        // The frames are never acknowledged, and the device recovers through its write timeout.
+        qCWarning(serialLogger) << "write failed:" << m_port->errorString();
+        while (!m_frameEnds.isEmpty() && m_frameEnds.last() > m_bytesQueued) {
+            m_frameEnds.removeLast();
+        }
+        m_batch.clear();
+        return;
+    }
+    m_bytesQueued += accepted;
+    m_batchesWritten++;
+    m_batch.remove(0, static_cast<int>(accepted));
+    if (!m_batch.isEmpty()) {
+        // The rest is written with the next batch.
+        m_flushTimer->start();
+    }
+}
+
+void QLegoSerialTransport::acknowledge(qint64 bytes)
+{
+    m_bytesWritten += bytes;
+    while (!m_frameEnds.isEmpty() && m_frameEnds.head() <= m_bytesWritten) {
+        m_frameEnds.dequeue();
+        emit written();
+    }
+}
+
+void QLegoSerialTransport::portError(QSerialPort::SerialPortError error)
+{
+    if (error == QSerialPort::NoError) {
+        return;
+    }
+    m_errorString = m_port->errorString();
+    qCWarning(serialLogger) << "error:" << error << m_errorString;
+    if (error == QSerialPort::ResourceError) {
+        // The adapter was unplugged or the hub turned off.
+        close();
+    }
+}
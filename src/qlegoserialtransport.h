@@ -0,0 +1,65 @@
+#ifndef QLEGOSERIALTRANSPORT_H
+#define QLEGOSERIALTRANSPORT_H
+
+#include "qlegoglobal.h"
+#include "qlegotransport.h"
+
+#include <QtCore/QQueue>
+#include <QtSerialPort/QSerialPort>
+
+QT_FORWARD_DECLARE_CLASS(QTimer)
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoSerialTransport : public QLegoTransport
+{
+    Q_OBJECT
+    Q_PROPERTY(qint32 baudRate READ baudRate WRITE setBaudRate)
+
+public:
+    static const qint32 DefaultBaudRate = 115200;
+    static const int DefaultMaxWritesInFlight = 16;
+
+    explicit QLegoSerialTransport(const QString &portName, QObject *parent = nullptr);
+
+    QString portName() const;
+    qint32 baudRate() const;
+    void setBaudRate(qint32 baudRate);
+    void setAddress(const QString &address);
+    void setMaxWritesInFlight(int frames);
+    QString errorString() const;
+    quint64 batchesWritten() const;
+
+    QString address() const override;
+    bool isOpen() const override;
+    int maxWritesInFlight() const override;
+
+public Q_SLOTS:
+    void open() override;
+    void close() override;
+    void write(const QByteArray &frame) override;
+
+private Q_SLOTS:
+    void readData();
+    void flush();
+    void acknowledge(qint64 bytes);
+    void portError(QSerialPort::SerialPortError error);
+
+private:
+    QSerialPort *m_port;
+    QString m_address;
+    qint32 m_baudRate;
+    int m_maxWritesInFlight;
+    QString m_errorString;
+    QTimer *m_flushTimer;
+    // Frames not yet passed to the port, and where each written frame ends.
+    QByteArray m_batch;
+    QQueue<qint64> m_frameEnds;
+    qint64 m_bytesQueued;
+    qint64 m_bytesWritten;
+    quint64 m_batchesWritten;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,708 @@
+#include "qlegosharedstate.h"
+#include "qlegoattacheddevice.h"
+#include "qlegodevice.h"
+#include <QtBluetooth/QBluetoothAddress>
+#include <QtCore/QLoggingCategory>
+#include <atomic>
+#include <cstring>
+
+Q_LOGGING_CATEGORY(sharedStateLogger, "lego.sharedstate");
+
+static const char SharedMagic[8] = { 'Q', 'L', 'E', 'G', 'O', 'S', 'H', 'M' };
+static const quint32 SharedVersion = 1;
+
+// Readers give up on a record the owner never finishes writing, e.g. after a crash.
+static const int MaxReadAttempts = 100000;
+
+// The segment starts with a header, followed by one block per device. A block holds the device
+// record and one slot per port, each followed by its sample ring. Everything the owner updates
+// is guarded by a sequence counter that is odd while a write is in progress.
+struct SharedHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 maxDevices;
+    quint32 maxPorts;
+    quint32 ringCapacity;
+    std::atomic<quint32> deviceCount;
+};
+
+struct SharedDevice
+{
+    std::atomic<quint32> sequence;
+    qint32 deviceType;
+    quint64 address;
+    qint32 battery;
+    qint32 rssi;
+    quint32 connected;
+    quint32 nameSize;
+    char name[64];
+};
+
+struct SharedPort
+{
+    std::atomic<quint32> sequence;
+    quint8 portId;
+    quint8 mode;
+    quint16 type;
+    quint32 used;
+    quint32 attached;
+    QLegoSample lastSample;
+    // Number of samples published, on its own cache line.
+    alignas(64) std::atomic<quint64> head;
+};
+
+static inline int alignToCacheLine(int size)
+{
+    return (size + 63) & ~63;
+}
+
+static inline int portSize(int ringCapacity)
+{
+    return alignToCacheLine(sizeof(SharedPort))
+            + alignToCacheLine(ringCapacity * static_cast<int>(sizeof(QLegoSample)));
+}
+
+static inline int deviceSize(int maxPorts, int ringCapacity)
+{
+    return alignToCacheLine(sizeof(SharedDevice)) + maxPorts * portSize(ringCapacity);
+}
+
+static inline int segmentSize(int maxDevices, int maxPorts, int ringCapacity)
+{
+    return alignToCacheLine(sizeof(SharedHeader))
+            + maxDevices * deviceSize(maxPorts, ringCapacity);
+}
+
+static inline QLegoSample *ring(const uchar *port)
+{
+    return reinterpret_cast<QLegoSample *>(const_cast<uchar *>(port)
+                                           + alignToCacheLine(sizeof(SharedPort)));
+}
+
+static inline void beginWrite(std::atomic<quint32> &sequence)
+{
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+static inline void endWrite(std::atomic<quint32> &sequence)
+{
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Runs copy until it completes without the owner writing concurrently.
+template<typename Copy>
+static inline bool readConsistent(const std::atomic<quint32> &sequence, Copy copy)
+{
+    for (int attempt = 0; attempt < MaxReadAttempts; attempt++) {
+        const quint32 before = sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        copy();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence.load(std::memory_order_relaxed) == before) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+  \class QLegoSharedState
+  \brief The QLegoSharedState class publishes the state of hubs to other local processes.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  Only one process can own the Bluetooth connections to a hub. QLegoSharedState lets that
+  process publish a table of its hubs and their attached devices, together with a ring of
+  recent samples per port, in a shared memory segment. Any number of processes on the same
+  machine can then read it with QLegoSharedStateReader.
+
+  Readers never signal or lock anything the owner waits on, so they add no load to it. Each
+  record is guarded by a sequence counter, and readers retry while the owner is updating it.
+  The owner always overwrites the oldest samples of a ring; readers that fall behind lose
+  samples rather than slowing it down.
+
+  The segment is laid out when it is created, so maxDevices(), maxPorts() and ringCapacity()
+  must be set before create().
+
+  \code
+  QLegoSharedState state("lego-hubs");
+  state.create();
+  connect(scanner, &QLegoDeviceScanner::deviceFound, [&](QLegoDevice *device) {
+      state.addDevice(device);
+  });
+  \endcode
+*/
+
+/*!
+    Constructs a publisher for the segment named \a key with the given \a parent.
+*/
+QLegoSharedState::QLegoSharedState(const QString &key, QObject *parent)
+    : QObject(parent)
+    , m_key(key)
+    , m_maxDevices(DefaultMaxDevices)
+    , m_maxPorts(DefaultMaxPorts)
+    , m_ringCapacity(DefaultRingCapacity)
+    , m_memory(key)
+    , m_data(nullptr)
+    , m_errorString()
+    , m_devices()
+    , m_ports()
+{
+}
+
+QLegoSharedState::~QLegoSharedState()
+{
+    destroy();
+}
+
+/*!
+    Returns the name of the segment.
+*/
+QString QLegoSharedState::key() const
+{
+    return m_key;
+}
+
+/*!
+    Returns the number of hubs the segment can hold.
+*/
+int QLegoSharedState::maxDevices() const
+{
+    return m_maxDevices;
+}
+
+/*!
+    Sets the number of hubs the segment can hold to \a count.
+*/
+void QLegoSharedState::setMaxDevices(int count)
+{
+    m_maxDevices = qMax(count, 1);
+}
+
+/*!
+    Returns the number of ports held for each hub.
+*/
+int QLegoSharedState::maxPorts() const
+{
+    return m_maxPorts;
+}
+
+/*!
+    Sets the number of ports held for each hub to \a count. Ports take slots in the order
+    devices are first attached to them.
+*/
+void QLegoSharedState::setMaxPorts(int count)
+{
+    m_maxPorts = qMax(count, 1);
+}
+
+/*!
+    Returns the number of samples kept for each port.
+*/
+int QLegoSharedState::ringCapacity() const
+{
+    return m_ringCapacity;
+}
+
+/*!
+    Keeps the last \a samples samples of each port. Readers can rely on all but the newest
+    slot, so a reader polling every 100 ms needs a capacity above 100 for a port reporting
+    at 1 kHz.
+*/
+void QLegoSharedState::setRingCapacity(int samples)
+{
+    m_ringCapacity = qMax(samples, 2);
+}
+
+/*!
+    Creates the segment. A segment with the same key left behind by an owner that exited
+    without destroying it is replaced. Returns \c false and sets errorString() if the segment
+    cannot be created, for example because another owner is publishing to it.
+*/
+bool QLegoSharedState::create()
+{
+    if (m_data) {
+        return true;
+    }
+
+    const int size = segmentSize(m_maxDevices, m_maxPorts, m_ringCapacity);
+    bool created = m_memory.create(size);
+    if (!created && m_memory.error() == QSharedMemory::AlreadyExists && m_memory.attach()) {
+        // Detaching the last attachment removes a stale segment.
+        m_memory.detach();
+        created = m_memory.create(size);
+    }
+    if (!created) {
+        m_errorString = m_memory.errorString();
+        qCWarning(sharedStateLogger) << "cannot create:" << m_key << m_errorString;
+        return false;
+    }
+
+    m_data = static_cast<uchar *>(m_memory.data());
+    memset(m_data, 0, size);
+    auto header = reinterpret_cast<SharedHeader *>(m_data);
+    memcpy(header->magic, SharedMagic, sizeof(SharedMagic));
+    header->maxDevices = m_maxDevices;
+    header->maxPorts = m_maxPorts;
+    header->ringCapacity = m_ringCapacity;
+    // Readers check the version last.
+    std::atomic_thread_fence(std::memory_order_release);
+    header->version = SharedVersion;
+
+    m_errorString.clear();
+    return true;
+}
+
+/*!
+    Stops publishing and detaches from the segment. The segment is removed once the last
+    reader detaches.
+*/
+void QLegoSharedState::destroy()
+{
+    for (const auto &device : m_devices) {
+        if (!device) {
+            continue;
+        }
+        QObject::disconnect(device, nullptr, this, nullptr);
+        for (const auto attachment : device->attachedDevices()) {
+            QObject::disconnect(attachment, nullptr, this, nullptr);
+        }
+    }
+    m_devices.clear();
+    m_ports.clear();
+    if (m_data) {
+        m_data = nullptr;
+        m_memory.detach();
+    }
+}
+
+/*!
+    Returns \c true if the segment has been created.
+*/
+bool QLegoSharedState::isCreated() const
+{
+    return m_data != nullptr;
+}
+
+/*!
+    Returns a description of the last error.
+*/
+QString QLegoSharedState::errorString() const
+{
+    return m_errorString;
+}
+
+/*!
+    Publishes the state of \a device, the devices attached to it and their samples. Returns
+    \c false if the segment has not been created or holds maxDevices() hubs already.
+*/
+bool QLegoSharedState::addDevice(QLegoDevice *device)
+{
+    if (!m_data) {
+        return false;
+    }
+    if (m_devices.contains(device)) {
+        return true;
+    }
+    if (m_devices.size() >= m_maxDevices) {
+        qCWarning(sharedStateLogger) << "no slot left for:" << device->address();
+        return false;
+    }
+
+    const int index = m_devices.size();
+    m_devices.append(device);
+    m_ports.append(QHash<quint8, int>());
+    updateDevice(index, device, device->isReady());
+    reinterpret_cast<SharedHeader *>(m_data)->deviceCount.store(index + 1,
+                                                                 std::memory_order_release);
+
+    const QPointer<QLegoDevice> guard(device);
+    // clang-format off
+    connect(device, &QLegoDevice::ready, this, [this, index, guard]() {
+        if (guard) {
+            updateDevice(index, guard, true);
+        }
+    });
+    connect(device, &QLegoDevice::batteryLevel, this, [this, index, guard]() {
+        const auto shared = reinterpret_cast<const SharedDevice *>(devicePointer(index));
+        if (guard) {
+            updateDevice(index, guard, shared->connected);
+        }
+    });
+    connect(device, &QLegoDevice::disconnected, this, [this, index, guard]() {
+        if (guard) {
+            updateDevice(index, guard, false);
+        }
+    });
+    connect(device, &QObject::destroyed, this, [this, index]() {
+        auto shared = reinterpret_cast<SharedDevice *>(devicePointer(index));
+        beginWrite(shared->sequence);
+        shared->connected = false;
+        endWrite(shared->sequence);
+    });
+    connect(device, &QLegoDevice::deviceAttached, this, [this, index](QLegoAttachedDevice *attachment) {
+        attachPort(index, attachment);
+    });
+    connect(device, &QLegoDevice::deviceDetached, this, [this, index](QLegoAttachedDevice *attachment) {
+        detachPort(index, attachment);
+    });
+    // clang-format on
+
+    for (const auto attachment : device->attachedDevices()) {
+        attachPort(index, attachment);
+    }
+    return true;
+}
+
+void QLegoSharedState::updateDevice(int index, QLegoDevice *device, bool connected)
+{
+    auto shared = reinterpret_cast<SharedDevice *>(devicePointer(index));
+    const QByteArray name = device->name().toUtf8().left(sizeof(shared->name));
+
+    beginWrite(shared->sequence);
+    shared->deviceType = device->deviceType();
+    shared->address = QBluetoothAddress(device->address()).toUInt64();
+    shared->battery = device->battery();
+    shared->rssi = device->rssi();
+    shared->connected = connected;
+    shared->nameSize = name.size();
+    memcpy(shared->name, name.constData(), name.size());
+    endWrite(shared->sequence);
+}
+
+void QLegoSharedState::attachPort(int index, QLegoAttachedDevice *attachment)
+{
+    auto &ports = m_ports[index];
+    const quint8 portId = attachment->portId();
+    int port = ports.value(portId, -1);
+    if (port < 0) {
+        if (ports.size() >= m_maxPorts) {
+            qCWarning(sharedStateLogger) << "no slot left for port:" << portId;
+            return;
+        }
+        port = ports.size();
+        ports.insert(portId, port);
+    }
+    updatePort(index, port, attachment, true);
+
+    // clang-format off
+    connect(attachment, &QLegoAttachedDevice::valueReceived, this, [this, index, port](const QLegoSample &sample) {
+        publishSample(index, port, sample);
+    });
+    connect(attachment, &QLegoAttachedDevice::modeChanged, this, [this, index, port, attachment]() {
+        updatePort(index, port, attachment, true);
+    });
+    // clang-format on
+}
+
+void QLegoSharedState::detachPort(int index, QLegoAttachedDevice *attachment)
+{
+    const int port = m_ports[index].value(attachment->portId(), -1);
+    if (port < 0) {
+        return;
+    }
+    QObject::disconnect(attachment, nullptr, this, nullptr);
+    updatePort(index, port, attachment, false);
+}
+
+void QLegoSharedState::updatePort(int index, int port, QLegoAttachedDevice *attachment,
+                                  bool attached)
+{
+    auto shared = reinterpret_cast<SharedPort *>(portPointer(index, port));
+
+    beginWrite(shared->sequence);
+    shared->portId = attachment->portId();
+    shared->mode = static_cast<quint8>(attachment->mode());
+    shared->type = attachment->type();
+    shared->used = true;
+    shared->attached = attached;
+    endWrite(shared->sequence);
+}
+
+void QLegoSharedState::publishSample(int index, int port, const QLegoSample &sample)
+{
+    uchar *pointer = portPointer(index, port);
+    auto shared = reinterpret_cast<SharedPort *>(pointer);
+
+    beginWrite(shared->sequence);
+    shared->lastSample = sample;
+    endWrite(shared->sequence);
+
+    const quint64 head = shared->head.load(std::memory_order_relaxed);
+    ring(pointer)[head % m_ringCapacity] = sample;
+    shared->head.store(head + 1, std::memory_order_release);
+}
+
+uchar *QLegoSharedState::devicePointer(int index) const
+{
+    return m_data + alignToCacheLine(sizeof(SharedHeader))
+            + index * deviceSize(m_maxPorts, m_ringCapacity);
+}
+
+uchar *QLegoSharedState::portPointer(int index, int port) const
+{
+    return devicePointer(index) + alignToCacheLine(sizeof(SharedDevice))
+            + port * portSize(m_ringCapacity);
+}
+
+/*!
+  \class QLegoSharedStateReader
+  \brief The QLegoSharedStateReader class reads hub state published by QLegoSharedState.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  The reader attaches to the segment read-only. device() and devices() return a consistent
+  snapshot of each record, and read() copies new samples of a port, tracked by a cursor the
+  caller keeps. Readers can run in any thread of any process.
+
+  \code
+  QLegoSharedStateReader reader("lego-hubs");
+  reader.attach();
+  quint64 cursor = 0;
+  QLegoSample samples[64];
+  const int count = reader.read(0, 0, &cursor, samples, 64);
+  \endcode
+*/
+
+/*!
+    Constructs a reader for the segment named \a key.
+*/
+QLegoSharedStateReader::QLegoSharedStateReader(const QString &key)
+    : m_memory(key)
+    , m_data(nullptr)
+    , m_errorString()
+    , m_maxDevices(0)
+    , m_maxPorts(0)
+    , m_ringCapacity(0)
+{
+}
+
+QLegoSharedStateReader::~QLegoSharedStateReader()
+{
+    detach();
+}
+
+/*!
+    Attaches to the segment. Returns \c false and sets errorString() if it does not exist or
+    was not created by QLegoSharedState.
+*/
+bool QLegoSharedStateReader::attach()
+{
+    if (m_data) {
+        return true;
+    }
+    if (!m_memory.attach(QSharedMemory::ReadOnly)) {
+        m_errorString = m_memory.errorString();
+        return false;
+    }
+
+    const auto header = static_cast<const SharedHeader *>(m_memory.constData());
+    const quint32 version = header->version;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_memory.size() < static_cast<int>(sizeof(SharedHeader))
+        || memcmp(header->magic, SharedMagic, sizeof(SharedMagic)) != 0
+        || version != SharedVersion
+        || m_memory.size() < segmentSize(header->maxDevices, header->maxPorts,
+                                         header->ringCapacity)) {
+        m_errorString = QStringLiteral("Not a QtLego shared state segment");
+        m_memory.detach();
+        return false;
+    }
+
+    m_data = static_cast<const uchar *>(m_memory.constData());
+    m_maxDevices = header->maxDevices;
+    m_maxPorts = header->maxPorts;
+    m_ringCapacity = header->ringCapacity;
+    m_errorString.clear();
+    return true;
+}
+
+/*!
+    Detaches from the segment.
+*/
+void QLegoSharedStateReader::detach()
+{
+    if (m_data) {
+        m_data = nullptr;
+        m_memory.detach();
+    }
+}
+
+/*!
+    Returns \c true if the reader is attached to the segment.
+*/
+bool QLegoSharedStateReader::isAttached() const
+{
+    return m_data != nullptr;
+}
+
+/*!
+    Returns a description of the last error.
+*/
+QString QLegoSharedStateReader::errorString() const
+{
+    return m_errorString;
+}
+
+/*!
+    Returns the number of hubs published.
+*/
+int QLegoSharedStateReader::deviceCount() const
+{
+    if (!m_data) {
+        return 0;
+    }
+    const auto header = reinterpret_cast<const SharedHeader *>(m_data);
+    return static_cast<int>(header->deviceCount.load(std::memory_order_acquire));
+}
+
+/*!
+    Copies the state of the hub at \a index, and of the ports it has seen, to \a device.
+    Returns \c false if there is no such hub or the owner stopped while updating it.
+*/
+bool QLegoSharedStateReader::device(int index, QLegoSharedDevice *device) const
+{
+    if (index < 0 || index >= deviceCount()) {
+        return false;
+    }
+
+    const auto shared = reinterpret_cast<const SharedDevice *>(devicePointer(index));
+    char name[sizeof(shared->name)];
+    quint32 nameSize = 0;
+    const bool consistent = readConsistent(shared->sequence, [&]() {
+        device->deviceType = shared->deviceType;
+        device->address = shared->address;
+        device->battery = shared->battery;
+        device->rssi = shared->rssi;
+        device->connected = shared->connected;
+        nameSize = qMin<quint32>(shared->nameSize, sizeof(name));
+        memcpy(name, shared->name, nameSize);
+    });
+    if (!consistent) {
+        return false;
+    }
+    device->name = QString::fromUtf8(name, nameSize);
+
+    device->ports.clear();
+    for (int port = 0; port < m_maxPorts; port++) {
+        const uchar *pointer = portPointer(index, port);
+        const auto sharedPort = reinterpret_cast<const SharedPort *>(pointer);
+        QLegoSharedPort state;
+        bool used = false;
+        if (!readConsistent(sharedPort->sequence, [&]() {
+                used = sharedPort->used;
+                state.portId = sharedPort->portId;
+                state.mode = sharedPort->mode;
+                state.type = sharedPort->type;
+                state.attached = sharedPort->attached;
+                state.lastSample = sharedPort->lastSample;
+            })) {
+            return false;
+        }
+        if (!used) {
+            // Ports take slots in order.
+            break;
+        }
+        state.samples = sharedPort->head.load(std::memory_order_acquire);
+        device->ports.append(state);
+    }
+    return true;
+}
+
+/*!
+    Returns a snapshot of all published hubs.
+*/
+QVector<QLegoSharedDevice> QLegoSharedStateReader::devices() const
+{
+    QVector<QLegoSharedDevice> devices;
+    const int count = deviceCount();
+    devices.reserve(count);
+    for (int index = 0; index < count; index++) {
+        QLegoSharedDevice state;
+        if (device(index, &state)) {
+            devices.append(state);
+        }
+    }
+    return devices;
+}
+
+/*!
+    Copies up to \a maxCount samples of port \a portId of the hub at \a index, published after
+    \a cursor, to \a samples and advances \a cursor. Start with a cursor of zero to read all
+    samples still held. If samples were overwritten before they could be read, their number is
+    added to \a lost.
+
+    Returns the number of samples copied.
+*/
+int QLegoSharedStateReader::read(int index, quint8 portId, quint64 *cursor,
+                                 QLegoSample *samples, int maxCount, quint64 *lost) const
+{
+    if (index < 0 || index >= deviceCount() || maxCount <= 0) {
+        return 0;
+    }
+
+    const uchar *pointer = nullptr;
+    for (int port = 0; port < m_maxPorts && !pointer; port++) {
+        const auto shared = reinterpret_cast<const SharedPort *>(portPointer(index, port));
+        bool used = false;
+        quint8 id = 0;
+        readConsistent(shared->sequence, [&]() {
+            used = shared->used;
+            id = shared->portId;
+        });
+        if (!used) {
+            return 0;
+        }
+        if (id == portId) {
+            pointer = portPointer(index, port);
+        }
+    }
+    if (!pointer) {
+        return 0;
+    }
+
+    // The slot after the newest sample may be half written, so one slot is never read.
+    const auto shared = reinterpret_cast<const SharedPort *>(pointer);
+    const quint64 depth = m_ringCapacity - 1;
+    const quint64 head = shared->head.load(std::memory_order_acquire);
+    quint64 start = qMin(*cursor, head);
+    if (head - start > depth) {
+        start = head - depth;
+    }
+    const int count = static_cast<int>(qMin<quint64>(head - start, maxCount));
+    const QLegoSample *entries = ring(pointer);
+    for (int i = 0; i < count; i++) {
+        samples[i] = entries[(start + i) % m_ringCapacity];
+    }
+
+    // Drop samples the owner overwrote while they were copied.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const quint64 latest = shared->head.load(std::memory_order_relaxed);
+    int skipped = 0;
+    if (latest - start > depth) {
+        skipped = static_cast<int>(qMin<quint64>(latest - depth - start, count));
+        memmove(samples, samples + skipped, (count - skipped) * sizeof(QLegoSample));
+    }
+
+    if (lost) {
+        *lost += start + skipped - qMin(*cursor, head);
+    }
+    *cursor = start + count;
+    return count - skipped;
+}
+
+const uchar *QLegoSharedStateReader::devicePointer(int index) const
+{
+    return m_data + alignToCacheLine(sizeof(SharedHeader))
+            + index * deviceSize(m_maxPorts, m_ringCapacity);
+}
+
+const uchar *QLegoSharedStateReader::portPointer(int index, int port) const
+{
+    return devicePointer(index) + alignToCacheLine(sizeof(SharedDevice))
+            + port * portSize(m_ringCapacity);
+}
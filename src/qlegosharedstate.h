@@ -0,0 +1,126 @@
+#ifndef QLEGOSHAREDSTATE_H
+#define QLEGOSHAREDSTATE_H
+
+#include "qlegoglobal.h"
+#include "qlegosample.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QPointer>
+#include <QtCore/QSharedMemory>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+QT_FORWARD_DECLARE_CLASS(QLegoDevice)
+QT_FORWARD_DECLARE_CLASS(QLegoAttachedDevice)
+
+QT_BEGIN_NAMESPACE
+
+struct QLegoSharedPort
+{
+    quint8 portId;
+    quint8 mode;
+    quint16 type;
+    bool attached;
+    // Samples published for the port so far.
+    quint64 samples;
+    QLegoSample lastSample;
+};
+
+struct QLegoSharedDevice
+{
+    quint64 address;
+    QString name;
+    int deviceType;
+    int battery;
+    int rssi;
+    bool connected;
+    QVector<QLegoSharedPort> ports;
+};
+
+class Q_LEGO_EXPORT QLegoSharedState : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int DefaultMaxDevices = 16;
+    static const int DefaultMaxPorts = 16;
+    static const int DefaultRingCapacity = 256;
+
+    explicit QLegoSharedState(const QString &key, QObject *parent = nullptr);
+    ~QLegoSharedState();
+
+    QString key() const;
+    int maxDevices() const;
+    void setMaxDevices(int count);
+    int maxPorts() const;
+    void setMaxPorts(int count);
+    int ringCapacity() const;
+    void setRingCapacity(int samples);
+
+    bool create();
+    void destroy();
+    bool isCreated() const;
+    QString errorString() const;
+
+    bool addDevice(QLegoDevice *device);
+
+private:
+    Q_DISABLE_COPY(QLegoSharedState)
+
+    void updateDevice(int index, QLegoDevice *device, bool connected);
+    void attachPort(int index, QLegoAttachedDevice *attachment);
+    void detachPort(int index, QLegoAttachedDevice *attachment);
+    void updatePort(int index, int port, QLegoAttachedDevice *attachment, bool attached);
+    void publishSample(int index, int port, const QLegoSample &sample);
+    uchar *devicePointer(int index) const;
+    uchar *portPointer(int index, int port) const;
+
+    const QString m_key;
+    int m_maxDevices;
+    int m_maxPorts;
+    int m_ringCapacity;
+    QSharedMemory m_memory;
+    uchar *m_data;
+    QString m_errorString;
+    // Devices may be deleted before the state.
+    QVector<QPointer<QLegoDevice>> m_devices;
+    // Port slots of each device, by port id.
+    QVector<QHash<quint8, int>> m_ports;
+};
+
+class Q_LEGO_EXPORT QLegoSharedStateReader
+{
+public:
+    explicit QLegoSharedStateReader(const QString &key);
+    ~QLegoSharedStateReader();
+
+    bool attach();
+    void detach();
+    bool isAttached() const;
+    QString errorString() const;
+
+    int deviceCount() const;
+    bool device(int index, QLegoSharedDevice *device) const;
+    QVector<QLegoSharedDevice> devices() const;
+
+    int read(int index, quint8 portId, quint64 *cursor, QLegoSample *samples, int maxCount,
+             quint64 *lost = nullptr) const;
+
+private:
+    Q_DISABLE_COPY(QLegoSharedStateReader)
+
+    const uchar *devicePointer(int index) const;
+    const uchar *portPointer(int index, int port) const;
+
+    QSharedMemory m_memory;
+    const uchar *m_data;
+    QString m_errorString;
+    int m_maxDevices;
+    int m_maxPorts;
+    int m_ringCapacity;
+};
+
+QT_END_NAMESPACE
+
+#endif
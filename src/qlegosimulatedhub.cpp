@@ -0,0 +1,663 @@
+#include "qlegosimulatedhub.h"
+#include <QtCore/QTimer>
+#include <QtCore/QtEndian>
+#include <QtBluetooth/QBluetoothAddress>
+
+// Firmware and hardware version 1.0.00.0017.
+static const char Version[] = { 0x17, 0x00, 0x00, 0x10 };
+static const qint8 Rssi = -50;
+static const quint8 FirstVirtualPort = 0x10;
+
+// The first value of \a value, read as a little endian signed integer of up to four bytes.
+static qint64 firstValue(const QByteArray &value)
+{
+    switch (value.size()) {
+        case 0:
+            return 0;
+        case 1:
+            return static_cast<qint8>(value[0]);
+        case 2:
+        case 3:
+            return qFromLittleEndian<qint16>(value.constData());
+        default:
+            return qFromLittleEndian<qint32>(value.constData());
+    }
+}
+
+static QByteArray encodeFloats(float first, float second)
+{
+    QByteArray bytes(8, 0);
+    quint32 bits;
+    memcpy(&bits, &first, sizeof(bits));
+    qToLittleEndian<quint32>(bits, bytes.data());
+    memcpy(&bits, &second, sizeof(bits));
+    qToLittleEndian<quint32>(bits, bytes.data() + 4);
+    return bytes;
+}
+
+/*!
+  \class QLegoSimulatedHub
+  \brief The QLegoSimulatedHub class is a transport that behaves like a hub.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  QLegoSimulatedHub answers the requests a QLegoDevice sends when a session starts, reports
+  the devices attached with attachDevice(), and confirms input format and port output
+  commands the way a hub does, or leaves the progress of port output commands to
+  sendFeedback(). Virtual ports are created and removed on request. Values set
+  with setValue() are reported to the device while the port is subscribed, on its own or in
+  a combination of modes, and when the device requests them. A single subscribed mode only
+  reports values that differ from the last reported one by at least the delta interval, with
+  the first value of the mode read as a little endian integer. Port and mode
+  information is answered for ports given one with setPortInformation(), and refused for all
+  others.
+
+  It lets applications and services built on QtLego be tested without a hub, including the
+  parts that depend on hub timing being reasonable rather than exact.
+
+  \code
+  auto hub = new QLegoSimulatedHub;
+  hub->attachDevice(0, QLegoAttachedDevice::TechnicLargeLinearMotor);
+  auto device = QLegoDevice::createDevice(hub);
+  device->connectToDevice();
+  // Later, once the motor reports its position:
+  hub->setValue(0, QByteArray::fromHex("5a000000"));
+  \endcode
+*/
+
+/*!
+    \fn void QLegoSimulatedHub::commandReceived(const QByteArray &frame)
+
+    Emitted for every \a frame written by the device, as it reaches the hub.
+*/
+
+/*!
+    \fn void QLegoSimulatedHub::portOutputReceived(quint8 portId, const QByteArray &frame)
+
+    Emitted when the device wrote the port output command \a frame for \a portId.
+*/
+
+/*!
+    Constructs a hub with no attached devices, with the given \a parent.
+*/
+QLegoSimulatedHub::QLegoSimulatedHub(QObject *parent)
+    : QLegoTransport(parent)
+    , m_address("00:16:53:00:00:01")
+    , m_name("Simulated Hub")
+    , m_battery(100)
+    , m_open(false)
+    , m_framesWritten(0)
+    , m_writeLatency(0)
+    , m_automaticFeedback(true)
+    , m_ports()
+    , m_reports()
+{
+}
+
+/*!
+    Sets the Bluetooth address the hub reports to \a address.
+*/
+void QLegoSimulatedHub::setAddress(const QString &address)
+{
+    m_address = address;
+}
+
+/*!
+    Returns the name of the hub.
+*/
+QString QLegoSimulatedHub::name() const
+{
+    return m_name;
+}
+
+/*!
+    Sets the name of the hub to \a name.
+*/
+void QLegoSimulatedHub::setName(const QString &name)
+{
+    m_name = name;
+}
+
+/*!
+    Returns the battery level in percent.
+*/
+int QLegoSimulatedHub::battery() const
+{
+    return m_battery;
+}
+
+/*!
+    Sets the battery level to \a level percent, and reports it if the hub is open and battery
+    reports are enabled.
+*/
+void QLegoSimulatedHub::setBattery(int level)
+{
+    m_battery = static_cast<quint8>(qBound(0, level, 100));
+    if (m_open && m_reports.contains(0x06)) {
+        replyHubProperty(0x06);
+    }
+}
+
+/*!
+    Attaches a device of \a type to \a portId. The attachment is reported when the hub is
+    opened, or immediately if it is open.
+*/
+void QLegoSimulatedHub::attachDevice(quint8 portId, quint16 type)
+{
+    Port port;
+    port.type = type;
+    m_ports.insert(portId, port);
+    if (m_open) {
+        sendAttachment(portId, port);
+    }
+}
+
+/*!
+    Detaches the device attached to \a portId.
+*/
+void QLegoSimulatedHub::detachDevice(quint8 portId)
+{
+    if (m_ports.remove(portId) && m_open) {
+        reply(QByteArray::fromHex("04") + static_cast<char>(portId) + '\0');
+    }
+}
+
+/*!
+    Returns the mode \a portId has been set up for, or -1 if none.
+*/
+int QLegoSimulatedHub::mode(quint8 portId) const
+{
+    return m_ports.value(portId).mode;
+}
+
+/*!
+    Returns \c true if reports of the hub \a property have been enabled.
+*/
+bool QLegoSimulatedHub::reportsEnabled(quint8 property) const
+{
+    return m_reports.contains(property);
+}
+
+/*!
+    Sets the raw \a value reported by the device attached to \a portId, in the format of its
+    current mode. For a combination of modes, \a value holds the values of all of its entries in
+    order. The value is reported if the port is subscribed and the value has changed by at least
+    the delta interval of the subscription.
+*/
+void QLegoSimulatedHub::setValue(quint8 portId, const QByteArray &value)
+{
+    const auto it = m_ports.find(portId);
+    if (it == m_ports.end()) {
+        return;
+    }
+    it->value = value;
+    if (m_open && it->notify) {
+        reportValue(portId, *it);
+    }
+}
+
+/*!
+    Sets the port and mode \a information the device attached to \a portId describes itself
+    with. Until it is set, information requests for the port are answered with an error.
+*/
+void QLegoSimulatedHub::setPortInformation(quint8 portId, const QLegoPortInformation &information)
+{
+    const auto it = m_ports.find(portId);
+    if (it != m_ports.end()) {
+        it->information = information;
+    }
+}
+
+/*!
+    Returns \c true if port output commands are reported as completed as soon as they arrive.
+*/
+bool QLegoSimulatedHub::automaticFeedback() const
+{
+    return m_automaticFeedback;
+}
+
+/*!
+    Enables or disables reporting every port output command as completed when it arrives. With
+    \a enabled \c false, commands stay on the hub until their progress is reported with
+    sendFeedback(). The default is \c true.
+*/
+void QLegoSimulatedHub::setAutomaticFeedback(bool enabled)
+{
+    m_automaticFeedback = enabled;
+}
+
+/*!
+    Reports the command \a feedback bits of \a portId to the device, like a hub whose commands
+    start, complete, or are discarded.
+*/
+void QLegoSimulatedHub::sendFeedback(quint8 portId, quint8 feedback)
+{
+    if (!m_open) {
+        return;
+    }
+    QByteArray message = QByteArray::fromHex("82");
+    message += static_cast<char>(portId);
+    message += static_cast<char>(feedback);
+    reply(message);
+}
+
+/*!
+    Returns the number of frames written by the device.
+*/
+int QLegoSimulatedHub::framesWritten() const
+{
+    return m_framesWritten;
+}
+
+QString QLegoSimulatedHub::address() const
+{
+    return m_address;
+}
+
+bool QLegoSimulatedHub::isOpen() const
+{
+    return m_open;
+}
+
+/*!
+    Opens the hub and reports its attached devices.
+*/
+void QLegoSimulatedHub::open()
+{
+    if (m_open) {
+        return;
+    }
+    m_open = true;
+    m_framesWritten = 0;
+    QTimer::singleShot(0, this, [this]() {
+        if (!m_open) {
+            return;
+        }
+        emit opened();
+        for (auto it = m_ports.cbegin(); it != m_ports.cend(); ++it) {
+            sendAttachment(it.key(), it.value());
+        }
+    });
+}
+
+/*!
+    Closes the hub. Subscriptions are forgotten.
+*/
+void QLegoSimulatedHub::close()
+{
+    if (!m_open) {
+        return;
+    }
+    m_open = false;
+    m_reports.clear();
+    for (auto it = m_ports.begin(); it != m_ports.end();) {
+        // Virtual ports do not outlive the connection.
+        if (it->virtualPort) {
+            it = m_ports.erase(it);
+            continue;
+        }
+        it->mode = -1;
+        it->notify = false;
+        it->reported.clear();
+        it->locked = false;
+        it->combined = false;
+        it->combination.clear();
+        ++it;
+    }
+    emit closed();
+}
+
+/*!
+    Returns how long each frame takes to reach the hub, in milliseconds.
+*/
+int QLegoSimulatedHub::writeLatency() const
+{
+    return m_writeLatency;
+}
+
+/*!
+    Delays the delivery and acknowledgement of every written frame by \a msecs, like a slow or
+    congested link. As the device writes one frame at a time, commands queue up on the device.
+    The default is 0.
+*/
+void QLegoSimulatedHub::setWriteLatency(int msecs)
+{
+    m_writeLatency = qMax(msecs, 0);
+}
+
+/*!
+    Takes \a frame written by the device and answers it like a hub.
+*/
+void QLegoSimulatedHub::write(const QByteArray &frame)
+{
+    if (!m_open) {
+        return;
+    }
+    if (m_writeLatency > 0) {
+        QTimer::singleShot(m_writeLatency, Qt::PreciseTimer, this, [this, frame]() {
+            if (m_open) {
+                emit written();
+                process(frame);
+            }
+        });
+        return;
+    }
+    QTimer::singleShot(0, this, &QLegoSimulatedHub::written);
+    process(frame);
+}
+
+void QLegoSimulatedHub::process(const QByteArray &frame)
+{
+    m_framesWritten++;
+    emit commandReceived(frame);
+    if (frame.size() < 4) {
+        return;
+    }
+
+    const auto msg = frame.constData();
+    const quint8 type = msg[2];
+    const quint8 portId = msg[3];
+    switch (type) {
+        case 0x01:
+            // Hub property update request, or enabling and disabling updates.
+            if (frame.size() < 5) {
+                break;
+            }
+            if (msg[4] == 0x02) {
+                m_reports.insert(portId);
+            } else if (msg[4] == 0x03) {
+                m_reports.remove(portId);
+            }
+            if (msg[4] == 0x02 || msg[4] == 0x05) {
+                replyHubProperty(portId);
+            }
+            break;
+        case 0x21:
+            if (frame.size() < 5) {
+                break;
+            }
+            if (msg[4] == 0x00) {
+                // A value request is answered like a report, regardless of the subscription.
+                const Port port = m_ports.value(portId);
+                if (port.value.isEmpty()) {
+                    reply(QByteArray::fromHex("05") + '\x21' + '\x05');
+                } else {
+                    sendValue(portId, port);
+                }
+                break;
+            }
+            replyPortInformation(portId, msg[4]);
+            break;
+        case 0x22:
+            if (frame.size() >= 6) {
+                replyModeInformation(portId, msg[4], msg[5]);
+            }
+            break;
+        case 0x41: {
+            const auto it = m_ports.find(portId);
+            if (frame.size() < 10 || it == m_ports.end()) {
+                reply(QByteArray::fromHex("05") + static_cast<char>(type) + '\x06');
+                break;
+            }
+            it->mode = static_cast<quint8>(msg[4]);
+            it->notify = msg[9] != 0;
+            it->deltaInterval = qFromLittleEndian<quint32>(msg + 5);
+            it->reported.clear();
+            // Outside of a combination setup, a single mode replaces the combination.
+            it->combined = it->combined && it->locked;
+            reply(QByteArray::fromHex("47") + frame.mid(3, 7));
+            if (it->notify && !it->value.isEmpty()) {
+                reportValue(portId, *it);
+            }
+            break;
+        }
+        case 0x42:
+            setupCombination(portId, frame);
+            break;
+        case 0x61: {
+            // Virtual port setup, where the port is the sub-command.
+            if (msg[3] == 0x01 && frame.size() >= 6) {
+                createVirtualPort(msg[4], msg[5]);
+            } else if (msg[3] == 0x00 && frame.size() >= 5 && m_ports.value(msg[4]).virtualPort) {
+                detachDevice(msg[4]);
+            }
+            break;
+        }
+        case 0x81: {
+            emit portOutputReceived(portId, frame);
+            if (m_automaticFeedback) {
+                // Buffer empty and command completed, port idle.
+                sendFeedback(portId, 0x0a);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void QLegoSimulatedHub::setupCombination(quint8 portId, const QByteArray &frame)
+{
+    const auto it = m_ports.find(portId);
+    if (frame.size() < 5 || it == m_ports.end()) {
+        reply(QByteArray::fromHex("05") + '\x42' + '\x06');
+        return;
+    }
+
+    switch (frame[4]) {
+        case 0x01:
+            // The combination index, followed by a mode and dataset per entry.
+            if (frame.size() > 6) {
+                it->combination = frame.mid(6);
+            }
+            break;
+        case 0x02:
+            it->locked = true;
+            it->combined = false;
+            break;
+        case 0x03:
+        case 0x04: {
+            it->locked = false;
+            it->combined = !it->combination.isEmpty();
+            const bool updates = it->combined && frame[4] == 0x03;
+            QByteArray message = QByteArray::fromHex("48");
+            message += static_cast<char>(portId);
+            message += static_cast<char>(updates ? 0x80 : 0x00);
+            const quint16 pointer = (1 << it->combination.size()) - 1;
+            message += static_cast<char>(pointer);
+            message += static_cast<char>(pointer >> 8);
+            reply(message);
+            it->notify = updates;
+            if (updates && !it->value.isEmpty()) {
+                sendValue(portId, *it);
+            }
+            break;
+        }
+        default:
+            reply(QByteArray::fromHex("05") + '\x42' + '\x06');
+            break;
+    }
+}
+
+void QLegoSimulatedHub::createVirtualPort(quint8 firstPortId, quint8 secondPortId)
+{
+    const auto first = m_ports.find(firstPortId);
+    const auto second = m_ports.find(secondPortId);
+    if (first == m_ports.end() || second == m_ports.end() || first->type != second->type) {
+        reply(QByteArray::fromHex("05") + '\x61' + '\x06');
+        return;
+    }
+
+    quint8 portId = FirstVirtualPort;
+    while (m_ports.contains(portId)) {
+        portId++;
+    }
+    Port port;
+    port.type = first->type;
+    port.virtualPort = true;
+    m_ports.insert(portId, port);
+
+    QByteArray message(7, 0);
+    message[0] = 0x04;
+    message[1] = static_cast<char>(portId);
+    message[2] = 0x02;
+    qToLittleEndian<quint16>(port.type, message.data() + 3);
+    message[5] = static_cast<char>(firstPortId);
+    message[6] = static_cast<char>(secondPortId);
+    reply(message);
+}
+
+void QLegoSimulatedHub::reply(const QByteArray &message)
+{
+    QByteArray frame;
+    frame.reserve(message.size() + 2);
+    frame += static_cast<char>(message.size() + 2);
+    frame += '\0';
+    frame += message;
+    QTimer::singleShot(0, this, [this, frame]() {
+        if (m_open) {
+            emit received(frame);
+        }
+    });
+}
+
+void QLegoSimulatedHub::replyHubProperty(quint8 property)
+{
+    QByteArray message = QByteArray::fromHex("01");
+    message += static_cast<char>(property);
+    message += '\x06';
+    switch (property) {
+        case 0x01:
+            message += m_name.toUtf8().left(14);
+            break;
+        case 0x03:
+        case 0x04:
+            message += QByteArray(Version, sizeof(Version));
+            break;
+        case 0x05:
+            message += static_cast<char>(Rssi);
+            break;
+        case 0x06:
+            message += static_cast<char>(m_battery);
+            break;
+        case 0x0D: {
+            const quint64 address = QBluetoothAddress(m_address).toUInt64();
+            for (int shift = 40; shift >= 0; shift -= 8) {
+                message += static_cast<char>(address >> shift);
+            }
+            break;
+        }
+        default:
+            // Button state and other properties are reported as released or empty.
+            message += '\0';
+            break;
+    }
+    reply(message);
+}
+
+void QLegoSimulatedHub::replyPortInformation(quint8 portId, quint8 type)
+{
+    const QLegoPortInformation information = m_ports.value(portId).information;
+    if (!information.isValid() || (type != 0x01 && type != 0x02)) {
+        reply(QByteArray::fromHex("05") + '\x21' + '\x05');
+        return;
+    }
+
+    QByteArray message = QByteArray::fromHex("43");
+    message += static_cast<char>(portId);
+    message += static_cast<char>(type);
+    if (type == 0x01) {
+        message += static_cast<char>(information.capabilities);
+        message += static_cast<char>(information.modes.size());
+        message += QByteArray(4, 0);
+        qToLittleEndian<quint16>(information.inputModes, message.data() + message.size() - 4);
+        qToLittleEndian<quint16>(information.outputModes, message.data() + message.size() - 2);
+    } else {
+        for (const quint16 combination : information.combinations) {
+            message += static_cast<char>(combination);
+            message += static_cast<char>(combination >> 8);
+        }
+        message += QByteArray(2, 0);
+    }
+    reply(message);
+}
+
+void QLegoSimulatedHub::replyModeInformation(quint8 portId, quint8 mode, quint8 type)
+{
+    const QLegoPortInformation information = m_ports.value(portId).information;
+    if (mode >= information.modes.size()) {
+        reply(QByteArray::fromHex("05") + '\x22' + '\x05');
+        return;
+    }
+
+    const QLegoModeInformation &modeInformation = information.modes[mode];
+    QByteArray message = QByteArray::fromHex("44");
+    message += static_cast<char>(portId);
+    message += static_cast<char>(mode);
+    message += static_cast<char>(type);
+    switch (type) {
+        case 0x00:
+            message += modeInformation.name.toLatin1().left(11);
+            break;
+        case 0x01:
+            message += encodeFloats(modeInformation.rawMinimum, modeInformation.rawMaximum);
+            break;
+        case 0x02:
+            message += encodeFloats(modeInformation.percentMinimum,
+                                    modeInformation.percentMaximum);
+            break;
+        case 0x03:
+            message += encodeFloats(modeInformation.siMinimum, modeInformation.siMaximum);
+            break;
+        case 0x04:
+            message += modeInformation.symbol.toLatin1().left(5);
+            break;
+        case 0x80:
+            message += static_cast<char>(modeInformation.format.datasets);
+            message += static_cast<char>(modeInformation.format.type);
+            message += static_cast<char>(modeInformation.figures);
+            message += static_cast<char>(modeInformation.decimals);
+            break;
+        default:
+            reply(QByteArray::fromHex("05") + '\x22' + '\x05');
+            return;
+    }
+    reply(message);
+}
+
+void QLegoSimulatedHub::sendAttachment(quint8 portId, const Port &port)
+{
+    QByteArray message(13, 0);
+    message[0] = 0x04;
+    message[1] = static_cast<char>(portId);
+    message[2] = 0x01;
+    qToLittleEndian<quint16>(port.type, message.data() + 3);
+    memcpy(message.data() + 5, Version, sizeof(Version));
+    memcpy(message.data() + 9, Version, sizeof(Version));
+    reply(message);
+}
+
+void QLegoSimulatedHub::sendValue(quint8 portId, const Port &port)
+{
+    QByteArray message = QByteArray::fromHex(port.combined ? "46" : "45");
+    message += static_cast<char>(portId);
+    if (port.combined) {
+        // Every entry of the combination is reported.
+        const quint16 pointer = (1 << port.combination.size()) - 1;
+        message += static_cast<char>(pointer);
+        message += static_cast<char>(pointer >> 8);
+    }
+    message += port.value;
+    reply(message);
+}
+
+void QLegoSimulatedHub::reportValue(quint8 portId, Port &port)
+{
+    // Combinations report every change, single modes only those beyond the delta interval.
+    if (!port.combined && !port.reported.isEmpty()
+        && qAbs(firstValue(port.value) - firstValue(port.reported)) < qint64(port.deltaInterval)) {
+        return;
+    }
+    port.reported = port.value;
+    sendValue(portId, port);
+}
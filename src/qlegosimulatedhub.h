@@ -0,0 +1,92 @@
+#ifndef QLEGOSIMULATEDHUB_H
+#define QLEGOSIMULATEDHUB_H
+
+#include "qlegoglobal.h"
+#include "qlegoportinformation.h"
+#include "qlegotransport.h"
+
+#include <QtCore/QMap>
+#include <QtCore/QSet>
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoSimulatedHub : public QLegoTransport
+{
+    Q_OBJECT
+
+public:
+    explicit QLegoSimulatedHub(QObject *parent = nullptr);
+
+    void setAddress(const QString &address);
+    QString name() const;
+    void setName(const QString &name);
+    int battery() const;
+    void setBattery(int level);
+
+    void attachDevice(quint8 portId, quint16 type);
+    void detachDevice(quint8 portId);
+    int mode(quint8 portId) const;
+    bool reportsEnabled(quint8 property) const;
+    void setValue(quint8 portId, const QByteArray &value);
+    void setPortInformation(quint8 portId, const QLegoPortInformation &information);
+    bool automaticFeedback() const;
+    void setAutomaticFeedback(bool enabled);
+    void sendFeedback(quint8 portId, quint8 feedback);
+
+    int framesWritten() const;
+    int writeLatency() const;
+    void setWriteLatency(int msecs);
+
+    QString address() const override;
+    bool isOpen() const override;
+
+public Q_SLOTS:
+    void open() override;
+    void close() override;
+    void write(const QByteArray &frame) override;
+
+Q_SIGNALS:
+    void commandReceived(const QByteArray &frame);
+    void portOutputReceived(quint8 portId, const QByteArray &frame);
+
+private:
+    struct Port
+    {
+        quint16 type = 0;
+        int mode = -1;
+        bool notify = false;
+        quint32 deltaInterval = 1;
+        bool virtualPort = false;
+        bool locked = false;
+        bool combined = false;
+        QByteArray combination;
+        QByteArray value;
+        QByteArray reported;
+        QLegoPortInformation information;
+    };
+
+    void process(const QByteArray &frame);
+    void reply(const QByteArray &message);
+    void replyHubProperty(quint8 property);
+    void replyPortInformation(quint8 portId, quint8 type);
+    void replyModeInformation(quint8 portId, quint8 mode, quint8 type);
+    void setupCombination(quint8 portId, const QByteArray &frame);
+    void createVirtualPort(quint8 firstPortId, quint8 secondPortId);
+    void sendAttachment(quint8 portId, const Port &port);
+    void sendValue(quint8 portId, const Port &port);
+    void reportValue(quint8 portId, Port &port);
+
+    QString m_address;
+    QString m_name;
+    quint8 m_battery;
+    bool m_open;
+    int m_framesWritten;
+    int m_writeLatency;
+    bool m_automaticFeedback;
+    QMap<quint8, Port> m_ports;
+    QSet<quint8> m_reports;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,506 @@
+#include "qlegostatistics.h"
+#include <QtCore/QSaveFile>
+#include <QtCore/QTextStream>
+
+static inline quint64 load(const std::atomic<quint64> &counter)
+{
+    return counter.load(std::memory_order_relaxed);
+}
+
+static void writeHeader(QTextStream &stream, const char *name, const char *type, const char *help)
+{
+    stream << "# HELP " << name << ' ' << help << '\n';
+    stream << "# TYPE " << name << ' ' << type << '\n';
+}
+
+static bool writeFile(const QString &fileName, const QString &contents)
+{
+    // QSaveFile renames into place, so a collector never reads a partial file.
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(contents.toUtf8());
+    return file.commit();
+}
+
+/*!
+  \class QLegoDeviceStatistics
+  \brief The QLegoDeviceStatistics class counts the traffic of a QLegoDevice.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  Every QLegoDevice keeps a QLegoDeviceStatistics object, available through
+  \l{QLegoDevice::statistics()}. The counters are updated on the receive and send paths with
+  relaxed atomic operations and can be read from any thread.
+
+  \l{QLegoDeviceStatistics::toPrometheus()} renders a snapshot in the Prometheus text exposition
+  format, and \l{QLegoDeviceStatistics::writePrometheus()} writes it to a file that can be
+  scraped by the node exporter textfile collector.
+
+  \sa QLegoScannerStatistics
+*/
+
+/*!
+    \enum QLegoDeviceStatistics::ConnectionPhase
+
+    The phases of connecting to a device.
+
+    \value ConnectPhase    From connectToDevice() until the link is established.
+
+    \value DiscoveryPhase  From the link being established until the LPF2 service is discovered.
+
+    \value SetupPhase      From service discovery until the device is ready.
+
+    \omitvalue PhaseCount
+*/
+
+QLegoDeviceStatistics::QLegoDeviceStatistics()
+    : m_addressMutex()
+    , m_address()
+    , m_framesReceived(0)
+    , m_bytesReceived(0)
+    , m_parseFailures(0)
+    , m_truncatedFrames(0)
+    , m_commandsSent(0)
+    , m_bytesSent(0)
+    , m_commandsCoalesced(0)
+    , m_commandsDropped(0)
+    , m_commandsPurged(0)
+    , m_queueDepth(0)
+    , m_reconnects(0)
+{
+    for (auto &counter : m_framesByType) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    for (auto &duration : m_phaseDurations) {
+        duration.store(0, std::memory_order_relaxed);
+    }
+}
+
+/*!
+    Returns the address used to label the metrics of this device.
+*/
+QString QLegoDeviceStatistics::address() const
+{
+    QMutexLocker locker(&m_addressMutex);
+    return m_address;
+}
+
+void QLegoDeviceStatistics::setAddress(const QString &address)
+{
+    QMutexLocker locker(&m_addressMutex);
+    m_address = address;
+}
+
+/*!
+    Returns the number of complete frames received.
+*/
+quint64 QLegoDeviceStatistics::framesReceived() const
+{
+    return load(m_framesReceived);
+}
+
+/*!
+    Returns the number of bytes received, including partial frames.
+*/
+quint64 QLegoDeviceStatistics::bytesReceived() const
+{
+    return load(m_bytesReceived);
+}
+
+/*!
+    Returns the number of complete frames of type \a messageType received.
+*/
+quint64 QLegoDeviceStatistics::framesReceived(quint8 messageType) const
+{
+    return load(m_framesByType[messageType]);
+}
+
+/*!
+    Returns the number of frames that were discarded because they could not be parsed.
+*/
+quint64 QLegoDeviceStatistics::parseFailures() const
+{
+    return load(m_parseFailures);
+}
+
+/*!
+    Returns the number of frames that were cut off before all of their bytes arrived.
+*/
+quint64 QLegoDeviceStatistics::truncatedFrames() const
+{
+    return load(m_truncatedFrames);
+}
+
+/*!
+    Returns the number of commands written to the hub.
+*/
+quint64 QLegoDeviceStatistics::commandsSent() const
+{
+    return load(m_commandsSent);
+}
+
+/*!
+    Returns the number of bytes written to the hub.
+*/
+quint64 QLegoDeviceStatistics::bytesSent() const
+{
+    return load(m_bytesSent);
+}
+
+/*!
+    Returns the number of commands merged with an identical command that was still queued.
+*/
+quint64 QLegoDeviceStatistics::commandsCoalesced() const
+{
+    return load(m_commandsCoalesced);
+}
+
+/*!
+    Returns the number of commands dropped because the device was not connected.
+*/
+quint64 QLegoDeviceStatistics::commandsDropped() const
+{
+    return load(m_commandsDropped);
+}
+
+/*!
+    Returns the number of queued motion commands dropped because a stop was sent to their port.
+*/
+quint64 QLegoDeviceStatistics::commandsPurged() const
+{
+    return load(m_commandsPurged);
+}
+
+/*!
+    Returns the number of commands that are queued or have not yet been acknowledged.
+*/
+quint64 QLegoDeviceStatistics::queueDepth() const
+{
+    return load(m_queueDepth);
+}
+
+/*!
+    Returns how many times the device was connected again after its first connection.
+*/
+quint64 QLegoDeviceStatistics::reconnects() const
+{
+    return load(m_reconnects);
+}
+
+/*!
+    Returns how long the last connection spent in \a phase, in nanoseconds.
+*/
+qint64 QLegoDeviceStatistics::phaseDuration(ConnectionPhase phase) const
+{
+    return m_phaseDurations[phase].load(std::memory_order_relaxed);
+}
+
+/*!
+    Returns a snapshot of the counters in the Prometheus text exposition format.
+
+    \sa writePrometheus()
+*/
+QString QLegoDeviceStatistics::toPrometheus() const
+{
+    QString output;
+    render(output, { this });
+    return output;
+}
+
+/*!
+    Writes a snapshot of the counters to \a fileName in the Prometheus text exposition format.
+    The file is replaced atomically. Returns \c true on success.
+
+    \sa toPrometheus()
+*/
+bool QLegoDeviceStatistics::writePrometheus(const QString &fileName) const
+{
+    return writeFile(fileName, toPrometheus());
+}
+
+void QLegoDeviceStatistics::render(QString &output,
+                                   const QList<const QLegoDeviceStatistics *> &devices)
+{
+    struct Counter
+    {
+        const char *name;
+        const char *type;
+        const char *help;
+        std::atomic<quint64> QLegoDeviceStatistics::*counter;
+    };
+
+    // clang-format off
+    static const Counter counters[] = {
+        { "qtlego_device_frames_received_total", "counter", "Complete frames received from the hub.", &QLegoDeviceStatistics::m_framesReceived },
+        { "qtlego_device_bytes_received_total", "counter", "Bytes received from the hub.", &QLegoDeviceStatistics::m_bytesReceived },
+        { "qtlego_device_parse_failures_total", "counter", "Frames discarded because they could not be parsed.", &QLegoDeviceStatistics::m_parseFailures },
+        { "qtlego_device_truncated_frames_total", "counter", "Frames cut off before all bytes arrived.", &QLegoDeviceStatistics::m_truncatedFrames },
+        { "qtlego_device_commands_sent_total", "counter", "Commands written to the hub.", &QLegoDeviceStatistics::m_commandsSent },
+        { "qtlego_device_bytes_sent_total", "counter", "Bytes written to the hub.", &QLegoDeviceStatistics::m_bytesSent },
+        { "qtlego_device_commands_coalesced_total", "counter", "Commands merged with an identical queued command.", &QLegoDeviceStatistics::m_commandsCoalesced },
+        { "qtlego_device_commands_dropped_total", "counter", "Commands dropped while disconnected.", &QLegoDeviceStatistics::m_commandsDropped },
+        { "qtlego_device_commands_purged_total", "counter", "Queued motion commands dropped by a stop.", &QLegoDeviceStatistics::m_commandsPurged },
+        { "qtlego_device_queue_depth", "gauge", "Commands queued or awaiting acknowledgement.", &QLegoDeviceStatistics::m_queueDepth },
+        { "qtlego_device_reconnects_total", "counter", "Connections after the first one.", &QLegoDeviceStatistics::m_reconnects },
+    };
+    static const char *phaseNames[] = { "connect", "discovery", "setup" };
+    // clang-format on
+
+    QTextStream stream(&output);
+
+    for (const auto &counter : counters) {
+        writeHeader(stream, counter.name, counter.type, counter.help);
+        for (const auto device : devices) {
+            stream << counter.name << "{address=\"" << device->address() << "\"} "
+                   << load(device->*counter.counter) << '\n';
+        }
+    }
+
+    writeHeader(stream, "qtlego_device_frames_by_type_total", "counter",
+                "Complete frames received from the hub by message type.");
+    for (const auto device : devices) {
+        for (int type = 0; type < 256; type++) {
+            const quint64 frames = load(device->m_framesByType[type]);
+            if (frames > 0) {
+                stream << "qtlego_device_frames_by_type_total{address=\"" << device->address()
+                       << "\",type=\"0x" << QString::number(type, 16).rightJustified(2, '0')
+                       << "\"} " << frames << '\n';
+            }
+        }
+    }
+
+    writeHeader(stream, "qtlego_device_connection_phase_seconds", "gauge",
+                "Duration of each phase of the last connection.");
+    for (const auto device : devices) {
+        for (int phase = 0; phase < PhaseCount; phase++) {
+            const qint64 nsecs = device->m_phaseDurations[phase].load(std::memory_order_relaxed);
+            stream << "qtlego_device_connection_phase_seconds{address=\"" << device->address()
+                   << "\",phase=\"" << phaseNames[phase] << "\"} "
+                   << QString::number(nsecs / 1e9, 'f', 6) << '\n';
+        }
+    }
+}
+
+/*!
+  \class QLegoAdapterStatistics
+  \brief The QLegoAdapterStatistics class counts the connections placed on a Bluetooth adapter.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  QLegoAdapterBalancer keeps one QLegoAdapterStatistics object for every local adapter. The
+  counters can be read from any thread, and are included in the Prometheus output of
+  QLegoScannerStatistics, labelled by adapter address.
+*/
+
+QLegoAdapterStatistics::QLegoAdapterStatistics()
+    : m_address()
+    , m_connections(0)
+    , m_placements(0)
+    , m_connectFailures(0)
+    , m_rssiTotal(0)
+    , m_rssiSamples(0)
+{
+}
+
+/*!
+    Returns the address of the adapter.
+*/
+QString QLegoAdapterStatistics::address() const
+{
+    return m_address;
+}
+
+/*!
+    Returns the number of connections the adapter currently holds.
+*/
+quint64 QLegoAdapterStatistics::connections() const
+{
+    return load(m_connections);
+}
+
+/*!
+    Returns the number of devices placed on the adapter.
+*/
+quint64 QLegoAdapterStatistics::placements() const
+{
+    return load(m_placements);
+}
+
+/*!
+    Returns the number of devices placed on the adapter that disconnected before they were
+    ready.
+*/
+quint64 QLegoAdapterStatistics::connectFailures() const
+{
+    return load(m_connectFailures);
+}
+
+/*!
+    Returns the mean RSSI, in dBm, at which the adapter heard the devices placed on it, or 0 if
+    none was heard.
+*/
+double QLegoAdapterStatistics::averageRssi() const
+{
+    const quint64 samples = load(m_rssiSamples);
+    return samples ? double(m_rssiTotal.load(std::memory_order_relaxed)) / samples : 0;
+}
+
+/*!
+  \class QLegoScannerStatistics
+  \brief The QLegoScannerStatistics class counts the activity of a QLegoDeviceScanner.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  The scanner statistics, available through \l{QLegoDeviceScanner::statistics()}, count scans
+  and discovered devices. When rendered to the Prometheus text format they also include the
+  \l{QLegoDeviceStatistics} of every device the scanner has connected to, labelled by address,
+  and the \l{QLegoAdapterStatistics} of every local adapter. All functions may be called from
+  any thread.
+*/
+
+QLegoScannerStatistics::QLegoScannerStatistics()
+    : m_scansStarted(0)
+    , m_scanErrors(0)
+    , m_advertisementsSeen(0)
+    , m_devicesFound(0)
+    , m_devicesLost(0)
+    , m_placementsRejected(0)
+    , m_devicesMutex()
+    , m_devices()
+    , m_adapters()
+{
+}
+
+/*!
+    Returns the number of scans started.
+*/
+quint64 QLegoScannerStatistics::scansStarted() const
+{
+    return load(m_scansStarted);
+}
+
+/*!
+    Returns the number of errors reported while scanning.
+*/
+quint64 QLegoScannerStatistics::scanErrors() const
+{
+    return load(m_scanErrors);
+}
+
+/*!
+    Returns the number of Bluetooth devices seen while scanning, including non-LEGO devices.
+*/
+quint64 QLegoScannerStatistics::advertisementsSeen() const
+{
+    return load(m_advertisementsSeen);
+}
+
+/*!
+    Returns the number of LEGO devices found.
+*/
+quint64 QLegoScannerStatistics::devicesFound() const
+{
+    return load(m_devicesFound);
+}
+
+/*!
+    Returns the number of devices that have disconnected.
+*/
+quint64 QLegoScannerStatistics::devicesLost() const
+{
+    return load(m_devicesLost);
+}
+
+/*!
+    Returns the number of devices that were not connected because every adapter was full.
+*/
+quint64 QLegoScannerStatistics::placementsRejected() const
+{
+    return load(m_placementsRejected);
+}
+
+/*!
+    Returns the statistics of the adapters the scanner connects through.
+*/
+QList<const QLegoAdapterStatistics *> QLegoScannerStatistics::adapters() const
+{
+    return m_adapters;
+}
+
+/*!
+    Returns a snapshot of the scanner and device counters in the Prometheus text exposition
+    format.
+*/
+QString QLegoScannerStatistics::toPrometheus() const
+{
+    // clang-format off
+    static const struct {
+        const char *name;
+        const char *help;
+        std::atomic<quint64> QLegoScannerStatistics::*counter;
+    } counters[] = {
+        { "qtlego_scanner_scans_started_total", "Scans started.", &QLegoScannerStatistics::m_scansStarted },
+        { "qtlego_scanner_scan_errors_total", "Errors reported while scanning.", &QLegoScannerStatistics::m_scanErrors },
+        { "qtlego_scanner_advertisements_total", "Bluetooth devices seen while scanning.", &QLegoScannerStatistics::m_advertisementsSeen },
+        { "qtlego_scanner_devices_found_total", "LEGO devices found.", &QLegoScannerStatistics::m_devicesFound },
+        { "qtlego_scanner_devices_lost_total", "LEGO devices disconnected.", &QLegoScannerStatistics::m_devicesLost },
+        { "qtlego_scanner_placements_rejected_total", "LEGO devices not connected because every adapter was full.", &QLegoScannerStatistics::m_placementsRejected },
+    };
+    static const struct {
+        const char *name;
+        const char *type;
+        const char *help;
+        std::atomic<quint64> QLegoAdapterStatistics::*counter;
+    } adapterCounters[] = {
+        { "qtlego_adapter_connections", "gauge", "Connections held by the adapter.", &QLegoAdapterStatistics::m_connections },
+        { "qtlego_adapter_placements_total", "counter", "Devices placed on the adapter.", &QLegoAdapterStatistics::m_placements },
+        { "qtlego_adapter_connect_failures_total", "counter", "Devices that disconnected before they were ready.", &QLegoAdapterStatistics::m_connectFailures },
+    };
+    // clang-format on
+
+    QString output;
+    {
+        QTextStream stream(&output);
+        for (const auto &counter : counters) {
+            writeHeader(stream, counter.name, "counter", counter.help);
+            stream << counter.name << ' ' << load(this->*counter.counter) << '\n';
+        }
+        for (const auto &counter : adapterCounters) {
+            writeHeader(stream, counter.name, counter.type, counter.help);
+            for (const auto adapter : m_adapters) {
+                stream << counter.name << "{adapter=\"" << adapter->m_address << "\"} "
+                       << load(adapter->*counter.counter) << '\n';
+            }
+        }
+    }
+    {
+        // Devices are only deleted once they are removed, so they outlive the lock.
+        QMutexLocker locker(&m_devicesMutex);
+        QLegoDeviceStatistics::render(output, m_devices);
+    }
+    return output;
+}
+
+/*!
+    Writes a snapshot of the scanner and device counters to \a fileName in the Prometheus text
+    exposition format. The file is replaced atomically. Returns \c true on success.
+*/
+bool QLegoScannerStatistics::writePrometheus(const QString &fileName) const
+{
+    return writeFile(fileName, toPrometheus());
+}
+
+void QLegoScannerStatistics::addDevice(const QLegoDeviceStatistics *device)
+{
+    QMutexLocker locker(&m_devicesMutex);
+    m_devices.append(device);
+}
+
+// Returns false if device was already removed.
+bool QLegoScannerStatistics::removeDevice(const QLegoDeviceStatistics *device)
+{
+    QMutexLocker locker(&m_devicesMutex);
+    return m_devices.removeAll(device) > 0;
+}
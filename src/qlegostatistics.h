@@ -0,0 +1,137 @@
+#ifndef QLEGOSTATISTICS_H
+#define QLEGOSTATISTICS_H
+
+#include "qlegoglobal.h"
+
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+#include <atomic>
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoDeviceStatistics
+{
+public:
+    enum ConnectionPhase
+    {
+        ConnectPhase,
+        DiscoveryPhase,
+        SetupPhase,
+        PhaseCount
+    };
+
+    QLegoDeviceStatistics();
+
+    QString address() const;
+
+    quint64 framesReceived() const;
+    quint64 bytesReceived() const;
+    quint64 framesReceived(quint8 messageType) const;
+    quint64 parseFailures() const;
+    quint64 truncatedFrames() const;
+
+    quint64 commandsSent() const;
+    quint64 bytesSent() const;
+    quint64 commandsCoalesced() const;
+    quint64 commandsDropped() const;
+    quint64 commandsPurged() const;
+    quint64 queueDepth() const;
+    quint64 reconnects() const;
+    qint64 phaseDuration(ConnectionPhase phase) const;
+
+    QString toPrometheus() const;
+    bool writePrometheus(const QString &fileName) const;
+
+private:
+    Q_DISABLE_COPY(QLegoDeviceStatistics)
+    friend class QLegoDevice;
+    friend class QLegoScannerStatistics;
+
+    static void render(QString &output, const QList<const QLegoDeviceStatistics *> &devices);
+
+    void setAddress(const QString &address);
+
+    // Written on the device thread, read by exporters on any thread.
+    mutable QMutex m_addressMutex;
+    QString m_address;
+    std::atomic<quint64> m_framesReceived;
+    std::atomic<quint64> m_bytesReceived;
+    std::atomic<quint64> m_framesByType[256];
+    std::atomic<quint64> m_parseFailures;
+    std::atomic<quint64> m_truncatedFrames;
+    std::atomic<quint64> m_commandsSent;
+    std::atomic<quint64> m_bytesSent;
+    std::atomic<quint64> m_commandsCoalesced;
+    std::atomic<quint64> m_commandsDropped;
+    std::atomic<quint64> m_commandsPurged;
+    std::atomic<quint64> m_queueDepth;
+    std::atomic<quint64> m_reconnects;
+    std::atomic<qint64> m_phaseDurations[PhaseCount];
+};
+
+class Q_LEGO_EXPORT QLegoAdapterStatistics
+{
+public:
+    QLegoAdapterStatistics();
+
+    QString address() const;
+
+    quint64 connections() const;
+    quint64 placements() const;
+    quint64 connectFailures() const;
+    double averageRssi() const;
+
+private:
+    Q_DISABLE_COPY(QLegoAdapterStatistics)
+    friend class QLegoAdapterBalancer;
+    friend class QLegoScannerStatistics;
+
+    QString m_address;
+    std::atomic<quint64> m_connections;
+    std::atomic<quint64> m_placements;
+    std::atomic<quint64> m_connectFailures;
+    std::atomic<qint64> m_rssiTotal;
+    std::atomic<quint64> m_rssiSamples;
+};
+
+class Q_LEGO_EXPORT QLegoScannerStatistics
+{
+public:
+    QLegoScannerStatistics();
+
+    quint64 scansStarted() const;
+    quint64 scanErrors() const;
+    quint64 advertisementsSeen() const;
+    quint64 devicesFound() const;
+    quint64 devicesLost() const;
+    quint64 placementsRejected() const;
+
+    QList<const QLegoAdapterStatistics *> adapters() const;
+
+    QString toPrometheus() const;
+    bool writePrometheus(const QString &fileName) const;
+
+private:
+    Q_DISABLE_COPY(QLegoScannerStatistics)
+    friend class QLegoDeviceScanner;
+
+    void addDevice(const QLegoDeviceStatistics *device);
+    bool removeDevice(const QLegoDeviceStatistics *device);
+
+    std::atomic<quint64> m_scansStarted;
+    std::atomic<quint64> m_scanErrors;
+    std::atomic<quint64> m_advertisementsSeen;
+    std::atomic<quint64> m_devicesFound;
+    std::atomic<quint64> m_devicesLost;
+    std::atomic<quint64> m_placementsRejected;
+    // Changed on the scanner thread, read by exporters on any thread.
+    mutable QMutex m_devicesMutex;
+    QList<const QLegoDeviceStatistics *> m_devices;
+    QList<const QLegoAdapterStatistics *> m_adapters;
+};
+
+QT_END_NAMESPACE
+
+#endif
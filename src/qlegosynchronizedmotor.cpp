@@ -0,0 +1,194 @@
+#include "qlegosynchronizedmotor.h"
+#include "qlegocommon.h"
+#include "qlegocommandreply.h"
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(synchronizedMotorLogger, "lego.attachedDevice.synchronizedMotor");
+
+enum MotorValues
+{
+    Stop = 0,
+    Brake = 127,
+};
+
+enum SynchronizedSubCommands
+{
+    StartPower = 0x02,
+    StartSpeed = 0x08,
+    StartSpeedForTime = 0x0A,
+    StartSpeedForDegrees = 0x0C,
+    GotoAbsolutePosition = 0x0E,
+};
+
+static inline qint8 clampSpeed(int speed)
+{
+    return static_cast<qint8>(qBound(-100, speed, 100));
+}
+
+static inline quint8 clampPower(int power)
+{
+    return static_cast<quint8>(qBound(0, power, 100));
+}
+
+/*!
+  \class QLegoSynchronizedMotor
+  \brief The QLegoSynchronizedMotor class drives two motors of a hub in lockstep.
+  \inmodule QtLego
+  \ingroup attached-devices
+
+  A hub can join two ports with identical motors into a virtual port. Commands for the virtual
+  port carry a value for each motor in a single frame, so both motors start, run and stop
+  together instead of one link interval apart. Typical uses are the two wheels of a rover or
+  the two sides of a crane.
+
+  Virtual ports are created with QLegoDevice::synchronizeMotors() or
+  QLegoDevice::createVirtualPort(), and removed again with QLegoDevice::destroyVirtualPort().
+  The hub reports the new port like any other attachment, with the ports it joins available as
+  firstPortId() and secondPortId().
+
+  \code
+  auto left = device->waitForAttachedMotor("A");
+  auto right = device->waitForAttachedMotor("B");
+  auto wheels = device->synchronizeMotors(left, right);
+  wheels->startSpeedForDegrees(720, 50, -50); // Turn on the spot.
+  \endcode
+
+  stop() and brake() stop both motors with a single synchronized command, and so does
+  QLegoDevice::stopAll(). The power property follows the first motor.
+*/
+
+QLegoSynchronizedMotor::QLegoSynchronizedMotor(DeviceType deviceType, quint8 portId,
+                                               quint8 firstPortId, quint8 secondPortId,
+                                               QObject *parent)
+    : QLegoMotor(deviceType, portId, parent)
+    , m_firstPortId(firstPortId)
+    , m_secondPortId(secondPortId)
+{
+}
+
+/*!
+    \property QLegoSynchronizedMotor::firstPortId
+    \brief the port of the motor that takes the first value of each command.
+*/
+int QLegoSynchronizedMotor::firstPortId() const
+{
+    return m_firstPortId;
+}
+
+/*!
+    \property QLegoSynchronizedMotor::secondPortId
+    \brief the port of the motor that takes the second value of each command.
+*/
+int QLegoSynchronizedMotor::secondPortId() const
+{
+    return m_secondPortId;
+}
+
+/*!
+    Commands both motors to stop.
+*/
+QLegoCommandReply *QLegoSynchronizedMotor::stop()
+{
+    return startPower(MotorValues::Stop, MotorValues::Stop);
+}
+
+/*!
+    Commands both motors to start braking.
+*/
+QLegoCommandReply *QLegoSynchronizedMotor::brake()
+{
+    return startPower(MotorValues::Brake, MotorValues::Brake);
+}
+
+/*!
+    Sets the first motor to \a first and the second motor to \a second percent of power.
+*/
+QLegoCommandReply *QLegoSynchronizedMotor::startPower(int first, int second)
+{
+    QByteArray bytes;
+    bytes += static_cast<char>(mapSpeed(first));
+    bytes += static_cast<char>(mapSpeed(second));
+    qCDebug(synchronizedMotorLogger) << "startPower:" << first << second;
+    updatePower(first);
+    return writePortOutput(SynchronizedSubCommands::StartPower, bytes);
+}
+
+/*!
+    Starts running the motors at \a first and \a second percent of speed, using at most
+    \a maxPower percent of power.
+*/
+QLegoCommandReply *QLegoSynchronizedMotor::startSpeed(int first, int second, int maxPower)
+{
+    QByteArray bytes;
+    bytes += static_cast<char>(clampSpeed(first));
+    bytes += static_cast<char>(clampSpeed(second));
+    bytes += static_cast<char>(clampPower(maxPower));
+    bytes += static_cast<char>(profiles());
+    qCDebug(synchronizedMotorLogger) << "startSpeed:" << first << second;
+    return writePortOutput(SynchronizedSubCommands::StartSpeed, bytes);
+}
+
+/*!
+    Runs the motors at \a first and \a second percent of speed for \a msecs milliseconds, then
+    applies \a endState. At most \a maxPower percent of power is used.
+*/
+QLegoCommandReply *QLegoSynchronizedMotor::startSpeedForTime(int msecs, int first, int second,
+                                                             int maxPower, EndState endState)
+{
+    QByteArray bytes;
+    appendLittleEndian<quint16>(bytes, static_cast<quint16>(qBound(0, msecs, 0xFFFF)));
+    bytes += static_cast<char>(clampSpeed(first));
+    bytes += static_cast<char>(clampSpeed(second));
+    bytes += static_cast<char>(clampPower(maxPower));
+    bytes += static_cast<char>(endState);
+    bytes += static_cast<char>(profiles());
+    qCDebug(synchronizedMotorLogger) << "startSpeedForTime:" << msecs << first << second;
+    return writePortOutput(SynchronizedSubCommands::StartSpeedForTime, bytes);
+}
+
+/*!
+    Runs the motors at \a first and \a second percent of speed until together they have turned
+    \a degrees, then applies \a endState. At most \a maxPower percent of power is used.
+
+    The hub splits \a degrees between the motors in proportion to their speeds. A negative value
+    for \a degrees reverses both speeds.
+*/
+QLegoCommandReply *QLegoSynchronizedMotor::startSpeedForDegrees(int degrees, int first,
+                                                                int second, int maxPower,
+                                                                EndState endState)
+{
+    if (degrees < 0) {
+        degrees = -degrees;
+        first = -first;
+        second = -second;
+    }
+    QByteArray bytes;
+    appendLittleEndian<quint32>(bytes, static_cast<quint32>(degrees));
+    bytes += static_cast<char>(clampSpeed(first));
+    bytes += static_cast<char>(clampSpeed(second));
+    bytes += static_cast<char>(clampPower(maxPower));
+    bytes += static_cast<char>(endState);
+    bytes += static_cast<char>(profiles());
+    qCDebug(synchronizedMotorLogger) << "startSpeedForDegrees:" << degrees << first << second;
+    return writePortOutput(SynchronizedSubCommands::StartSpeedForDegrees, bytes);
+}
+
+/*!
+    Moves the first motor to the absolute encoder position \a first and the second motor to
+    \a second (in degrees) at \a speed percent, then applies \a endState. At most \a maxPower
+    percent of power is used.
+*/
+QLegoCommandReply *QLegoSynchronizedMotor::gotoAbsolutePosition(int first, int second,
+                                                                int speed, int maxPower,
+                                                                EndState endState)
+{
+    QByteArray bytes;
+    appendLittleEndian<qint32>(bytes, first);
+    appendLittleEndian<qint32>(bytes, second);
+    bytes += static_cast<char>(clampSpeed(qAbs(speed)));
+    bytes += static_cast<char>(clampPower(maxPower));
+    bytes += static_cast<char>(endState);
+    bytes += static_cast<char>(profiles());
+    qCDebug(synchronizedMotorLogger) << "gotoAbsolutePosition:" << first << second << speed;
+    return writePortOutput(SynchronizedSubCommands::GotoAbsolutePosition, bytes);
+}
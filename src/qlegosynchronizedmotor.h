@@ -0,0 +1,47 @@
+#ifndef QLEGOSYNCHRONIZEDMOTOR_H
+#define QLEGOSYNCHRONIZEDMOTOR_H
+
+#include "qlegoglobal.h"
+#include "qlegomotor.h"
+#include <QtCore/QObject>
+
+QT_FORWARD_DECLARE_CLASS(QLegoCommandReply)
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoSynchronizedMotor : public QLegoMotor
+{
+    Q_OBJECT
+    Q_PROPERTY(int firstPortId READ firstPortId)
+    Q_PROPERTY(int secondPortId READ secondPortId)
+
+public:
+    explicit QLegoSynchronizedMotor(DeviceType deviceType, quint8 portId, quint8 firstPortId,
+                                    quint8 secondPortId, QObject *parent = nullptr);
+
+    int firstPortId() const;
+    int secondPortId() const;
+
+    QLegoCommandReply *stop() override;
+    QLegoCommandReply *brake() override;
+
+    Q_INVOKABLE QLegoCommandReply *startPower(int first, int second);
+    Q_INVOKABLE QLegoCommandReply *startSpeed(int first, int second, int maxPower = 100);
+    Q_INVOKABLE QLegoCommandReply *startSpeedForTime(int msecs, int first, int second,
+                                                     int maxPower = 100,
+                                                     EndState endState = Brake);
+    Q_INVOKABLE QLegoCommandReply *startSpeedForDegrees(int degrees, int first, int second,
+                                                        int maxPower = 100,
+                                                        EndState endState = Brake);
+    Q_INVOKABLE QLegoCommandReply *gotoAbsolutePosition(int first, int second, int speed,
+                                                        int maxPower = 100,
+                                                        EndState endState = Brake);
+
+private:
+    quint8 m_firstPortId;
+    quint8 m_secondPortId;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,620 @@
+#include "qlegotelemetry.h"
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+#include <QtCore/QtEndian>
+#include <algorithm>
+#include <cstring>
+
+Q_LOGGING_CATEGORY(telemetryLogger, "lego.telemetry");
+
+static const char FileMagic[8] = { 'Q', 'L', 'E', 'G', 'O', 'T', 'L', 'M' };
+static const char IndexMagic[8] = { 'Q', 'L', 'T', 'I', 'N', 'D', 'E', 'X' };
+static const quint32 ChunkMagic = 0x43544c51; // "QLTC"
+static const quint32 FileVersion = 1;
+
+static const int FileHeaderSize = 16;
+static const int ChunkHeaderSize = 48;
+static const int IndexEntrySize = 8 + ChunkHeaderSize;
+static const int FooterSize = 24;
+
+static inline quint64 zigzag(qint64 value)
+{
+    return (static_cast<quint64>(value) << 1) ^ static_cast<quint64>(value >> 63);
+}
+
+static inline qint64 unzigzag(quint64 value)
+{
+    return static_cast<qint64>(value >> 1) ^ -static_cast<qint64>(value & 1);
+}
+
+static inline void appendVarint(QByteArray &bytes, quint64 value)
+{
+    while (value >= 0x80) {
+        bytes += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    bytes += static_cast<char>(value);
+}
+
+static inline bool readVarint(const uchar *&data, const uchar *end, quint64 *value)
+{
+    quint64 result = 0;
+    for (int shift = 0; data < end && shift < 64; shift += 7) {
+        const uchar byte = *data++;
+        result |= static_cast<quint64>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+  \class QLegoTelemetryChannel
+  \brief The QLegoTelemetryChannel struct names one column of a telemetry file.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  A channel holds the values of one dataset of one mode of an attached device, identified
+  by the address of its hub and its port.
+*/
+
+/*!
+  \class QLegoTelemetryWriter
+  \brief The QLegoTelemetryWriter class stores decoded sensor samples compactly.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  The writer keeps one column per channel. Once a column holds chunkSize() samples, it is
+  handed to a worker thread that encodes it as a chunk and appends it to the file, so writing
+  a sample only appends two numbers in memory.
+
+  Within a chunk, timestamps are rounded to resolution() and stored as the zigzag varint
+  encoded change of their spacing, which is close to zero for periodic reports. Values are
+  stored as zigzag varint encoded differences. A sensor reporting every 10 ms typically takes
+  three to four bytes per sample, against about 26 bytes for the same frame in a QLegoCapture.
+
+  Closing the writer appends an index of all chunks with their channel and time range, which
+  lets QLegoTelemetryReader find the chunks of a channel and time window without reading
+  the others. Files that were not closed are still readable, by scanning the chunk headers.
+
+  \code
+  QLegoTelemetryWriter writer("telemetry.qlt");
+  writer.open();
+  const quint64 address = QBluetoothAddress(device->address()).toUInt64();
+  QObject::connect(motor, &QLegoAttachedDevice::valueReceived, [&](const QLegoSample &sample) {
+      writer.write(address, sample);
+  });
+  \endcode
+*/
+
+/*!
+    Constructs a writer for \a fileName.
+*/
+QLegoTelemetryWriter::QLegoTelemetryWriter(const QString &fileName)
+    : m_fileName(fileName)
+    , m_chunkSize(DefaultChunkSize)
+    , m_resolution(DefaultResolution)
+    , m_file()
+    , m_worker(nullptr)
+    , m_mutex()
+    , m_condition()
+    , m_stopping(false)
+    , m_channels()
+    , m_queue()
+    , m_index()
+    , m_buffer()
+    , m_samplesWritten(0)
+    , m_chunksWritten(0)
+{
+}
+
+QLegoTelemetryWriter::~QLegoTelemetryWriter()
+{
+    close();
+}
+
+/*!
+    Returns the name of the file written.
+*/
+QString QLegoTelemetryWriter::fileName() const
+{
+    return m_fileName;
+}
+
+/*!
+    Returns the number of samples per chunk.
+*/
+int QLegoTelemetryWriter::chunkSize() const
+{
+    return m_chunkSize;
+}
+
+/*!
+    Sets the number of samples per chunk to \a samples. Smaller chunks make reads of short
+    windows cheaper, and larger chunks compress slightly better. The chunk size cannot be
+    changed while the file is open.
+*/
+void QLegoTelemetryWriter::setChunkSize(int samples)
+{
+    if (isOpen()) {
+        qCWarning(telemetryLogger) << "cannot change the chunk size of an open file";
+        return;
+    }
+    m_chunkSize = qMax(samples, 1);
+}
+
+/*!
+    Returns the resolution of stored timestamps in nanoseconds. The default is one
+    microsecond.
+*/
+qint64 QLegoTelemetryWriter::resolution() const
+{
+    return m_resolution;
+}
+
+/*!
+    Rounds stored timestamps down to multiples of \a nanoseconds. The resolution is stored in
+    the header of the file, and cannot be changed while it is open.
+*/
+void QLegoTelemetryWriter::setResolution(qint64 nanoseconds)
+{
+    if (isOpen()) {
+        qCWarning(telemetryLogger) << "cannot change the resolution of an open file";
+        return;
+    }
+    m_resolution = qBound<qint64>(1, nanoseconds, 1000000000);
+}
+
+/*!
+    Creates the file and starts the worker thread. Returns \c false if the file cannot be
+    created.
+*/
+bool QLegoTelemetryWriter::open()
+{
+    if (isOpen()) {
+        return true;
+    }
+
+    m_file.setFileName(m_fileName);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCWarning(telemetryLogger) << "cannot create:" << m_fileName << m_file.errorString();
+        return false;
+    }
+
+    QByteArray header(FileHeaderSize, 0);
+    memcpy(header.data(), FileMagic, sizeof(FileMagic));
+    qToLittleEndian<quint32>(FileVersion, header.data() + 8);
+    qToLittleEndian<quint32>(static_cast<quint32>(m_resolution), header.data() + 12);
+    m_file.write(header);
+
+    m_index.clear();
+    m_stopping = false;
+    m_samplesWritten.store(0, std::memory_order_relaxed);
+    m_chunksWritten.store(0, std::memory_order_relaxed);
+    m_worker = QThread::create([this]() { run(); });
+    m_worker->start(QThread::LowPriority);
+    return true;
+}
+
+/*!
+    Writes all buffered samples, appends the index and closes the file.
+*/
+void QLegoTelemetryWriter::close()
+{
+    if (!m_worker) {
+        return;
+    }
+
+    flush();
+    QMutexLocker locker(&m_mutex);
+    m_stopping = true;
+    m_condition.wakeOne();
+    locker.unlock();
+
+    m_worker->wait();
+    delete m_worker;
+    m_worker = nullptr;
+    m_channels.clear();
+
+    QByteArray footer(FooterSize, 0);
+    qToLittleEndian<qint64>(m_file.pos(), footer.data());
+    qToLittleEndian<quint32>(static_cast<quint32>(m_index.size()), footer.data() + 8);
+    memcpy(footer.data() + 16, IndexMagic, sizeof(IndexMagic));
+
+    for (const auto &entry : m_index) {
+        QByteArray offset(8, 0);
+        qToLittleEndian<qint64>(entry.offset, offset.data());
+        m_file.write(offset);
+        m_file.write(entry.header);
+    }
+    m_file.write(footer);
+    m_file.close();
+    m_index.clear();
+}
+
+/*!
+    Returns \c true if samples are being written.
+*/
+bool QLegoTelemetryWriter::isOpen() const
+{
+    return m_worker != nullptr;
+}
+
+/*!
+    Appends the values of \a sample, reported by the hub with Bluetooth \a address. Each value
+    goes to the channel of its dataset.
+
+    This function is thread-safe.
+*/
+void QLegoTelemetryWriter::write(quint64 address, const QLegoSample &sample)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_worker) {
+        return;
+    }
+
+    for (quint8 dataset = 0; dataset < sample.count; dataset++) {
+        const ChannelKey key(address, (sample.portId << 16) | (sample.mode << 8) | dataset);
+        auto it = m_channels.find(key);
+        if (it == m_channels.end()) {
+            Chunk chunk;
+            chunk.channel = { address, sample.portId, sample.mode, dataset,
+                              static_cast<QLegoValueFormat::DataType>(sample.type) };
+            chunk.timestamps.reserve(m_chunkSize);
+            chunk.values.reserve(m_chunkSize);
+            it = m_channels.insert(key, chunk);
+        }
+        it->timestamps.append(sample.timestamp);
+        it->values.append(sample.values[dataset]);
+        if (it->timestamps.size() >= m_chunkSize) {
+            enqueue(*it);
+        }
+    }
+    m_samplesWritten.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*!
+    Hands all partially filled columns to the worker thread.
+*/
+void QLegoTelemetryWriter::flush()
+{
+    QMutexLocker locker(&m_mutex);
+    for (auto it = m_channels.begin(); it != m_channels.end(); ++it) {
+        if (!it->timestamps.isEmpty()) {
+            enqueue(*it);
+        }
+    }
+}
+
+/*!
+    Returns the number of samples written since the file was opened.
+*/
+quint64 QLegoTelemetryWriter::samplesWritten() const
+{
+    return m_samplesWritten.load(std::memory_order_relaxed);
+}
+
+/*!
+    Returns the number of chunks written to the file since it was opened.
+*/
+quint64 QLegoTelemetryWriter::chunksWritten() const
+{
+    return m_chunksWritten.load(std::memory_order_relaxed);
+}
+
+void QLegoTelemetryWriter::enqueue(Chunk &chunk)
+{
+    m_queue.enqueue(chunk);
+    chunk.timestamps = QVector<qint64>();
+    chunk.values = QVector<qint32>();
+    chunk.timestamps.reserve(m_chunkSize);
+    chunk.values.reserve(m_chunkSize);
+    m_condition.wakeOne();
+}
+
+void QLegoTelemetryWriter::writeChunk(const Chunk &chunk)
+{
+    const auto &timestamps = chunk.timestamps;
+    const auto &values = chunk.values;
+    m_buffer.clear();
+
+    // Timestamps as the change of their spacing, values as differences.
+    qint64 previous = timestamps.first() / m_resolution;
+    qint64 previousDelta = 0;
+    for (int i = 1; i < timestamps.size(); i++) {
+        const qint64 timestamp = timestamps[i] / m_resolution;
+        const qint64 delta = timestamp - previous;
+        appendVarint(m_buffer, zigzag(delta - previousDelta));
+        previous = timestamp;
+        previousDelta = delta;
+    }
+    const int timestampBytes = m_buffer.size();
+
+    qint64 previousValue = 0;
+    for (const qint32 value : values) {
+        appendVarint(m_buffer, zigzag(value - previousValue));
+        previousValue = value;
+    }
+
+    QByteArray header(ChunkHeaderSize, 0);
+    char *data = header.data();
+    qToLittleEndian<quint32>(ChunkMagic, data);
+    qToLittleEndian<quint32>(static_cast<quint32>(m_buffer.size()), data + 4);
+    qToLittleEndian<quint64>(chunk.channel.address, data + 8);
+    data[16] = static_cast<char>(chunk.channel.portId);
+    data[17] = static_cast<char>(chunk.channel.mode);
+    data[18] = static_cast<char>(chunk.channel.dataset);
+    data[19] = static_cast<char>(chunk.channel.type);
+    qToLittleEndian<quint32>(static_cast<quint32>(timestamps.size()), data + 20);
+    qToLittleEndian<qint64>(timestamps.first() / m_resolution * m_resolution, data + 24);
+    qToLittleEndian<qint64>(previous * m_resolution, data + 32);
+    qToLittleEndian<quint32>(static_cast<quint32>(timestampBytes), data + 40);
+
+    const qint64 offset = m_file.pos();
+    if (m_file.write(header) != ChunkHeaderSize || m_file.write(m_buffer) != m_buffer.size()) {
+        qCWarning(telemetryLogger) << "cannot write chunk:" << m_file.errorString();
+        return;
+    }
+    m_index.append({ offset, header });
+    m_chunksWritten.fetch_add(1, std::memory_order_relaxed);
+}
+
+void QLegoTelemetryWriter::run()
+{
+    QMutexLocker locker(&m_mutex);
+    while (true) {
+        if (!m_queue.isEmpty()) {
+            const Chunk chunk = m_queue.dequeue();
+            locker.unlock();
+            writeChunk(chunk);
+            locker.relock();
+            continue;
+        }
+        if (m_stopping) {
+            break;
+        }
+        m_condition.wait(&m_mutex);
+    }
+}
+
+/*!
+  \class QLegoTelemetryReader
+  \brief The QLegoTelemetryReader class reads files written by QLegoTelemetryWriter.
+  \inmodule QtLego
+  \ingroup instrumentation
+
+  The reader maps the file and loads its chunk index. read() only decodes the chunks of the
+  requested channel that overlap the requested time window, so exporting an hour of one port
+  from a file covering weeks of a whole fleet touches a small part of it.
+
+  \code
+  QLegoTelemetryReader reader("telemetry.qlt");
+  reader.open();
+  QVector<qint64> timestamps;
+  QVector<qint32> values;
+  for (const auto &channel : reader.channels()) {
+      if (channel.portId == 0 && channel.mode == QLegoMotor::PositionMode) {
+          reader.read(channel, from, from + 3600 * qint64(1000000000), &timestamps, &values);
+      }
+  }
+  \endcode
+*/
+
+/*!
+    Constructs a reader for \a fileName.
+*/
+QLegoTelemetryReader::QLegoTelemetryReader(const QString &fileName)
+    : m_file(fileName)
+    , m_memory(nullptr)
+    , m_size(0)
+    , m_resolution(0)
+    , m_chunks()
+    , m_chunksDecoded(0)
+{
+}
+
+QLegoTelemetryReader::~QLegoTelemetryReader()
+{
+    close();
+}
+
+/*!
+    Maps the file and loads its index, or scans its chunks if it has none. Returns \c false
+    if the file cannot be read or is not a telemetry file.
+*/
+bool QLegoTelemetryReader::open()
+{
+    close();
+    if (!m_file.open(QIODevice::ReadOnly) || m_file.size() < FileHeaderSize) {
+        return false;
+    }
+    m_size = m_file.size();
+    m_memory = m_file.map(0, m_size);
+    if (!m_memory || memcmp(m_memory, FileMagic, sizeof(FileMagic)) != 0) {
+        qCWarning(telemetryLogger) << "not a telemetry file:" << m_file.fileName();
+        close();
+        return false;
+    }
+    m_resolution = qFromLittleEndian<quint32>(m_memory + 12);
+
+    if (!readIndex()) {
+        qCDebug(telemetryLogger) << "no index, scanning:" << m_file.fileName();
+        m_chunks.clear();
+        scanChunks();
+    }
+    return true;
+}
+
+/*!
+    Unmaps the file.
+*/
+void QLegoTelemetryReader::close()
+{
+    m_file.close();
+    m_memory = nullptr;
+    m_size = 0;
+    m_chunks.clear();
+}
+
+/*!
+    Returns the timestamp resolution of the file in nanoseconds.
+*/
+qint64 QLegoTelemetryReader::resolution() const
+{
+    return m_resolution;
+}
+
+/*!
+    Returns the channels stored in the file.
+*/
+QVector<QLegoTelemetryChannel> QLegoTelemetryReader::channels() const
+{
+    QVector<QLegoTelemetryChannel> channels;
+    for (const auto &chunk : m_chunks) {
+        const auto same = [&chunk](const QLegoTelemetryChannel &channel) {
+            return channel.address == chunk.channel.address
+                    && channel.portId == chunk.channel.portId
+                    && channel.mode == chunk.channel.mode
+                    && channel.dataset == chunk.channel.dataset;
+        };
+        if (std::none_of(channels.cbegin(), channels.cend(), same)) {
+            channels.append(chunk.channel);
+        }
+    }
+    return channels;
+}
+
+/*!
+    Returns the number of chunks in the file.
+*/
+int QLegoTelemetryReader::chunkCount() const
+{
+    return m_chunks.size();
+}
+
+/*!
+    Returns the number of chunks decoded by the last call to read().
+*/
+int QLegoTelemetryReader::chunksDecoded() const
+{
+    return m_chunksDecoded;
+}
+
+/*!
+    Appends the samples of \a channel with timestamps from \a from to \a to, inclusive, to
+    \a timestamps and \a values. Returns the number of samples appended.
+*/
+int QLegoTelemetryReader::read(const QLegoTelemetryChannel &channel, qint64 from, qint64 to,
+                               QVector<qint64> *timestamps, QVector<qint32> *values)
+{
+    int count = 0;
+    m_chunksDecoded = 0;
+    for (const auto &chunk : m_chunks) {
+        if (chunk.channel.address != channel.address || chunk.channel.portId != channel.portId
+            || chunk.channel.mode != channel.mode || chunk.channel.dataset != channel.dataset
+            || chunk.last < from || chunk.first > to) {
+            continue;
+        }
+        m_chunksDecoded++;
+
+        const uchar *data = m_memory + chunk.offset + ChunkHeaderSize;
+        const uchar *valueData = data + chunk.timestampBytes;
+        const uchar *end = data + chunk.size;
+
+        qint64 timestamp = chunk.first;
+        qint64 delta = 0;
+        qint64 value = 0;
+        for (quint32 i = 0; i < chunk.count; i++) {
+            quint64 encoded;
+            if (i > 0) {
+                if (!readVarint(data, valueData, &encoded)) {
+                    break;
+                }
+                delta += unzigzag(encoded);
+                timestamp += delta * m_resolution;
+            }
+            if (!readVarint(valueData, end, &encoded)) {
+                break;
+            }
+            value += unzigzag(encoded);
+            if (timestamp >= from && timestamp <= to) {
+                timestamps->append(timestamp);
+                values->append(static_cast<qint32>(value));
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+static bool decodeChunkHeader(const uchar *header, qint64 offset, qint64 limit,
+                              QLegoTelemetryChannel *channel, qint64 *first, qint64 *last,
+                              quint32 *count, quint32 *timestampBytes, quint32 *size)
+{
+    if (qFromLittleEndian<quint32>(header) != ChunkMagic) {
+        return false;
+    }
+    *size = qFromLittleEndian<quint32>(header + 4);
+    channel->address = qFromLittleEndian<quint64>(header + 8);
+    channel->portId = header[16];
+    channel->mode = header[17];
+    channel->dataset = header[18];
+    channel->type = static_cast<QLegoValueFormat::DataType>(header[19] & 0x03);
+    *count = qFromLittleEndian<quint32>(header + 20);
+    *first = qFromLittleEndian<qint64>(header + 24);
+    *last = qFromLittleEndian<qint64>(header + 32);
+    *timestampBytes = qFromLittleEndian<quint32>(header + 40);
+    return *timestampBytes <= *size && offset + ChunkHeaderSize + *size <= limit;
+}
+
+bool QLegoTelemetryReader::readIndex()
+{
+    if (m_size < FileHeaderSize + FooterSize) {
+        return false;
+    }
+    const uchar *footer = m_memory + m_size - FooterSize;
+    if (memcmp(footer + 16, IndexMagic, sizeof(IndexMagic)) != 0) {
+        return false;
+    }
+    const qint64 indexOffset = qFromLittleEndian<qint64>(footer);
+    const quint32 entries = qFromLittleEndian<quint32>(footer + 8);
+    if (indexOffset < FileHeaderSize || indexOffset + qint64(entries) * IndexEntrySize
+                != m_size - FooterSize) {
+        return false;
+    }
+
+    m_chunks.reserve(entries);
+    for (quint32 i = 0; i < entries; i++) {
+        const uchar *entry = m_memory + indexOffset + i * IndexEntrySize;
+        ChunkEntry chunk;
+        chunk.offset = qFromLittleEndian<qint64>(entry);
+        if (chunk.offset < FileHeaderSize
+            || !decodeChunkHeader(entry + 8, chunk.offset, indexOffset, &chunk.channel,
+                                  &chunk.first, &chunk.last, &chunk.count,
+                                  &chunk.timestampBytes, &chunk.size)) {
+            return false;
+        }
+        m_chunks.append(chunk);
+    }
+    return true;
+}
+
+bool QLegoTelemetryReader::scanChunks()
+{
+    qint64 offset = FileHeaderSize;
+    while (offset + ChunkHeaderSize <= m_size) {
+        ChunkEntry chunk;
+        chunk.offset = offset;
+        if (!decodeChunkHeader(m_memory + offset, offset, m_size, &chunk.channel, &chunk.first,
+                               &chunk.last, &chunk.count, &chunk.timestampBytes, &chunk.size)) {
+            // The end of an index, or a chunk cut short when the writer stopped.
+            break;
+        }
+        m_chunks.append(chunk);
+        offset += ChunkHeaderSize + chunk.size;
+    }
+    return !m_chunks.isEmpty();
+}
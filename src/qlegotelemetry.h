@@ -0,0 +1,143 @@
+#ifndef QLEGOTELEMETRY_H
+#define QLEGOTELEMETRY_H
+
+#include "qlegoglobal.h"
+#include "qlegosample.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QPair>
+#include <QtCore/QQueue>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtCore/QWaitCondition>
+
+#include <atomic>
+
+QT_FORWARD_DECLARE_CLASS(QThread)
+
+QT_BEGIN_NAMESPACE
+
+struct QLegoTelemetryChannel
+{
+    quint64 address;
+    quint8 portId;
+    quint8 mode;
+    quint8 dataset;
+    QLegoValueFormat::DataType type;
+};
+
+class Q_LEGO_EXPORT QLegoTelemetryWriter
+{
+public:
+    static const int DefaultChunkSize = 4096;
+    static const qint64 DefaultResolution = 1000;
+
+    explicit QLegoTelemetryWriter(const QString &fileName);
+    ~QLegoTelemetryWriter();
+
+    QString fileName() const;
+    int chunkSize() const;
+    void setChunkSize(int samples);
+    qint64 resolution() const;
+    void setResolution(qint64 nanoseconds);
+
+    bool open();
+    void close();
+    bool isOpen() const;
+
+    void write(quint64 address, const QLegoSample &sample);
+    void flush();
+
+    quint64 samplesWritten() const;
+    quint64 chunksWritten() const;
+
+private:
+    Q_DISABLE_COPY(QLegoTelemetryWriter)
+
+    typedef QPair<quint64, quint32> ChannelKey;
+
+    struct Chunk
+    {
+        QLegoTelemetryChannel channel;
+        QVector<qint64> timestamps;
+        QVector<qint32> values;
+    };
+
+    struct IndexEntry
+    {
+        qint64 offset;
+        QByteArray header;
+    };
+
+    void enqueue(Chunk &chunk);
+    void writeChunk(const Chunk &chunk);
+    void run();
+
+    const QString m_fileName;
+    int m_chunkSize;
+    qint64 m_resolution;
+    QFile m_file;
+    QThread *m_worker;
+
+    // Guards the open columns and the queue of full chunks.
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    bool m_stopping;
+    QHash<ChannelKey, Chunk> m_channels;
+    QQueue<Chunk> m_queue;
+
+    // Only used by the worker while it runs.
+    QVector<IndexEntry> m_index;
+    QByteArray m_buffer;
+
+    std::atomic<quint64> m_samplesWritten;
+    std::atomic<quint64> m_chunksWritten;
+};
+
+class Q_LEGO_EXPORT QLegoTelemetryReader
+{
+public:
+    explicit QLegoTelemetryReader(const QString &fileName);
+    ~QLegoTelemetryReader();
+
+    bool open();
+    void close();
+
+    qint64 resolution() const;
+    QVector<QLegoTelemetryChannel> channels() const;
+    int chunkCount() const;
+    int chunksDecoded() const;
+
+    int read(const QLegoTelemetryChannel &channel, qint64 from, qint64 to,
+             QVector<qint64> *timestamps, QVector<qint32> *values);
+
+private:
+    Q_DISABLE_COPY(QLegoTelemetryReader)
+
+    struct ChunkEntry
+    {
+        QLegoTelemetryChannel channel;
+        qint64 first;
+        qint64 last;
+        qint64 offset;
+        quint32 count;
+        quint32 timestampBytes;
+        quint32 size;
+    };
+
+    bool readIndex();
+    bool scanChunks();
+
+    QFile m_file;
+    const uchar *m_memory;
+    qint64 m_size;
+    qint64 m_resolution;
+    QVector<ChunkEntry> m_chunks;
+    int m_chunksDecoded;
+};
+
+QT_END_NAMESPACE
+
+#endif
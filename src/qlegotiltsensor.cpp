@@ -0,0 +1,104 @@
+#include "qlegotiltsensor.h"
+
+/*!
+  \class QLegoTiltSensor
+  \brief The QLegoTiltSensor class reads the tilt of a hub or tilt sensor.
+  \inmodule QtLego
+  \ingroup attached-devices
+
+  QLegoTiltSensor decodes the angle mode of the external tilt sensor, the Boost Move hub's
+  internal tilt sensor and the Technic hub's internal tilt sensor. The first two only report the
+  x and y axes, in which case z is always 0.
+
+  \code
+  tilt->subscribe(QLegoTiltSensor::AngleMode, 2);
+  QObject::connect(tilt, &QLegoTiltSensor::tiltChanged, [](int x, int y, int z) {
+      qDebug() << "tilt:" << x << y << z;
+  });
+  \endcode
+*/
+
+/*!
+    \enum QLegoTiltSensor::Mode
+
+    The input modes of the sensor.
+
+    \value AngleMode  The angle of each axis in degrees.
+*/
+
+/*!
+    \fn void QLegoTiltSensor::tiltChanged(int x, int y, int z)
+
+    This signal is emitted when the angle of any axis has changed.
+*/
+
+/*!
+    Constructs a QLegoTiltSensor object for a given \a deviceType and \a portId.
+
+    Most users will not need to construct this class themselves.
+*/
+QLegoTiltSensor::QLegoTiltSensor(DeviceType deviceType, quint8 portId, QObject *parent)
+    : QLegoAttachedDevice(deviceType, portId, parent)
+    , m_x(0)
+    , m_y(0)
+    , m_z(0)
+{
+    setAttached(true);
+    setMotor(false);
+    setSensor(true);
+}
+
+/*!
+    \property QLegoTiltSensor::x
+    \brief the angle of the x axis in degrees.
+*/
+int QLegoTiltSensor::x() const
+{
+    return m_x;
+}
+
+/*!
+    \property QLegoTiltSensor::y
+    \brief the angle of the y axis in degrees.
+*/
+int QLegoTiltSensor::y() const
+{
+    return m_y;
+}
+
+/*!
+    \property QLegoTiltSensor::z
+    \brief the angle of the z axis in degrees.
+*/
+int QLegoTiltSensor::z() const
+{
+    return m_z;
+}
+
+QLegoValueFormat QLegoTiltSensor::valueFormat(quint8 mode) const
+{
+    if (mode != Mode::AngleMode) {
+        return QLegoAttachedDevice::valueFormat(mode);
+    }
+    if (type() == DeviceType::TechnicMediumHubTiltSensor) {
+        return { 3, QLegoValueFormat::Int16 };
+    }
+    return { 2, QLegoValueFormat::Int8 };
+}
+
+void QLegoTiltSensor::processSample(const QLegoSample &sample)
+{
+    if (sample.mode != Mode::AngleMode || sample.count < 2) {
+        return;
+    }
+
+    const int x = sample.values[0];
+    const int y = sample.values[1];
+    const int z = sample.count > 2 ? sample.values[2] : 0;
+    if (x != m_x || y != m_y || z != m_z) {
+        m_x = x;
+        m_y = y;
+        m_z = z;
+        emit tiltChanged(x, y, z);
+    }
+}
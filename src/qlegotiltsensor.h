@@ -0,0 +1,46 @@
+#ifndef QLEGOTILTSENSOR_H
+#define QLEGOTILTSENSOR_H
+
+#include "qlegoglobal.h"
+#include "qlegoattacheddevice.h"
+#include <QtCore/QObject>
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoTiltSensor : public QLegoAttachedDevice
+{
+    Q_OBJECT
+    Q_PROPERTY(int x READ x NOTIFY tiltChanged)
+    Q_PROPERTY(int y READ y NOTIFY tiltChanged)
+    Q_PROPERTY(int z READ z NOTIFY tiltChanged)
+
+public:
+    enum Mode
+    {
+        AngleMode = 0
+    };
+    Q_ENUM(Mode)
+
+    explicit QLegoTiltSensor(DeviceType deviceType, quint8 portId, QObject *parent = nullptr);
+
+    int x() const;
+    int y() const;
+    int z() const;
+
+    QLegoValueFormat valueFormat(quint8 mode) const override;
+
+Q_SIGNALS:
+    void tiltChanged(int x, int y, int z);
+
+protected:
+    void processSample(const QLegoSample &sample) override;
+
+private:
+    int m_x;
+    int m_y;
+    int m_z;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,65 @@
+#include "qlegotransport.h"
+
+/*!
+  \class QLegoTransport
+  \brief The QLegoTransport class carries frames between a QLegoDevice and a hub.
+  \inmodule QtLego
+  \ingroup devices
+
+  Devices found by QLegoDeviceScanner talk to their hub over Bluetooth Low Energy. A device
+  created with \l{QLegoDevice::createDevice()} from a transport uses the transport instead,
+  which can replay a capture, simulate a hub or reach one through another link.
+
+  Implementations emit opened() once frames can be written, and closed() when the link is
+  lost. Every call to write() passes one complete frame and must be acknowledged by exactly
+  one written() signal, emitted from the event loop rather than from within write(). Incoming
+  data is passed on by received(), which may carry part of a frame or several frames.
+*/
+
+/*!
+    \fn QString QLegoTransport::address() const
+
+    Returns the address of the hub, in the form \c{90:84:2B:4E:5A:1F} where one is known.
+*/
+
+/*!
+    \fn bool QLegoTransport::isOpen() const
+
+    Returns \c true if frames can be written.
+*/
+
+/*!
+    \fn void QLegoTransport::open()
+
+    Opens the link to the hub. opened() is emitted once it is ready.
+*/
+
+/*!
+    \fn void QLegoTransport::close()
+
+    Closes the link to the hub and emits closed().
+*/
+
+/*!
+    \fn void QLegoTransport::write(const QByteArray &frame)
+
+    Sends \a frame, including its length and hub ID, to the hub.
+*/
+
+/*!
+    Constructs a transport with the given \a parent.
+*/
+QLegoTransport::QLegoTransport(QObject *parent)
+    : QObject(parent)
+{
+}
+
+/*!
+    Returns the number of frames a device may write before the first of them is acknowledged
+    by written(). The default of 1 matches Bluetooth Low Energy, where each write waits for the
+    previous one. Transports that can batch frames return more.
+*/
+int QLegoTransport::maxWritesInFlight() const
+{
+    return 1;
+}
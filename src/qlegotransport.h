@@ -0,0 +1,37 @@
+#ifndef QLEGOTRANSPORT_H
+#define QLEGOTRANSPORT_H
+
+#include "qlegoglobal.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoTransport : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit QLegoTransport(QObject *parent = nullptr);
+
+    virtual QString address() const = 0;
+    virtual bool isOpen() const = 0;
+    virtual int maxWritesInFlight() const;
+
+public Q_SLOTS:
+    virtual void open() = 0;
+    virtual void close() = 0;
+    virtual void write(const QByteArray &frame) = 0;
+
+Q_SIGNALS:
+    void opened();
+    void closed();
+    void received(const QByteArray &data);
+    void written();
+};
+
+QT_END_NAMESPACE
+
+#endif
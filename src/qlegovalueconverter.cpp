@@ -0,0 +1,341 @@
+#include "qlegovalueconverter.h"
+#include "qlegoportinformation.h"
+#include <cstring>
+
+#if defined(Q_PROCESSOR_X86) && defined(Q_CC_GNU)
+#    define QLEGO_X86_KERNELS
+#    define QLEGO_TARGET(feature) __attribute__((target(feature)))
+#    include <immintrin.h>
+#endif
+
+typedef void (*ConvertKernel)(const char *raw, int count, float scale, float offset, float *out);
+
+template<typename T>
+static inline float rawValue(const char *data)
+{
+    return static_cast<float>(qFromLittleEndian<T>(data));
+}
+
+template<>
+inline float rawValue<float>(const char *data)
+{
+    const quint32 bits = qFromLittleEndian<quint32>(data);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// The reference for all kernels. Each value is multiplied and then added, rounding after each
+// step; the SIMD kernels do the same, so results match bit for bit.
+template<typename T>
+static void convertScalar(const char *raw, int count, float scale, float offset, float *out)
+{
+    for (int i = 0; i < count; i++) {
+        out[i] = rawValue<T>(raw + i * sizeof(T)) * scale + offset;
+    }
+}
+
+#ifdef QLEGO_X86_KERNELS
+QLEGO_TARGET("sse2")
+static inline void storeSse2(float *out, __m128i values, __m128 scale, __m128 offset)
+{
+    _mm_storeu_ps(out, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(values), scale), offset));
+}
+
+QLEGO_TARGET("sse2")
+static void convertSse2Int8(const char *raw, int count, float scale, float offset, float *out)
+{
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 o = _mm_set1_ps(offset);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(raw + i));
+        // SSE2 has no sign extension; move each value to the top of a wider lane and shift back.
+        const __m128i low = _mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8);
+        const __m128i high = _mm_srai_epi16(_mm_unpackhi_epi8(bytes, bytes), 8);
+        storeSse2(out + i, _mm_srai_epi32(_mm_unpacklo_epi16(low, low), 16), s, o);
+        storeSse2(out + i + 4, _mm_srai_epi32(_mm_unpackhi_epi16(low, low), 16), s, o);
+        storeSse2(out + i + 8, _mm_srai_epi32(_mm_unpacklo_epi16(high, high), 16), s, o);
+        storeSse2(out + i + 12, _mm_srai_epi32(_mm_unpackhi_epi16(high, high), 16), s, o);
+    }
+    convertScalar<qint8>(raw + i, count - i, scale, offset, out + i);
+}
+
+QLEGO_TARGET("sse2")
+static void convertSse2Int16(const char *raw, int count, float scale, float offset, float *out)
+{
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 o = _mm_set1_ps(offset);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i *>(raw + i * 2));
+        storeSse2(out + i, _mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16), s, o);
+        storeSse2(out + i + 4, _mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16), s, o);
+    }
+    convertScalar<qint16>(raw + i * 2, count - i, scale, offset, out + i);
+}
+
+QLEGO_TARGET("sse2")
+static void convertSse2Int32(const char *raw, int count, float scale, float offset, float *out)
+{
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 o = _mm_set1_ps(offset);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        storeSse2(out + i, _mm_loadu_si128(reinterpret_cast<const __m128i *>(raw + i * 4)), s, o);
+    }
+    convertScalar<qint32>(raw + i * 4, count - i, scale, offset, out + i);
+}
+
+QLEGO_TARGET("sse2")
+static void convertSse2Float(const char *raw, int count, float scale, float offset, float *out)
+{
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 o = _mm_set1_ps(offset);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 values = _mm_loadu_ps(reinterpret_cast<const float *>(raw + i * 4));
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(values, s), o));
+    }
+    convertScalar<float>(raw + i * 4, count - i, scale, offset, out + i);
+}
+
+QLEGO_TARGET("avx2")
+static inline void storeAvx2(float *out, __m256i values, __m256 scale, __m256 offset)
+{
+    _mm256_storeu_ps(out, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(values), scale), offset));
+}
+
+QLEGO_TARGET("avx2")
+static void convertAvx2Int8(const char *raw, int count, float scale, float offset, float *out)
+{
+    const __m256 s = _mm256_set1_ps(scale);
+    const __m256 o = _mm256_set1_ps(offset);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(raw + i));
+        storeAvx2(out + i, _mm256_cvtepi8_epi32(bytes), s, o);
+    }
+    convertScalar<qint8>(raw + i, count - i, scale, offset, out + i);
+}
+
+QLEGO_TARGET("avx2")
+static void convertAvx2Int16(const char *raw, int count, float scale, float offset, float *out)
+{
+    const __m256 s = _mm256_set1_ps(scale);
+    const __m256 o = _mm256_set1_ps(offset);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i *>(raw + i * 2));
+        storeAvx2(out + i, _mm256_cvtepi16_epi32(words), s, o);
+    }
+    convertScalar<qint16>(raw + i * 2, count - i, scale, offset, out + i);
+}
+
+QLEGO_TARGET("avx2")
+static void convertAvx2Int32(const char *raw, int count, float scale, float offset, float *out)
+{
+    const __m256 s = _mm256_set1_ps(scale);
+    const __m256 o = _mm256_set1_ps(offset);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(raw + i * 4));
+        storeAvx2(out + i, values, s, o);
+    }
+    convertScalar<qint32>(raw + i * 4, count - i, scale, offset, out + i);
+}
+
+QLEGO_TARGET("avx2")
+static void convertAvx2Float(const char *raw, int count, float scale, float offset, float *out)
+{
+    const __m256 s = _mm256_set1_ps(scale);
+    const __m256 o = _mm256_set1_ps(offset);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 values = _mm256_loadu_ps(reinterpret_cast<const float *>(raw + i * 4));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(values, s), o));
+    }
+    convertScalar<float>(raw + i * 4, count - i, scale, offset, out + i);
+}
+#endif
+
+// Indexed by implementation and data type.
+static const ConvertKernel kernels[3][4] = {
+    { convertScalar<qint8>, convertScalar<qint16>, convertScalar<qint32>, convertScalar<float> },
+#ifdef QLEGO_X86_KERNELS
+    { convertSse2Int8, convertSse2Int16, convertSse2Int32, convertSse2Float },
+    { convertAvx2Int8, convertAvx2Int16, convertAvx2Int32, convertAvx2Float },
+#else
+    { convertScalar<qint8>, convertScalar<qint16>, convertScalar<qint32>, convertScalar<float> },
+    { convertScalar<qint8>, convertScalar<qint16>, convertScalar<qint32>, convertScalar<float> },
+#endif
+};
+
+static QLegoValueConverter::Implementation detectImplementation()
+{
+#ifdef QLEGO_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return QLegoValueConverter::Avx2Implementation;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return QLegoValueConverter::Sse2Implementation;
+    }
+#endif
+    return QLegoValueConverter::ScalarImplementation;
+}
+
+/*!
+    \class QLegoValueConverter
+    \brief The QLegoValueConverter class converts raw sensor values to floats.
+    \inmodule QtLego
+    \ingroup attached-devices
+
+    Hubs report raw values, which map linearly to a percentage or to SI units. The ranges of
+    each mode are part of its \l{QLegoModeInformation}, and
+    \l{QLegoAttachedDevice::valueConverter()} returns a converter for them.
+
+    convert() turns a whole array of raw values into floats in one pass, computing
+    \c{float(raw) * scale() + offset()} for every value. It uses SSE2 or AVX2 when the
+    processor supports them, and produces exactly the same results as the scalar code it
+    falls back to.
+
+    \code
+    const auto converter = sensor->valueConverter(mode, QLegoValueConverter::SiUnit);
+    QVector<float> values(count);
+    converter.convert(raw.constData(), QLegoValueFormat::Int16, count, values.data());
+    \endcode
+
+    The values of a QLegoSample are already widened to 32 bits, and can be converted as
+    \c QLegoValueFormat::Int32, or \c QLegoValueFormat::Float for float modes.
+*/
+
+/*!
+    \enum QLegoValueConverter::Unit
+
+    \value RawUnit      The raw value, unchanged.
+    \value PercentUnit  The percentage range of the mode.
+    \value SiUnit       The SI range of the mode.
+*/
+
+/*!
+    \enum QLegoValueConverter::Implementation
+
+    \value ScalarImplementation  Plain C++.
+    \value Sse2Implementation    SSE2 kernels, converting four values at a time.
+    \value Avx2Implementation    AVX2 kernels, converting eight values at a time.
+*/
+
+/*!
+    Constructs a converter that returns raw values unchanged.
+*/
+QLegoValueConverter::QLegoValueConverter()
+    : m_scale(1)
+    , m_offset(0)
+    , m_implementation(bestImplementation())
+{
+}
+
+/*!
+    Constructs a converter mapping the raw range from \a rawMinimum to \a rawMaximum onto
+    \a minimum to \a maximum. An empty raw range returns raw values unchanged.
+*/
+QLegoValueConverter::QLegoValueConverter(float rawMinimum, float rawMaximum, float minimum,
+                                         float maximum)
+    : m_scale(1)
+    , m_offset(0)
+    , m_implementation(bestImplementation())
+{
+    if (rawMaximum != rawMinimum) {
+        m_scale = (maximum - minimum) / (rawMaximum - rawMinimum);
+        m_offset = minimum - rawMinimum * m_scale;
+    }
+}
+
+/*!
+    Constructs a converter from the ranges of \a information to \a unit.
+*/
+QLegoValueConverter::QLegoValueConverter(const QLegoModeInformation &information, Unit unit)
+    : QLegoValueConverter()
+{
+    switch (unit) {
+        case PercentUnit:
+            *this = QLegoValueConverter(information.rawMinimum, information.rawMaximum,
+                                        information.percentMinimum, information.percentMaximum);
+            break;
+        case SiUnit:
+            *this = QLegoValueConverter(information.rawMinimum, information.rawMaximum,
+                                        information.siMinimum, information.siMaximum);
+            break;
+        case RawUnit:
+        default:
+            break;
+    }
+}
+
+/*!
+    Returns the factor raw values are multiplied with.
+*/
+float QLegoValueConverter::scale() const
+{
+    return m_scale;
+}
+
+/*!
+    Returns the value added after scaling.
+*/
+float QLegoValueConverter::offset() const
+{
+    return m_offset;
+}
+
+/*!
+    Returns the kernels used by convert(). Defaults to bestImplementation().
+*/
+QLegoValueConverter::Implementation QLegoValueConverter::implementation() const
+{
+    return m_implementation;
+}
+
+/*!
+    Selects the kernels used by convert(). Implementations the processor does not support are
+    replaced by bestImplementation().
+*/
+void QLegoValueConverter::setImplementation(Implementation implementation)
+{
+    m_implementation = qMin(implementation, bestImplementation());
+}
+
+/*!
+    Converts \a count values of \a type, stored in little endian byte order at \a raw, and
+    writes them to \a out.
+*/
+void QLegoValueConverter::convert(const void *raw, QLegoValueFormat::DataType type, int count,
+                                  float *out) const
+{
+    if (count <= 0 || type < QLegoValueFormat::Int8 || type > QLegoValueFormat::Float) {
+        return;
+    }
+    kernels[m_implementation][type](static_cast<const char *>(raw), count, m_scale, m_offset, out);
+}
+
+/*!
+    Returns the fastest implementation supported by the processor.
+*/
+QLegoValueConverter::Implementation QLegoValueConverter::bestImplementation()
+{
+    static const Implementation best = detectImplementation();
+    return best;
+}
+
+/*!
+    Returns all implementations supported by the processor, slowest first.
+*/
+QList<QLegoValueConverter::Implementation> QLegoValueConverter::supportedImplementations()
+{
+    QList<Implementation> implementations;
+    for (int i = ScalarImplementation; i <= bestImplementation(); i++) {
+        implementations.append(static_cast<Implementation>(i));
+    }
+    return implementations;
+}
@@ -0,0 +1,53 @@
+#ifndef QLEGOVALUECONVERTER_H
+#define QLEGOVALUECONVERTER_H
+
+#include "qlegoglobal.h"
+#include "qlegosample.h"
+
+#include <QtCore/QList>
+
+QT_BEGIN_NAMESPACE
+
+struct QLegoModeInformation;
+
+class Q_LEGO_EXPORT QLegoValueConverter
+{
+public:
+    enum Unit
+    {
+        RawUnit,
+        PercentUnit,
+        SiUnit
+    };
+
+    enum Implementation
+    {
+        ScalarImplementation,
+        Sse2Implementation,
+        Avx2Implementation
+    };
+
+    QLegoValueConverter();
+    QLegoValueConverter(float rawMinimum, float rawMaximum, float minimum, float maximum);
+    QLegoValueConverter(const QLegoModeInformation &information, Unit unit);
+
+    float scale() const;
+    float offset() const;
+
+    Implementation implementation() const;
+    void setImplementation(Implementation implementation);
+
+    void convert(const void *raw, QLegoValueFormat::DataType type, int count, float *out) const;
+
+    static Implementation bestImplementation();
+    static QList<Implementation> supportedImplementations();
+
+private:
+    float m_scale;
+    float m_offset;
+    Implementation m_implementation;
+};
+
+QT_END_NAMESPACE
+
+#endif
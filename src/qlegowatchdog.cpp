@@ -0,0 +1,297 @@
+#include "qlegowatchdog.h"
+#include "qlegocommon.h"
+#include "qlegodevice.h"
+#include "qlegomotor.h"
+#include <QtCore/QCoreApplication>
+#include <QtCore/QEvent>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+
+Q_LOGGING_CATEGORY(watchdogLogger, "lego.watchdog");
+
+static const qint64 Millisecond = 1000000;
+
+// Posted by the watchdog thread to the thread the device lives in.
+class QLegoWatchdogTripEvent : public QEvent
+{
+public:
+    QLegoWatchdogTripEvent(qint64 heartbeat, qint64 detected)
+        : QEvent(eventType())
+        , heartbeat(heartbeat)
+        , detected(detected)
+    {
+    }
+
+    static QEvent::Type eventType()
+    {
+        static const int type = QEvent::registerEventType();
+        return static_cast<QEvent::Type>(type);
+    }
+
+    const qint64 heartbeat;
+    const qint64 detected;
+};
+
+/*!
+  \class QLegoWatchdog
+  \brief The QLegoWatchdog class stops the motors of a hub when the host stops talking to it.
+  \inmodule QtLego
+  \ingroup devices
+
+  A hub keeps running its motors at the last commanded power for as long as it is connected. If
+  the controlling process stalls, for example while it is swapped out or stuck in a slow slot,
+  the motors keep going. The watchdog of a device, available through QLegoDevice::watchdog(),
+  guards against that.
+
+  Once armed, the watchdog expects a heartbeat() or a motion command within its timeout.
+  Safety and motion commands sent through the device count as heartbeats; configuration and
+  cosmetic commands do not, so a light animation does not keep a stalled controller alive.
+  A dedicated thread running at time-critical priority checks the deadline. When it lapses,
+  every motor of the hub is braked, or left to float, and tripped() reports when the last
+  heartbeat was seen, when the lapse was detected and when the motors were stopped, all as
+  monotonic nanosecond timestamps on the clock used for samples.
+
+  The stop commands are sent from the thread the device lives in, ahead of every other posted
+  event and through the safety lane of the device. To keep stopping motors while application
+  code stalls, move the device to a thread of its own and send heartbeats from the application
+  thread; heartbeat() is thread-safe.
+
+  \code
+  auto watchdog = device->watchdog();
+  watchdog->arm(200);
+  QObject::connect(controlTimer, &QTimer::timeout, watchdog, &QLegoWatchdog::heartbeat);
+  QObject::connect(watchdog, &QLegoWatchdog::tripped, [](qint64 heartbeat, qint64 detected,
+                                                         qint64 stopped) {
+      qWarning() << "stalled for" << (detected - heartbeat) / 1e6 << "ms";
+  });
+  \endcode
+
+  After a trip the watchdog stays tripped, and does not stop the motors again, until the next
+  heartbeat.
+*/
+
+/*!
+    \enum QLegoWatchdog::Action
+
+    What the watchdog does with the motors when it trips.
+
+    \value Brake  The motors are braked.
+
+    \value Float  The motors are stopped and left to float.
+*/
+
+/*!
+    \fn void QLegoWatchdog::tripped(qint64 lastHeartbeat, qint64 detected, qint64 stopped)
+
+    Emitted after the motors have been stopped because no heartbeat arrived within the
+    timeout. \a lastHeartbeat is when the last heartbeat was seen, \a detected when the watchdog
+    thread noticed the lapse, and \a stopped when the stop commands were queued. A large gap
+    between \a detected and \a stopped means the thread of the device was stalled too.
+*/
+
+QLegoWatchdog::QLegoWatchdog(QLegoDevice *device)
+    : QObject(device)
+    , m_device(device)
+    , m_action(Brake)
+    , m_braking(false)
+    , m_worker(nullptr)
+    , m_timeout(0)
+    , m_lastHeartbeat(0)
+    , m_tripped(false)
+    , m_trips(0)
+    , m_mutex()
+    , m_condition()
+    , m_exiting(false)
+{
+}
+
+QLegoWatchdog::~QLegoWatchdog()
+{
+    disarm();
+}
+
+/*!
+    Returns the device whose motors are stopped.
+*/
+QLegoDevice *QLegoWatchdog::device() const
+{
+    return m_device;
+}
+
+/*!
+    \property QLegoWatchdog::timeout
+    \brief the time a heartbeat is expected within, in milliseconds.
+*/
+int QLegoWatchdog::timeout() const
+{
+    return static_cast<int>(m_timeout.load(std::memory_order_relaxed) / Millisecond);
+}
+
+/*!
+    \property QLegoWatchdog::armed
+    \brief whether the watchdog thread is running.
+*/
+bool QLegoWatchdog::isArmed() const
+{
+    return m_worker != nullptr;
+}
+
+/*!
+    Returns \c true if the watchdog has tripped and not received a heartbeat since.
+*/
+bool QLegoWatchdog::isTripped() const
+{
+    return m_tripped.load(std::memory_order_acquire);
+}
+
+/*!
+    \property QLegoWatchdog::action
+    \brief what is done with the motors when the watchdog trips.
+
+    The default is Brake.
+*/
+QLegoWatchdog::Action QLegoWatchdog::action() const
+{
+    return m_action;
+}
+
+void QLegoWatchdog::setAction(Action action)
+{
+    m_action = action;
+}
+
+/*!
+    Returns how many times the watchdog has tripped. This function is thread-safe.
+*/
+quint64 QLegoWatchdog::trips() const
+{
+    return m_trips.load(std::memory_order_relaxed);
+}
+
+/*!
+    Returns the monotonic timestamp of the last heartbeat, in nanoseconds.
+*/
+qint64 QLegoWatchdog::lastHeartbeat() const
+{
+    return m_lastHeartbeat.load(std::memory_order_acquire);
+}
+
+/*!
+    Starts the watchdog thread, expecting a heartbeat every \a msecs milliseconds from now on.
+    Arming an armed watchdog changes its timeout.
+
+    A warning is logged when the device lives in the calling thread, as a stall of that thread
+    then delays the stop commands until it is over.
+*/
+void QLegoWatchdog::arm(int msecs)
+{
+    m_timeout.store(qMax(msecs, 1) * Millisecond, std::memory_order_relaxed);
+    heartbeat();
+
+    if (m_worker) {
+        QMutexLocker locker(&m_mutex);
+        m_condition.wakeOne();
+        return;
+    }
+    if (m_device->thread() == QThread::currentThread()) {
+        // The stop commands are posted to this thread, which may be the one that stalls.
+        qCWarning(watchdogLogger) << "armed from the thread of the device, motors only stop"
+                                  << "once it processes events again";
+    }
+    m_exiting = false;
+    m_worker = QThread::create([this]() { run(); });
+    m_worker->start(QThread::TimeCriticalPriority);
+}
+
+/*!
+    Stops the watchdog thread. The motors are no longer stopped when heartbeats stop.
+*/
+void QLegoWatchdog::disarm()
+{
+    if (!m_worker) {
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_exiting = true;
+    m_condition.wakeOne();
+    locker.unlock();
+
+    m_worker->wait();
+    delete m_worker;
+    m_worker = nullptr;
+    m_tripped.store(false, std::memory_order_release);
+}
+
+/*!
+    Tells the watchdog that the host is alive. This function is thread-safe and lock-free.
+*/
+void QLegoWatchdog::heartbeat()
+{
+    m_lastHeartbeat.store(monotonicNanoseconds(), std::memory_order_release);
+    m_tripped.store(false, std::memory_order_release);
+}
+
+void QLegoWatchdog::commandSent()
+{
+    // The stop commands of a trip are not a sign of life.
+    if (!m_braking) {
+        heartbeat();
+    }
+}
+
+bool QLegoWatchdog::event(QEvent *event)
+{
+    if (event->type() != QLegoWatchdogTripEvent::eventType()) {
+        return QObject::event(event);
+    }
+    if (!m_worker) {
+        // Disarmed while the trip was on its way.
+        return true;
+    }
+
+    const auto trip = static_cast<QLegoWatchdogTripEvent *>(event);
+    m_braking = true;
+    for (const auto attachment : m_device->attachedDevices()) {
+        if (auto motor = qobject_cast<QLegoMotor *>(attachment)) {
+            if (m_action == Brake) {
+                motor->brake();
+            } else {
+                motor->stop();
+            }
+        }
+    }
+    m_braking = false;
+
+    const qint64 stopped = monotonicNanoseconds();
+    qCWarning(watchdogLogger) << m_device->address() << "tripped after"
+                              << (trip->detected - trip->heartbeat) / Millisecond
+                              << "ms without a heartbeat, motors stopped"
+                              << (stopped - trip->detected) / Millisecond << "ms later";
+    emit tripped(trip->heartbeat, trip->detected, stopped);
+    return true;
+}
+
+void QLegoWatchdog::run()
+{
+    QMutexLocker locker(&m_mutex);
+    while (!m_exiting) {
+        const qint64 timeout = m_timeout.load(std::memory_order_relaxed);
+        const qint64 heartbeat = m_lastHeartbeat.load(std::memory_order_acquire);
+        const qint64 now = monotonicNanoseconds();
+        qint64 remaining = heartbeat + timeout - now;
+
+        if (remaining <= 0) {
+            if (!m_tripped.exchange(true, std::memory_order_acq_rel)) {
+                m_trips.fetch_add(1, std::memory_order_relaxed);
+                QCoreApplication::postEvent(this, new QLegoWatchdogTripEvent(heartbeat, now),
+                                            Qt::HighEventPriority);
+            }
+            // Nothing can lapse again before the next heartbeat.
+            remaining = timeout;
+        }
+        m_condition.wait(&m_mutex, static_cast<unsigned long>((remaining + Millisecond - 1)
+                                                              / Millisecond));
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef QLEGOWATCHDOG_H
+#define QLEGOWATCHDOG_H
+
+#include "qlegoglobal.h"
+
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QWaitCondition>
+
+#include <atomic>
+
+QT_FORWARD_DECLARE_CLASS(QLegoDevice)
+QT_FORWARD_DECLARE_CLASS(QThread)
+
+QT_BEGIN_NAMESPACE
+
+class Q_LEGO_EXPORT QLegoWatchdog : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int timeout READ timeout)
+    Q_PROPERTY(bool armed READ isArmed)
+    Q_PROPERTY(Action action READ action WRITE setAction)
+
+public:
+    enum Action
+    {
+        Brake,
+        Float
+    };
+    Q_ENUM(Action)
+
+    ~QLegoWatchdog();
+
+    QLegoDevice *device() const;
+
+    int timeout() const;
+    bool isArmed() const;
+    bool isTripped() const;
+    Action action() const;
+    void setAction(Action action);
+
+    quint64 trips() const;
+    qint64 lastHeartbeat() const;
+
+public Q_SLOTS:
+    void arm(int msecs);
+    void disarm();
+    void heartbeat();
+
+Q_SIGNALS:
+    void tripped(qint64 lastHeartbeat, qint64 detected, qint64 stopped);
+
+protected:
+    bool event(QEvent *event) override;
+
+private:
+    Q_DISABLE_COPY(QLegoWatchdog)
+    friend class QLegoDevice;
+
+    explicit QLegoWatchdog(QLegoDevice *device);
+
+    void commandSent();
+    void run();
+
+    QLegoDevice *m_device;
+    Action m_action;
+    bool m_braking;
+    QThread *m_worker;
+
+    // Read by the watchdog thread.
+    std::atomic<qint64> m_timeout;
+    std::atomic<qint64> m_lastHeartbeat;
+    std::atomic<bool> m_tripped;
+    std::atomic<quint64> m_trips;
+
+    // Guards the shutdown of the watchdog thread.
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    bool m_exiting;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef QLEGOTESTHUB_H
+#define QLEGOTESTHUB_H
+
+#include <QMap>
+#include <QSignalSpy>
+#include "qlegodevice.h"
+#include "qlegomotor.h"
+#include "qlegosimulatedhub.h"
+
+// The devices attached to a test hub by default: a motor on port 0.
+static const QMap<quint8, quint16> MotorOnly = {
+    { 0, QLegoAttachedDevice::TechnicLargeLinearMotor }
+};
+
+// A hub with \a devices attached to their ports, connected and ready.
+static inline QLegoDevice *connectHub(QLegoSimulatedHub *hub,
+                                      const QMap<quint8, quint16> &devices = MotorOnly)
+{
+    for (auto it = devices.cbegin(); it != devices.cend(); ++it) {
+        hub->attachDevice(it.key(), it.value());
+    }
+    auto device = QLegoDevice::createDevice(hub);
+    QSignalSpy ready(device, &QLegoDevice::ready);
+    device->connectToDevice();
+    if (!ready.wait(2000) || device->attachedDevices().size() != devices.size()) {
+        delete device;
+        return nullptr;
+    }
+    return device;
+}
+
+static inline QLegoMotor *motorOf(QLegoDevice *device, int portId = 0)
+{
+    for (const auto attachment : device->attachedDevices()) {
+        if (attachment->portId() == portId) {
+            return qobject_cast<QLegoMotor *>(attachment);
+        }
+    }
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,140 @@
+#include <QTest>
+#include "tst_qlegoadapterbalancer.h"
+#include "qlegoadapterbalancer.h"
+
+static const char *Hub = "90:84:2B:4E:5A:1F";
+
+// Adapters that do not have to exist; the balancer never talks to them.
+static QList<QBluetoothHostInfo> mockAdapters(int count)
+{
+    QList<QBluetoothHostInfo> adapters;
+    for (int i = 0; i < count; i++) {
+        QBluetoothHostInfo info;
+        info.setAddress(QBluetoothAddress(Q_UINT64_C(0x001a7dda7100) + i));
+        info.setName(QString("hci%1").arg(i));
+        adapters.append(info);
+    }
+    return adapters;
+}
+
+static QString hub(int index)
+{
+    return QString("90:84:2B:4E:5A:%1").arg(index, 2, 16, QChar('0')).toUpper();
+}
+
+void QLegoAdapterBalancerTest::testPlacement()
+{
+    const auto adapters = mockAdapters(3);
+    QLegoAdapterBalancer balancer(adapters);
+
+    // The adapter that hears the hub best wins.
+    balancer.reportRssi(adapters[0].address(), Hub, -80);
+    balancer.reportRssi(adapters[1].address(), Hub, -55);
+    QBluetoothAddress adapter;
+    QVERIFY(balancer.place(Hub, &adapter));
+    QCOMPARE(adapter, adapters[1].address());
+    QCOMPARE(balancer.adapterFor(Hub), adapters[1].address());
+    QCOMPARE(balancer.connections(adapters[1].address()), 1);
+
+    // Placing again keeps the adapter.
+    QVERIFY(balancer.place(Hub, &adapter));
+    QCOMPARE(adapter, adapters[1].address());
+    QCOMPARE(balancer.connections(adapters[1].address()), 1);
+
+    // Unheard hubs go to the least busy adapter.
+    QVERIFY(balancer.place(hub(1), &adapter));
+    QCOMPARE(adapter, adapters[0].address());
+    QVERIFY(balancer.place(hub(2), &adapter));
+    QCOMPARE(adapter, adapters[2].address());
+
+    // A busier adapter loses to a slightly weaker one.
+    QVERIFY(balancer.place(hub(3), &adapter));
+    balancer.reportRssi(adapters[0].address(), hub(4), -60);
+    balancer.reportRssi(adapters[2].address(), hub(4), -64);
+    QCOMPARE(balancer.connections(adapters[0].address()), 2);
+    QVERIFY(balancer.place(hub(4), &adapter));
+    QCOMPARE(adapter, adapters[2].address());
+
+    // But not to a much weaker one.
+    balancer.reportRssi(adapters[0].address(), hub(5), -50);
+    balancer.reportRssi(adapters[1].address(), hub(5), -90);
+    QVERIFY(balancer.place(hub(5), &adapter));
+    QCOMPARE(adapter, adapters[0].address());
+}
+
+void QLegoAdapterBalancerTest::testCapacity()
+{
+    const auto adapters = mockAdapters(2);
+    QLegoAdapterBalancer balancer(adapters);
+    balancer.setMaxConnections(3);
+    balancer.setConnectionPenalty(0);
+
+    // Everything is heard best by the first adapter, which fills up before the second is used.
+    QBluetoothAddress adapter;
+    for (int i = 0; i < 6; i++) {
+        balancer.reportRssi(adapters[0].address(), hub(i), -40);
+        balancer.reportRssi(adapters[1].address(), hub(i), -70);
+        QVERIFY(balancer.place(hub(i), &adapter));
+        QCOMPARE(adapter, adapters[i < 3 ? 0 : 1].address());
+    }
+    QCOMPARE(balancer.connections(adapters[0].address()), 3);
+    QCOMPARE(balancer.connections(adapters[1].address()), 3);
+
+    // A hub that finds no room is forgotten, signal strength and all.
+    balancer.reportRssi(adapters[0].address(), hub(6), -40);
+    QVERIFY(!balancer.place(hub(6), &adapter));
+    QVERIFY(balancer.adapterFor(hub(6)).isNull());
+    QCOMPARE(balancer.rssi(adapters[0].address(), hub(6)), int(QLegoAdapterBalancer::UnknownRssi));
+
+    balancer.release(hub(0));
+    QVERIFY(balancer.place(hub(6), &adapter));
+    QCOMPARE(adapter, adapters[0].address());
+}
+
+void QLegoAdapterBalancerTest::testRelease()
+{
+    const auto adapters = mockAdapters(2);
+    QLegoAdapterBalancer balancer(adapters);
+    QBluetoothAddress adapter;
+
+    balancer.reportRssi(adapters[1].address(), hub(0), -50);
+    balancer.reportRssi(adapters[1].address(), hub(1), -70);
+    QVERIFY(balancer.place(hub(0), &adapter));
+    QVERIFY(balancer.place(hub(1), &adapter));
+    QCOMPARE(adapter, adapters[1].address());
+
+    const auto stats = balancer.statistics(adapters[1].address());
+    QVERIFY(stats);
+    QCOMPARE(stats->address(), adapters[1].address().toString());
+    QCOMPARE(stats->connections(), quint64(2));
+    QCOMPARE(stats->placements(), quint64(2));
+    QCOMPARE(stats->averageRssi(), -60.0);
+
+    balancer.release(hub(0));
+    balancer.release(hub(1), true);
+    balancer.release(hub(1));
+    QCOMPARE(stats->connections(), quint64(0));
+    QCOMPARE(stats->placements(), quint64(2));
+    QCOMPARE(stats->connectFailures(), quint64(1));
+    QCOMPARE(balancer.rssi(adapters[1].address(), hub(0)), int(QLegoAdapterBalancer::UnknownRssi));
+
+    QCOMPARE(balancer.statistics().size(), 2);
+    QCOMPARE(balancer.statistics(adapters[0].address())->placements(), quint64(0));
+    QVERIFY(!balancer.statistics(QBluetoothAddress(Q_UINT64_C(1))));
+}
+
+void QLegoAdapterBalancerTest::testDefaultAdapter()
+{
+    QLegoAdapterBalancer balancer(QList<QBluetoothHostInfo>{});
+    QBluetoothAddress adapter(Q_UINT64_C(1));
+
+    // Without known adapters everything goes through the default one, without a limit.
+    balancer.setMaxConnections(1);
+    for (int i = 0; i < 3; i++) {
+        QVERIFY(balancer.place(hub(i), &adapter));
+        QVERIFY(adapter.isNull());
+    }
+    QVERIFY(balancer.statistics().isEmpty());
+}
+
+QTEST_MAIN(QLegoAdapterBalancerTest)
@@ -0,0 +1,16 @@
+#ifndef QLEGOADAPTERBALANCERTEST_H
+#define QLEGOADAPTERBALANCERTEST_H
+
+#include <QObject>
+
+class QLegoAdapterBalancerTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testPlacement();
+    void testCapacity();
+    void testRelease();
+    void testDefaultAdapter();
+};
+
+#endif
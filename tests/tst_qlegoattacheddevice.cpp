@@ -0,0 +1,361 @@
+#include <QTest>
+#include <QSignalSpy>
+#include <QtEndian>
+#include <cstring>
+#include "tst_qlegoattacheddevice.h"
+#include "qlegocommandreply.h"
+#include "qlegodevice.h"
+#include "qlegomotor.h"
+#include "qlegoportinformation.h"
+#include "qlegosimulatedhub.h"
+#include "qlegotesthub.h"
+
+static const quint8 LoadMode = 4;
+
+static QLegoModeInformation modeInformation(const QString &name, quint8 datasets,
+                                            QLegoValueFormat::DataType type)
+{
+    QLegoModeInformation information;
+    information.name = name;
+    information.format = { datasets, type };
+    return information;
+}
+
+// The modes of a motor, with a float mode added after the standard ones.
+static QLegoPortInformation motorInformation()
+{
+    QLegoPortInformation information;
+    information.capabilities = QLegoPortInformation::Input | QLegoPortInformation::Output
+            | QLegoPortInformation::LogicalCombinable;
+    information.inputModes = 0x001F;
+    information.outputModes = 0x0003;
+    information.combinations = { 0x0014 };
+    information.modes = { modeInformation("POWER", 1, QLegoValueFormat::Int8),
+                          modeInformation("SPEED", 1, QLegoValueFormat::Int8),
+                          modeInformation("POS", 1, QLegoValueFormat::Int32),
+                          modeInformation("APOS", 1, QLegoValueFormat::Int16),
+                          modeInformation("LOAD", 1, QLegoValueFormat::Float) };
+    return information;
+}
+
+// The frames written to the hub since the spy was created.
+static QList<QByteArray> framesOf(const QSignalSpy &spy)
+{
+    QList<QByteArray> frames;
+    for (const auto &arguments : spy) {
+        frames.append(arguments[0].toByteArray());
+    }
+    return frames;
+}
+
+static QByteArray encodeInt32(qint32 value)
+{
+    QByteArray bytes(4, 0);
+    qToLittleEndian<qint32>(value, bytes.data());
+    return bytes;
+}
+
+static QByteArray encodeFloat(float value)
+{
+    QByteArray bytes(4, 0);
+    memcpy(bytes.data(), &value, sizeof(value));
+    return bytes;
+}
+
+// Follows the state of \a reply in \a states, as replies delete themselves once finished.
+static void follow(QLegoCommandReply *reply, QVector<QLegoCommandReply::State> *states)
+{
+    const int index = states->size();
+    states->append(reply->state());
+    QObject::connect(reply, &QLegoCommandReply::stateChanged,
+                     [states, index](QLegoCommandReply::State state) { (*states)[index] = state; });
+}
+
+void QLegoAttachedDeviceTest::init()
+{
+    qRegisterMetaType<QLegoSample>();
+    QLegoPortInformationTable::clear();
+}
+
+void QLegoAttachedDeviceTest::testSubscription()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+    auto motor = motorOf(device.data());
+    QSignalSpy commands(hub, &QLegoSimulatedHub::commandReceived);
+    QSignalSpy values(motor, &QLegoAttachedDevice::valueReceived);
+
+    motor->subscribe(QLegoMotor::PositionMode, 5);
+    QTRY_VERIFY(motor->subscribed());
+    QCOMPARE(motor->mode(), int(QLegoMotor::PositionMode));
+    QCOMPARE(hub->mode(0), int(QLegoMotor::PositionMode));
+    const QList<QByteArray> expected = { QByteArray::fromHex("0a004100020500000001") };
+    QCOMPARE(framesOf(commands), expected);
+
+    // Changes below the delta interval are not reported.
+    hub->setValue(0, encodeInt32(90));
+    QTRY_COMPARE(values.count(), 1);
+    hub->setValue(0, encodeInt32(94));
+    hub->setValue(0, encodeInt32(95));
+    QTRY_COMPARE(values.count(), 2);
+    QCOMPARE(motor->position(), 95);
+    QCOMPARE(device->statistics()->framesReceived(0x45), quint64(2));
+    const auto sample = values[1][0].value<QLegoSample>();
+    QCOMPARE(sample.mode, quint8(QLegoMotor::PositionMode));
+    QCOMPARE(sample.count, quint8(1));
+    QCOMPARE(sample.value(0), 95.0);
+
+    motor->unsubscribe();
+    QTRY_VERIFY(!motor->subscribed());
+    QCOMPARE(motor->mode(), int(QLegoMotor::PositionMode));
+    QCOMPARE(commands.last()[0].toByteArray(), QByteArray::fromHex("0a004100020500000000"));
+
+    // Once unsubscribed, values are only reported on request.
+    hub->setValue(0, encodeInt32(-200));
+    motor->requestValue();
+    QTRY_COMPARE(values.count(), 3);
+    QCOMPARE(commands.last()[0].toByteArray(), QByteArray::fromHex("0500210000"));
+    QCOMPARE(motor->position(), -200);
+    QCOMPARE(device->statistics()->framesReceived(0x45), quint64(3));
+}
+
+void QLegoAttachedDeviceTest::testDeltaTraffic()
+{
+    // A motor turning a degree at a time, followed to within 10 degrees.
+    static const int Steps = 100;
+    static const int Delta = 10;
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+    auto motor = motorOf(device.data());
+    QSignalSpy commands(hub, &QLegoSimulatedHub::commandReceived);
+    QSignalSpy values(motor, &QLegoAttachedDevice::valueReceived);
+
+    motor->subscribe(QLegoMotor::PositionMode, Delta);
+    QTRY_VERIFY(motor->subscribed());
+    for (int position = 0; position < Steps; ++position) {
+        hub->setValue(0, encodeInt32(position));
+    }
+    QTRY_COMPARE(motor->position(), Steps - Delta);
+    const quint64 subscribed = device->statistics()->framesReceived(0x45);
+    const int subscribedCommands = commands.count();
+    QCOMPARE(subscribed, quint64(Steps / Delta));
+    QCOMPARE(subscribedCommands, 1);
+
+    motor->unsubscribe();
+    QTRY_VERIFY(!motor->subscribed());
+    commands.clear();
+    values.clear();
+    for (int position = 0; position < Steps; ++position) {
+        hub->setValue(0, encodeInt32(position));
+        motor->requestValue();
+        QTRY_COMPARE(values.count(), position + 1);
+    }
+    const quint64 polled = device->statistics()->framesReceived(0x45) - subscribed;
+    QCOMPARE(polled, quint64(Steps));
+    QCOMPARE(commands.count(), Steps);
+
+    // Polling as often as the motor moves costs a request and a value per step.
+    QVERIFY(subscribed * Delta <= polled);
+}
+
+void QLegoAttachedDeviceTest::testPortInformation()
+{
+    QLegoModeInformation position = modeInformation("POS", 1, QLegoValueFormat::Int32);
+    position.symbol = "DEG";
+    position.rawMinimum = -360;
+    position.rawMaximum = 360;
+    position.figures = 4;
+    QLegoModeInformation load = modeInformation("LOAD", 1, QLegoValueFormat::Float);
+    load.figures = 5;
+    load.decimals = 1;
+    QLegoPortInformation information;
+    information.capabilities = QLegoPortInformation::Input | QLegoPortInformation::Output
+            | QLegoPortInformation::LogicalCombinable;
+    information.inputModes = 0x0003;
+    information.combinations = { 0x0003 };
+    information.modes = { position, load };
+
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+    hub->setPortInformation(0, information);
+    auto motor = motorOf(device.data());
+    QSignalSpy commands(hub, &QLegoSimulatedHub::commandReceived);
+    QSignalSpy replies(hub, &QLegoTransport::received);
+    QSignalSpy changed(motor, &QLegoAttachedDevice::portInformationChanged);
+    motor->requestPortInformation();
+    QTRY_COMPARE(changed.count(), 1);
+
+    // The mode count comes first, then value formats, combinations and the other items.
+    QList<QByteArray> expected = { QByteArray::fromHex("0500210001"),
+                                   QByteArray::fromHex("060022000080"),
+                                   QByteArray::fromHex("060022000180"),
+                                   QByteArray::fromHex("0500210002") };
+    for (const char mode : { '\x00', '\x01' }) {
+        for (const char item : { '\x00', '\x01', '\x02', '\x03', '\x04' }) {
+            expected.append(QByteArray::fromHex("06002200") + mode + item);
+        }
+    }
+    QCOMPARE(framesOf(commands), expected);
+
+    // Capabilities, mode count and masks; combinations; a float range; a value format.
+    const QList<QByteArray> frames = framesOf(replies);
+    QVERIFY(frames.contains(QByteArray::fromHex("0b00430001070203000000")));
+    QVERIFY(frames.contains(QByteArray::fromHex("090043000203000000")));
+    QVERIFY(frames.contains(QByteArray::fromHex("0e00440000010000b4c30000b443")));
+    QVERIFY(frames.contains(QByteArray::fromHex("0a004400018001030501")));
+    QCOMPARE(frames.size(), expected.size());
+
+    const QLegoPortInformation discovered = motor->portInformation();
+    QVERIFY(discovered.complete);
+    QCOMPARE(discovered.capabilities, quint8(0x07));
+    QCOMPARE(discovered.inputModes, quint16(0x0003));
+    QCOMPARE(discovered.outputModes, quint16(0x0000));
+    QCOMPARE(discovered.combinations, QVector<quint16>{ 0x0003 });
+    QCOMPARE(discovered.modes.size(), 2);
+    QCOMPARE(discovered.modes[0].name, QString("POS"));
+    QCOMPARE(discovered.modes[0].symbol, QString("DEG"));
+    QCOMPARE(discovered.modes[0].rawMinimum, -360.0f);
+    QCOMPARE(discovered.modes[0].rawMaximum, 360.0f);
+    QCOMPARE(discovered.modes[0].format.type, QLegoValueFormat::Int32);
+    QCOMPARE(discovered.modes[0].figures, quint8(4));
+    QCOMPARE(discovered.modes[1].name, QString("LOAD"));
+    QCOMPARE(discovered.modes[1].format.datasets, quint8(1));
+    QCOMPARE(discovered.modes[1].format.type, QLegoValueFormat::Float);
+    QCOMPARE(discovered.modes[1].figures, quint8(5));
+    QCOMPARE(discovered.modes[1].decimals, quint8(1));
+    QCOMPARE(discovered.modes[1].received, quint8(QLegoModeInformation::AllItems));
+}
+
+void QLegoAttachedDeviceTest::testCombinedFloat()
+{
+    auto hub = new QLegoSimulatedHub;
+    hub->attachDevice(0, QLegoAttachedDevice::TechnicLargeLinearMotor);
+    hub->setPortInformation(0, motorInformation());
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+    auto motor = motorOf(device.data());
+    motor->requestPortInformation();
+    QTRY_VERIFY(motor->portInformation().complete);
+    QCOMPARE(motor->portInformation().combinations, QVector<quint16>{ 0x0014 });
+
+    QSignalSpy commands(hub, &QLegoSimulatedHub::commandReceived);
+    QSignalSpy values(motor, &QLegoAttachedDevice::valueReceived);
+    motor->subscribeCombined({ { QLegoMotor::PositionMode, 0 }, { LoadMode, 0 } }, 5);
+    QTRY_COMPARE(commands.count(), 5);
+    QTRY_VERIFY(motor->subscribed());
+
+    // Locked, both modes set up, combined and unlocked with updates.
+    const QList<QByteArray> expected = { QByteArray::fromHex("0500420002"),
+                                         QByteArray::fromHex("0a004100020500000001"),
+                                         QByteArray::fromHex("0a004100040500000001"),
+                                         QByteArray::fromHex("0800420001002040"),
+                                         QByteArray::fromHex("0500420003") };
+    QCOMPARE(framesOf(commands), expected);
+
+    // The integer position is converted, as the load is a float.
+    hub->setValue(0, QByteArray::fromHex("5affffff") + encodeFloat(1.5f));
+    QTRY_COMPARE(values.count(), 1);
+    const auto sample = values[0][0].value<QLegoSample>();
+    QCOMPARE(sample.mode, quint8(QLegoSample::CombinedMode));
+    QCOMPARE(sample.count, quint8(2));
+    QCOMPARE(sample.type, quint8(QLegoValueFormat::Float));
+    QCOMPARE(sample.value(0), -166.0);
+    QCOMPARE(sample.value(1), 1.5);
+    QCOMPARE(motor->position(), -166);
+}
+
+void QLegoAttachedDeviceTest::testCommandFeedback()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+    hub->setAutomaticFeedback(false);
+    auto motor = motorOf(device.data());
+    motor->setStartupMode(QLegoAttachedDevice::BufferIfNecessary);
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+
+    // One command executes and one waits in the buffer of the hub, the rest on the host.
+    QVector<QLegoCommandReply::State> states;
+    for (const int power : { 30, 40, 50 }) {
+        follow(motor->startPower(power), &states);
+    }
+    QTRY_COMPARE(outputs.count(), 2);
+    QCOMPARE(outputs[0][1].toByteArray(), QByteArray::fromHex("08008100015100" "1e"));
+    QCOMPARE(outputs[1][1].toByteArray(), QByteArray::fromHex("08008100015100" "28"));
+    QCOMPARE(states[0], QLegoCommandReply::Sent);
+    QCOMPARE(states[2], QLegoCommandReply::Queued);
+
+    // Buffer empty, command in progress.
+    hub->sendFeedback(0, 0x01);
+    QTRY_COMPARE(states[0], QLegoCommandReply::InProgress);
+    QCOMPARE(states[1], QLegoCommandReply::Sent);
+
+    // The first completes and the second starts, which makes room for the third.
+    hub->sendFeedback(0, 0x03);
+    QTRY_COMPARE(states[0], QLegoCommandReply::Completed);
+    QCOMPARE(states[1], QLegoCommandReply::InProgress);
+    QTRY_COMPARE(outputs.count(), 3);
+    QCOMPARE(outputs[2][1].toByteArray(), QByteArray::fromHex("08008100015100" "32"));
+    QCOMPARE(states[2], QLegoCommandReply::Sent);
+
+    // The second is discarded and the third starts.
+    hub->sendFeedback(0, 0x05);
+    QTRY_COMPARE(states[1], QLegoCommandReply::Discarded);
+    QCOMPARE(states[2], QLegoCommandReply::InProgress);
+
+    // While the hub reports busy, nothing more is sent.
+    for (const int power : { 60, 70 }) {
+        follow(motor->startPower(power), &states);
+    }
+    QTRY_COMPARE(outputs.count(), 4);
+    QCOMPARE(states[4], QLegoCommandReply::Queued);
+    hub->sendFeedback(0, 0x11);
+    QTest::qWait(50);
+    QCOMPARE(outputs.count(), 4);
+    QCOMPARE(states[4], QLegoCommandReply::Queued);
+
+    // The third completes, which lets the queued command follow.
+    hub->sendFeedback(0, 0x0a);
+    QTRY_COMPARE(states[2], QLegoCommandReply::Completed);
+    QTRY_COMPARE(outputs.count(), 5);
+    QCOMPARE(outputs[4][1].toByteArray(), QByteArray::fromHex("08008100015100" "46"));
+    QCOMPARE(states[3], QLegoCommandReply::Sent);
+    QCOMPARE(states[4], QLegoCommandReply::Sent);
+}
+
+void QLegoAttachedDeviceTest::testDisconnectedCommand()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+    auto motor = motorOf(device.data());
+    motor->setStartupMode(QLegoAttachedDevice::BufferIfNecessary);
+    QSignalSpy disconnected(device.data(), &QLegoDevice::disconnected);
+    hub->close();
+    QCOMPARE(disconnected.count(), 1);
+
+    // Commands written while the link is down are discarded, rather than waiting for feedback.
+    QVector<QLegoCommandReply::State> states;
+    for (const int power : { 30, 40, 50 }) {
+        follow(motor->startPower(power), &states);
+    }
+    const QVector<QLegoCommandReply::State> discarded(3, QLegoCommandReply::Discarded);
+    QCOMPARE(states, discarded);
+    QCOMPARE(device->statistics()->commandsDropped(), quint64(3));
+
+    // The attachment survives the reconnect, with room on the hub for new commands.
+    QSignalSpy ready(device.data(), &QLegoDevice::ready);
+    device->connectToDevice();
+    QVERIFY(ready.wait(2000));
+    QCOMPARE(motorOf(device.data()), motor);
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+    follow(motor->startPower(60), &states);
+    QTRY_COMPARE(outputs.count(), 1);
+    QCOMPARE(outputs[0][1].toByteArray(), QByteArray::fromHex("08008100015100" "3c"));
+    QTRY_COMPARE(states[3], QLegoCommandReply::Completed);
+}
+
+QTEST_MAIN(QLegoAttachedDeviceTest)
@@ -0,0 +1,19 @@
+#ifndef QLEGOATTACHEDDEVICETEST_H
+#define QLEGOATTACHEDDEVICETEST_H
+
+#include <QObject>
+
+class QLegoAttachedDeviceTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void init();
+    void testSubscription();
+    void testDeltaTraffic();
+    void testPortInformation();
+    void testCombinedFloat();
+    void testCommandFeedback();
+    void testDisconnectedCommand();
+};
+
+#endif
@@ -0,0 +1,253 @@
+#include <QTest>
+#include <QLocalSocket>
+#include <QSignalSpy>
+#include <QTcpSocket>
+#include "tst_qlegobridge.h"
+#include "qlegobridgeprotocol.h"
+#include "qlegobridgeserver.h"
+#include "qlegodevice.h"
+#include "qlegomotor.h"
+#include "qlegosimulatedhub.h"
+
+using namespace QLegoBridgeProtocol;
+
+static QByteArray position(qint32 degrees)
+{
+    QByteArray value(4, Qt::Uninitialized);
+    qToLittleEndian<qint32>(degrees, value.data());
+    return value;
+}
+
+// A simulated hub with a motor on port A, served by a bridge on localhost.
+struct Bridge
+{
+    Bridge()
+    {
+        hub = new QLegoSimulatedHub;
+        hub->attachDevice(0, QLegoAttachedDevice::TechnicLargeLinearMotor);
+        device.reset(QLegoDevice::createDevice(hub));
+        server.addDevice(device.data());
+        device->connectToDevice();
+    }
+
+    bool waitForReady()
+    {
+        return QTest::qWaitFor([this]() { return device->isReady(); })
+                && server.listen(QHostAddress::LocalHost);
+    }
+
+    QLegoSimulatedHub *hub;
+    QScopedPointer<QLegoDevice> device;
+    QLegoBridgeServer server;
+};
+
+// Collects what the bridge sends to a client.
+struct Client
+{
+    explicit Client(QIODevice *socket)
+        : socket(socket)
+    {
+        QObject::connect(socket, &QIODevice::readyRead, [this]() { read(); });
+    }
+
+    void read()
+    {
+        buffer += this->socket->readAll();
+        MessageType type;
+        QByteArray payload;
+        while (takeMessage(buffer, &type, &payload)) {
+            if (type == HubState) {
+                hubStates.append(payload);
+            } else if (type == PortState) {
+                portStates.append(payload);
+            } else if (type == CommandAck) {
+                acks.append(payload);
+            } else if (type == Telemetry) {
+                const char *data = payload.constData() + 1;
+                const char *end = payload.constData() + payload.size();
+                TelemetrySample sample;
+                while (readSample(data, end, &sample)) {
+                    samples.append(sample);
+                }
+            }
+        }
+    }
+
+    QIODevice *socket;
+    QByteArray buffer;
+    QVector<QByteArray> hubStates;
+    QVector<QByteArray> portStates;
+    QVector<QByteArray> acks;
+    QVector<TelemetrySample> samples;
+};
+
+void QLegoBridgeTest::testSession()
+{
+    Bridge bridge;
+    QVERIFY(bridge.waitForReady());
+
+    QTcpSocket socket;
+    Client client(&socket);
+    socket.connectToHost(QHostAddress::LocalHost, bridge.server.serverPort());
+    QVERIFY(socket.waitForConnected());
+
+    QTRY_COMPARE(client.portStates.size(), 1);
+    QCOMPARE(client.hubStates.size(), 1);
+    QCOMPARE(client.hubStates[0][1], '\x01');
+    QCOMPARE(client.portStates[0], QByteArray::fromHex("00002e0001"));
+
+    socket.write(subscription(Subscribe, 0, 0, QLegoMotor::PositionMode));
+    QTRY_COMPARE(bridge.hub->mode(0), int(QLegoMotor::PositionMode));
+
+    bridge.hub->setValue(0, position(90));
+    QTRY_COMPARE(client.samples.size(), 1);
+    QCOMPARE(client.samples[0].hub, quint8(0));
+    QCOMPARE(client.samples[0].sample.portId, quint8(0));
+    QCOMPARE(client.samples[0].sample.mode, quint8(QLegoMotor::PositionMode));
+    QCOMPARE(client.samples[0].sample.values[0], 90);
+
+    // Samples of other modes are filtered out.
+    socket.write(subscription(Unsubscribe, 0, 0, QLegoMotor::PositionMode));
+    socket.write(subscription(Subscribe, Any, Any, QLegoMotor::SpeedMode));
+    QTRY_COMPARE(bridge.hub->mode(0), int(QLegoMotor::PositionMode));
+    bridge.hub->setValue(0, position(180));
+    QTest::qWait(50);
+    QCOMPARE(client.samples.size(), 1);
+
+    // A deleted hub is reported as disconnected, and commands for it are ignored.
+    const int states = client.hubStates.size();
+    bridge.device.reset();
+    QTRY_VERIFY(client.hubStates.size() > states);
+    QCOMPARE(client.hubStates.last()[1], '\x00');
+    socket.write(commandBatch(1, { { 0, 0, 0x07, QByteArray::fromHex("326400") } }));
+    QTRY_COMPARE(client.acks.size(), 1);
+    QCOMPARE(client.acks[0], QByteArray::fromHex("0100000000"));
+}
+
+void QLegoBridgeTest::testCommands()
+{
+    Bridge bridge;
+    QVERIFY(bridge.waitForReady());
+    QSignalSpy outputs(bridge.hub, &QLegoSimulatedHub::portOutputReceived);
+
+    QTcpSocket socket;
+    Client client(&socket);
+    socket.connectToHost(QHostAddress::LocalHost, bridge.server.serverPort());
+    QVERIFY(socket.waitForConnected());
+
+    // Start speed 50 at 100% power, twice, and once on a port without a device.
+    const QByteArray startSpeed = QByteArray::fromHex("326400");
+    socket.write(commandBatch(7, { { 0, 0, 0x07, startSpeed },
+                                   { 0, 0, 0x07, startSpeed },
+                                   { 0, 3, 0x07, startSpeed } }));
+
+    QTRY_COMPARE(client.acks.size(), 1);
+    QCOMPARE(client.acks[0], QByteArray::fromHex("0700000002"));
+    QTRY_COMPARE(outputs.count(), 2);
+    QCOMPARE(outputs[0][1].toByteArray(), QByteArray::fromHex("090081001107326400"));
+    QCOMPARE(bridge.server.commandsForwarded(), quint64(2));
+
+    // A command too long for its size byte is left out, instead of corrupting the batch.
+    socket.write(commandBatch(8, { { 0, 0, 0x07, QByteArray(300, '\x01') },
+                                   { 0, 0, 0x07, startSpeed } }));
+    QTRY_COMPARE(client.acks.size(), 2);
+    QCOMPARE(client.acks[1], QByteArray::fromHex("0800000001"));
+    QTRY_COMPARE(outputs.count(), 3);
+}
+
+void QLegoBridgeTest::testCoalescing()
+{
+    Bridge bridge;
+    bridge.server.setFlushInterval(200);
+    QVERIFY(bridge.waitForReady());
+
+    QTcpSocket socket;
+    Client client(&socket);
+    socket.connectToHost(QHostAddress::LocalHost, bridge.server.serverPort());
+    QVERIFY(socket.waitForConnected());
+    socket.write(subscription(Subscribe, 0, 0, QLegoMotor::PositionMode));
+    QTRY_COMPARE(bridge.hub->mode(0), int(QLegoMotor::PositionMode));
+
+    // Samples arriving within one flush interval reach the client as the latest one.
+    for (int i = 1; i <= 100; i++) {
+        bridge.hub->setValue(0, position(i));
+    }
+    QTRY_VERIFY(!client.samples.isEmpty() && client.samples.last().sample.values[0] == 100);
+
+    int received = 0;
+    for (const auto &sample : client.samples) {
+        received += 1 + sample.coalesced;
+    }
+    QVERIFY(client.samples.size() < 10);
+    QCOMPARE(received, 100);
+    QCOMPARE(bridge.server.samplesSent() + bridge.server.samplesCoalesced(), quint64(100));
+}
+
+void QLegoBridgeTest::testLocalSocket()
+{
+    Bridge bridge;
+    QVERIFY(bridge.waitForReady());
+    const auto name = QStringLiteral("tst_qlegobridge_%1").arg(QCoreApplication::applicationPid());
+    QVERIFY2(bridge.server.listen(name), qPrintable(bridge.server.errorString()));
+
+    QLocalSocket socket;
+    Client client(&socket);
+    socket.connectToServer(name);
+    QVERIFY(socket.waitForConnected());
+    QTRY_COMPARE(client.portStates.size(), 1);
+    QTRY_COMPARE(bridge.server.clientCount(), 1);
+
+    socket.disconnectFromServer();
+    QTRY_COMPARE(bridge.server.clientCount(), 0);
+
+    // A second bridge does not take over the name of a live one.
+    QLegoBridgeServer other;
+    QVERIFY(!other.listen(name));
+    QVERIFY(other.errorString().contains(name));
+}
+
+void QLegoBridgeTest::benchmarkCommandLatency()
+{
+    Bridge bridge;
+    QVERIFY(bridge.waitForReady());
+    QSignalSpy outputs(bridge.hub, &QLegoSimulatedHub::portOutputReceived);
+
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, bridge.server.serverPort());
+    QVERIFY(socket.waitForConnected());
+    const QByteArray batch = commandBatch(0, { { 0, 0, 0x07, QByteArray::fromHex("326400") } });
+
+    // From a client writing a command to the hub receiving it.
+    QBENCHMARK {
+        const int count = outputs.count();
+        socket.write(batch);
+        QVERIFY(QTest::qWaitFor([&]() { return outputs.count() > count; }, 1000));
+    }
+}
+
+void QLegoBridgeTest::benchmarkTelemetryThroughput()
+{
+    Bridge bridge;
+    bridge.server.setFlushInterval(0);
+    QVERIFY(bridge.waitForReady());
+
+    QTcpSocket socket;
+    Client client(&socket);
+    socket.connectToHost(QHostAddress::LocalHost, bridge.server.serverPort());
+    QVERIFY(socket.waitForConnected());
+    socket.write(subscription(Subscribe, 0, 0, QLegoMotor::PositionMode));
+    QTRY_COMPARE(bridge.hub->mode(0), int(QLegoMotor::PositionMode));
+
+    // From the hub reporting 1000 samples to the client holding the last one.
+    qint32 value = 0;
+    QBENCHMARK {
+        for (int i = 0; i < 1000; i++) {
+            bridge.hub->setValue(0, position(++value));
+        }
+        QVERIFY(QTest::qWaitFor([&]() {
+            return !client.samples.isEmpty() && client.samples.last().sample.values[0] == value;
+        }, 5000));
+    }
+}
+
+QTEST_MAIN(QLegoBridgeTest)
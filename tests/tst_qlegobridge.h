@@ -0,0 +1,18 @@
+#ifndef QLEGOBRIDGETEST_H
+#define QLEGOBRIDGETEST_H
+
+#include <QObject>
+
+class QLegoBridgeTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testSession();
+    void testCommands();
+    void testCoalescing();
+    void testLocalSocket();
+    void benchmarkCommandLatency();
+    void benchmarkTelemetryThroughput();
+};
+
+#endif
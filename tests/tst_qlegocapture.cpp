@@ -0,0 +1,136 @@
+#include <QTest>
+#include <QTemporaryDir>
+#include "tst_qlegocapture.h"
+#include "qlegocapture.h"
+
+static const quint64 Address = Q_UINT64_C(0x90842b4e5a1f);
+
+static QByteArray frame(int index)
+{
+    // A port value message, with the index as its value.
+    QByteArray bytes = QByteArray::fromHex("0800450100000000");
+    qToLittleEndian<qint32>(index, bytes.data() + 4);
+    return bytes;
+}
+
+// Writes a frame, giving the worker time to prepare the next segment if it is not ready.
+static bool writeFrame(QLegoCapture &capture, int index)
+{
+    const QByteArray bytes = frame(index);
+    const auto direction = index % 2 ? QLegoCapture::Outgoing : QLegoCapture::Incoming;
+    for (int attempt = 0; attempt < 100; attempt++) {
+        if (capture.write(direction, Address, 1000 + index, bytes.constData(), bytes.size())) {
+            return true;
+        }
+        QTest::qWait(10);
+    }
+    return false;
+}
+
+void QLegoCaptureTest::testWriteRead()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.filePath("hub.qlc");
+
+    QLegoCapture capture(fileName);
+    QVERIFY(capture.open());
+    for (int i = 0; i < 100; i++) {
+        QVERIFY(writeFrame(capture, i));
+    }
+    capture.close();
+    QCOMPARE(capture.recordsWritten(), quint64(100));
+    QCOMPARE(QLegoCapture::findSegments(fileName),
+             QStringList { QLegoCapture::segmentFileName(fileName, 0) });
+
+    QLegoCaptureReader reader(QLegoCapture::findSegments(fileName));
+    QVERIFY(reader.open());
+    QLegoCaptureReader::Record record;
+    for (int i = 0; i < 100; i++) {
+        QVERIFY(reader.readNext(&record));
+        QCOMPARE(record.direction, i % 2 ? QLegoCapture::Outgoing : QLegoCapture::Incoming);
+        QCOMPARE(record.address, Address);
+        QCOMPARE(record.timestamp, qint64(1000 + i));
+        QCOMPARE(QByteArray(record.data, record.size), frame(i));
+    }
+    QVERIFY(!reader.readNext(&record));
+    QCOMPARE(reader.recordsRead(), quint64(100));
+}
+
+void QLegoCaptureTest::testRollover()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.filePath("hub.qlc");
+    const int recordSize = QLegoCapture::RecordHeaderSize + frame(0).size();
+
+    QLegoCapture capture(fileName);
+    capture.setSegmentSize(4096);
+    QVERIFY(capture.open());
+    // Segments are mapped with the size they were opened with.
+    QTest::ignoreMessage(QtWarningMsg, "cannot change the segment size of an open capture");
+    capture.setSegmentSize(1 << 20);
+    QCOMPARE(capture.segmentSize(), qint64(4096));
+    const int perSegment = (4096 - QLegoCapture::SegmentHeaderSize) / recordSize;
+    const int total = perSegment * 5 + 1;
+    for (int i = 0; i < total; i++) {
+        QVERIFY(writeFrame(capture, i));
+    }
+    capture.close();
+
+    const QStringList segments = QLegoCapture::findSegments(fileName);
+    QCOMPARE(segments.size(), 6);
+    QCOMPARE(capture.segments(), segments);
+
+    QLegoCaptureReader reader(segments);
+    QVERIFY(reader.open());
+    QLegoCaptureReader::Record record;
+    int count = 0;
+    while (reader.readNext(&record)) {
+        QCOMPARE(record.timestamp, qint64(1000 + count));
+        count++;
+    }
+    QCOMPARE(count, total);
+
+    // A new capture continues the numbering and keeps only the newest segments.
+    QLegoCapture next(fileName);
+    next.setSegmentSize(4096);
+    next.setMaxSegments(2);
+    QVERIFY(next.open());
+    for (int i = 0; i < perSegment * 3; i++) {
+        QVERIFY(writeFrame(next, i));
+    }
+    next.close();
+    QCOMPARE(QLegoCapture::findSegments(fileName),
+             QStringList({ QLegoCapture::segmentFileName(fileName, 7),
+                           QLegoCapture::segmentFileName(fileName, 8) }));
+}
+
+void QLegoCaptureTest::testDropped()
+{
+    QTemporaryDir dir;
+    QLegoCapture capture(dir.filePath("hub.qlc"));
+    const QByteArray bytes = frame(0);
+
+    // Not open yet.
+    QVERIFY(!capture.write(QLegoCapture::Incoming, Address, 0, bytes.constData(), bytes.size()));
+
+    capture.setSegmentSize(4096);
+    QVERIFY(capture.open());
+    const QByteArray large(4096, 'x');
+    QVERIFY(!capture.write(QLegoCapture::Incoming, Address, 0, large.constData(), large.size()));
+    QCOMPARE(capture.recordsDropped(), quint64(2));
+    QCOMPARE(capture.recordsWritten(), quint64(0));
+}
+
+void QLegoCaptureTest::benchmarkWrite()
+{
+    QTemporaryDir dir;
+    QLegoCapture capture(dir.filePath("hub.qlc"));
+    QVERIFY(capture.open());
+    const QByteArray bytes = frame(0);
+
+    QBENCHMARK {
+        capture.write(QLegoCapture::Incoming, Address, 0, bytes.constData(), bytes.size());
+    }
+}
+
+QTEST_MAIN(QLegoCaptureTest)
@@ -0,0 +1,16 @@
+#ifndef QLEGOCAPTURETEST_H
+#define QLEGOCAPTURETEST_H
+
+#include <QObject>
+
+class QLegoCaptureTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testWriteRead();
+    void testRollover();
+    void testDropped();
+    void benchmarkWrite();
+};
+
+#endif
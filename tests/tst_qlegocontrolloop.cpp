@@ -0,0 +1,174 @@
+#include <QTest>
+#include <QSignalSpy>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QtEndian>
+#include "tst_qlegocontrolloop.h"
+#include "qlegocontrolloop.h"
+#include "qlegodevice.h"
+#include "qlegomotor.h"
+#include "qlegopidcontroller.h"
+#include "qlegosimulatedhub.h"
+#include "qlegotesthub.h"
+
+#include <atomic>
+
+static const qint64 Millisecond = 1000000;
+
+static QByteArray position(qint32 degrees)
+{
+    QByteArray value(4, 0);
+    qToLittleEndian<qint32>(degrees, value.data());
+    return value;
+}
+
+void QLegoControlLoopTest::testRate()
+{
+    QLegoControlLoop loop;
+    loop.setRate(200);
+    std::atomic<int> steps(0);
+    std::atomic<bool> ordered(true);
+    loop.addStep([&steps, &ordered](QLegoControlContext &context) {
+        if (context.tick() != quint64(steps.load())) {
+            ordered = false;
+        }
+        steps++;
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+    loop.start();
+    QVERIFY(loop.isRunning());
+    QTest::qWait(250);
+    loop.stop();
+    QVERIFY(!loop.isRunning());
+
+    // A tick every 5 ms, and never more; a loaded machine may skip some.
+    const quint64 expected = timer.elapsed() / 5 + 1;
+    QCOMPARE(loop.ticks(), quint64(steps.load()));
+    QVERIFY(ordered);
+    QVERIFY(loop.ticks() <= expected + 1);
+    QVERIFY(loop.ticks() + loop.overruns() >= expected / 2);
+    QCOMPARE(loop.jitter()->count(), loop.ticks());
+    QCOMPARE(loop.stepTime()->count(), loop.ticks());
+}
+
+void QLegoControlLoopTest::testOverruns()
+{
+    QLegoControlLoop loop;
+    loop.setRate(100);
+    loop.addStep([](QLegoControlContext &context) {
+        // Every other tick takes two and a half periods.
+        if (context.tick() % 2) {
+            QThread::msleep(25);
+        }
+    });
+    loop.start();
+    QTest::qWait(200);
+    loop.stop();
+
+    QVERIFY(loop.ticks() >= 4);
+    QVERIFY(loop.overruns() >= 2 * (loop.ticks() / 2 - 1));
+}
+
+void QLegoControlLoopTest::testPidController()
+{
+    QLegoPidController pid(0.5, 1.0, 0.1);
+    pid.setSetpoint(100);
+
+    // Without an interval only the proportional term applies.
+    QCOMPARE(pid.update(20, 0), 40.0);
+
+    // 70 * 1.0 * 0.5 is integrated, and the measurement moving up by 10 is damped by 2.
+    QCOMPARE(pid.update(30, 0.5), 35.0 + 35.0 - 2.0);
+
+    // The output and the integral are limited.
+    pid.setOutputLimits(-50, 50);
+    for (int i = 0; i < 10; i++) {
+        pid.update(30, 1.0);
+    }
+    QCOMPARE(pid.output(), 50.0);
+    pid.setSetpoint(30);
+    QCOMPARE(pid.update(30, 1.0), 50.0);
+    QVERIFY(pid.update(40, 1.0) < 50.0);
+
+    pid.reset();
+    QCOMPARE(pid.update(20, 0), 5.0);
+}
+
+void QLegoControlLoopTest::testMotorControl()
+{
+    auto hub = new QLegoSimulatedHub;
+    hub->attachDevice(0, QLegoAttachedDevice::TechnicLargeLinearMotor);
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(hub));
+    QSignalSpy ready(device.data(), &QLegoDevice::ready);
+    device->connectToDevice();
+    QVERIFY(ready.wait(2000));
+    QTRY_COMPARE(device->attachedDevices().size(), 1);
+    auto motor = qobject_cast<QLegoMotor *>(device->attachedDevices().first());
+    QVERIFY(motor);
+    motor->subscribe(QLegoMotor::PositionMode);
+    QTRY_COMPARE(hub->mode(0), int(QLegoMotor::PositionMode));
+
+    QLegoControlLoop loop;
+    loop.setRate(200);
+    QLegoPidController pid(0.5);
+    pid.setSetpoint(100);
+    const int input = loop.addInput(motor, QLegoMotor::PositionMode);
+    QCOMPARE(input, 0);
+    loop.addStep(pid.motorStep(motor, input));
+
+    // Nothing is commanded before the first sample.
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+    loop.start();
+    QTest::qWait(50);
+    QCOMPARE(outputs.count(), 0);
+
+    hub->setValue(0, position(20));
+    QTRY_VERIFY(!outputs.isEmpty());
+    QCOMPARE(outputs.first()[1].toByteArray(), QByteArray::fromHex("0800810011510028"));
+    QTRY_VERIFY(loop.feedbackLatency()->count() > 0);
+    QVERIFY(loop.feedbackLatency()->maximum() < 1000 * Millisecond);
+    loop.stop();
+    QCOMPARE(motor->power(), 40);
+}
+
+void QLegoControlLoopTest::testSlowLink()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+    auto motor = motorOf(device.data());
+    QVERIFY(motor);
+
+    // Every write takes four ticks.
+    hub->setWriteLatency(20);
+    QLegoControlLoop loop;
+    loop.setRate(200);
+    std::atomic<int> power(0);
+    loop.addStep([motor, &power](QLegoControlContext &context) {
+        context.setPower(motor, ++power % 100);
+    });
+
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+    loop.start();
+    int deepest = 0;
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < 300) {
+        QTest::qWait(5);
+        deepest = qMax(deepest, device->queuedCommands(QLegoDevice::MotionPriority));
+    }
+    loop.stop();
+
+    // Each tick replaces the command of the previous one, so at most one waits for the link.
+    QVERIFY(loop.ticks() > 20);
+    QVERIFY(deepest <= 1);
+    QVERIFY(device->statistics()->commandsPurged() > 0);
+    QTRY_COMPARE(device->queuedCommands(QLegoDevice::MotionPriority), 0);
+    QVERIFY(quint64(outputs.count()) < loop.ticks() / 2);
+    QVERIFY(loop.feedbackLatency()->count() > 0);
+    QVERIFY(loop.feedbackLatency()->maximum() < 200 * Millisecond);
+}
+
+QTEST_MAIN(QLegoControlLoopTest)
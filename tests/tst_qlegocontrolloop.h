@@ -0,0 +1,17 @@
+#ifndef QLEGOCONTROLLOOPTEST_H
+#define QLEGOCONTROLLOOPTEST_H
+
+#include <QObject>
+
+class QLegoControlLoopTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testRate();
+    void testOverruns();
+    void testPidController();
+    void testMotorControl();
+    void testSlowLink();
+};
+
+#endif
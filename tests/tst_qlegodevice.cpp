@@ -0,0 +1,491 @@
+#include <QTest>
+#include <QSignalSpy>
+#include <QElapsedTimer>
+#include "tst_qlegodevice.h"
+#include "qlegocommandreply.h"
+#include "qlegodevice.h"
+#include "qlegolatencyhistogram.h"
+#include "qlegomotor.h"
+#include "qlegoportinformation.h"
+#include "qlegoreplay.h"
+#include "qlegosimulatedhub.h"
+#include "qlegosynchronizedmotor.h"
+#include "qlegotesthub.h"
+#include "qlegowatchdog.h"
+#include <QThread>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+static const qint64 Millisecond = 1000000;
+static const quint8 MotorPort = 0;
+static const quint8 LedPort = 50;
+
+// A motor and a light.
+static const QMap<quint8, quint16> MotorAndLed = {
+    { MotorPort, QLegoAttachedDevice::TechnicLargeLinearMotor },
+    { LedPort, QLegoAttachedDevice::HubLed }
+};
+
+static bool isBrake(const QByteArray &frame)
+{
+    return frame.size() >= 8 && frame[5] == 0x51 && frame[6] == 0x00 && frame[7] == 127;
+}
+
+static QByteArray rssiReport(qint8 rssi)
+{
+    return QByteArray::fromHex("0600010506") + static_cast<char>(rssi);
+}
+
+// A replay that delivers \a values as RSSI reports, \a spacing milliseconds apart.
+static QLegoReplay *rssiReplay(const QList<int> &values, int spacing)
+{
+    auto replay = new QLegoReplay;
+    replay->setVerifyCommands(false);
+    replay->setSpeed(spacing ? 1 : 0);
+    for (int i = 0; i < values.size(); i++) {
+        replay->addFrame(false, i * spacing * Millisecond, rssiReport(values[i]));
+    }
+    return replay;
+}
+
+void QLegoDeviceTest::testPropertySubscriptions()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(hub));
+    QSignalSpy ready(device.data(), &QLegoDevice::ready);
+    device->connectToDevice();
+    QTRY_COMPARE(ready.count(), 1);
+
+    // Nobody listens, so the hub does not report.
+    QVERIFY(!device->reportsEnabled(QLegoDevice::BatteryProperty));
+    QVERIFY(!hub->reportsEnabled(QLegoDevice::BatteryProperty));
+    QVERIFY(!hub->reportsEnabled(QLegoDevice::ButtonProperty));
+    QVERIFY(!hub->reportsEnabled(QLegoDevice::RssiProperty));
+
+    {
+        QSignalSpy battery(device.data(), &QLegoDevice::batteryLevel);
+        QSignalSpy second(device.data(), &QLegoDevice::batteryLevel);
+        QVERIFY(device->reportsEnabled(QLegoDevice::BatteryProperty));
+        QTRY_VERIFY(hub->reportsEnabled(QLegoDevice::BatteryProperty));
+        // Enabling reports sends the current level.
+        QTRY_COMPARE(battery.count(), 1);
+
+        hub->setBattery(42);
+        QTRY_COMPARE(battery.count(), 2);
+        QCOMPARE(battery.last().first().value<quint8>(), quint8(42));
+        QCOMPARE(device->battery(), 42);
+    }
+
+    // Disabled again once the last listener is gone.
+    QVERIFY(!device->reportsEnabled(QLegoDevice::BatteryProperty));
+    QTRY_VERIFY(!hub->reportsEnabled(QLegoDevice::BatteryProperty));
+
+    // Listeners connected before the session are subscribed when it starts.
+    QSignalSpy button(device.data(), &QLegoDevice::button);
+    device->connectToDevice();
+    QTRY_COMPARE(ready.count(), 2);
+    QVERIFY(hub->reportsEnabled(QLegoDevice::ButtonProperty));
+    QVERIFY(!hub->reportsEnabled(QLegoDevice::BatteryProperty));
+}
+
+void QLegoDeviceTest::testRssi()
+{
+    auto replay = rssiReplay({ -60, -95 }, 0);
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(replay));
+    QSignalSpy rssi(device.data(), &QLegoDevice::rssiChanged);
+    device->connectToDevice();
+    QTRY_VERIFY(replay->atEnd());
+
+    QCOMPARE(rssi.count(), 2);
+    QCOMPARE(rssi[0][0].toInt(), -60);
+    QCOMPARE(rssi[1][0].toInt(), -95);
+    QCOMPARE(device->rssi(), -95);
+}
+
+void QLegoDeviceTest::testReportHysteresis()
+{
+    auto replay = rssiReplay({ -60, -61, -63, -64, -70, -70 }, 0);
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(replay));
+    device->setReportHysteresis(QLegoDevice::RssiProperty, 3);
+    QSignalSpy rssi(device.data(), &QLegoDevice::rssiChanged);
+    device->connectToDevice();
+    QTRY_VERIFY(replay->atEnd());
+
+    QCOMPARE(rssi.count(), 3);
+    QCOMPARE(rssi[0][0].toInt(), -60);
+    QCOMPARE(rssi[1][0].toInt(), -63);
+    QCOMPARE(rssi[2][0].toInt(), -70);
+    // The property follows every report.
+    QCOMPARE(device->rssi(), -70);
+}
+
+void QLegoDeviceTest::testReportInterval()
+{
+    auto replay = rssiReplay({ -60, -61, -62, -63 }, 10);
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(replay));
+    device->setReportInterval(QLegoDevice::RssiProperty, 200);
+    QSignalSpy rssi(device.data(), &QLegoDevice::rssiChanged);
+    device->connectToDevice();
+    QTRY_VERIFY(replay->atEnd());
+
+    // The first report is emitted at once, the latest one when the interval has passed.
+    QCOMPARE(rssi.count(), 1);
+    QTRY_COMPARE(rssi.count(), 2);
+    QCOMPARE(rssi[0][0].toInt(), -60);
+    QCOMPARE(rssi[1][0].toInt(), -63);
+}
+
+void QLegoDeviceTest::testPriorityLanes()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub, MotorAndLed));
+    QVERIFY(device);
+    hub->setWriteLatency(10);
+    auto motor = qobject_cast<QLegoMotor *>(device->attachedDevices().first());
+    auto led = device->attachedDevices().last();
+    QVERIFY(motor);
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+
+    // The first colour goes out at once, the others queue behind it.
+    for (int color = 1; color <= 3; color++) {
+        led->writePortOutput(0x51, QByteArray::fromHex("00") + static_cast<char>(color));
+    }
+    const auto power = motor->startPower(50);
+    QCOMPARE(device->queuedCommands(QLegoDevice::CosmeticPriority), 2);
+    QCOMPARE(device->queuedCommands(QLegoDevice::MotionPriority), 1);
+
+    // Braking drops the queued power command and overtakes the colours.
+    const auto brake = motor->brake();
+    QCOMPARE(device->queuedCommands(QLegoDevice::MotionPriority), 0);
+    QCOMPARE(device->queuedCommands(QLegoDevice::SafetyPriority), 1);
+    QCOMPARE(power->state(), QLegoCommandReply::Discarded);
+
+    QTRY_COMPARE(outputs.count(), 4);
+    QCOMPARE(outputs[0][0].value<quint8>(), LedPort);
+    QCOMPARE(outputs[1][0].value<quint8>(), MotorPort);
+    QVERIFY(isBrake(outputs[1][1].toByteArray()));
+    QCOMPARE(outputs[2][0].value<quint8>(), LedPort);
+    QCOMPARE(outputs[3][0].value<quint8>(), LedPort);
+    QTRY_COMPARE(brake->state(), QLegoCommandReply::Completed);
+    QCOMPARE(device->statistics()->commandsPurged(), quint64(1));
+}
+
+void QLegoDeviceTest::testRequestOrder()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub, MotorAndLed));
+    QVERIFY(device);
+    hub->setWriteLatency(10);
+    auto motor = qobject_cast<QLegoMotor *>(device->attachedDevices().first());
+    auto led = device->attachedDevices().last();
+    QVERIFY(motor);
+    QSignalSpy values(motor, &QLegoAttachedDevice::valueReceived);
+
+    // The colour keeps the link busy, so the requests queue up behind it. Only the last,
+    // adjacent duplicate is merged; the second subscription must survive the one in between.
+    led->writePortOutput(0x51, QByteArray::fromHex("0001"));
+    const quint64 coalesced = device->statistics()->commandsCoalesced();
+    motor->subscribe(QLegoMotor::PositionMode);
+    motor->unsubscribe();
+    motor->subscribe(QLegoMotor::PositionMode);
+    motor->subscribe(QLegoMotor::PositionMode);
+    QCOMPARE(device->statistics()->commandsCoalesced(), coalesced + 1);
+
+    QTRY_COMPARE(device->queuedCommands(QLegoDevice::ConfigurationPriority), 0);
+    QTest::qWait(50);
+    hub->setValue(MotorPort, QByteArray(4, 0));
+    QTRY_COMPARE(values.count(), 1);
+}
+
+void QLegoDeviceTest::testDispatchLatency()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+    auto motor = motorOf(device.data());
+    QSignalSpy values(motor, &QLegoAttachedDevice::valueReceived);
+    motor->subscribe(QLegoMotor::PositionMode, 1);
+    QTRY_VERIFY(motor->subscribed());
+
+    // Without tracking, samples are still timestamped, but nothing is recorded.
+    QByteArray position(4, '\0');
+    position[0] = 10;
+    hub->setValue(0, position);
+    QTRY_COMPARE(values.count(), 1);
+    QVERIFY(values[0][0].value<QLegoSample>().timestamp > 0);
+    QVERIFY(!device->dispatchLatency(0x45));
+
+    // The dispatch time includes the slots connected to the signals of a message.
+    device->setLatencyTracking(true);
+    connect(motor, &QLegoMotor::positionChanged, this, []() { QThread::msleep(5); });
+    position[0] = 20;
+    hub->setValue(0, position);
+    QTRY_COMPARE(values.count(), 2);
+    const auto dispatch = device->dispatchLatency(0x45);
+    QVERIFY(dispatch);
+    QCOMPARE(dispatch->count(), quint64(1));
+    QVERIFY(dispatch->minimum() >= 5 * Millisecond);
+}
+
+void QLegoDeviceTest::testStopAllLatency()
+{
+    const int hubs = 4;
+    const int latency = 10;
+    std::vector<std::unique_ptr<QLegoDevice>> devices;
+    std::vector<std::unique_ptr<QSignalSpy>> outputs;
+
+    for (int i = 0; i < hubs; i++) {
+        auto hub = new QLegoSimulatedHub;
+        devices.emplace_back(connectHub(hub, MotorAndLed));
+        QVERIFY(devices.back());
+        outputs.emplace_back(new QSignalSpy(hub, &QLegoSimulatedHub::portOutputReceived));
+        hub->setWriteLatency(latency);
+    }
+
+    // Congest every link with half a second of colours and motion.
+    for (const auto &device : devices) {
+        auto motor = motorOf(device.get(), MotorPort);
+        auto led = device->attachedDevices().last();
+        for (int j = 0; j < 40; j++) {
+            led->writePortOutput(0x51, QByteArray::fromHex("00") + static_cast<char>(j % 10));
+        }
+        for (int j = 0; j < 10; j++) {
+            motor->startPower(10 + j);
+        }
+    }
+
+    for (const auto &device : devices) {
+        device->stopAll();
+    }
+
+    // Only the frame already on its way goes out before the brake, and none of the queued motion
+    // commands follow it.
+    for (int i = 0; i < hubs; i++) {
+        const auto &spy = *outputs[i];
+        QTRY_VERIFY(spy.count() >= 2);
+        int brake = -1;
+        for (int j = 0; j < spy.count() && brake < 0; j++) {
+            if (isBrake(spy[j][1].toByteArray())) {
+                brake = j;
+            }
+        }
+        QVERIFY(brake == 0 || brake == 1);
+        QTest::qWait(5 * latency);
+        for (int j = brake + 1; j < spy.count(); j++) {
+            QCOMPARE(spy[j][0].value<quint8>(), LedPort);
+        }
+        QVERIFY(devices[i]->queuedCommands(QLegoDevice::MotionPriority) == 0);
+        QVERIFY(devices[i]->queuedCommands(QLegoDevice::CosmeticPriority) > 0);
+    }
+}
+
+void QLegoDeviceTest::testWatchdog()
+{
+    const int timeout = 50;
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub, MotorAndLed));
+    QVERIFY(device);
+    auto motor = qobject_cast<QLegoMotor *>(device->attachedDevices().first());
+    QVERIFY(motor);
+    auto watchdog = device->watchdog();
+    QSignalSpy tripped(watchdog, &QLegoWatchdog::tripped);
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+
+    // Motion commands and heartbeats keep it from tripping.
+    motor->startPower(30);
+    watchdog->arm(timeout);
+    QVERIFY(watchdog->isArmed());
+    for (int i = 0; i < 6; i++) {
+        QTest::qWait(timeout / 2);
+        if (i % 2) {
+            watchdog->heartbeat();
+        } else {
+            motor->startPower(30 + i);
+        }
+    }
+    QCOMPARE(tripped.count(), 0);
+
+    // A stalled host is caught by the watchdog thread, and the motor brakes as soon as the
+    // thread of the device runs again.
+    outputs.clear();
+    QThread::msleep(3 * timeout);
+    QTRY_COMPARE(tripped.count(), 1);
+    QVERIFY(watchdog->isTripped());
+    QCOMPARE(watchdog->trips(), quint64(1));
+    const qint64 heartbeat = tripped[0][0].toLongLong();
+    const qint64 detected = tripped[0][1].toLongLong();
+    const qint64 stopped = tripped[0][2].toLongLong();
+    QVERIFY(detected - heartbeat >= timeout * Millisecond);
+    QVERIFY(detected - heartbeat < 2 * timeout * Millisecond);
+    QVERIFY(stopped >= detected);
+    QTRY_VERIFY(!outputs.isEmpty());
+    QVERIFY(isBrake(outputs.last()[1].toByteArray()));
+
+    // It stays tripped until the host is back, and stops once disarmed.
+    QTest::qWait(2 * timeout);
+    QCOMPARE(tripped.count(), 1);
+    watchdog->heartbeat();
+    QVERIFY(!watchdog->isTripped());
+    watchdog->disarm();
+    QVERIFY(!watchdog->isArmed());
+    QTest::qWait(2 * timeout);
+    QCOMPARE(tripped.count(), 1);
+}
+
+void QLegoDeviceTest::testWatchdogThread()
+{
+    const int timeout = 50;
+    auto hub = new QLegoSimulatedHub;
+    auto device = connectHub(hub, MotorAndLed);
+    QVERIFY(device);
+    motorOf(device, MotorPort)->startPower(30);
+    QTest::qWait(20);
+
+    // Recorded in the thread of the device, while this one is stalled.
+    QElapsedTimer timer;
+    std::atomic<qint64> braked(-1);
+    connect(hub, &QLegoSimulatedHub::portOutputReceived, hub,
+            [&timer, &braked](quint8, const QByteArray &frame) {
+                qint64 none = -1;
+                if (isBrake(frame)) {
+                    braked.compare_exchange_strong(none, timer.elapsed());
+                }
+            });
+
+    QThread worker;
+    connect(&worker, &QThread::finished, device, &QObject::deleteLater);
+    device->moveToThread(&worker);
+    worker.start();
+    timer.start();
+    device->watchdog()->arm(timeout);
+
+    // The application thread stalls, and the device thread brakes the motor meanwhile.
+    QThread::msleep(4 * timeout);
+    const qint64 stalled = timer.elapsed();
+    worker.quit();
+    QVERIFY(worker.wait(1000));
+    QVERIFY(braked >= timeout);
+    QVERIFY(braked < stalled);
+}
+
+void QLegoDeviceTest::testVirtualPort()
+{
+    auto hub = new QLegoSimulatedHub;
+    hub->attachDevice(0, QLegoAttachedDevice::TechnicLargeLinearMotor);
+    hub->attachDevice(1, QLegoAttachedDevice::TechnicLargeLinearMotor);
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(hub));
+    QSignalSpy ready(device.data(), &QLegoDevice::ready);
+    device->connectToDevice();
+    QVERIFY(ready.wait(2000));
+    QTRY_COMPARE(device->attachedDevices().size(), 2);
+    auto left = qobject_cast<QLegoMotor *>(device->attachedDevices().first());
+    auto right = qobject_cast<QLegoMotor *>(device->attachedDevices().last());
+    QVERIFY(left && right);
+
+    auto wheels = device->synchronizeMotors(left, right);
+    QVERIFY(wheels);
+    QCOMPARE(wheels->firstPortId(), 0);
+    QCOMPARE(wheels->secondPortId(), 1);
+    QCOMPARE(device->synchronizeMotors(left, right), wheels);
+
+    // Both motors are driven by a single frame.
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+    const auto reply = wheels->startSpeedForDegrees(-720, 50, -50);
+    QTRY_COMPARE(outputs.count(), 1);
+    QCOMPARE(outputs[0][0].value<quint8>(), quint8(wheels->portId()));
+    QCOMPARE(outputs[0][1].toByteArray(), QByteArray::fromHex("0f008110110cd0020000ce32647f00"));
+    QTRY_COMPARE(reply->state(), QLegoCommandReply::Completed);
+
+    // Stopping and braking stop both motors together.
+    QSignalSpy power(wheels, &QLegoMotor::powerChanged);
+    wheels->startPower(40, -40);
+    QCOMPARE(wheels->power(), 40);
+    wheels->stop();
+    QCOMPARE(wheels->power(), 0);
+    wheels->brake();
+    QCOMPARE(wheels->power(), 127);
+    QCOMPARE(power.count(), 3);
+    QTRY_COMPARE(outputs.count(), 4);
+    QCOMPARE(outputs[1][1].toByteArray(), QByteArray::fromHex("08008110110228d8"));
+    QCOMPARE(outputs[2][1].toByteArray(), QByteArray::fromHex("0800811011020000"));
+    QCOMPARE(outputs[3][1].toByteArray(), QByteArray::fromHex("0800811011027f7f"));
+
+    // Stopping them together also drops the motion still queued for either motor.
+    hub->setWriteLatency(10);
+    left->startPower(50);
+    const auto queuedLeft = left->startPower(60);
+    const auto queuedRight = right->startPower(70);
+    wheels->stop();
+    QCOMPARE(device->queuedCommands(QLegoDevice::MotionPriority), 0);
+    QCOMPARE(queuedLeft->state(), QLegoCommandReply::Discarded);
+    QCOMPARE(queuedRight->state(), QLegoCommandReply::Discarded);
+    QTRY_COMPARE(outputs.last()[1].toByteArray(), QByteArray::fromHex("0800811011020000"));
+    const int written = outputs.count();
+    QTest::qWait(50);
+    QCOMPARE(outputs.count(), written);
+
+    QSignalSpy detached(device.data(), &QLegoDevice::deviceDetached);
+    device->destroyVirtualPort(wheels);
+    QVERIFY(detached.wait(1000));
+    QCOMPARE(detached[0][0].value<QLegoAttachedDevice *>(),
+             static_cast<QLegoAttachedDevice *>(wheels));
+    QCOMPARE(device->attachedDevices().size(), 2);
+}
+
+void QLegoDeviceTest::testPortDiscovery()
+{
+    QLegoPortInformationTable::clear();
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub, MotorAndLed));
+    QVERIFY(device);
+    auto motor = device->attachedDevices().first();
+    QCOMPARE(motor->portId(), int(MotorPort));
+
+    // The hub refuses to describe the motor, which stays unknown and can be asked again.
+    QSignalSpy requested(motor, &QLegoAttachedDevice::portInformationRequested);
+    QSignalSpy changed(motor, &QLegoAttachedDevice::portInformationChanged);
+    motor->requestPortInformation();
+    QCOMPARE(requested.count(), 1);
+    QTRY_VERIFY((motor->requestPortInformation(), requested.count() == 2));
+    QVERIFY(!motor->portInformation().complete);
+    QCOMPARE(changed.count(), 0);
+    QCOMPARE(QLegoPortInformationTable::size(), 0);
+
+    QLegoModeInformation position;
+    position.name = "POS";
+    position.symbol = "DEG";
+    position.rawMinimum = -360;
+    position.rawMaximum = 360;
+    position.format = { 1, QLegoValueFormat::Int32 };
+    QLegoPortInformation information;
+    information.capabilities = QLegoPortInformation::Input | QLegoPortInformation::Output;
+    information.inputModes = 0x0001;
+    information.modes = { position };
+    hub->setPortInformation(MotorPort, information);
+
+    // Once it answers every request, the result is complete and shared.
+    QTRY_VERIFY((motor->requestPortInformation(), changed.count() == 1));
+    QVERIFY(motor->portInformation().complete);
+    QCOMPARE(motor->portInformation().modes.size(), 1);
+    QCOMPARE(motor->portInformation().modes[0].name, QString("POS"));
+    QCOMPARE(motor->portInformation().modes[0].symbol, QString("DEG"));
+    QCOMPARE(motor->portInformation().modes[0].rawMaximum, 360.0f);
+    QCOMPARE(motor->portInformation().modes[0].format.type, QLegoValueFormat::Int32);
+    QCOMPARE(QLegoPortInformationTable::size(), 1);
+
+    // Another hub with the same motor does not ask.
+    auto otherHub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> other(connectHub(otherHub, MotorAndLed));
+    QVERIFY(other);
+    const int written = otherHub->framesWritten();
+    auto otherMotor = other->attachedDevices().first();
+    otherMotor->requestPortInformation();
+    QVERIFY(otherMotor->portInformation().complete);
+    QTest::qWait(50);
+    QCOMPARE(otherHub->framesWritten(), written);
+    QLegoPortInformationTable::clear();
+}
+
+QTEST_MAIN(QLegoDeviceTest)
@@ -0,0 +1,24 @@
+#ifndef QLEGODEVICETEST_H
+#define QLEGODEVICETEST_H
+
+#include <QObject>
+
+class QLegoDeviceTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testPropertySubscriptions();
+    void testRssi();
+    void testReportHysteresis();
+    void testReportInterval();
+    void testPriorityLanes();
+    void testRequestOrder();
+    void testDispatchLatency();
+    void testStopAllLatency();
+    void testWatchdog();
+    void testWatchdogThread();
+    void testVirtualPort();
+    void testPortDiscovery();
+};
+
+#endif
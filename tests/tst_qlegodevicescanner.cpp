@@ -10,4 +10,18 @@ void QLegoDeviceScannerTest::testInit()
     QVERIFY(test.scanning() == false);
 }
 
+void QLegoDeviceScannerTest::testStatistics()
+{
+    QLegoDeviceScanner test;
+    const auto stats = test.statistics();
+
+    QVERIFY(stats->scansStarted() == 0);
+    QVERIFY(stats->devicesFound() == 0);
+
+    const QString text = stats->toPrometheus();
+    QVERIFY(text.contains("# TYPE qtlego_scanner_scans_started_total counter\n"));
+    QVERIFY(text.contains("qtlego_scanner_devices_found_total 0\n"));
+    QVERIFY(text.contains("# TYPE qtlego_device_queue_depth gauge\n"));
+}
+
 QTEST_MAIN(QLegoDeviceScannerTest)
@@ -8,6 +8,7 @@ class QLegoDeviceScannerTest : public QObject
     Q_OBJECT
 private slots:
     void testInit();
+    void testStatistics();
 };
 
 #endif
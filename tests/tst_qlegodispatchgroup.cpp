@@ -0,0 +1,218 @@
+#include <QTest>
+#include <QSignalSpy>
+#include "tst_qlegodispatchgroup.h"
+#include "qlegodevice.h"
+#include "qlegodispatchgroup.h"
+#include "qlegomotor.h"
+#include "qlegosimulatedhub.h"
+#include "qlegotesthub.h"
+#include <QThread>
+
+static const qint64 Millisecond = 1000000;
+
+void QLegoDispatchGroupTest::testDispatch()
+{
+    const int hubs = 4;
+    const int latency = 10;
+    QList<QLegoDevice *> devices;
+    QList<QSignalSpy *> outputs;
+    QLegoDispatchGroup group;
+
+    for (int i = 0; i < hubs; i++) {
+        auto hub = new QLegoSimulatedHub;
+        auto device = connectHub(hub);
+        QVERIFY(device);
+        devices.append(device);
+        outputs.append(new QSignalSpy(hub, &QLegoSimulatedHub::portOutputReceived));
+        hub->setWriteLatency(latency);
+        group.addPower(device, motorOf(device), 70);
+    }
+    QCOMPARE(group.size(), hubs);
+
+    // Every link is busy with one write and has more motion queued behind it.
+    for (const auto device : devices) {
+        for (int j = 0; j < 5; j++) {
+            motorOf(device)->startPower(10 + j);
+        }
+        QCOMPARE(device->queuedCommands(QLegoDevice::MotionPriority), 4);
+    }
+
+    QSignalSpy dispatched(&group, &QLegoDispatchGroup::dispatched);
+    QVERIFY(group.dispatch());
+    QVERIFY(!group.dispatch());
+    QVERIFY(dispatched.wait(1000));
+    QVERIFY(!group.isDispatching());
+
+    // The group overtakes the queued power commands, which it replaces.
+    const qint64 skew = dispatched[0][0].toLongLong();
+    QCOMPARE(group.skew(), skew);
+    QVERIFY(skew >= 0);
+    QVERIFY(skew < latency * Millisecond);
+    QCOMPARE(group.skewHistogram()->count(), quint64(1));
+    QCOMPARE(group.transmitTimes().size(), hubs);
+    for (int i = 0; i < hubs; i++) {
+        QVERIFY(group.transmitTimes()[i] >= 0);
+        QCOMPARE(devices[i]->queuedCommands(QLegoDevice::MotionPriority), 0);
+        QCOMPARE(motorOf(devices[i])->power(), 70);
+        QTRY_COMPARE(outputs[i]->count(), 2);
+        QCOMPARE(outputs[i]->last()[1].toByteArray(), QByteArray::fromHex("0800810011510046"));
+    }
+
+    qDeleteAll(outputs);
+    qDeleteAll(devices);
+}
+
+void QLegoDispatchGroupTest::testDroppedTarget()
+{
+    QLegoDispatchGroup group;
+    QScopedPointer<QLegoDevice> first(connectHub(new QLegoSimulatedHub));
+    auto second = connectHub(new QLegoSimulatedHub);
+    QVERIFY(first);
+    QVERIFY(second);
+    group.addPower(first.data(), motorOf(first.data()), -40);
+    group.addPower(second, motorOf(second), -40);
+    delete second;
+
+    QSignalSpy dispatched(&group, &QLegoDispatchGroup::dispatched);
+    QVERIFY(group.dispatch());
+    QVERIFY(dispatched.wait(1000));
+    QCOMPARE(dispatched[0][0].toLongLong(), qint64(0));
+    QVERIFY(group.transmitTimes()[0] >= 0);
+    QCOMPARE(group.transmitTimes()[1], qint64(-1));
+    QCOMPARE(group.skewHistogram()->count(), quint64(0));
+
+    group.clear();
+    QCOMPARE(group.size(), 0);
+    QVERIFY(!group.dispatch());
+}
+
+void QLegoDispatchGroupTest::testClosedLink()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+    auto motor = motorOf(device.data());
+    motor->setStartupMode(QLegoAttachedDevice::BufferIfNecessary);
+    hub->close();
+
+    // A command that never reached the hub neither changes the power nor holds its place.
+    QLegoDispatchGroup group;
+    group.addPower(device.data(), motor, 50);
+    QSignalSpy dispatched(&group, &QLegoDispatchGroup::dispatched);
+    QVERIFY(group.dispatch());
+    QVERIFY(dispatched.wait(1000));
+    QCOMPARE(group.transmitTimes()[0], qint64(-1));
+    QCOMPARE(motor->power(), 0);
+
+    QSignalSpy ready(device.data(), &QLegoDevice::ready);
+    device->connectToDevice();
+    QVERIFY(ready.wait(2000));
+    hub->setAutomaticFeedback(false);
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+    motor->startPower(20);
+    motor->startPower(30);
+    QTRY_COMPARE(outputs.count(), 2);
+
+    QVERIFY(group.dispatch());
+    QVERIFY(dispatched.wait(1000));
+    QVERIFY(group.transmitTimes()[0] >= 0);
+    QCOMPARE(motor->power(), 50);
+}
+
+void QLegoDispatchGroupTest::testSameHub()
+{
+    const QMap<quint8, quint16> motors = {
+        { 0, QLegoAttachedDevice::TechnicLargeLinearMotor },
+        { 1, QLegoAttachedDevice::TechnicLargeLinearMotor },
+        { 2, QLegoAttachedDevice::TechnicLargeLinearMotor },
+        { 3, QLegoAttachedDevice::TechnicLargeLinearMotor }
+    };
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub, motors));
+    QVERIFY(device);
+    hub->setWriteLatency(10);
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+
+    // The link is busy, with more motion for another port queued behind the write.
+    motorOf(device.data(), 3)->startPower(10);
+    motorOf(device.data(), 3)->startPower(20);
+    QCOMPARE(device->queuedCommands(QLegoDevice::MotionPriority), 1);
+
+    QLegoDispatchGroup group;
+    for (int port = 0; port < 3; port++) {
+        group.addPower(device.data(), motorOf(device.data(), port), 30);
+    }
+    QSignalSpy dispatched(&group, &QLegoDispatchGroup::dispatched);
+    QVERIFY(group.dispatch());
+    QCOMPARE(device->queuedCommands(QLegoDevice::MotionPriority), 4);
+
+    // The prepared frames go out in the order they were added, ahead of the queued one.
+    QTRY_COMPARE(outputs.count(), 5);
+    QTRY_COMPARE(dispatched.count(), 1);
+    const QVector<quint8> ports = { 3, 0, 1, 2, 3 };
+    for (int i = 0; i < ports.size(); i++) {
+        QCOMPARE(outputs[i][0].value<quint8>(), ports[i]);
+    }
+    const auto times = group.transmitTimes();
+    QVERIFY(times[0] >= 0 && times[0] <= times[1] && times[1] <= times[2]);
+}
+
+void QLegoDispatchGroupTest::testWorkerThreads()
+{
+    QLegoDispatchGroup group;
+    QScopedPointer<QLegoDevice> local(connectHub(new QLegoSimulatedHub));
+    auto remoteHub = new QLegoSimulatedHub;
+    auto remote = connectHub(remoteHub);
+    QVERIFY(local);
+    QVERIFY(remote);
+    group.addPower(local.data(), motorOf(local.data()), 50);
+    group.addPower(remote, motorOf(remote), 50);
+
+    // Frames are collected in this thread.
+    QList<QByteArray> frames;
+    connect(remoteHub, &QLegoSimulatedHub::portOutputReceived, &group,
+            [&frames](quint8, const QByteArray &frame) { frames.append(frame); });
+
+    QThread worker;
+    remote->moveToThread(&worker);
+    connect(&worker, &QThread::finished, remote, &QObject::deleteLater);
+    worker.start();
+
+    QSignalSpy dispatched(&group, &QLegoDispatchGroup::dispatched);
+    QVERIFY(group.dispatch());
+    QVERIFY(dispatched.wait(1000));
+    QVERIFY(group.transmitTimes()[0] >= 0);
+    QVERIFY(group.transmitTimes()[1] >= 0);
+    QTRY_COMPARE(frames.size(), 1);
+    QCOMPARE(frames[0], QByteArray::fromHex("0800810011510032"));
+
+    worker.quit();
+    QVERIFY(worker.wait(1000));
+}
+
+void QLegoDispatchGroupTest::testDeletedWorker()
+{
+    QLegoDispatchGroup group;
+    QScopedPointer<QLegoDevice> local(connectHub(new QLegoSimulatedHub));
+    auto remote = connectHub(new QLegoSimulatedHub);
+    QVERIFY(local);
+    QVERIFY(remote);
+    group.addPower(local.data(), motorOf(local.data()), 50);
+    group.addPower(remote, motorOf(remote), 50);
+
+    // The worker never runs, so the hub is deleted with its commands still posted to it.
+    QThread worker;
+    remote->moveToThread(&worker);
+    QSignalSpy dispatched(&group, &QLegoDispatchGroup::dispatched);
+    QVERIFY(group.dispatch());
+    delete remote;
+
+    QVERIFY(dispatched.wait(1000));
+    QVERIFY(group.transmitTimes()[0] >= 0);
+    QCOMPARE(group.transmitTimes()[1], qint64(-1));
+    QVERIFY(!group.isDispatching());
+    QVERIFY(group.dispatch());
+    QVERIFY(dispatched.wait(1000));
+}
+
+QTEST_MAIN(QLegoDispatchGroupTest)
@@ -0,0 +1,18 @@
+#ifndef QLEGODISPATCHGROUPTEST_H
+#define QLEGODISPATCHGROUPTEST_H
+
+#include <QObject>
+
+class QLegoDispatchGroupTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testDispatch();
+    void testDroppedTarget();
+    void testClosedLink();
+    void testSameHub();
+    void testWorkerThreads();
+    void testDeletedWorker();
+};
+
+#endif
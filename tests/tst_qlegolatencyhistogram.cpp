@@ -0,0 +1,57 @@
+#include <QTest>
+#include "tst_qlegolatencyhistogram.h"
+#include "qlegolatencyhistogram.h"
+
+void QLegoLatencyHistogramTest::testEmpty()
+{
+    QLegoLatencyHistogram histogram;
+
+    QVERIFY(histogram.count() == 0);
+    QVERIFY(histogram.minimum() == 0);
+    QVERIFY(histogram.maximum() == 0);
+    QVERIFY(histogram.percentile(50) == 0);
+}
+
+void QLegoLatencyHistogramTest::testRecord()
+{
+    QLegoLatencyHistogram histogram;
+
+    histogram.record(1000);
+    histogram.record(3000);
+    histogram.record(-5);
+
+    QCOMPARE(histogram.count(), quint64(3));
+    QCOMPARE(histogram.minimum(), qint64(0));
+    QCOMPARE(histogram.maximum(), qint64(3000));
+    QCOMPARE(histogram.mean(), 4000.0 / 3);
+}
+
+void QLegoLatencyHistogramTest::testPercentile()
+{
+    QLegoLatencyHistogram histogram;
+
+    for (qint64 i = 1; i <= 1000; i++) {
+        histogram.record(i * 1000);
+    }
+
+    // Values are reported within the 6.25% bucket resolution.
+    const qint64 median = histogram.percentile(50);
+    QVERIFY(median <= 500000 && median >= 500000 * 15 / 16);
+    const qint64 p99 = histogram.percentile(99);
+    QVERIFY(p99 <= 990000 && p99 >= 990000 * 15 / 16);
+    QCOMPARE(histogram.percentile(100), qint64(1000000 - 1000000 % 32768));
+    QCOMPARE(histogram.percentile(0), qint64(1000));
+}
+
+void QLegoLatencyHistogramTest::testReset()
+{
+    QLegoLatencyHistogram histogram;
+
+    histogram.record(42);
+    histogram.reset();
+
+    QVERIFY(histogram.count() == 0);
+    QVERIFY(histogram.maximum() == 0);
+}
+
+QTEST_MAIN(QLegoLatencyHistogramTest)
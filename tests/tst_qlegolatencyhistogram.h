@@ -0,0 +1,16 @@
+#ifndef QLEGOLATENCYHISTOGRAMTEST_H
+#define QLEGOLATENCYHISTOGRAMTEST_H
+
+#include <QObject>
+
+class QLegoLatencyHistogramTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testEmpty();
+    void testRecord();
+    void testPercentile();
+    void testReset();
+};
+
+#endif
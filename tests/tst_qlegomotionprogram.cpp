@@ -0,0 +1,266 @@
+#include <QTest>
+#include <QSignalSpy>
+#include <QtEndian>
+#include "tst_qlegomotionprogram.h"
+#include "qlegodevice.h"
+#include "qlegomotionprogram.h"
+#include "qlegomotionscheduler.h"
+#include "qlegomotor.h"
+#include "qlegosimulatedhub.h"
+#include "qlegotesthub.h"
+
+static const qint64 Millisecond = 1000000;
+
+static QByteArray position(qint32 degrees)
+{
+    QByteArray value(4, 0);
+    qToLittleEndian<qint32>(degrees, value.data());
+    return value;
+}
+
+void QLegoMotionProgramTest::testCompile()
+{
+    QLegoMotionProgram unbalanced;
+    unbalanced.beginLoop(2);
+    unbalanced.beginParallel();
+    unbalanced.endLoop();
+    QVERIFY(!unbalanced.compile());
+    QVERIFY(unbalanced.errorString().startsWith("endLoop"));
+
+    QLegoMotionProgram endless;
+    endless.beginLoop();
+    endless.setPower(0, 10);
+    endless.endLoop();
+    QVERIFY(!endless.compile());
+    QVERIFY(!endless.isCompiled());
+
+    QLegoMotionProgram open;
+    open.beginParallel();
+    QVERIFY(!open.compile());
+
+    // Fork, two arms of a Branch and a Join, the wait, the loop and End.
+    QLegoMotionProgram program;
+    program.beginLoop();
+    program.beginParallel();
+    program.wait(10);
+    program.nextBranch();
+    program.waitForFeedback();
+    program.endParallel();
+    program.endLoop();
+    QVERIFY(program.compile());
+    QVERIFY(program.errorString().isEmpty());
+    QCOMPARE(program.instructionCount(), 10);
+
+    program.wait(10);
+    QVERIFY(program.isCompiled());
+    QVERIFY(!program.errorString().isEmpty());
+    QCOMPARE(program.instructionCount(), 10);
+}
+
+void QLegoMotionProgramTest::testRun()
+{
+    auto firstHub = new QLegoSimulatedHub;
+    auto secondHub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> first(connectHub(firstHub));
+    QScopedPointer<QLegoDevice> second(connectHub(secondHub));
+    QVERIFY(first);
+    QVERIFY(second);
+    QSignalSpy firstOutputs(firstHub, &QLegoSimulatedHub::portOutputReceived);
+    QSignalSpy secondOutputs(secondHub, &QLegoSimulatedHub::portOutputReceived);
+
+    QLegoMotionProgram program;
+    const int left = program.addMotor(first.data(), motorOf(first.data()));
+    const int right = program.addMotor(second.data(), motorOf(second.data()));
+    program.beginLoop(3);
+    program.beginParallel();
+    program.setPower(left, 50);
+    program.wait(20);
+    program.brake(left);
+    program.nextBranch();
+    program.setPower(right, -50);
+    program.waitForFeedback();
+    program.wait(10);
+    program.stop(right);
+    program.endParallel();
+    program.endLoop();
+    QVERIFY(program.compile());
+
+    QLegoMotionScheduler scheduler;
+    QSignalSpy finished(&scheduler, &QLegoMotionScheduler::finished);
+    const int run = scheduler.start(program);
+    QVERIFY(run > 0);
+    QVERIFY(finished.wait(2000));
+    QCOMPARE(finished[0][0].toInt(), run);
+    QVERIFY(!scheduler.isRunning(run));
+    QCOMPARE(scheduler.runningPrograms(), 0);
+
+    QTRY_COMPARE(firstOutputs.count(), 6);
+    QTRY_COMPARE(secondOutputs.count(), 6);
+    QCOMPARE(firstOutputs[0][1].toByteArray(), QByteArray::fromHex("0800810011510032"));
+    QCOMPARE(firstOutputs[1][1].toByteArray(), QByteArray::fromHex("080081001151007f"));
+    QCOMPARE(secondOutputs[0][1].toByteArray(), QByteArray::fromHex("08008100115100ce"));
+    QCOMPARE(secondOutputs[1][1].toByteArray(), QByteArray::fromHex("0800810011510000"));
+
+    // Waits count from when the previous step was due, not from when it ran.
+    const auto trace = scheduler.takeTrace(run);
+    QVERIFY(scheduler.takeTrace(run).isEmpty());
+    QList<QLegoMotionStep> starts;
+    QList<QLegoMotionStep> brakes;
+    for (const auto &step : trace) {
+        QVERIFY(step.executed >= step.scheduled);
+        if (step.instruction == 3) {
+            starts.append(step);
+        } else if (step.instruction == 5) {
+            brakes.append(step);
+            QVERIFY(step.transmitted >= step.executed);
+        }
+    }
+    QCOMPARE(starts.size(), 3);
+    QCOMPARE(brakes.size(), 3);
+    for (int i = 0; i < 3; i++) {
+        QCOMPARE(brakes[i].scheduled - starts[i].scheduled, 20 * Millisecond);
+    }
+    QCOMPARE(scheduler.lateness()->count(), quint64(12));
+}
+
+void QLegoMotionProgramTest::testWaitForSensor()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+    auto motor = motorOf(device.data());
+    motor->subscribe(QLegoMotor::PositionMode);
+    QTRY_COMPARE(hub->mode(0), int(QLegoMotor::PositionMode));
+    hub->setValue(0, position(0));
+
+    QLegoMotionProgram program;
+    const int drive = program.addMotor(device.data(), motor);
+    const int angle = program.addInput(motor, QLegoMotor::PositionMode);
+    program.setPower(drive, 30);
+    program.waitForSensor(angle, QLegoMotionProgram::AtLeast, 90);
+    program.brake(drive);
+    program.waitForSensor(angle, QLegoMotionProgram::AtMost, -90, 0, 50);
+    program.stop(drive);
+    QVERIFY(program.compile());
+
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+    QLegoMotionScheduler scheduler;
+    const int run = scheduler.start(program);
+    QTRY_COMPARE(outputs.count(), 1);
+    QTest::qWait(50);
+    QCOMPARE(outputs.count(), 1);
+
+    // The second wait gives up after its timeout.
+    hub->setValue(0, position(100));
+    QTRY_COMPARE(outputs.count(), 3);
+    QCOMPARE(outputs[1][1].toByteArray(), QByteArray::fromHex("080081001151007f"));
+    QCOMPARE(outputs[2][1].toByteArray(), QByteArray::fromHex("0800810011510000"));
+    QTRY_VERIFY(!scheduler.isRunning(run));
+    const auto trace = scheduler.takeTrace(run);
+    QCOMPARE(trace.size(), 5);
+    QCOMPARE(trace[3].scheduled - trace[2].scheduled, 50 * Millisecond);
+}
+
+void QLegoMotionProgramTest::testCancel()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+
+    QLegoMotionProgram program;
+    const int motor = program.addMotor(device.data(), motorOf(device.data()));
+    program.beginLoop();
+    program.setPower(motor, 20);
+    program.wait(5);
+    program.endLoop();
+    QVERIFY(program.compile());
+
+    QLegoMotionScheduler scheduler;
+    QSignalSpy finished(&scheduler, &QLegoMotionScheduler::finished);
+    const int first = scheduler.start(program);
+    const int second = scheduler.start(program);
+    QVERIFY(first != second);
+    QTest::qWait(30);
+    QCOMPARE(scheduler.runningPrograms(), 2);
+    QVERIFY(scheduler.steps() > 4);
+
+    scheduler.cancel(first);
+    QVERIFY(finished.wait(1000));
+    QCOMPARE(finished[0][0].toInt(), first);
+    QVERIFY(scheduler.isRunning(second));
+    QCOMPARE(scheduler.start(QLegoMotionProgram()), -1);
+}
+
+void QLegoMotionProgramTest::testConsecutiveSends()
+{
+    const QMap<quint8, quint16> motors = {
+        { 0, QLegoAttachedDevice::TechnicLargeLinearMotor },
+        { 1, QLegoAttachedDevice::TechnicLargeLinearMotor },
+        { 2, QLegoAttachedDevice::TechnicLargeLinearMotor },
+        { 3, QLegoAttachedDevice::TechnicLargeLinearMotor }
+    };
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub, motors));
+    QVERIFY(device);
+    hub->setWriteLatency(10);
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+
+    QLegoMotionProgram program;
+    for (int port = 0; port < 3; port++) {
+        const int motor = program.addMotor(device.data(), motorOf(device.data(), port));
+        program.setPower(motor, 10 * (port + 1));
+    }
+    QVERIFY(program.compile());
+
+    // The link is busy, so the three commands queue up behind the write in flight.
+    motorOf(device.data(), 3)->startPower(50);
+    QLegoMotionScheduler scheduler;
+    QSignalSpy finished(&scheduler, &QLegoMotionScheduler::finished);
+    QVERIFY(scheduler.start(program) > 0);
+    QVERIFY(finished.wait(1000));
+
+    QTRY_COMPARE(outputs.count(), 4);
+    const QList<QByteArray> expected = { QByteArray::fromHex("0800810311510032"),
+                                         QByteArray::fromHex("080081001151000a"),
+                                         QByteArray::fromHex("0800810111510014"),
+                                         QByteArray::fromHex("080081021151001e") };
+    for (int i = 0; i < expected.size(); i++) {
+        QCOMPARE(outputs[i][1].toByteArray(), expected[i]);
+    }
+}
+
+void QLegoMotionProgramTest::testClosedLink()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+    auto attachment = motorOf(device.data());
+    attachment->setStartupMode(QLegoAttachedDevice::BufferIfNecessary);
+
+    QLegoMotionProgram program;
+    const int motor = program.addMotor(device.data(), attachment);
+    program.setPower(motor, 40);
+    program.waitForFeedback();
+    QVERIFY(program.compile());
+    hub->close();
+
+    // The dropped command settles the wait.
+    QLegoMotionScheduler scheduler;
+    const int run = scheduler.start(program);
+    QTRY_VERIFY(!scheduler.isRunning(run));
+    const auto trace = scheduler.takeTrace(run);
+    QVERIFY(!trace.isEmpty());
+    QCOMPARE(trace[0].transmitted, qint64(-1));
+
+    // Its reply does not hold one of the places on the hub.
+    QSignalSpy ready(device.data(), &QLegoDevice::ready);
+    device->connectToDevice();
+    QVERIFY(ready.wait(2000));
+    hub->setAutomaticFeedback(false);
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+    attachment->startPower(20);
+    attachment->startPower(30);
+    QTRY_COMPARE(outputs.count(), 2);
+}
+
+QTEST_MAIN(QLegoMotionProgramTest)
@@ -0,0 +1,18 @@
+#ifndef QLEGOMOTIONPROGRAMTEST_H
+#define QLEGOMOTIONPROGRAMTEST_H
+
+#include <QObject>
+
+class QLegoMotionProgramTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testCompile();
+    void testRun();
+    void testWaitForSensor();
+    void testCancel();
+    void testConsecutiveSends();
+    void testClosedLink();
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include <QTest>
+#include <QSignalSpy>
+#include "tst_qlegomotor.h"
+#include "qlegodevice.h"
+#include "qlegomotor.h"
+#include "qlegosimulatedhub.h"
+#include "qlegotesthub.h"
+
+// The port output commands written to the hub since the spy was created.
+static QList<QByteArray> outputsOf(const QSignalSpy &spy)
+{
+    QList<QByteArray> frames;
+    for (const auto &arguments : spy) {
+        frames.append(arguments[1].toByteArray());
+    }
+    return frames;
+}
+
+void QLegoMotorTest::testSpeedCommands()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+    auto motor = motorOf(device.data());
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+
+    motor->startSpeed(50, 80);
+    motor->startSpeed(-150);
+    motor->startSpeedForTime(2000, -30, 60, QLegoMotor::Hold);
+    // Negative degrees turn the other way.
+    motor->startSpeedForDegrees(-720, 40);
+    // The direction of a position command follows from the position.
+    motor->gotoAbsolutePosition(-90, -50, 70, QLegoMotor::Float);
+    motor->presetEncoder(-360);
+    motor->setProfiles(QLegoMotor::AccelerationProfile | QLegoMotor::DecelerationProfile);
+    motor->startSpeed(10);
+    motor->setStartupMode(QLegoAttachedDevice::BufferIfNecessary);
+    motor->startSpeed(20);
+
+    // Speeds and powers are clamped, durations and angles little endian.
+    const QList<QByteArray> expected = {
+        QByteArray::fromHex("09008100110732" "5000"),
+        QByteArray::fromHex("0900810011079c" "6400"),
+        QByteArray::fromHex("0c0081001109" "d007" "e2" "3c7e00"),
+        QByteArray::fromHex("0e008100110b" "d0020000" "d8" "647f00"),
+        QByteArray::fromHex("0e008100110d" "a6ffffff" "32" "460000"),
+        QByteArray::fromHex("0b008100115102" "98feffff"),
+        QByteArray::fromHex("0900810011070a" "6403"),
+        QByteArray::fromHex("09008100010714" "6403")
+    };
+    QTRY_COMPARE(outputs.count(), expected.size());
+    QCOMPARE(outputsOf(outputs), expected);
+}
+
+void QLegoMotorTest::testRampTimes()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+    auto motor = motorOf(device.data());
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+    QCOMPARE(motor->accelerationTime(), -1);
+    QCOMPARE(motor->decelerationTime(), -1);
+
+    // Times are clamped to 10 s, and set for the only profile of the port.
+    motor->setAccelerationTime(500);
+    motor->setDecelerationTime(12000);
+    QCOMPARE(motor->accelerationTime(), 500);
+    QCOMPARE(motor->decelerationTime(), 10000);
+    const QList<QByteArray> expected = { QByteArray::fromHex("090081001105" "f401" "00"),
+                                         QByteArray::fromHex("090081001106" "1027" "00") };
+    QTRY_COMPARE(outputs.count(), expected.size());
+    QCOMPARE(outputsOf(outputs), expected);
+
+    // The hub keeps the times, so setting them again sends nothing.
+    motor->setAccelerationTime(500);
+    motor->setDecelerationTime(10000);
+    motor->setAccelerationTime(0);
+    QTRY_COMPARE(outputs.count(), 3);
+    QCOMPARE(outputs[2][1].toByteArray(), QByteArray::fromHex("090081001105" "0000" "00"));
+    QTest::qWait(50);
+    QCOMPARE(outputs.count(), 3);
+}
+
+void QLegoMotorTest::testUnsentRampTimes()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    QVERIFY(device);
+    auto motor = motorOf(device.data());
+    hub->close();
+
+    // A time that never reached the hub is not kept.
+    motor->setAccelerationTime(500);
+    motor->setDecelerationTime(700);
+    QCOMPARE(motor->accelerationTime(), -1);
+    QCOMPARE(motor->decelerationTime(), -1);
+
+    // So setting it again after the reconnect sends it.
+    QSignalSpy ready(device.data(), &QLegoDevice::ready);
+    device->connectToDevice();
+    QVERIFY(ready.wait(2000));
+    QSignalSpy outputs(hub, &QLegoSimulatedHub::portOutputReceived);
+    motor->setAccelerationTime(500);
+    motor->setDecelerationTime(700);
+    const QList<QByteArray> expected = { QByteArray::fromHex("090081001105" "f401" "00"),
+                                         QByteArray::fromHex("090081001106" "bc02" "00") };
+    QTRY_COMPARE(outputs.count(), expected.size());
+    QCOMPARE(outputsOf(outputs), expected);
+    QCOMPARE(motor->accelerationTime(), 500);
+    QCOMPARE(motor->decelerationTime(), 700);
+}
+
+QTEST_MAIN(QLegoMotorTest)
@@ -0,0 +1,15 @@
+#ifndef QLEGOMOTORTEST_H
+#define QLEGOMOTORTEST_H
+
+#include <QObject>
+
+class QLegoMotorTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testSpeedCommands();
+    void testRampTimes();
+    void testUnsentRampTimes();
+};
+
+#endif
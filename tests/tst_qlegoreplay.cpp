@@ -0,0 +1,157 @@
+#include <QTest>
+#include <QSignalSpy>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include "tst_qlegoreplay.h"
+#include "qlegocapture.h"
+#include "qlegodevice.h"
+#include "qlegoreplay.h"
+
+static const qint64 Millisecond = 1000000;
+
+// The requests QLegoDevice sends when a session starts, with listeners for all reports.
+static const char *SessionCommands[] = { "0500010202", "0500010305", "0500010405",
+                                         "0500010502", "0500010602", "0500010d05" };
+
+// A motor attached to port A, and a battery level report of 90%.
+static const char *AttachMessage = "0f0004000127000000001000000010";
+static const char *BatteryMessage = "06000106065a";
+
+// Enables the button, RSSI and battery reports of the session.
+static void listen(QLegoDevice *device)
+{
+    QObject::connect(device, &QLegoDevice::button, []() {});
+    QObject::connect(device, &QLegoDevice::rssiChanged, []() {});
+    QObject::connect(device, &QLegoDevice::batteryLevel, []() {});
+}
+
+static void addSession(QLegoReplay *replay, const char *replaced = nullptr)
+{
+    for (int i = 0; i < 6; i++) {
+        const char *command = i == 3 && replaced ? replaced : SessionCommands[i];
+        replay->addFrame(true, (i < 2 ? i : i + 1) * Millisecond, QByteArray::fromHex(command));
+        if (i == 1) {
+            replay->addFrame(false, 2 * Millisecond, QByteArray::fromHex(AttachMessage));
+        }
+    }
+    replay->addFrame(false, 7 * Millisecond, QByteArray::fromHex(BatteryMessage));
+}
+
+void QLegoReplayTest::testSession()
+{
+    auto replay = new QLegoReplay;
+    replay->setSpeed(0);
+    addSession(replay);
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(replay));
+    listen(device.data());
+    QSignalSpy attached(device.data(), &QLegoDevice::deviceAttached);
+    QSignalSpy battery(device.data(), &QLegoDevice::batteryLevel);
+
+    device->connectToDevice();
+    QTRY_VERIFY(replay->atEnd());
+
+    QCOMPARE(replay->mismatches(), 0);
+    QCOMPARE(replay->commandsVerified(), 6);
+    QCOMPARE(replay->framesReplayed(), 2);
+    QCOMPARE(attached.count(), 1);
+    QCOMPARE(battery.count(), 1);
+    QCOMPARE(battery.first().first().value<quint8>(), quint8(90));
+}
+
+void QLegoReplayTest::testMismatch()
+{
+    auto replay = new QLegoReplay;
+    replay->setSpeed(0);
+    replay->setCommandTimeout(50);
+    addSession(replay, "0500010702");
+    // A command the device will never send.
+    replay->addFrame(true, 8 * Millisecond, QByteArray::fromHex("0500010305"));
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(replay));
+    listen(device.data());
+    QSignalSpy mismatch(replay, &QLegoReplay::mismatch);
+
+    device->connectToDevice();
+    QTRY_VERIFY(replay->atEnd());
+
+    QCOMPARE(mismatch.count(), 2);
+    QCOMPARE(mismatch[0][0].toInt(), 3);
+    QCOMPARE(mismatch[0][1].toByteArray(), QByteArray::fromHex("0500010702"));
+    QCOMPARE(mismatch[0][2].toByteArray(), QByteArray::fromHex(SessionCommands[3]));
+    QCOMPARE(mismatch[1][0].toInt(), 6);
+    QVERIFY(mismatch[1][2].toByteArray().isEmpty());
+}
+
+void QLegoReplayTest::testSpeed()
+{
+    for (const qreal speed : { 1.0, 10.0 }) {
+        auto replay = new QLegoReplay;
+        replay->setSpeed(speed);
+        replay->setVerifyCommands(false);
+        replay->addFrame(false, 0, QByteArray::fromHex(BatteryMessage));
+        replay->addFrame(false, 100 * Millisecond, QByteArray::fromHex(BatteryMessage));
+        QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(replay));
+
+        QElapsedTimer timer;
+        timer.start();
+        device->connectToDevice();
+        QTRY_VERIFY(replay->atEnd());
+        QVERIFY(timer.elapsed() >= 100 / speed);
+    }
+}
+
+void QLegoReplayTest::testCapture()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.filePath("hub.qlc");
+    const quint64 address = Q_UINT64_C(0x90842b4e5a1f);
+
+    QLegoCapture capture(fileName);
+    QVERIFY(capture.open());
+    for (int i = 0; i < 6; i++) {
+        const QByteArray command = QByteArray::fromHex(SessionCommands[i]);
+        capture.write(QLegoCapture::Outgoing, address, i, command.constData(), command.size());
+    }
+    // Another hub in the same capture.
+    const QByteArray battery = QByteArray::fromHex(BatteryMessage);
+    capture.write(QLegoCapture::Incoming, 1, 7, battery.constData(), battery.size());
+    capture.write(QLegoCapture::Incoming, address, 8, battery.constData(), battery.size());
+    capture.close();
+
+    auto replay = new QLegoReplay;
+    QVERIFY(replay->load(QLegoCapture::findSegments(fileName), address));
+    replay->setSpeed(0);
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(replay));
+    listen(device.data());
+    QCOMPARE(device->address(), QString("90:84:2B:4E:5A:1F"));
+
+    device->connectToDevice();
+    QTRY_VERIFY(replay->atEnd());
+    QCOMPARE(replay->mismatches(), 0);
+    QCOMPARE(replay->framesReplayed(), 1);
+}
+
+void QLegoReplayTest::benchmarkParser()
+{
+    auto replay = new QLegoReplay;
+    replay->setSpeed(0);
+    addSession(replay);
+    for (int i = 0; i < 10000; i++) {
+        QByteArray value = QByteArray::fromHex("0800450000000000");
+        qToLittleEndian<qint32>(i, value.data() + 4);
+        replay->addFrame(false, (8 + i) * Millisecond, value);
+    }
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(replay));
+    listen(device.data());
+
+    QBENCHMARK {
+        replay->close();
+        device->connectToDevice();
+        while (!replay->atEnd()) {
+            QCoreApplication::processEvents();
+        }
+    }
+    QCOMPARE(replay->mismatches(), 0);
+    QVERIFY(device->statistics()->framesReceived(0x45) >= quint64(10000));
+}
+
+QTEST_MAIN(QLegoReplayTest)
@@ -0,0 +1,17 @@
+#ifndef QLEGOREPLAYTEST_H
+#define QLEGOREPLAYTEST_H
+
+#include <QObject>
+
+class QLegoReplayTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testSession();
+    void testMismatch();
+    void testSpeed();
+    void testCapture();
+    void benchmarkParser();
+};
+
+#endif
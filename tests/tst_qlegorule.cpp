@@ -0,0 +1,171 @@
+#include <QTest>
+#include <QSignalSpy>
+#include <QtEndian>
+#include "tst_qlegorule.h"
+#include "qlegodevice.h"
+#include "qlegolatencyhistogram.h"
+#include "qlegomotor.h"
+#include "qlegorule.h"
+#include "qlegosimulatedhub.h"
+#include "qlegotesthub.h"
+
+#include <chrono>
+
+static QByteArray position(qint32 degrees)
+{
+    QByteArray value(4, 0);
+    qToLittleEndian<qint32>(degrees, value.data());
+    return value;
+}
+
+static qint64 now()
+{
+    const auto time = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+}
+
+void QLegoRuleTest::testSensorRule()
+{
+    auto hub = new QLegoSimulatedHub;
+    hub->attachDevice(0, QLegoAttachedDevice::TechnicLargeLinearMotor);
+    hub->attachDevice(1, QLegoAttachedDevice::TechnicLargeLinearMotor);
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(hub));
+    QSignalSpy ready(device.data(), &QLegoDevice::ready);
+    device->connectToDevice();
+    QVERIFY(ready.wait(2000));
+    QTRY_COMPARE(device->attachedDevices().size(), 2);
+    auto sensor = device->waitForAttachedMotor("A");
+    auto actuator = device->waitForAttachedMotor("B");
+    QVERIFY(sensor);
+    QVERIFY(actuator);
+    sensor->subscribe(QLegoMotor::PositionMode);
+    QTRY_COMPARE(hub->mode(0), int(QLegoMotor::PositionMode));
+
+    QLegoRule rule;
+    rule.setSensor(sensor, 0, QLegoMotor::PositionMode);
+    rule.setCondition(QLegoRule::AtLeast, 90);
+    rule.setPower(device.data(), actuator, 127);
+    device->addRule(&rule);
+    QCOMPARE(device->rules().size(), 1);
+    QCOMPARE(rule.device(), device.data());
+
+    // The same reflex through a slot, which reverses the sensing motor.
+    qint64 received = 0;
+    bool reversed = false;
+    connect(sensor, &QLegoAttachedDevice::valueReceived, this, [&](const QLegoSample &sample) {
+        if (!reversed && sample.value(0) >= 90) {
+            reversed = true;
+            received = sample.timestamp;
+            sensor->startPower(-50);
+        }
+    });
+    QList<QPair<quint8, qint64>> outputs;
+    connect(hub, &QLegoSimulatedHub::portOutputReceived, this,
+            [&](quint8 portId, const QByteArray &) { outputs.append(qMakePair(portId, now())); });
+
+    // Both paths react to the same samples, from receiving the frame to writing the command.
+    const int rounds = 20;
+    QLegoLatencyHistogram rulePath;
+    QLegoLatencyHistogram slotPath;
+    QSignalSpy triggered(&rule, &QLegoRule::triggered);
+    for (int i = 0; i < rounds; i++) {
+        outputs.clear();
+        reversed = false;
+        hub->setValue(0, position(100));
+        QTRY_COMPARE(outputs.size(), 2);
+        QCOMPARE(triggered.count(), i + 1);
+        QCOMPARE(triggered[i][0].toLongLong(), received);
+
+        // The rule is evaluated before the signal is emitted, so its command leaves first.
+        QCOMPARE(outputs[0].first, quint8(1));
+        QCOMPARE(outputs[1].first, quint8(0));
+        rulePath.record(outputs[0].second - received);
+        slotPath.record(outputs[1].second - received);
+
+        // Rearms the rule.
+        hub->setValue(0, position(0));
+        QTRY_COMPARE(sensor->position(), 0);
+    }
+    QCOMPARE(actuator->power(), 127);
+    QCOMPARE(rule.latency()->count(), quint64(rounds));
+    QCOMPARE(rulePath.count(), quint64(rounds));
+    QVERIFY(rulePath.percentile(50) <= slotPath.percentile(50));
+    QVERIFY(rulePath.percentile(99) <= slotPath.percentile(99));
+
+    // Rules trigger again only once their condition has been false.
+    outputs.clear();
+    reversed = true;
+    hub->setValue(0, position(100));
+    hub->setValue(0, position(120));
+    QTRY_COMPARE(rule.triggers(), quint64(rounds + 1));
+    hub->setValue(0, position(0));
+    hub->setValue(0, position(95));
+    QTRY_COMPARE(rule.triggers(), quint64(rounds + 2));
+    QTRY_COMPARE(outputs.size(), 2);
+
+    rule.setEnabled(false);
+    hub->setValue(0, position(0));
+    hub->setValue(0, position(100));
+    QTest::qWait(50);
+    QCOMPARE(rule.triggers(), quint64(rounds + 2));
+
+    device->removeRule(&rule);
+    QVERIFY(device->rules().isEmpty());
+    QCOMPARE(rule.device(), static_cast<QLegoDevice *>(nullptr));
+}
+
+void QLegoRuleTest::testClosedTarget()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(connectHub(hub));
+    auto targetHub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> target(connectHub(targetHub));
+    QVERIFY(device);
+    QVERIFY(target);
+    auto sensor = motorOf(device.data());
+    auto actuator = motorOf(target.data());
+    actuator->setStartupMode(QLegoAttachedDevice::BufferIfNecessary);
+    sensor->subscribe(QLegoMotor::PositionMode);
+    QTRY_COMPARE(hub->mode(0), int(QLegoMotor::PositionMode));
+
+    QLegoRule rule;
+    rule.setSensor(sensor, 0, QLegoMotor::PositionMode);
+    rule.setCondition(QLegoRule::AtLeast, 90);
+    rule.setPower(target.data(), actuator, 60);
+    device->addRule(&rule);
+    targetHub->close();
+
+    // The command is dropped, so the power stays and the reply does not hold a place.
+    hub->setValue(0, position(100));
+    QTRY_COMPARE(rule.triggers(), quint64(1));
+    QCOMPARE(rule.latency()->count(), quint64(0));
+    QCOMPARE(actuator->power(), 0);
+
+    QSignalSpy ready(target.data(), &QLegoDevice::ready);
+    target->connectToDevice();
+    QVERIFY(ready.wait(2000));
+    targetHub->setAutomaticFeedback(false);
+    QSignalSpy outputs(targetHub, &QLegoSimulatedHub::portOutputReceived);
+    actuator->startPower(20);
+    actuator->startPower(30);
+    QTRY_COMPARE(outputs.count(), 2);
+}
+
+void QLegoRuleTest::testInvalidSource()
+{
+    auto hub = new QLegoSimulatedHub;
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(hub));
+    QLegoRule rule;
+    device->addRule(&rule);
+    QVERIFY(device->rules().isEmpty());
+
+    QScopedPointer<QLegoRule> button(new QLegoRule);
+    button->setButton();
+    button->setCondition(QLegoRule::Equal, QLegoDevice::Pressed);
+    device->addRule(button.data());
+    QCOMPARE(device->rules().size(), 1);
+    button.reset();
+    QVERIFY(device->rules().isEmpty());
+}
+
+QTEST_MAIN(QLegoRuleTest)
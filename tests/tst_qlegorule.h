@@ -0,0 +1,15 @@
+#ifndef QLEGORULETEST_H
+#define QLEGORULETEST_H
+
+#include <QObject>
+
+class QLegoRuleTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testSensorRule();
+    void testClosedTarget();
+    void testInvalidSource();
+};
+
+#endif
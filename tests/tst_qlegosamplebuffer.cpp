@@ -0,0 +1,178 @@
+#include <QTest>
+#include <QThread>
+#include <QElapsedTimer>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "tst_qlegosamplebuffer.h"
+#include "qlegosamplebuffer.h"
+
+static const int Ports = 50;
+
+static QLegoSample makeSample(int port, quint32 sequence)
+{
+    QLegoSample sample = {};
+    sample.portId = static_cast<quint8>(port);
+    sample.sequence = sequence;
+    sample.count = 1;
+    sample.values[0] = static_cast<qint32>(sequence);
+    return sample;
+}
+
+// Pushes samples round-robin over all buffers while the calling thread drains them, and
+// checks that every port sees its samples in order.
+static int runProducerConsumer(std::vector<std::unique_ptr<QLegoSampleBuffer>> &buffers,
+                               int total, qint64 intervalNs)
+{
+    std::atomic<bool> done(false);
+    std::unique_ptr<QThread> producer(QThread::create([&]() {
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < total; i++) {
+            if (intervalNs > 0) {
+                while (timer.nsecsElapsed() < i * intervalNs) {
+                    QThread::yieldCurrentThread();
+                }
+            }
+            const int port = i % Ports;
+            buffers[port]->push(makeSample(port, static_cast<quint32>(i / Ports)));
+        }
+        done.store(true, std::memory_order_release);
+    }));
+    producer->start();
+
+    QLegoSample batch[64];
+    std::vector<quint32> next(Ports, 0);
+    int received = 0;
+    int outOfOrder = 0;
+    bool finished = false;
+    while (!finished) {
+        finished = done.load(std::memory_order_acquire);
+        for (int port = 0; port < Ports; port++) {
+            int count;
+            while ((count = buffers[port]->read(batch, 64)) > 0) {
+                for (int i = 0; i < count; i++) {
+                    if (batch[i].sequence != next[port] || batch[i].portId != port) {
+                        outOfOrder++;
+                    }
+                    next[port] = batch[i].sequence + 1;
+                }
+                received += count;
+            }
+        }
+        if (intervalNs > 0) {
+            QThread::msleep(1);
+        }
+    }
+    producer->wait();
+
+    return outOfOrder == 0 ? received : -1;
+}
+
+void QLegoSampleBufferTest::testCapacity()
+{
+    QCOMPARE(QLegoSampleBuffer(1000).capacity(), 1024);
+    QCOMPARE(QLegoSampleBuffer(64).capacity(), 64);
+    QCOMPARE(QLegoSampleBuffer(0).capacity(), 1);
+}
+
+void QLegoSampleBufferTest::testPushRead()
+{
+    QLegoSampleBuffer buffer(8);
+    QLegoSample samples[8];
+
+    QVERIFY(buffer.isEmpty());
+    QCOMPARE(buffer.read(samples, 8), 0);
+
+    // Wrap around the end of the ring a few times.
+    quint32 sequence = 0;
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < 5; i++) {
+            QVERIFY(buffer.push(makeSample(1, sequence + i)));
+        }
+        QCOMPARE(buffer.size(), 5);
+        QCOMPARE(buffer.read(samples, 3), 3);
+        QCOMPARE(buffer.read(samples + 3, 8), 2);
+        for (int i = 0; i < 5; i++) {
+            QCOMPARE(samples[i].sequence, sequence + i);
+        }
+        sequence += 5;
+    }
+    QVERIFY(buffer.isEmpty());
+    QCOMPARE(buffer.overruns(), quint64(0));
+}
+
+void QLegoSampleBufferTest::testOverrun()
+{
+    QLegoSampleBuffer buffer(4);
+    QLegoSample samples[4];
+
+    for (quint32 i = 0; i < 6; i++) {
+        QCOMPARE(buffer.push(makeSample(0, i)), i < 4);
+    }
+    QCOMPARE(buffer.overruns(), quint64(2));
+
+    // The oldest samples are kept; the gap shows up in the sequence numbers.
+    QCOMPARE(buffer.read(samples, 4), 4);
+    QCOMPARE(samples[3].sequence, quint32(3));
+    QVERIFY(buffer.push(makeSample(0, 6)));
+    QCOMPARE(buffer.read(samples, 4), 1);
+    QCOMPARE(samples[0].sequence, quint32(6));
+}
+
+void QLegoSampleBufferTest::testAggregateRate()
+{
+    // One second of 1 kHz aggregate reports over 50 ports, drained every millisecond.
+    const int total = 1000;
+    std::vector<std::unique_ptr<QLegoSampleBuffer>> buffers;
+    for (int i = 0; i < Ports; i++) {
+        buffers.emplace_back(new QLegoSampleBuffer(64));
+    }
+
+    QCOMPARE(runProducerConsumer(buffers, total, 1000000), total);
+    for (const auto &buffer : buffers) {
+        QCOMPARE(buffer->overruns(), quint64(0));
+    }
+
+    // The consumer stalls while every port receives three times what its ring holds. The
+    // oldest samples are kept and every other one is counted as an overrun.
+    const int capacity = 16;
+    std::vector<std::unique_ptr<QLegoSampleBuffer>> lagging;
+    for (int i = 0; i < Ports; i++) {
+        lagging.emplace_back(new QLegoSampleBuffer(capacity));
+    }
+    std::unique_ptr<QThread> producer(QThread::create([&lagging]() {
+        for (int i = 0; i < 3 * capacity * Ports; i++) {
+            const int port = i % Ports;
+            lagging[port]->push(makeSample(port, static_cast<quint32>(i / Ports)));
+        }
+    }));
+    producer->start();
+    QVERIFY(producer->wait(5000));
+
+    QLegoSample samples[capacity];
+    for (const auto &buffer : lagging) {
+        QCOMPARE(buffer->overruns(), quint64(2 * capacity));
+        QCOMPARE(buffer->read(samples, capacity), capacity);
+        QCOMPARE(samples[capacity - 1].sequence, quint32(capacity - 1));
+        QVERIFY(buffer->isEmpty());
+    }
+}
+
+void QLegoSampleBufferTest::benchmarkThroughput()
+{
+    // Unpaced, with rings large enough to absorb scheduling hiccups of the consumer.
+    const int total = 100000;
+    std::vector<std::unique_ptr<QLegoSampleBuffer>> buffers;
+    for (int i = 0; i < Ports; i++) {
+        buffers.emplace_back(new QLegoSampleBuffer(total / Ports));
+    }
+
+    int received = 0;
+    QBENCHMARK {
+        received = runProducerConsumer(buffers, total, 0);
+    }
+    QCOMPARE(received, total);
+}
+
+QTEST_MAIN(QLegoSampleBufferTest)
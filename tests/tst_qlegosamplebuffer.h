@@ -0,0 +1,17 @@
+#ifndef QLEGOSAMPLEBUFFERTEST_H
+#define QLEGOSAMPLEBUFFERTEST_H
+
+#include <QObject>
+
+class QLegoSampleBufferTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testCapacity();
+    void testPushRead();
+    void testOverrun();
+    void testAggregateRate();
+    void benchmarkThroughput();
+};
+
+#endif
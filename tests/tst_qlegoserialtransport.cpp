@@ -0,0 +1,135 @@
+#include <QTest>
+#include <QSignalSpy>
+#include "tst_qlegoserialtransport.h"
+#include "qlegodevice.h"
+#include "qlegoserialtransport.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// A motor attached to port A, and a battery level report of 90%.
+static const char *AttachMessage = "0f0004000127000000001000000010";
+static const char *BatteryMessage = "06000106065a";
+
+// Reads everything the transport has written to the other end of the pseudo-terminal.
+static QByteArray readMaster(int master)
+{
+    QByteArray data;
+    char buffer[256];
+    ssize_t size;
+    while ((size = ::read(master, buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, static_cast<int>(size));
+    }
+    return data;
+}
+
+static bool writeMaster(int master, const QByteArray &data)
+{
+    return ::write(master, data.constData(), data.size()) == data.size();
+}
+
+void QLegoSerialTransportTest::init()
+{
+    // The transport opens the slave end like any serial port; the test plays the hub.
+    m_master = posix_openpt(O_RDWR | O_NOCTTY);
+    QVERIFY(m_master >= 0);
+    QVERIFY(grantpt(m_master) == 0 && unlockpt(m_master) == 0);
+    m_slaveName = QString::fromLocal8Bit(ptsname(m_master));
+    fcntl(m_master, F_SETFL, fcntl(m_master, F_GETFL) | O_NONBLOCK);
+}
+
+void QLegoSerialTransportTest::cleanup()
+{
+    if (m_master >= 0) {
+        ::close(m_master);
+        m_master = -1;
+    }
+}
+
+void QLegoSerialTransportTest::testReceive()
+{
+    QLegoSerialTransport transport(m_slaveName);
+    QSignalSpy opened(&transport, &QLegoTransport::opened);
+    QByteArray data;
+    connect(&transport, &QLegoTransport::received, [&data](const QByteArray &chunk) {
+        data += chunk;
+    });
+    transport.open();
+    QTRY_COMPARE(opened.count(), 1);
+
+    // Frames may arrive in any number of pieces.
+    const QByteArray frames = QByteArray::fromHex(AttachMessage) + QByteArray::fromHex(BatteryMessage);
+    QVERIFY(writeMaster(m_master, frames.left(5)));
+    QVERIFY(writeMaster(m_master, frames.mid(5, 12)));
+    QVERIFY(writeMaster(m_master, frames.mid(17)));
+    QTRY_COMPARE(data, frames);
+
+    QSignalSpy closed(&transport, &QLegoTransport::closed);
+    transport.close();
+    QCOMPARE(closed.count(), 1);
+    QVERIFY(!transport.isOpen());
+}
+
+void QLegoSerialTransportTest::testBatchedWrites()
+{
+    QLegoSerialTransport transport(m_slaveName);
+    QSignalSpy written(&transport, &QLegoTransport::written);
+    transport.open();
+    QTRY_VERIFY(transport.isOpen());
+
+    QByteArray frames;
+    for (int i = 0; i < 5; i++) {
+        const QByteArray frame = QByteArray::fromHex("0500010602");
+        transport.write(frame);
+        frames += frame;
+    }
+    // Acknowledged from the event loop, not from within write().
+    QCOMPARE(written.count(), 0);
+
+    QTRY_COMPARE(written.count(), 5);
+    QCOMPARE(transport.batchesWritten(), quint64(1));
+    QByteArray data;
+    QTRY_COMPARE(data += readMaster(m_master), frames);
+}
+
+void QLegoSerialTransportTest::testDevice()
+{
+    auto transport = new QLegoSerialTransport(m_slaveName);
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(transport));
+    QSignalSpy attached(device.data(), &QLegoDevice::deviceAttached);
+    QSignalSpy battery(device.data(), &QLegoDevice::batteryLevel);
+    device->connectToDevice();
+
+    // The requests a session starts with, sent in one batch. Only battery reports are enabled,
+    // as nothing listens to the button or the signal strength.
+    const QByteArray session = QByteArray::fromHex("0500010305" "0500010405" "0500010602"
+                                                   "0500010d05");
+    QByteArray data;
+    QTRY_COMPARE(data += readMaster(m_master), session);
+    QCOMPARE(transport->batchesWritten(), quint64(1));
+
+    QVERIFY(writeMaster(m_master, QByteArray::fromHex(AttachMessage)));
+    QVERIFY(writeMaster(m_master, QByteArray::fromHex(BatteryMessage)));
+    QTRY_COMPARE(attached.count(), 1);
+    QTRY_COMPARE(battery.count(), 1);
+    QCOMPARE(device->statistics()->parseFailures(), quint64(0));
+}
+
+void QLegoSerialTransportTest::benchmarkReceive()
+{
+    QLegoSerialTransport transport(m_slaveName);
+    QSignalSpy received(&transport, &QLegoTransport::received);
+    transport.open();
+    QTRY_VERIFY(transport.isOpen());
+    const QByteArray frame = QByteArray::fromHex(BatteryMessage);
+
+    // From the hub writing a frame to the transport passing it on.
+    QBENCHMARK {
+        received.clear();
+        writeMaster(m_master, frame);
+        QVERIFY(received.wait(1000));
+    }
+}
+
+QTEST_MAIN(QLegoSerialTransportTest)
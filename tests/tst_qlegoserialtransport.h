@@ -0,0 +1,22 @@
+#ifndef QLEGOSERIALTRANSPORTTEST_H
+#define QLEGOSERIALTRANSPORTTEST_H
+
+#include <QObject>
+
+class QLegoSerialTransportTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void init();
+    void cleanup();
+    void testReceive();
+    void testBatchedWrites();
+    void testDevice();
+    void benchmarkReceive();
+
+private:
+    int m_master = -1;
+    QString m_slaveName;
+};
+
+#endif
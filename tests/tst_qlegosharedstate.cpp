@@ -0,0 +1,191 @@
+#include <QTest>
+#include <QSignalSpy>
+#include <QThread>
+#include <atomic>
+#include "tst_qlegosharedstate.h"
+#include "qlegoattacheddevice.h"
+#include "qlegodevice.h"
+#include "qlegoreplay.h"
+#include "qlegosharedstate.h"
+
+// A motor attached to port A, and a battery level report of 90%.
+static const char *AttachMessage = "0f0004000127000000001000000010";
+static const char *BatteryMessage = "06000106065a";
+
+static QString segmentKey()
+{
+    return QStringLiteral("tst_qlegosharedstate_%1").arg(QCoreApplication::applicationPid());
+}
+
+// Connects a device to a replayed motor and returns the motor.
+static QLegoAttachedDevice *connectDevice(QLegoDevice *device, QLegoReplay *replay)
+{
+    QSignalSpy attached(device, &QLegoDevice::deviceAttached);
+    device->connectToDevice();
+    if (!QTest::qWaitFor([replay]() { return replay->atEnd(); }) || attached.count() != 1) {
+        return nullptr;
+    }
+    return attached.first().first().value<QLegoAttachedDevice *>();
+}
+
+static QLegoReplay *createReplay()
+{
+    auto replay = new QLegoReplay;
+    replay->setSpeed(0);
+    replay->setVerifyCommands(false);
+    replay->addFrame(false, 0, QByteArray::fromHex(AttachMessage));
+    replay->addFrame(false, 0, QByteArray::fromHex(BatteryMessage));
+    return replay;
+}
+
+static QLegoSample sample(quint32 sequence)
+{
+    QLegoSample sample = {};
+    sample.sequence = sequence;
+    sample.count = QLegoSample::MaxValues;
+    sample.type = QLegoValueFormat::Int32;
+    for (int i = 0; i < QLegoSample::MaxValues; i++) {
+        sample.values[i] = static_cast<qint32>(sequence);
+    }
+    return sample;
+}
+
+void QLegoSharedStateTest::testDeviceTable()
+{
+    QLegoSharedState state(segmentKey());
+    QVERIFY2(state.create(), qPrintable(state.errorString()));
+
+    auto replay = createReplay();
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(replay));
+    QVERIFY(state.addDevice(device.data()));
+    QVERIFY(connectDevice(device.data(), replay));
+
+    QLegoSharedStateReader reader(segmentKey());
+    QVERIFY2(reader.attach(), qPrintable(reader.errorString()));
+    QCOMPARE(reader.deviceCount(), 1);
+
+    QLegoSharedDevice shared;
+    QVERIFY(reader.device(0, &shared));
+    QVERIFY(shared.connected);
+    QCOMPARE(shared.battery, 90);
+    QCOMPARE(shared.ports.size(), 1);
+    QCOMPARE(shared.ports[0].portId, quint8(0));
+    QCOMPARE(shared.ports[0].type, quint16(QLegoAttachedDevice::MoveHubMediumLinearMotor));
+    QVERIFY(shared.ports[0].attached);
+    QCOMPARE(shared.ports[0].samples, quint64(0));
+
+    // A second owner cannot take over the segment while it is in use.
+    QLegoSharedState other(segmentKey());
+    QVERIFY(!other.create());
+
+    // The state outlives the hubs it publishes.
+    device.reset();
+    QVERIFY(reader.device(0, &shared));
+    QVERIFY(!shared.connected);
+    state.destroy();
+}
+
+void QLegoSharedStateTest::testSamples()
+{
+    QLegoSharedState state(segmentKey());
+    state.setRingCapacity(64);
+    QVERIFY(state.create());
+
+    auto replay = createReplay();
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(replay));
+    state.addDevice(device.data());
+    const auto motor = connectDevice(device.data(), replay);
+    QVERIFY(motor);
+
+    QLegoSharedStateReader reader(segmentKey());
+    QVERIFY(reader.attach());
+
+    QLegoSample samples[100];
+    quint64 cursor = 0;
+    quint64 lost = 0;
+    for (quint32 i = 0; i < 10; i++) {
+        emit motor->valueReceived(sample(i));
+    }
+    QCOMPARE(reader.read(0, 0, &cursor, samples, 100, &lost), 10);
+    QCOMPARE(samples[9].sequence, quint32(9));
+    QCOMPARE(cursor, quint64(10));
+    QCOMPARE(reader.read(0, 0, &cursor, samples, 100, &lost), 0);
+
+    // Falling behind loses the oldest samples, keeping all but one slot of the ring.
+    for (quint32 i = 10; i < 110; i++) {
+        emit motor->valueReceived(sample(i));
+    }
+    QCOMPARE(reader.read(0, 0, &cursor, samples, 100, &lost), 63);
+    QCOMPARE(lost, quint64(37));
+    QCOMPARE(samples[0].sequence, quint32(47));
+    QCOMPARE(samples[62].sequence, quint32(109));
+    QCOMPARE(cursor, quint64(110));
+
+    QLegoSharedDevice shared;
+    QVERIFY(reader.device(0, &shared));
+    QCOMPARE(shared.ports[0].samples, quint64(110));
+    QCOMPARE(shared.ports[0].lastSample.sequence, quint32(109));
+
+    // Unknown ports and devices.
+    QCOMPARE(reader.read(0, 1, &cursor, samples, 100), 0);
+    QCOMPARE(reader.read(1, 0, &cursor, samples, 100), 0);
+}
+
+void QLegoSharedStateTest::testConcurrentReader()
+{
+    QLegoSharedState state(segmentKey());
+    QVERIFY(state.create());
+
+    auto replay = createReplay();
+    QScopedPointer<QLegoDevice> device(QLegoDevice::createDevice(replay));
+    state.addDevice(device.data());
+    const auto motor = connectDevice(device.data(), replay);
+    QVERIFY(motor);
+
+    const quint32 total = 200000;
+    std::atomic<int> torn(0);
+    std::atomic<int> disordered(0);
+    QScopedPointer<QThread> thread(QThread::create([&]() {
+        QLegoSharedStateReader reader(segmentKey());
+        if (!reader.attach()) {
+            torn++;
+            return;
+        }
+        QLegoSample samples[64];
+        quint64 cursor = 0;
+        qint64 previous = -1;
+        while (previous < total - 1) {
+            const int count = reader.read(0, 0, &cursor, samples, 64);
+            for (int i = 0; i < count; i++) {
+                const auto &sample = samples[i];
+                for (int value = 0; value < QLegoSample::MaxValues; value++) {
+                    if (sample.values[value] != static_cast<qint32>(sample.sequence)) {
+                        torn++;
+                    }
+                }
+                if (sample.sequence <= previous) {
+                    disordered++;
+                }
+                previous = sample.sequence;
+            }
+
+            QLegoSharedDevice shared;
+            if (reader.device(0, &shared) && shared.ports.size() == 1) {
+                const auto &last = shared.ports[0].lastSample;
+                if (last.values[QLegoSample::MaxValues - 1] != qint32(last.sequence)) {
+                    torn++;
+                }
+            }
+        }
+    }));
+    thread->start();
+
+    for (quint32 i = 0; i < total; i++) {
+        emit motor->valueReceived(sample(i));
+    }
+    QVERIFY(thread->wait(10000));
+    QCOMPARE(torn.load(), 0);
+    QCOMPARE(disordered.load(), 0);
+}
+
+QTEST_MAIN(QLegoSharedStateTest)
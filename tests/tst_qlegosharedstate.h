@@ -0,0 +1,15 @@
+#ifndef QLEGOSHAREDSTATETEST_H
+#define QLEGOSHAREDSTATETEST_H
+
+#include <QObject>
+
+class QLegoSharedStateTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testDeviceTable();
+    void testSamples();
+    void testConcurrentReader();
+};
+
+#endif
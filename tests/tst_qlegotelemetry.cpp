@@ -0,0 +1,161 @@
+#include <QTest>
+#include <QTemporaryDir>
+#include <QRandomGenerator>
+#include <QFileInfo>
+#include "tst_qlegotelemetry.h"
+#include "qlegotelemetry.h"
+
+static const quint64 Address = Q_UINT64_C(0x90842b4e5a1f);
+static const qint64 Millisecond = 1000000;
+
+// Size of a capture record holding a single port value message.
+static const int CaptureRecordSize = 18 + 8;
+
+static QLegoSample sample(quint8 portId, qint64 timestamp, qint32 value)
+{
+    QLegoSample sample = {};
+    sample.timestamp = timestamp;
+    sample.portId = portId;
+    sample.mode = 2;
+    sample.count = 2;
+    sample.type = QLegoValueFormat::Int32;
+    sample.values[0] = value;
+    sample.values[1] = -value / 3;
+    return sample;
+}
+
+static QLegoTelemetryChannel channel(quint8 portId, quint8 dataset)
+{
+    return { Address, portId, 2, dataset, QLegoValueFormat::Int32 };
+}
+
+void QLegoTelemetryTest::testRoundTrip()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.filePath("hub.qlt");
+
+    QRandomGenerator generator(42);
+    QVector<qint64> timestamps;
+    QVector<qint32> values;
+    qint64 timestamp = 1000 * Millisecond;
+    for (int i = 0; i < 1000; i++) {
+        timestamp += 10 * Millisecond + generator.bounded(-2000, 2000) * 1000;
+        timestamps.append(timestamp);
+        values.append(static_cast<qint32>(generator.generate()));
+    }
+
+    QLegoTelemetryWriter writer(fileName);
+    writer.setChunkSize(64);
+    QVERIFY(writer.open());
+    // The header and the worker keep the settings the file was opened with.
+    QTest::ignoreMessage(QtWarningMsg, "cannot change the chunk size of an open file");
+    writer.setChunkSize(8);
+    QTest::ignoreMessage(QtWarningMsg, "cannot change the resolution of an open file");
+    writer.setResolution(Millisecond);
+    QCOMPARE(writer.chunkSize(), 64);
+    QCOMPARE(writer.resolution(), qint64(QLegoTelemetryWriter::DefaultResolution));
+    for (int i = 0; i < timestamps.size(); i++) {
+        writer.write(Address, sample(0, timestamps[i], values[i]));
+        writer.write(Address, sample(1, timestamps[i], i));
+    }
+    writer.close();
+    QCOMPARE(writer.samplesWritten(), quint64(2000));
+
+    for (bool indexed : { true, false }) {
+        if (!indexed) {
+            // Drop the footer, as if the writer had not been closed.
+            QFile file(fileName);
+            QVERIFY(file.resize(file.size() - 24));
+        }
+
+        QLegoTelemetryReader reader(fileName);
+        QVERIFY(reader.open());
+        QCOMPARE(reader.channels().size(), 4);
+        QCOMPARE(quint64(reader.chunkCount()), writer.chunksWritten());
+
+        QVector<qint64> readTimestamps;
+        QVector<qint32> readValues;
+        QCOMPARE(reader.read(channel(0, 0), 0, timestamp, &readTimestamps, &readValues), 1000);
+        QCOMPARE(readTimestamps, timestamps);
+        QCOMPARE(readValues, values);
+
+        readTimestamps.clear();
+        readValues.clear();
+        QCOMPARE(reader.read(channel(0, 1), 0, timestamp, &readTimestamps, &readValues), 1000);
+        QCOMPARE(readValues.last(), -values.last() / 3);
+        QCOMPARE(reader.read(channel(1, 0), 0, timestamp, &readTimestamps, &readValues), 1000);
+        QCOMPARE(readValues.last(), 999);
+    }
+}
+
+void QLegoTelemetryTest::testWindow()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.filePath("hub.qlt");
+
+    QLegoTelemetryWriter writer(fileName);
+    writer.setChunkSize(100);
+    QVERIFY(writer.open());
+    for (int i = 0; i < 1000; i++) {
+        for (quint8 port = 0; port < 4; port++) {
+            writer.write(Address, sample(port, i * 100 * Millisecond, i));
+        }
+    }
+    writer.close();
+
+    QLegoTelemetryReader reader(fileName);
+    QVERIFY(reader.open());
+    QCOMPARE(reader.chunkCount(), 80);
+
+    // Samples 250 to 449 of one port lie in three of its chunks.
+    QVector<qint64> timestamps;
+    QVector<qint32> values;
+    const int count = reader.read(channel(2, 0), 250 * 100 * Millisecond, 449 * 100 * Millisecond,
+                                  &timestamps, &values);
+    QCOMPARE(count, 200);
+    QCOMPARE(reader.chunksDecoded(), 3);
+    QCOMPARE(values.first(), 250);
+    QCOMPARE(values.last(), 449);
+}
+
+void QLegoTelemetryTest::testSize()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.filePath("hub.qlt");
+
+    // An hour of a motor position reported at 10 Hz with scheduling jitter.
+    QRandomGenerator generator(7);
+    QLegoSample position = {};
+    position.portId = 0;
+    position.mode = 2;
+    position.count = 1;
+    position.type = QLegoValueFormat::Int32;
+
+    QLegoTelemetryWriter writer(fileName);
+    QVERIFY(writer.open());
+    const int samples = 36000;
+    for (int i = 0; i < samples; i++) {
+        position.timestamp = i * 100 * Millisecond + generator.bounded(0, 3000) * 1000;
+        position.values[0] += generator.bounded(-20, 60);
+        writer.write(Address, position);
+    }
+    writer.close();
+
+    const qint64 size = QFileInfo(fileName).size();
+    QVERIFY2(size * 5 <= qint64(samples) * CaptureRecordSize, qPrintable(QString::number(size)));
+}
+
+void QLegoTelemetryTest::benchmarkWrite()
+{
+    QTemporaryDir dir;
+    QLegoTelemetryWriter writer(dir.filePath("hub.qlt"));
+    QVERIFY(writer.open());
+    qint64 timestamp = 0;
+
+    QBENCHMARK {
+        writer.write(Address, sample(0, timestamp, static_cast<qint32>(timestamp)));
+        timestamp += Millisecond;
+    }
+}
+
+QTEST_MAIN(QLegoTelemetryTest)
@@ -0,0 +1,16 @@
+#ifndef QLEGOTELEMETRYTEST_H
+#define QLEGOTELEMETRYTEST_H
+
+#include <QObject>
+
+class QLegoTelemetryTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testRoundTrip();
+    void testWindow();
+    void testSize();
+    void benchmarkWrite();
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include <QTest>
+#include <QRandomGenerator>
+#include <QVector>
+#include <cstring>
+#include "tst_qlegovalueconverter.h"
+#include "qlegoportinformation.h"
+#include "qlegovalueconverter.h"
+
+Q_DECLARE_METATYPE(QLegoValueFormat::DataType)
+Q_DECLARE_METATYPE(QLegoValueConverter::Implementation)
+
+static QByteArray randomValues(QLegoValueFormat::DataType type, int count)
+{
+    QRandomGenerator generator(42);
+    QByteArray raw(count * QLegoValueFormat::size(type), Qt::Uninitialized);
+    if (type == QLegoValueFormat::Float) {
+        for (int i = 0; i < count; i++) {
+            const float value = static_cast<qint32>(generator.generate()) / 1000.0f;
+            memcpy(raw.data() + i * 4, &value, sizeof(value));
+        }
+    } else {
+        for (int i = 0; i < raw.size(); i++) {
+            raw[i] = static_cast<char>(generator.generate());
+        }
+    }
+    return raw;
+}
+
+void QLegoValueConverterTest::testRanges()
+{
+    const qint8 raw[] = { -100, 0, 100 };
+    float values[3];
+
+    QLegoValueConverter identity;
+    identity.convert(raw, QLegoValueFormat::Int8, 3, values);
+    QCOMPARE(values[0], -100.0f);
+    QCOMPARE(values[2], 100.0f);
+
+    QLegoValueConverter percent(-100, 100, 0, 100);
+    percent.convert(raw, QLegoValueFormat::Int8, 3, values);
+    QCOMPARE(values[0], 0.0f);
+    QCOMPARE(values[1], 50.0f);
+    QCOMPARE(values[2], 100.0f);
+
+    // An empty raw range cannot be scaled.
+    QLegoValueConverter empty(5, 5, 0, 100);
+    QCOMPARE(empty.scale(), 1.0f);
+    QCOMPARE(empty.offset(), 0.0f);
+}
+
+void QLegoValueConverterTest::testModeInformation()
+{
+    QLegoModeInformation information;
+    information.rawMinimum = 0;
+    information.rawMaximum = 1023;
+    information.percentMinimum = 0;
+    information.percentMaximum = 100;
+    information.siMinimum = 0;
+    information.siMaximum = 5000;
+
+    const qint16 raw = 1023;
+    float value;
+    QLegoValueConverter(information, QLegoValueConverter::SiUnit)
+        .convert(&raw, QLegoValueFormat::Int16, 1, &value);
+    QCOMPARE(value, 5000.0f);
+    QLegoValueConverter(information, QLegoValueConverter::PercentUnit)
+        .convert(&raw, QLegoValueFormat::Int16, 1, &value);
+    QCOMPARE(value, 100.0f);
+    QLegoValueConverter(information, QLegoValueConverter::RawUnit)
+        .convert(&raw, QLegoValueFormat::Int16, 1, &value);
+    QCOMPARE(value, 1023.0f);
+}
+
+void QLegoValueConverterTest::testBitExact_data()
+{
+    QTest::addColumn<QLegoValueConverter::Implementation>("implementation");
+    QTest::addColumn<QLegoValueFormat::DataType>("type");
+
+    const char *implementations[] = { "scalar", "sse2", "avx2" };
+    const char *types[] = { "int8", "int16", "int32", "float" };
+    for (const auto implementation : QLegoValueConverter::supportedImplementations()) {
+        for (int type = QLegoValueFormat::Int8; type <= QLegoValueFormat::Float; type++) {
+            QTest::addRow("%s-%s", implementations[implementation], types[type])
+                << implementation << static_cast<QLegoValueFormat::DataType>(type);
+        }
+    }
+}
+
+void QLegoValueConverterTest::testBitExact()
+{
+    QFETCH(QLegoValueConverter::Implementation, implementation);
+    QFETCH(QLegoValueFormat::DataType, type);
+
+    QLegoValueConverter scalar(-1024, 1023, -3.5f, 217.25f);
+    scalar.setImplementation(QLegoValueConverter::ScalarImplementation);
+    QLegoValueConverter converter = scalar;
+    converter.setImplementation(implementation);
+    QCOMPARE(converter.implementation(), implementation);
+
+    // Every count up to a few vectors, to cover the remainder loops.
+    for (int count = 0; count < 70; count++) {
+        const QByteArray raw = randomValues(type, count);
+        QVector<float> expected(count);
+        QVector<float> actual(count);
+        scalar.convert(raw.constData(), type, count, expected.data());
+        converter.convert(raw.constData(), type, count, actual.data());
+        QVERIFY2(memcmp(expected.constData(), actual.constData(), count * sizeof(float)) == 0,
+                 qPrintable(QString("count %1").arg(count)));
+    }
+}
+
+void QLegoValueConverterTest::benchmarkConvert_data()
+{
+    testBitExact_data();
+}
+
+void QLegoValueConverterTest::benchmarkConvert()
+{
+    QFETCH(QLegoValueConverter::Implementation, implementation);
+    QFETCH(QLegoValueFormat::DataType, type);
+
+    const int count = 4096;
+    const QByteArray raw = randomValues(type, count);
+    QVector<float> values(count);
+    QLegoValueConverter converter(0, 1023, 0, 100);
+    converter.setImplementation(implementation);
+
+    QBENCHMARK {
+        converter.convert(raw.constData(), type, count, values.data());
+    }
+}
+
+QTEST_MAIN(QLegoValueConverterTest)
@@ -0,0 +1,18 @@
+#ifndef QLEGOVALUECONVERTERTEST_H
+#define QLEGOVALUECONVERTERTEST_H
+
+#include <QObject>
+
+class QLegoValueConverterTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testRanges();
+    void testModeInformation();
+    void testBitExact_data();
+    void testBitExact();
+    void benchmarkConvert_data();
+    void benchmarkConvert();
+};
+
+#endif